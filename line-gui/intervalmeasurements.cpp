@@ -77,7 +77,52 @@ void LinkIntervalMeasurement::sample(int packetCount)
     }
 }
 
-LinkIntervalMeasurement& LinkIntervalMeasurement::operator+=(LinkIntervalMeasurement other)
+qint64 LinkIntervalMeasurement::sampleNumPacketsDropped(int packetCount, std::mt19937 &generator) const
+{
+    // The drops recorded in the events take precedence, as in sample()
+    qint64 total = numPacketsInFlight;
+    qint64 dropped = qint64(events.count()) == numPacketsInFlight ?
+                         numPacketsInFlight - qint64(events.countOnes()) :
+                         numPacketsDropped;
+    dropped = qMax(0LL, qMin(dropped, total));
+
+    // Sequential hypergeometric draw: each pick is a drop with probability dropped/total among
+    // the packets not picked yet. Stops as soon as the rest of the outcome is decided.
+    qint64 result = 0;
+    for (qint64 i = 0; i < packetCount; i++) {
+        if (dropped == 0)
+            break;
+        if (dropped == total) {
+            result += packetCount - i;
+            break;
+        }
+        if (frandexmt(generator) * total < dropped) {
+            result++;
+            dropped--;
+        }
+        total--;
+    }
+    return result;
+}
+
+qreal LinkIntervalMeasurement::sampledSuccessRate(int packetCount, std::mt19937 &generator, bool *ok) const
+{
+    if (packetCount > numPacketsInFlight)
+        return successRate(ok);
+
+    if (packetCount <= 0) {
+        if (ok) {
+            *ok = false;
+        }
+        return 0.0;
+    }
+    if (ok) {
+        *ok = true;
+    }
+    return 1.0 - qreal(sampleNumPacketsDropped(packetCount, generator)) / qreal(packetCount);
+}
+
+LinkIntervalMeasurement& LinkIntervalMeasurement::operator+=(const LinkIntervalMeasurement &other)
 {
 	this->numPacketsInFlight += other.numPacketsInFlight;
 	this->numPacketsDropped += other.numPacketsDropped;
@@ -210,7 +255,21 @@ void GraphIntervalMeasurements::clear()
 	}
 }
 
-GraphIntervalMeasurements& GraphIntervalMeasurements::operator+=(GraphIntervalMeasurements other)
+void GraphIntervalMeasurements::clearEvents()
+{
+	for (int i = 0; i < edgeMeasurements.count(); i++) {
+		edgeMeasurements[i].events.clear();
+	}
+	for (int i = 0; i < pathMeasurements.count(); i++) {
+		pathMeasurements[i].events.clear();
+	}
+	for (QHash<QPair<qint32, qint32>, LinkIntervalMeasurement>::iterator it = perPathEdgeMeasurements.begin();
+		 it != perPathEdgeMeasurements.end(); ++it) {
+		it.value().events.clear();
+	}
+}
+
+GraphIntervalMeasurements& GraphIntervalMeasurements::operator+=(const GraphIntervalMeasurements &other)
 {
 	for (int i = 0; i < qMin(this->edgeMeasurements.count(), other.edgeMeasurements.count()); i++) {
 		this->edgeMeasurements[i] += other.edgeMeasurements[i];
@@ -218,9 +277,12 @@ GraphIntervalMeasurements& GraphIntervalMeasurements::operator+=(GraphIntervalMe
 	for (int i = 0; i < qMin(this->pathMeasurements.count(), other.pathMeasurements.count()); i++) {
 		this->pathMeasurements[i] += other.pathMeasurements[i];
 	}
-	foreach (QInt32Pair edgePath, this->perPathEdgeMeasurements.uniqueKeys()) {
-		if (other.perPathEdgeMeasurements.contains(edgePath)) {
-			this->perPathEdgeMeasurements[edgePath] += other.perPathEdgeMeasurements[edgePath];
+	for (QHash<QPair<qint32, qint32>, LinkIntervalMeasurement>::iterator it = this->perPathEdgeMeasurements.begin();
+		 it != this->perPathEdgeMeasurements.end(); ++it) {
+		QHash<QPair<qint32, qint32>, LinkIntervalMeasurement>::const_iterator otherIt =
+				other.perPathEdgeMeasurements.constFind(it.key());
+		if (otherIt != other.perPathEdgeMeasurements.constEnd()) {
+			it.value() += otherIt.value();
 		}
 	}
 	return *this;
@@ -436,7 +498,7 @@ int ExperimentIntervalMeasurements::timestampToOpenInterval(quint64 ts)
 	return result;
 }
 
-int ExperimentIntervalMeasurements::numIntervals()
+int ExperimentIntervalMeasurements::numIntervals() const
 {
 	return intervalMeasurements.count();
 }
@@ -532,7 +594,7 @@ bool ExperimentIntervalMeasurements::exportText(QString fileName,
 }
 
 void printLinkMeasurementValues(QTextStream &out,
-								QVector<LinkIntervalMeasurement> data)
+								const QVector<LinkIntervalMeasurement> &data)
 {
 	out << "<table>";
 	out << "<tr>";
@@ -555,13 +617,13 @@ void printLinkMeasurementValues(QTextStream &out,
 	}
 	out << "</tr>";
 	out << "</table>";
-	out << endl;
+	out << "\n";
 }
 
 void printLinkPathMeasurementValues(QTextStream &out,
 									int nEdges,
 									int nPaths,
-									QHash<QPair<qint32, qint32>, LinkIntervalMeasurement> data)
+									const QHash<QPair<qint32, qint32>, LinkIntervalMeasurement> &data)
 {
 	if (data.isEmpty())
 		return;
@@ -578,22 +640,22 @@ void printLinkPathMeasurementValues(QTextStream &out,
 		out << "<td>" << (iPath + 1) << "</td>";
 		for (int iEdge = 0; iEdge < nEdges; iEdge++) {
 			out << "<td>";
-			QInt32Pair ep = QInt32Pair(iEdge, iPath);
-			if (data[ep].numPacketsInFlight > 0) {
-				out << QString("%1 ").arg(data[ep].successRate());
+			QHash<QPair<qint32, qint32>, LinkIntervalMeasurement>::const_iterator it = data.constFind(QInt32Pair(iEdge, iPath));
+			if (it != data.constEnd() && it.value().numPacketsInFlight > 0) {
+				out << QString("%1 ").arg(it.value().successRate());
 				out << QString("(%1/%2)")
-					   .arg(data[ep].numPacketsDropped)
-					   .arg(data[ep].numPacketsInFlight);
+					   .arg(it.value().numPacketsDropped)
+					   .arg(it.value().numPacketsInFlight);
 			} else {
 				out << QString(".");
 			}
 			out << "</td>";
 		}
 		out << "</tr>";
-		out << endl;
+		out << "\n";
 	}
 	out << "</table>";
-	out << endl;
+	out << "\n";
 }
 
 bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
@@ -603,86 +665,86 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
 	Q_UNUSED(trueEdgeNeutrality);
 	QTextStream out(device);
 
-	out << "<h1>Overall measurements</h1>" << endl;
-	out << "<p>" << "Timestamp start (ns): " << QString::number(tsStart) << "</p>" << endl;
-	out << "<p>" << "Timestamp end (ns): " << QString::number(tsLast) << "</p>" << endl;
-	out << "<h2> Path transmission rates </h2>" << endl;
+	out << "<h1>Overall measurements</h1>" << "\n";
+	out << "<p>" << "Timestamp start (ns): " << QString::number(tsStart) << "</p>" << "\n";
+	out << "<p>" << "Timestamp end (ns): " << QString::number(tsLast) << "</p>" << "\n";
+	out << "<h2> Path transmission rates </h2>" << "\n";
 	printLinkMeasurementValues(out, globalMeasurements.pathMeasurements);
-	out << endl;
+	out << "\n";
 
-	out << "<h2> Path transmission rates -- sorted </h2>" << endl;
+	out << "<h2> Path transmission rates -- sorted </h2>" << "\n";
 	{
 		QVector<LinkIntervalMeasurement> measurements = globalMeasurements.pathMeasurements;
 		qSort(measurements);
 		printLinkMeasurementValues(out, measurements);
 	}
-	out << endl;
+	out << "\n";
 
-    out << "<h2> Link transmission rates </h2>" << endl;
+    out << "<h2> Link transmission rates </h2>" << "\n";
 	printLinkMeasurementValues(out, globalMeasurements.edgeMeasurements);
-	out << endl;
+	out << "\n";
 
-    out << "<h2> Link transmission rates -- sorted </h2>" << endl;
+    out << "<h2> Link transmission rates -- sorted </h2>" << "\n";
 	{
 		QVector<LinkIntervalMeasurement> measurements = globalMeasurements.edgeMeasurements;
 		qSort(measurements);
 		printLinkMeasurementValues(out, measurements);
 	}
-	out << endl;
+	out << "\n";
 
-    out << "<h2> Per path link transmission rates (rows = paths) </h2>" << endl;
+    out << "<h2> Per path link transmission rates (rows = paths) </h2>" << "\n";
 	printLinkPathMeasurementValues(out, numEdges, numPaths, globalMeasurements.perPathEdgeMeasurements);
-	out << endl;
+	out << "\n";
 
-	out << "<h1> Interval measurements </h1>" << endl;
-	out << "<h2> Number of intervals </h2>" << endl;
-	out << QString("%1").arg(numIntervals()) << endl;
-	out << endl;
+	out << "<h1> Interval measurements </h1>" << "\n";
+	out << "<h2> Number of intervals </h2>" << "\n";
+	out << QString("%1").arg(numIntervals()) << "\n";
+	out << "\n";
     for (int iInterval = 0; iInterval < numIntervals(); iInterval++) {
-		out << "<h2 id=\"" << (iInterval + 1) << "\"> Interval " << (iInterval + 1) << "</h2>" << endl;
-		out << "<h2> Path transmission rates </h2>" << endl;
+		out << "<h2 id=\"" << (iInterval + 1) << "\"> Interval " << (iInterval + 1) << "</h2>" << "\n";
+		out << "<h2> Path transmission rates </h2>" << "\n";
 		printLinkMeasurementValues(out, intervalMeasurements[iInterval].pathMeasurements);
-		out << endl;
+		out << "\n";
 
-		out << "<h2> Path transmission rates -- sorted </h2>" << endl;
+		out << "<h2> Path transmission rates -- sorted </h2>" << "\n";
 		{
 			QVector<LinkIntervalMeasurement> measurements = intervalMeasurements[iInterval].pathMeasurements;
 			qSort(measurements);
 			printLinkMeasurementValues(out, measurements);
 		}
-		out << endl;
+		out << "\n";
 
-        out << "<h2> Link transmission rates </h2>" << endl;
+        out << "<h2> Link transmission rates </h2>" << "\n";
 		printLinkMeasurementValues(out, intervalMeasurements[iInterval].edgeMeasurements);
-		out << endl;
+		out << "\n";
 
-        out << "<h2> Link transmission rates -- sorted </h2>" << endl;
+        out << "<h2> Link transmission rates -- sorted </h2>" << "\n";
 		{
 			QVector<LinkIntervalMeasurement> measurements = intervalMeasurements[iInterval].edgeMeasurements;
 			qSort(measurements);
 			printLinkMeasurementValues(out, measurements);
 		}
-		out << endl;
+		out << "\n";
 
-        out << "<h2> Per path link transmission rates (rows = paths) </h2>" << endl;
+        out << "<h2> Per path link transmission rates (rows = paths) </h2>" << "\n";
 		printLinkPathMeasurementValues(out, numEdges, numPaths, intervalMeasurements[iInterval].perPathEdgeMeasurements);
-		out << endl;
+		out << "\n";
 	}
-	out << endl;
+	out << "\n";
 
 	// Listing
 	{
 		QSet<int> trafficClasses = QSet<int>::fromList(pathTrafficClass.toList());
 		foreach (int trafficClass, trafficClasses) {
-			out << "<p>" << QString("Traffic class %1:").arg(trafficClass) << "</p>" << endl;
+			out << "<p>" << QString("Traffic class %1:").arg(trafficClass) << "</p>" << "\n";
 			out << "<p>" << QString("Paths: ");
 			for (int p = 0; p < numPaths; p++) {
 				if (pathTrafficClass[p] != trafficClass)
 					continue;
 				out << QString("%1 ").arg(p + 1);
 			}
-			out << "</p>" << endl;
-			out << endl;
+			out << "</p>" << "\n";
+			out << "\n";
 		}
         out << "<p>" << QString("Neutral links: ");
 		for (int e = 0; e < trueEdgeNeutrality.count(); e++) {
@@ -690,32 +752,32 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
 				out << QString("%1 ").arg(e + 1);
 			}
 		}
-		out << "</p>" << endl;
+		out << "</p>" << "\n";
         out << "<p>" << QString("Non-neutral links: ");
 		for (int e = 0; e < trueEdgeNeutrality.count(); e++) {
 			if (!trueEdgeNeutrality[e]) {
 				out << QString("%1 ").arg(e + 1);
 			}
 		}
-		out << "</p>" << endl;
-		out << endl;
+		out << "</p>" << "\n";
+		out << "\n";
 	}
-	out << endl;
+	out << "\n";
 
     // Statistics
     out << QString("Found %1 intervals of %2 seconds each (total experiment duration: %3 seconds)")
            .arg(numIntervals())
            .arg(intervalSize / 1000000000ULL)
-           .arg((tsLast - tsStart) / 1000000000ULL) << endl;
-    out << endl;
+           .arg((tsLast - tsStart) / 1000000000ULL) << "\n";
+    out << "\n";
     {
-        out << "Per interval path transmission statistics:" << endl;
+        out << "Per interval path transmission statistics:" << "\n";
         {
             QList<qreal> transmissionThresholds = QList<qreal>() << 0.0 << 0.85 << 0.90 << 0.95 << 0.97 << 0.98 << 0.99 << 1.0;
             // first index: interval, second index: histogram bin
             QList<QVector<qreal> > pathDistribution;
             for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
-                QVector<LinkIntervalMeasurement> measurements = intervalMeasurements[iInterval].pathMeasurements;
+                const QVector<LinkIntervalMeasurement> &measurements = intervalMeasurements[iInterval].pathMeasurements;
 
                 // histogram
                 QVector<qreal> intervalDistribution(transmissionThresholds.count() - 1);
@@ -748,7 +810,7 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
             for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
                 out << QString("Interval %1    ").arg(iInterval + 1, 3);
             }
-            out << endl;
+            out << "\n";
             for (int bin = 0; bin < transmissionThresholds.count() - 1; bin++) {
                 out << QString("%1-%2:   ").arg(transmissionThresholds[bin], 4, 'f', 2).arg(transmissionThresholds[bin + 1], 4, 'f', 2);
                 for (int i = 0; i < numIntervals() - 2; i++) {
@@ -758,21 +820,21 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
                         out << QString("                ");
                     }
                 }
-                out << endl;
+                out << "\n";
             }
         }
-        out << endl;
+        out << "\n";
 
 		if (pathTrafficClass.count() == numPaths) {
 			QSet<int> trafficClasses = QSet<int>::fromList(pathTrafficClass.toList());
 			foreach (int trafficClass, trafficClasses) {
-				out << QString("Traffic class %1: Per interval path transmission statistics:").arg(trafficClass) << endl;
+				out << QString("Traffic class %1: Per interval path transmission statistics:").arg(trafficClass) << "\n";
 				{
 					QList<qreal> transmissionThresholds = QList<qreal>() << 0.0 << 0.85 << 0.90 << 0.95 << 0.97 << 0.98 << 0.99 << 1.0;
 					// first index: interval, second index: histogram bin
 					QList<QVector<qreal> > pathDistribution;
 					for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
-						QVector<LinkIntervalMeasurement> measurements = intervalMeasurements[iInterval].pathMeasurements;
+						const QVector<LinkIntervalMeasurement> &measurements = intervalMeasurements[iInterval].pathMeasurements;
 
 						// histogram
 						QVector<qreal> intervalDistribution(transmissionThresholds.count() - 1);
@@ -807,7 +869,7 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
 					for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
 						out << QString("Interval %1    ").arg(iInterval + 1, 3);
 					}
-					out << endl;
+					out << "\n";
 					for (int bin = 0; bin < transmissionThresholds.count() - 1; bin++) {
 						out << QString("%1-%2:   ").arg(transmissionThresholds[bin], 4, 'f', 2).arg(transmissionThresholds[bin + 1], 4, 'f', 2);
 						for (int i = 0; i < numIntervals() - 2; i++) {
@@ -817,23 +879,23 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
 								out << QString("                ");
 							}
 						}
-						out << endl;
+						out << "\n";
 					}
 				}
-				out << endl;
+				out << "\n";
 			}
 		}
-        out << endl;
-        out << endl;
-        out << endl;
+        out << "\n";
+        out << "\n";
+        out << "\n";
 
-        out << "Per interval link transmission statistics:" << endl;
+        out << "Per interval link transmission statistics:" << "\n";
         {
             QList<qreal> transmissionThresholds = QList<qreal>() << 0.0 << 0.85 << 0.90 << 0.95 << 0.97 << 0.98 << 0.99 << 1.0;
             // first index: interval, second index: histogram bin
             QList<QVector<qreal> > edgeDistribution;
             for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
-                QVector<LinkIntervalMeasurement> measurements = intervalMeasurements[iInterval].edgeMeasurements;
+                const QVector<LinkIntervalMeasurement> &measurements = intervalMeasurements[iInterval].edgeMeasurements;
 
                 // histogram
                 QVector<qreal> intervalDistribution(transmissionThresholds.count() - 1);
@@ -866,7 +928,7 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
             for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
                 out << QString("Interval %1    ").arg(iInterval + 1, 3);
             }
-            out << endl;
+            out << "\n";
             for (int bin = 0; bin < transmissionThresholds.count() - 1; bin++) {
                 out << QString("%1-%2:   ").arg(transmissionThresholds[bin], 4, 'f', 2).arg(transmissionThresholds[bin + 1], 4, 'f', 2);
                 for (int i = 0; i < numIntervals() - 2; i++) {
@@ -876,18 +938,18 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
                         out << QString("                ");
                     }
                 }
-                out << endl;
+                out << "\n";
             }
         }
-        out << endl;
+        out << "\n";
 
-        out << "Neutral links (by policy): Per interval edge transmission statistics:" << endl;
+        out << "Neutral links (by policy): Per interval edge transmission statistics:" << "\n";
         {
             QList<qreal> transmissionThresholds = QList<qreal>() << 0.0 << 0.85 << 0.90 << 0.95 << 0.97 << 0.98 << 0.99 << 1.0;
             // first index: interval, second index: histogram bin
             QList<QVector<qreal> > edgeDistribution;
             for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
-                QVector<LinkIntervalMeasurement> measurements = intervalMeasurements[iInterval].edgeMeasurements;
+                const QVector<LinkIntervalMeasurement> &measurements = intervalMeasurements[iInterval].edgeMeasurements;
 
                 // histogram
                 QVector<qreal> intervalDistribution(transmissionThresholds.count() - 1);
@@ -922,7 +984,7 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
             for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
                 out << QString("Interval %1    ").arg(iInterval + 1, 3);
             }
-            out << endl;
+            out << "\n";
             for (int bin = 0; bin < transmissionThresholds.count() - 1; bin++) {
                 out << QString("%1-%2:   ").arg(transmissionThresholds[bin], 4, 'f', 2).arg(transmissionThresholds[bin + 1], 4, 'f', 2);
                 for (int i = 0; i < numIntervals() - 2; i++) {
@@ -932,18 +994,18 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
                         out << QString("                ");
                     }
                 }
-                out << endl;
+                out << "\n";
             }
         }
-        out << endl;
+        out << "\n";
 
-        out << "Non-neutral links (by policy): Per interval edge transmission statistics:" << endl;
+        out << "Non-neutral links (by policy): Per interval edge transmission statistics:" << "\n";
         {
             QList<qreal> transmissionThresholds = QList<qreal>() << 0.0 << 0.85 << 0.90 << 0.95 << 0.97 << 0.98 << 0.99 << 1.0;
             // first index: interval, second index: histogram bin
             QList<QVector<qreal> > edgeDistribution;
             for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
-                QVector<LinkIntervalMeasurement> measurements = intervalMeasurements[iInterval].edgeMeasurements;
+                const QVector<LinkIntervalMeasurement> &measurements = intervalMeasurements[iInterval].edgeMeasurements;
 
                 // histogram
                 QVector<qreal> intervalDistribution(transmissionThresholds.count() - 1);
@@ -978,7 +1040,7 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
             for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
                 out << QString("Interval %1    ").arg(iInterval + 1, 3);
             }
-            out << endl;
+            out << "\n";
             for (int bin = 0; bin < transmissionThresholds.count() - 1; bin++) {
                 out << QString("%1-%2:   ").arg(transmissionThresholds[bin], 4, 'f', 2).arg(transmissionThresholds[bin + 1], 4, 'f', 2);
                 for (int i = 0; i < numIntervals() - 2; i++) {
@@ -988,21 +1050,21 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
                         out << QString("                ");
                     }
                 }
-                out << endl;
+                out << "\n";
             }
         }
-        out << endl;
-        out << endl;
-        out << endl;
+        out << "\n";
+        out << "\n";
+        out << "\n";
 
-        out << "Per interval link non-neutrality statistics (rates are absolute deltas):" << endl;
+        out << "Per interval link non-neutrality statistics (rates are absolute deltas):" << "\n";
         {
             QList<qreal> nonNeutralityThresholds = QList<qreal>() << 0.0 << 0.01 << 0.02 << 0.03 << 0.05 << 0.10 << 0.15 << 1.0;
             // first index: interval, second index: histogram bin
             QList<QVector<qreal> > edgeNonNeutralityDistribution;
             for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
                 // first index: edge; second index: path
-				QHash<QPair<qint32, qint32>, LinkIntervalMeasurement> pathEdgeMeasurements =
+				const QHash<QPair<qint32, qint32>, LinkIntervalMeasurement> &pathEdgeMeasurements =
 						intervalMeasurements[iInterval].perPathEdgeMeasurements;
 
                 // histogram
@@ -1011,10 +1073,11 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
 				for (int e = 0; e < numEdges; e++) {
                     QList<qreal> rates;
 					for (int p = 0; p < numPaths; p++) {
-						QInt32Pair ep = QInt32Pair(e, p);
-						if (pathEdgeMeasurements[ep].numPacketsInFlight == 0)
+						QHash<QPair<qint32, qint32>, LinkIntervalMeasurement>::const_iterator it =
+								pathEdgeMeasurements.constFind(QInt32Pair(e, p));
+						if (it == pathEdgeMeasurements.constEnd() || it.value().numPacketsInFlight == 0)
                             continue;
-						rates << pathEdgeMeasurements[ep].successRate();
+						rates << it.value().successRate();
                     }
                     qreal nonNeutrality;
                     if (rates.count() < 2) {
@@ -1055,7 +1118,7 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
             for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
                 out << QString("Interval %1    ").arg(iInterval + 1, 3);
             }
-            out << endl;
+            out << "\n";
             for (int bin = 0; bin < nonNeutralityThresholds.count() - 1; bin++) {
                 out << QString("%1-%2:     ").arg(nonNeutralityThresholds[bin], 4, 'f', 2).arg(nonNeutralityThresholds[bin + 1], 4, 'f', 2);
                 for (int i = 0; i < numIntervals() - 2; i++) {
@@ -1065,20 +1128,20 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
                         out << QString("                ");
                     }
                 }
-                out << endl;
+                out << "\n";
             }
         }
-        out << endl;
+        out << "\n";
 
 		if (trueEdgeNeutrality.count() == numEdges) {
-            out << "Neutral links (by policy): per interval link non-neutrality statistics (rates are absolute deltas):" << endl;
+            out << "Neutral links (by policy): per interval link non-neutrality statistics (rates are absolute deltas):" << "\n";
 			{
 				QList<qreal> nonNeutralityThresholds = QList<qreal>() << 0.0 << 0.01 << 0.02 << 0.03 << 0.05 << 0.10 << 0.15 << 1.0;
 				// first index: interval, second index: histogram bin
 				QList<QVector<qreal> > edgeNonNeutralityDistribution;
 				for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
 					// first index: edge; second index: path
-					QHash<QPair<qint32, qint32>, LinkIntervalMeasurement> pathEdgeMeasurements =
+					const QHash<QPair<qint32, qint32>, LinkIntervalMeasurement> &pathEdgeMeasurements =
 							intervalMeasurements[iInterval].perPathEdgeMeasurements;
 
 					// histogram
@@ -1089,10 +1152,11 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
 							continue;
 						QList<qreal> rates;
 						for (int p = 0; p < numPaths; p++) {
-							QInt32Pair ep = QInt32Pair(e, p);
-							if (pathEdgeMeasurements[ep].numPacketsInFlight == 0)
+							QHash<QPair<qint32, qint32>, LinkIntervalMeasurement>::const_iterator it =
+									pathEdgeMeasurements.constFind(QInt32Pair(e, p));
+							if (it == pathEdgeMeasurements.constEnd() || it.value().numPacketsInFlight == 0)
 								continue;
-							rates << pathEdgeMeasurements[ep].successRate();
+							rates << it.value().successRate();
 						}
 						qreal nonNeutrality;
 						if (rates.count() < 2) {
@@ -1133,7 +1197,7 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
 				for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
 					out << QString("Interval %1    ").arg(iInterval + 1, 3);
 				}
-				out << endl;
+				out << "\n";
 				for (int bin = 0; bin < nonNeutralityThresholds.count() - 1; bin++) {
 					out << QString("%1-%2:     ").arg(nonNeutralityThresholds[bin], 4, 'f', 2).arg(nonNeutralityThresholds[bin + 1], 4, 'f', 2);
 					for (int i = 0; i < numIntervals() - 2; i++) {
@@ -1143,19 +1207,19 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
 							out << QString("                ");
 						}
 					}
-					out << endl;
+					out << "\n";
 				}
 			}
-			out << endl;
+			out << "\n";
 
-            out << "Non-neutral links (by policy): per interval link non-neutrality statistics (rates are absolute deltas):" << endl;
+            out << "Non-neutral links (by policy): per interval link non-neutrality statistics (rates are absolute deltas):" << "\n";
 			{
 				QList<qreal> nonNeutralityThresholds = QList<qreal>() << 0.0 << 0.01 << 0.02 << 0.03 << 0.05 << 0.10 << 0.15 << 1.0;
 				// first index: interval, second index: histogram bin
 				QList<QVector<qreal> > edgeNonNeutralityDistribution;
 				for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
 					// first index: edge; second index: path
-					QHash<QPair<qint32, qint32>, LinkIntervalMeasurement> pathEdgeMeasurements =
+					const QHash<QPair<qint32, qint32>, LinkIntervalMeasurement> &pathEdgeMeasurements =
 							intervalMeasurements[iInterval].perPathEdgeMeasurements;
 
 					// histogram
@@ -1166,10 +1230,11 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
 							continue;
 						QList<qreal> rates;
 						for (int p = 0; p < numPaths; p++) {
-							QInt32Pair ep = QInt32Pair(e, p);
-							if (pathEdgeMeasurements[ep].numPacketsInFlight == 0)
+							QHash<QPair<qint32, qint32>, LinkIntervalMeasurement>::const_iterator it =
+									pathEdgeMeasurements.constFind(QInt32Pair(e, p));
+							if (it == pathEdgeMeasurements.constEnd() || it.value().numPacketsInFlight == 0)
 								continue;
-							rates << pathEdgeMeasurements[ep].successRate();
+							rates << it.value().successRate();
 						}
 						qreal nonNeutrality;
 						if (rates.count() < 2) {
@@ -1210,7 +1275,7 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
 				for (int iInterval = 1; iInterval < numIntervals() - 1; iInterval++) {
 					out << QString("Interval %1    ").arg(iInterval + 1, 3);
 				}
-				out << endl;
+				out << "\n";
 				for (int bin = 0; bin < nonNeutralityThresholds.count() - 1; bin++) {
 					out << QString("%1-%2:     ").arg(nonNeutralityThresholds[bin], 4, 'f', 2).arg(nonNeutralityThresholds[bin + 1], 4, 'f', 2);
 					for (int i = 0; i < numIntervals() - 2; i++) {
@@ -1220,10 +1285,10 @@ bool ExperimentIntervalMeasurements::exportText(QIODevice *device,
 							out << QString("                ");
 						}
 					}
-					out << endl;
+					out << "\n";
 				}
 			}
-			out << endl;
+			out << "\n";
 		}
     }
 
@@ -1258,6 +1323,156 @@ ExperimentIntervalMeasurements ExperimentIntervalMeasurements::resample(quint64
 	return result;
 }
 
+int ExperimentIntervalMeasurements::resampleFactor(quint64 resamplePeriod) const
+{
+	if (resamplePeriod <= intervalSize) {
+		return 1;
+	}
+	// Round it up
+	if (resamplePeriod % intervalSize != 0) {
+		resamplePeriod = (resamplePeriod / intervalSize + 1) * intervalSize;
+	}
+	return resamplePeriod / intervalSize;
+}
+
+int ExperimentIntervalMeasurements::numResampledIntervals(quint64 resamplePeriod) const
+{
+	int factor = resampleFactor(resamplePeriod);
+	return intervalMeasurements.count() / factor + ((intervalMeasurements.count() % factor) ? 1 : 0);
+}
+
+void ExperimentIntervalMeasurements::resampledInterval(quint64 resamplePeriod, int i, GraphIntervalMeasurements &result) const
+{
+	int factor = resampleFactor(resamplePeriod);
+	result = intervalMeasurements[i * factor];
+	if (factor == 1)
+		return;
+	for (int j = i * factor + 1; j < qMin(i * factor + factor, intervalMeasurements.count()); j++) {
+		result += intervalMeasurements[j];
+	}
+	// Same as resample(): only the counters are merged
+	result.clearEvents();
+}
+
+void ExperimentIntervalMeasurements::resampleInPlace(quint64 resamplePeriod)
+{
+	int factor = resampleFactor(resamplePeriod);
+	// Nothing to do
+	if (factor == 1)
+		return;
+
+	int count = numResampledIntervals(resamplePeriod);
+	for (int i = 0; i < count; i++) {
+		// Output interval i goes to slot i, whose own data has already been merged (i < i * factor
+		// for i > 0), so it can be reused.
+		if (i > 0) {
+			qSwap(intervalMeasurements[i], intervalMeasurements[i * factor]);
+			intervalMeasurements[i * factor] = GraphIntervalMeasurements();
+		}
+		for (int j = i * factor + 1; j < qMin(i * factor + factor, intervalMeasurements.count()); j++) {
+			intervalMeasurements[i] += intervalMeasurements[j];
+			intervalMeasurements[j] = GraphIntervalMeasurements();
+		}
+		intervalMeasurements[i].clearEvents();
+	}
+	intervalMeasurements.resize(count);
+	intervalSize *= factor;
+}
+
+QString ExperimentIntervalMeasurements::cacheFileName(QString fileName, quint64 resamplePeriod)
+{
+	return QString("%1.resampled-%2ns").arg(fileName).arg(resamplePeriod);
+}
+
+// Header of the resampled cache files: identifies the source file the data was computed from
+#define RESAMPLED_CACHE_MAGIC 0x52534d50
+#define RESAMPLED_CACHE_VERSION 1
+
+class ResampledCacheHeader {
+public:
+	ResampledCacheHeader() : sourceSize(0), sourceMtime(0), tRead(0), resamplePeriod(0) {}
+	qint64 sourceSize;
+	// Modification time of the source (s since epoch)
+	qint64 sourceMtime;
+	// Time when the source was read (s since epoch)
+	qint64 tRead;
+	quint64 resamplePeriod;
+};
+
+// The cache is valid if the source has the same size and modification time as when it was read.
+// Modification times have a resolution of one second, so if the source was modified in the second
+// it was read (or later), a rewrite in that same second would go unnoticed: such caches are never
+// trusted.
+static bool resampledCacheValid(const ResampledCacheHeader &header, QFileInfo sourceInfo, quint64 resamplePeriod)
+{
+	return header.resamplePeriod == resamplePeriod &&
+		   header.sourceSize == sourceInfo.size() &&
+		   header.sourceMtime == qint64(sourceInfo.lastModified().toTime_t()) &&
+		   header.sourceMtime < header.tRead;
+}
+
+bool ExperimentIntervalMeasurements::loadResampled(QString fileName, quint64 resamplePeriod, bool useCache)
+{
+	QString cacheName = cacheFileName(fileName, resamplePeriod);
+	QFileInfo sourceInfo(fileName);
+	if (useCache && sourceInfo.exists()) {
+		QFile file(cacheName);
+		if (file.open(QIODevice::ReadOnly)) {
+			QDataStream in(&file);
+			in.setVersion(QDataStream::Qt_4_0);
+			quint32 magic = 0;
+			qint32 version = 0;
+			ResampledCacheHeader header;
+			in >> magic >> version;
+			if (in.status() == QDataStream::Ok &&
+				magic == RESAMPLED_CACHE_MAGIC &&
+				version == RESAMPLED_CACHE_VERSION) {
+				in >> header.sourceSize >> header.sourceMtime >> header.tRead >> header.resamplePeriod;
+				if (in.status() == QDataStream::Ok && resampledCacheValid(header, sourceInfo, resamplePeriod)) {
+					in >> *this;
+					if (in.status() == QDataStream::Ok) {
+						trim();
+						return true;
+					}
+					qDebug() << __FILE__ << __LINE__ << "Error reading file:" << file.fileName();
+				}
+			}
+		}
+	}
+
+	ResampledCacheHeader header;
+	header.sourceSize = sourceInfo.size();
+	header.sourceMtime = sourceInfo.lastModified().toTime_t();
+	header.tRead = QDateTime::currentDateTime().toTime_t();
+	header.resamplePeriod = resamplePeriod;
+
+	if (!load(fileName))
+		return false;
+
+	if (resampleFactor(resamplePeriod) == 1)
+		return true;
+
+	resampleInPlace(resamplePeriod);
+
+	if (useCache) {
+		QFile file(cacheName);
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+			qDebug() << __FILE__ << __LINE__ << "Could not save resampled data to" << cacheName;
+			return true;
+		}
+		QDataStream out(&file);
+		out.setVersion(QDataStream::Qt_4_0);
+		out << quint32(RESAMPLED_CACHE_MAGIC) << qint32(RESAMPLED_CACHE_VERSION);
+		out << header.sourceSize << header.sourceMtime << header.tRead << header.resamplePeriod;
+		out << *this;
+		if (out.status() != QDataStream::Ok) {
+			qDebug() << __FILE__ << __LINE__ << "Could not save resampled data to" << cacheName;
+			file.remove();
+		}
+	}
+	return true;
+}
+
 QDataStream& operator<<(QDataStream& s, const ExperimentIntervalMeasurements& d)
 {
     qint32 ver = 2;
@@ -1301,3 +1516,60 @@ QDataStream& operator>>(QDataStream& s, ExperimentIntervalMeasurements& d)
 
     return s;
 }
+
+IntervalCountMatrix::IntervalCountMatrix() :
+	numIntervals(0),
+	numEdges(0),
+	numPaths(0),
+	numPathEdges(0)
+{
+}
+
+void IntervalCountMatrix::extract(const ExperimentIntervalMeasurements &measurements)
+{
+	numIntervals = measurements.numIntervals();
+	numEdges = measurements.numEdges;
+	numPaths = measurements.numPaths;
+
+	// Rows in (edge, path) order
+	numPathEdges = 0;
+	pathEdgeIndices.fill(-1, numEdges * numPaths);
+	QVector<QPair<qint32, qint32> > pathEdges;
+	for (int e = 0; e < numEdges; e++) {
+		for (int p = 0; p < numPaths; p++) {
+			if (measurements.globalMeasurements.perPathEdgeMeasurements.contains(QPair<qint32, qint32>(e, p))) {
+				pathEdgeIndices[e * numPaths + p] = numPathEdges;
+				pathEdges.append(QPair<qint32, qint32>(e, p));
+				numPathEdges++;
+			}
+		}
+	}
+
+	pathEdgeInFlightCounts.fill(0, numPathEdges * numIntervals);
+	pathEdgeDroppedCounts.fill(0, numPathEdges * numIntervals);
+	pathEdgeTotalInFlightCounts.fill(0, numPathEdges);
+	pathInFlightCounts.fill(0, numPaths * numIntervals);
+	pathDroppedCounts.fill(0, numPaths * numIntervals);
+
+	for (int pe = 0; pe < numPathEdges; pe++) {
+		pathEdgeTotalInFlightCounts[pe] =
+				measurements.globalMeasurements.perPathEdgeMeasurements.constFind(pathEdges[pe]).value().numPacketsInFlight;
+	}
+
+	// One pass over the intervals, in the order in which they are stored
+	for (int i = 0; i < numIntervals; i++) {
+		const GraphIntervalMeasurements &interval = measurements.intervalMeasurements[i];
+		for (int pe = 0; pe < numPathEdges; pe++) {
+			QHash<QPair<qint32, qint32>, LinkIntervalMeasurement>::const_iterator it =
+					interval.perPathEdgeMeasurements.constFind(pathEdges[pe]);
+			if (it == interval.perPathEdgeMeasurements.constEnd())
+				continue;
+			pathEdgeInFlightCounts[pe * numIntervals + i] = it.value().numPacketsInFlight;
+			pathEdgeDroppedCounts[pe * numIntervals + i] = it.value().numPacketsDropped;
+		}
+		for (int p = 0; p < numPaths && p < interval.pathMeasurements.count(); p++) {
+			pathInFlightCounts[p * numIntervals + i] = interval.pathMeasurements[p].numPacketsInFlight;
+			pathDroppedCounts[p * numIntervals + i] = interval.pathMeasurements[p].numPacketsDropped;
+		}
+	}
+}
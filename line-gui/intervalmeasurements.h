@@ -20,6 +20,7 @@
 #define INTERVALMEASUREMENTS_H
 
 #include <QtCore>
+#include <random>
 #include "../util/bitarray.h"
 
 class LinkIntervalMeasurement
@@ -34,6 +35,14 @@ public:
 	void clear();
 
     void sample(int packetCount);
+    // Equivalent to sample(packetCount) followed by successRate(ok), without changing or copying
+    // the measurement: the number of drops among packetCount packets picked without replacement
+    // is drawn directly from the hypergeometric distribution of the counters.
+    // The random numbers come from generator, so parallel callers get reproducible results.
+    qreal sampledSuccessRate(int packetCount, std::mt19937 &generator, bool *ok = NULL) const;
+    // Number of dropped packets among packetCount packets picked at random without replacement.
+    // packetCount must not exceed numPacketsInFlight.
+    qint64 sampleNumPacketsDropped(int packetCount, std::mt19937 &generator) const;
 
 	friend bool operator ==(const LinkIntervalMeasurement &a, const LinkIntervalMeasurement &b);
 	friend bool operator !=(const LinkIntervalMeasurement &a, const LinkIntervalMeasurement &b);
@@ -42,7 +51,7 @@ public:
 	friend bool operator >(const LinkIntervalMeasurement &a, const LinkIntervalMeasurement &b);
 	friend bool operator >=(const LinkIntervalMeasurement &a, const LinkIntervalMeasurement &b);
 
-	LinkIntervalMeasurement& operator+=(LinkIntervalMeasurement other);
+	LinkIntervalMeasurement& operator+=(const LinkIntervalMeasurement &other);
 };
 
 bool operator ==(const LinkIntervalMeasurement &a, const LinkIntervalMeasurement &b);
@@ -61,6 +70,8 @@ public:
 	void initialize(int numEdges, int numPaths, QList<QPair<qint32, qint32> > sparseRoutingMatrixTransposed);
 	// Sets all the counters to zero
 	void clear();
+	// Clears the packet events, keeping the counters
+	void clearEvents();
 	// Index: edge
     QVector<LinkIntervalMeasurement> edgeMeasurements;
     // Index: path
@@ -69,7 +80,7 @@ public:
 	// QVector<QVector<LinkIntervalMeasurement> > perPathEdgeMeasurements;
 	QHash<QPair<qint32, qint32>, LinkIntervalMeasurement> perPathEdgeMeasurements;
 	// The object other must have been initialized with the same routing matrix.
-	GraphIntervalMeasurements& operator+=(GraphIntervalMeasurements other);
+	GraphIntervalMeasurements& operator+=(const GraphIntervalMeasurements &other);
 };
 
 QDataStream& operator>>(QDataStream& s, GraphIntervalMeasurements& d);
@@ -101,7 +112,7 @@ public:
 
     int timestampToOpenInterval(quint64 ts);
 
-	int numIntervals();
+	int numIntervals() const;
 
     bool save(QString fileName);
     bool load(QString fileName);
@@ -122,6 +133,25 @@ public:
 	// rounding up to the next multiple.
 	ExperimentIntervalMeasurements resample(quint64 resamplePeriod) const;
 
+	// Number of stored intervals merged into one interval when resampling at resamplePeriod
+	// (1 if no resampling is performed).
+	int resampleFactor(quint64 resamplePeriod) const;
+	// Number of intervals after resampling at resamplePeriod.
+	int numResampledIntervals(quint64 resamplePeriod) const;
+	// Computes interval i of resample(resamplePeriod) into result, merging only the stored
+	// intervals it covers. Use this to walk the resampled intervals one at a time.
+	void resampledInterval(quint64 resamplePeriod, int i, GraphIntervalMeasurements &result) const;
+	// Same as *this = resample(resamplePeriod), but done in place one output interval at a time,
+	// releasing the stored intervals as they are merged. Peak memory stays at the size of the
+	// stored data instead of twice that.
+	void resampleInPlace(quint64 resamplePeriod);
+	// load() followed by resampleInPlace().
+	// If useCache is set, the resampled data is also saved to cacheFileName(), and loaded from
+	// there next time as long as fileName still has the size and modification time recorded in
+	// the header of the cache.
+	bool loadResampled(QString fileName, quint64 resamplePeriod, bool useCache);
+	static QString cacheFileName(QString fileName, quint64 resamplePeriod);
+
     // Index: interval
     QVector<GraphIntervalMeasurements> intervalMeasurements;
     GraphIntervalMeasurements globalMeasurements;
@@ -136,4 +166,70 @@ public:
 QDataStream& operator>>(QDataStream& s, ExperimentIntervalMeasurements& d);
 QDataStream& operator<<(QDataStream& s, const ExperimentIntervalMeasurements& d);
 
+// The packet counters of all the intervals, copied once into flat arrays so that the analyses
+// scan contiguous memory instead of looking up (edge, path) pairs in the hashes of every interval.
+// The arrays are path-major: the counters of a path (or of an edge of a path) are stored one
+// interval after the other.
+class IntervalCountMatrix
+{
+public:
+	IntervalCountMatrix();
+	// Copies the counters of measurements. Pairs (edge, path) that are not in the routing matrix
+	// (i.e. not in measurements.globalMeasurements) get no row.
+	void extract(const ExperimentIntervalMeasurements &measurements);
+
+	// Index of the row of the pair (e, p), or -1 if path p does not cross edge e.
+	int pathEdgeIndex(int e, int p) const {
+		return pathEdgeIndices[e * numPaths + p];
+	}
+	qint64 pathEdgeInFlight(int pe, int i) const {
+		return pathEdgeInFlightCounts[qint64(pe) * numIntervals + i];
+	}
+	qint64 pathEdgeDropped(int pe, int i) const {
+		return pathEdgeDroppedCounts[qint64(pe) * numIntervals + i];
+	}
+	// Number of packets of the pair over the whole experiment (from globalMeasurements)
+	qint64 pathEdgeTotalInFlight(int pe) const {
+		return pathEdgeTotalInFlightCounts[pe];
+	}
+	qint64 pathInFlight(int p, int i) const {
+		return pathInFlightCounts[qint64(p) * numIntervals + i];
+	}
+	qint64 pathDropped(int p, int i) const {
+		return pathDroppedCounts[qint64(p) * numIntervals + i];
+	}
+	// Same as LinkIntervalMeasurement::successRate()
+	qreal pathEdgeSuccessRate(int pe, int i, bool *ok = NULL) const {
+		return successRate(pathEdgeInFlight(pe, i), pathEdgeDropped(pe, i), ok);
+	}
+	qreal pathSuccessRate(int p, int i, bool *ok = NULL) const {
+		return successRate(pathInFlight(p, i), pathDropped(p, i), ok);
+	}
+	static qreal successRate(qint64 numPacketsInFlight, qint64 numPacketsDropped, bool *ok) {
+		if (ok) {
+			*ok = numPacketsInFlight != 0;
+		}
+		if (numPacketsInFlight == 0)
+			return 0.0;
+		return 1.0 - qreal(numPacketsDropped) / qreal(numPacketsInFlight);
+	}
+
+	int numIntervals;
+	int numEdges;
+	int numPaths;
+	int numPathEdges;
+
+protected:
+	// Index: e * numPaths + p
+	QVector<qint32> pathEdgeIndices;
+	// Index: pe * numIntervals + i
+	QVector<qint64> pathEdgeInFlightCounts;
+	QVector<qint64> pathEdgeDroppedCounts;
+	// Index: pe
+	QVector<qint64> pathEdgeTotalInFlightCounts;
+	// Index: p * numIntervals + i
+	QVector<qint64> pathInFlightCounts;
+	QVector<qint64> pathDroppedCounts;
+};
+
 #endif // INTERVALMEASUREMENTS_H
@@ -118,6 +118,16 @@ bool NetGraphConnection::setParamsFromType()
         if (!readDouble(tokens, streamingPeriod_s)) {
             return false;
         }
+    } else if (arg == "TCP-Trace") {
+		if (!readString(tokens, traceFile)) {
+			return false;
+		}
+		// Percent-encoded, since the tokens are separated by spaces
+		traceFile = QUrl::fromPercentEncoding(traceFile.toUtf8());
+		if (!tokens.isEmpty() && tokens.first() == "loop") {
+			tokens.takeFirst();
+			traceLoop = true;
+		}
     } else if (arg == "UDP-CBR") {
 		if (!readDouble(tokens, rate_Mbps)) {
 			return false;
@@ -240,6 +250,13 @@ void NetGraphConnection::setTypeFromParams()
                       .arg(bufferingRate_Mbps)
                       .arg(bufferingTime_s)
                       .arg(streamingPeriod_s);
+	} else if (basicType == "TCP-Trace") {
+		encodedType = QString("%1 %2")
+					  .arg(basicType)
+					  .arg(QString::fromUtf8(QUrl::toPercentEncoding(traceFile, "/")));
+		if (traceLoop) {
+			encodedType += " loop";
+		}
     } else if (basicType == "UDP-CBR") {
 		encodedType = QString("%1 %2 %3")
 					  .arg(basicType)
@@ -310,6 +327,8 @@ void NetGraphConnection::setDefaultParams()
     bufferingRate_Mbps = 10 * 1.0e6;
     bufferingTime_s = 60;
     streamingPeriod_s = 5;
+	traceFile = "";
+	traceLoop = false;
 	sequential = false;
 	encodedType = "";
 	basicType = "";
@@ -90,6 +90,11 @@ public:
     qreal bufferingRate_Mbps;
     qreal bufferingTime_s;
     qreal streamingPeriod_s;
+	// For TCP-Trace: binary trace file on the machine running the source (see line-traffic/tracereplay.h).
+	// Percent-encoded in encodedType, so that it may contain spaces.
+	QString traceFile;
+	// If true, replay the trace again after it ends
+	bool traceLoop;
 
 	// 0 means auto color by index
 	QRgb color;
@@ -24,6 +24,8 @@
 
 #include "netgraph.h"
 
+#include <limits.h>
+
 #ifdef LINE_EMULATOR
 bool comparePacketEvent(const packetEvent &a, const packetEvent &b)
 {
@@ -263,14 +265,175 @@ QDataStream& operator>>(QDataStream& s, EdgeTimelines& d)
     return s;
 }
 
-bool readEdgeTimelines(EdgeTimelines &d, NetGraph *g, QString workingDir)
+// Unrolls the sampled items of a timeline into timeline.items: gaps between samples are filled
+// with empty items (with the queue draining at the link rate), and timestamps are made relative
+// to tsMin.
+static void unrollEdgeTimeline(EdgeTimeline &timeline, const QVector<EdgeTimelineItem> &sampled, quint64 tsMin)
+{
+    quint64 samplingPeriod = timeline.timelineSamplingPeriod;
+
+    tsMin = samplingPeriod ? (tsMin / samplingPeriod) * samplingPeriod : tsMin;
+    timeline.tsMin = tsMin;
+
+    quint64 lastTs = 0;
+    quint64 lastQueueSampled = 0;
+    quint64 lastQueueAvg = 0;
+    quint64 lastQueueMax = 0;
+
+    timeline.items.clear();
+    foreach (EdgeTimelineItem item, sampled) {
+        // "extrapolate"
+        while (item.timestamp > tsMin + lastTs + samplingPeriod) {
+            quint64 delta = ((timeline.rate_Bps * samplingPeriod) / 1000000000ULL);
+            lastQueueSampled = (delta < lastQueueSampled) ? lastQueueSampled-delta : 0;
+            lastQueueAvg = (delta < lastQueueAvg) ? lastQueueAvg-delta : 0;
+            lastQueueMax = (delta < lastQueueMax) ? lastQueueMax-delta : 0;
+
+            lastTs += samplingPeriod;
+            EdgeTimelineItem newItem;
+            newItem.clear();
+            newItem.timestamp = lastTs;
+            newItem.queue_sampled = lastQueueSampled;
+            newItem.queue_avg = lastQueueAvg;
+            newItem.queue_max = lastQueueMax;
+            timeline.items.append(newItem);
+        }
+
+        lastTs = item.timestamp - tsMin;
+        lastQueueSampled = item.queue_sampled;
+        lastQueueAvg = item.arrivals_p ? item.queue_avg / item.arrivals_p : 0;
+        lastQueueMax = item.queue_max;
+
+        EdgeTimelineItem newItem;
+        newItem.clear();
+
+        newItem.timestamp = lastTs;
+        newItem.arrivals_p = item.arrivals_p;
+        newItem.arrivals_B = item.arrivals_B;
+        newItem.qdrops_p = item.qdrops_p;
+        newItem.qdrops_B = item.qdrops_B;
+        newItem.rdrops_p = item.rdrops_p;
+        newItem.rdrops_B = item.rdrops_B;
+        newItem.queue_sampled = lastQueueSampled;
+        newItem.queue_avg = lastQueueAvg;
+        newItem.queue_max = lastQueueMax;
+        newItem.flows = item.flows;
+        timeline.items.append(newItem);
+    }
+}
+
+// Reads the timeline stream written progressively by the emulator (see EdgeTimelineTiers).
+// Format: version; number of timelines; for each timeline, an EdgeTimeline header (no items)
+// followed by its tier periods; then records of (edge, queue, tier, EdgeTimelineItem) in
+// eviction order; then a trailer with edge index -1, tsMin and tsMax. The trailer is missing
+// if the emulator did not shut down cleanly.
+static bool readEdgeTimelinesStream(EdgeTimelines &d, QFile &file, quint64 samplingPeriod)
+{
+    QDataStream s(&file);
+    s.setVersion(QDataStream::Qt_4_0);
+
+    qint32 ver = 0;
+    s >> ver;
+    if (ver > 1) {
+        qDebug() << __FILE__ << __LINE__ << "Unknown version" << ver << "of file:" << file.fileName();
+        return false;
+    }
+
+    qint32 numTimelines = 0;
+    s >> numTimelines;
+
+    QVector<EdgeTimeline> timelines;
+    QVector<qint32> selectedTiers;
+    QHash<QPair<qint32, qint32>, qint32> timelineIndex;
+    for (qint32 i = 0; i < numTimelines && s.status() == QDataStream::Ok; i++) {
+        EdgeTimeline timeline;
+        QVector<quint64> periods;
+        s >> timeline;
+        s >> periods;
+        qint32 tier = qMax(0, periods.indexOf(samplingPeriod));
+        if (tier < periods.count()) {
+            timeline.timelineSamplingPeriod = periods[tier];
+        }
+        timelineIndex[QPair<qint32, qint32>(timeline.edgeIndex, timeline.queueIndex)] = timelines.count();
+        timelines << timeline;
+        selectedTiers << tier;
+    }
+
+    QVector<QVector<EdgeTimelineItem> > sampled(timelines.count());
+    quint64 tsMin = ULLONG_MAX;
+    quint64 tsMax = 0;
+    bool complete = false;
+    while (!s.atEnd() && s.status() == QDataStream::Ok) {
+        qint32 edgeIndex;
+        s >> edgeIndex;
+        if (edgeIndex < 0) {
+            s >> tsMin;
+            s >> tsMax;
+            complete = true;
+            break;
+        }
+        qint32 queueIndex;
+        qint32 tier;
+        EdgeTimelineItem item;
+        s >> queueIndex;
+        s >> tier;
+        s >> item;
+        qint32 t = timelineIndex.value(QPair<qint32, qint32>(edgeIndex, queueIndex), -1);
+        if (t < 0 || tier != selectedTiers[t])
+            continue;
+        sampled[t].append(item);
+    }
+
+    if (!complete) {
+        // Truncated stream: recover the time range from the items
+        for (int t = 0; t < timelines.count(); t++) {
+            if (sampled[t].isEmpty())
+                continue;
+            if (timelines[t].queueIndex < 0) {
+                tsMin = qMin(tsMin, sampled[t].first().timestamp);
+            }
+            tsMax = qMax(tsMax, sampled[t].last().timestamp + timelines[t].timelineSamplingPeriod);
+        }
+        if (tsMin == ULLONG_MAX) {
+            // Only queue timelines have items
+            for (int t = 0; t < timelines.count(); t++) {
+                if (!sampled[t].isEmpty()) {
+                    tsMin = qMin(tsMin, sampled[t].first().timestamp);
+                }
+            }
+        }
+        if (tsMin == ULLONG_MAX) {
+            qDebug() << __FILE__ << __LINE__ << "No timeline records in truncated file:" << file.fileName();
+            return false;
+        }
+    }
+
+    d = EdgeTimelines();
+    for (int t = 0; t < timelines.count(); t++) {
+        EdgeTimeline &timeline = timelines[t];
+        timeline.tsMax = tsMax;
+        unrollEdgeTimeline(timeline, sampled[t], tsMin);
+        sampled[t].clear();
+        while (d.timelines.count() <= timeline.edgeIndex) {
+            d.timelines.append(QVector<EdgeTimeline>());
+        }
+        d.timelines[timeline.edgeIndex].append(timeline);
+    }
+
+    return s.status() == QDataStream::Ok;
+}
+
+bool readEdgeTimelines(EdgeTimelines &d, NetGraph *g, QString workingDir, quint64 samplingPeriod)
 {
     QFile file(QString("%1/edge-timelines.dat").arg(workingDir));
+    QFile streamFile(QString("%1/edge-timelines-stream.dat").arg(workingDir));
     if (file.open(QIODevice::ReadOnly)) {
         QDataStream s(&file);
         s.setVersion(QDataStream::Qt_4_0);
         s >> d;
         return s.status() == QDataStream::Ok;
+    } else if (streamFile.open(QIODevice::ReadOnly)) {
+        return readEdgeTimelinesStream(d, streamFile, samplingPeriod);
     } else {
         d = EdgeTimelines();
         // attempt to load legacy data
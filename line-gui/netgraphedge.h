@@ -117,7 +117,10 @@ QDataStream& operator>>(QDataStream& s, EdgeTimelines& d);
 
 QDataStream& operator<<(QDataStream& s, const EdgeTimelines& d);
 
-bool readEdgeTimelines(EdgeTimelines &d, NetGraph *g, QString workingDir);
+// Loads the edge timelines saved by the emulator in workingDir.
+// If samplingPeriod is non-zero and the emulator recorded a timeline tier with that period,
+// that tier is loaded; otherwise the finest tier (the edge's timelineSamplingPeriod) is loaded.
+bool readEdgeTimelines(EdgeTimelines &d, NetGraph *g, QString workingDir, quint64 samplingPeriod = 0);
 
 #ifdef LINE_EMULATOR
 
@@ -130,6 +133,50 @@ struct packetEvent {
 
 bool comparePacketEvent(const packetEvent &a, const packetEvent &b);
 
+// Sampled edge (or queue) timeline, kept online at several resolutions (tiers).
+// Each tier is a bounded, time-ordered ring of aggregates; the last item of a ring is the
+// bucket currently being filled. Only the finest tier is updated per packet: when one of its
+// buckets closes, it is merged into the coarser tiers. Items evicted from a full ring are
+// appended to the timeline stream (edgeTimelineStream), so memory does not grow with the
+// duration of the emulation and nothing needs to be sorted at the end.
+class EdgeTimelineTiers {
+public:
+	EdgeTimelineTiers();
+
+	// periods[0] is the finest tier (the timelineSamplingPeriod of the edge); the other
+	// periods must be multiples of it.
+	void init(qint32 edgeIndex, qint32 queueIndex, QVector<quint64> periods, qint32 capacity, quint64 ts_now);
+
+	// Returns the bucket of the finest tier that contains ts_now.
+	// If a new bucket is started, its queue_sampled field is set to qload.
+	inline EdgeTimelineItem &bucket(quint64 ts_now, quint64 qload) {
+		if (ts_now >= rings[0].last().timestamp + periods[0]) {
+			startBucket(ts_now, qload);
+		}
+		return rings[0].last();
+	}
+
+	// Writes all the items still held in memory to the timeline stream and empties the rings.
+	void flush();
+
+	bool isEmpty() const;
+
+	qint32 edgeIndex;
+	qint32 queueIndex;
+	// Start of the first bucket that was recorded, including buckets that have been flushed.
+	quint64 tsFirst;
+	// Maximum number of items held in memory per tier.
+	qint32 capacity;
+	QVector<quint64> periods;
+	QVector<OVector<EdgeTimelineItem> > rings;
+
+protected:
+	void startBucket(quint64 ts_now, quint64 qload);
+	EdgeTimelineItem &appendBucket(int tier, quint64 timestamp, quint64 qload);
+	void merge(int tier, const EdgeTimelineItem &item);
+	void evict(int tier);
+};
+
 class NetGraphEdge;
 
 class QueueItem
@@ -201,7 +248,7 @@ public:
 
     // Timeline
 	OVector<packetEvent> timelineFull;
-    OVector<EdgeTimelineItem> timelineSampled;
+    EdgeTimelineTiers timelineSampled;
     quint64 tsMin;
     quint64 tsMax;
 
@@ -336,7 +383,7 @@ public:
 
 	// Timeline
 	OVector<packetEvent> timelineFull;
-    OVector<EdgeTimelineItem> timelineSampled;
+    EdgeTimelineTiers timelineSampled;
     quint64 tsMin;
     quint64 tsMax;
 
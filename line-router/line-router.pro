@@ -33,8 +33,13 @@ exists( ../line.pro ) {
 	#INCLUDEPATH += $$PF_RING_DIR/userland/c++ $$PF_RING_DIR/kernel $$PF_RING_DIR/kernel/plugins $$PF_RING_DIR/userland/libpcap-1.1.1-ring $$PF_RING_DIR/userland/lib
 	#QMAKE_LIBS += $$PF_RING_DIR/userland/c++/libpfring_cpp.a $$PF_RING_DIR/userland/lib/libpfring.a $$PF_RING_DIR/userland/libpcap-1.1.1-ring/libpcap.a
 	QMAKE_LIBS += /usr/local/lib/libpfring.a /usr/local/lib/libpcap.a
+	# shm_open
+	LIBS += -lrt
 
   QMAKE_CXXFLAGS += -std=c++0x -Wno-unused-local-typedefs
+	# The router is built on the machine it runs on (see make-remote.sh); enables the SSE4.1/AVX2
+	# NAT rewrite when available
+	QMAKE_CXXFLAGS += -march=native
 
 	system(pkg-config libnl-1) : {
 		CONFIG += link_pkgconfig
@@ -58,6 +63,9 @@ exists( ../line.pro ) {
 		pconsumer.cpp \
 		pscheduler.cpp \
 		psender.cpp \
+		livestats.cpp \
+		threadlayout.cpp \
+		natrewrite.cpp \
 		../util/bitarray.cpp \
 		../line-gui/netgraphpath.cpp \
     ../line-gui/netgraphnode.cpp \
@@ -85,6 +93,9 @@ exists( ../line.pro ) {
 		pscheduler.h \
 		pconsumer.h \
 		psender.h \
+		livestats.h \
+		threadlayout.h \
+		natrewrite.h \
 		../util/bitarray.h \
 		../line-gui/netgraphpath.h \
 		../line-gui/netgraphnode.h \
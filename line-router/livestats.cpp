@@ -0,0 +1,209 @@
+/*
+ *	Copyright (C) 2014 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "livestats.h"
+
+#include <sched.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "pconsumer.h"
+#include "../util/util.h"
+
+LiveStats *liveStats = NULL;
+
+static size_t liveStatsSize(int numEdges)
+{
+	return sizeof(LiveStats) + numEdges * sizeof(LiveEdgeStats);
+}
+
+bool liveStatsCreate(int numEdges)
+{
+	liveStats = NULL;
+
+	int fd = shm_open(LIVE_STATS_SHM_NAME, O_CREAT | O_RDWR, 0644);
+	if (fd < 0) {
+		printf("Live stats disabled: shm_open failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	size_t size = liveStatsSize(numEdges);
+	if (ftruncate(fd, size) != 0) {
+		printf("Live stats disabled: ftruncate failed: %s\n", strerror(errno));
+		close(fd);
+		shm_unlink(LIVE_STATS_SHM_NAME);
+		return false;
+	}
+
+	void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		printf("Live stats disabled: mmap failed: %s\n", strerror(errno));
+		shm_unlink(LIVE_STATS_SHM_NAME);
+		return false;
+	}
+
+	memset(mem, 0, size);
+	liveStats = static_cast<LiveStats*>(mem);
+	liveStats->header.version = LIVE_STATS_VERSION;
+	liveStats->header.numEdges = numEdges;
+	liveStats->header.pid = getpid();
+	liveStats->header.tsStart = get_current_time();
+	liveStats->header.size = size;
+	__sync_synchronize();
+	// Written last, so that readers never see a partially initialized header
+	liveStats->header.magic = LIVE_STATS_MAGIC;
+
+	printf("Live stats exported in shared memory segment %s (%s bytes)\n",
+		   LIVE_STATS_SHM_NAME, withCommas(quint64(size)));
+	return true;
+}
+
+void liveStatsDestroy()
+{
+	if (!liveStats)
+		return;
+	munmap(liveStats, liveStats->header.size);
+	liveStats = NULL;
+	shm_unlink(LIVE_STATS_SHM_NAME);
+}
+
+// Copies size bytes starting at data, which are protected by the seqlock of stats, into result.
+// Retries until the copy is consistent.
+static void liveStatsRead(const LiveThreadStats &stats, const void *data, size_t size, void *result)
+{
+	while (1) {
+		quint32 sequence = stats.sequence;
+		if (sequence & 1) {
+			sched_yield();
+			continue;
+		}
+		__sync_synchronize();
+		memcpy(result, data, size);
+		__sync_synchronize();
+		if (stats.sequence == sequence)
+			break;
+	}
+}
+
+static void printThreadStats(const char *name, const LiveThreadStats &stats, quint64 tsStart)
+{
+	printf("%-10s t = " TS_FORMAT " : %s pkts, %s pps, %s drops, loop delay avg " TS_FORMAT " max " TS_FORMAT "\n",
+		   name,
+		   TS_FORMAT_PARAM(stats.tsUpdate > tsStart ? stats.tsUpdate - tsStart : 0),
+		   withCommas(stats.packets),
+		   withCommas(stats.pps),
+		   withCommas(stats.drops),
+		   TS_FORMAT_PARAM(stats.loopDelayAvg),
+		   TS_FORMAT_PARAM(stats.loopDelayMax));
+}
+
+int runLiveStatsReader(int argc, char **argv)
+{
+	int periodMs = 1000;
+	if (argc > 2) {
+		bool ok;
+		periodMs = QString(argv[2]).toInt(&ok);
+		if (!ok || periodMs <= 0) {
+			fprintf(stderr, "Usage: line-router --live-stats [period_ms]\n");
+			return -1;
+		}
+	}
+
+	int fd = shm_open(LIVE_STATS_SHM_NAME, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open %s (is line-router running?): %s\n", LIVE_STATS_SHM_NAME, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(LiveStats)) {
+		fprintf(stderr, "Shared memory segment %s is not initialized\n", LIVE_STATS_SHM_NAME);
+		close(fd);
+		return -1;
+	}
+
+	void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+		return -1;
+	}
+	const LiveStats *shared = static_cast<const LiveStats*>(mem);
+
+	if (shared->header.magic != LIVE_STATS_MAGIC ||
+		shared->header.version != LIVE_STATS_VERSION ||
+		liveStatsSize(shared->header.numEdges) > (size_t)st.st_size) {
+		fprintf(stderr, "Shared memory segment %s has an unknown format\n", LIVE_STATS_SHM_NAME);
+		munmap(mem, st.st_size);
+		return -1;
+	}
+
+	const int numEdges = shared->header.numEdges;
+	const quint64 tsStart = shared->header.tsStart;
+	printf("Attached to line-router pid %u, %d edges\n", shared->header.pid, numEdges);
+
+	LiveThreadStats consumer;
+	LiveThreadStats scheduler;
+	LiveThreadStats sender;
+	QVector<LiveEdgeStats> edges(numEdges);
+
+	while (1) {
+		liveStatsRead(shared->consumer, &shared->consumer, sizeof(consumer), &consumer);
+		liveStatsRead(shared->sender, &shared->sender, sizeof(sender), &sender);
+		// The edges are published together with the scheduler stats
+		liveStatsRead(shared->scheduler, &shared->scheduler, sizeof(scheduler), &scheduler);
+		if (numEdges > 0) {
+			liveStatsRead(shared->scheduler, shared->edges(), numEdges * sizeof(LiveEdgeStats), edges.data());
+		}
+
+		printf("=========================\n");
+		printThreadStats("consumer", consumer, tsStart);
+		printThreadStats("scheduler", scheduler, tsStart);
+		printThreadStats("sender", sender, tsStart);
+		for (int e = 0; e < numEdges; e++) {
+			if (edges[e].packets == 0)
+				continue;
+			printf("Link %4d: queue %3llu%% (%s/%s B), %s pps, %s pkts, %s qdrops, %s rdrops\n",
+				   e + 1,
+				   edges[e].qcapacity ? (edges[e].qload * 100) / edges[e].qcapacity : 0ULL,
+				   withCommas(edges[e].qload),
+				   withCommas(edges[e].qcapacity),
+				   withCommas(edges[e].pps),
+				   withCommas(edges[e].packets),
+				   withCommas(edges[e].qdrops),
+				   withCommas(edges[e].rdrops));
+		}
+		fflush(stdout);
+
+		if (kill(shared->header.pid, 0) != 0 && errno == ESRCH) {
+			printf("line-router has exited\n");
+			break;
+		}
+		usleep(periodMs * 1000);
+	}
+
+	munmap(mem, st.st_size);
+	return 0;
+}
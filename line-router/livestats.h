@@ -0,0 +1,121 @@
+/*
+ *	Copyright (C) 2014 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef LIVESTATS_H
+#define LIVESTATS_H
+
+#include <QtCore>
+
+// Live statistics of a running emulation, exported in a POSIX shared memory segment.
+// Each router thread owns one LiveThreadStats block and publishes it periodically under a
+// seqlock: no locks or syscalls are added to the packet path, and readers (see
+// runLiveStatsReader(), i.e. line-router --live-stats) retry until they get a consistent copy.
+
+#define LIVE_STATS_SHM_NAME "/line-router-stats"
+#define LIVE_STATS_MAGIC 0x4c535453
+#define LIVE_STATS_VERSION 1
+
+// How often the scheduler and the sender publish their stats (ns)
+#define LIVE_STATS_PERIOD (10 * 1000ULL * 1000ULL)
+// The consumer publishes its stats every this many packets (it does not read the clock when idle)
+#define LIVE_STATS_CONSUMER_BATCH 256
+
+struct LiveStatsHeader {
+	quint32 magic;
+	quint32 version;
+	quint32 numEdges;
+	quint32 pid;
+	quint64 tsStart;
+	// Size of the segment in bytes
+	quint64 size;
+};
+
+// Counters of one thread. Written only by that thread, between liveStatsWriteBegin() and
+// liveStatsWriteEnd().
+struct LiveThreadStats {
+	// Odd while an update is in progress
+	volatile quint32 sequence;
+	quint32 reserved;
+	// Time of the last update
+	quint64 tsUpdate;
+	// Packets/bytes processed (received, scheduled or sent, depending on the thread)
+	quint64 packets;
+	quint64 bytes;
+	// Packets processed per second during the last update period
+	quint64 pps;
+	// Packets dropped by the thread
+	quint64 drops;
+	// Non-idle loops, and their latency during the last update period (ns)
+	quint64 loops;
+	quint64 loopDelayAvg;
+	quint64 loopDelayMax;
+} __attribute__((aligned(64)));
+
+// Per-edge counters, published by the scheduler under its seqlock.
+struct LiveEdgeStats {
+	// Bytes queued (all queues of the edge)
+	quint64 qload;
+	quint64 qcapacity;
+	quint64 packets;
+	quint64 bytes;
+	quint64 qdrops;
+	quint64 rdrops;
+	// Packet arrivals per second during the last update period
+	quint64 pps;
+};
+
+struct LiveStats {
+	LiveStatsHeader header;
+	LiveThreadStats consumer;
+	LiveThreadStats scheduler;
+	LiveThreadStats sender;
+	// Followed by header.numEdges items of LiveEdgeStats
+
+	inline LiveEdgeStats *edges() {
+		return reinterpret_cast<LiveEdgeStats*>(this + 1);
+	}
+	inline const LiveEdgeStats *edges() const {
+		return reinterpret_cast<const LiveEdgeStats*>(this + 1);
+	}
+};
+
+// The segment of this process, or NULL if it could not be created.
+extern LiveStats *liveStats;
+
+// Creates the shared memory segment. Returns false (and leaves liveStats NULL) on failure.
+bool liveStatsCreate(int numEdges);
+// Unmaps and removes the segment.
+void liveStatsDestroy();
+
+inline void liveStatsWriteBegin(LiveThreadStats &stats)
+{
+	stats.sequence++;
+	__sync_synchronize();
+}
+
+inline void liveStatsWriteEnd(LiveThreadStats &stats)
+{
+	__sync_synchronize();
+	stats.sequence++;
+}
+
+// Samples the segment of a running line-router and prints it periodically.
+// Usage: line-router --live-stats [period_ms]
+int runLiveStatsReader(int argc, char **argv);
+
+#endif // LIVESTATS_H
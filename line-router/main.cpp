@@ -21,6 +21,8 @@
 #include "pconsumer.h"
 #include <QtCore>
 #include "qpairingheap.h"
+#include "livestats.h"
+#include "natrewrite.h"
 // This is defined in the .pro file
 // #define USE_TC_MALLOC
 #ifdef USE_TC_MALLOC
@@ -33,6 +35,13 @@ void warmMallocCache()
 
 int main(int argc, char *argv[])
 {
+	if (argc > 1 && QString(argv[1]) == "--live-stats") {
+		return runLiveStatsReader(argc, argv);
+	}
+	if (argc > 1 && QString(argv[1]) == "--bench-nat") {
+		return runNatRewriteBenchmark(argc, argv);
+	}
+
 #ifdef USE_TC_MALLOC
 	// Don't release memory to the OS
 	// MallocExtension::instance()->SetMemoryReleaseRate(0);
@@ -0,0 +1,374 @@
+/*
+ *	Copyright (C) 2014 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "natrewrite.h"
+
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <netinet/tcp.h>
+#include <linux/if_ether.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+
+#include "psender.h"
+#include "../util/util.h"
+
+// The header fields of a burst, one lane per packet.
+// Checksums are 16-bit values (in network byte order) zero-extended to 32 bits.
+struct NatLanes {
+	quint32 saddr[NAT_REWRITE_BURST];
+	quint32 daddr[NAT_REWRITE_BURST];
+	quint32 ipCheck[NAT_REWRITE_BURST];
+	quint32 l4Check[NAT_REWRITE_BURST];
+	// All ones for UDP packets, 0 otherwise
+	quint32 udp[NAT_REWRITE_BURST];
+} __attribute__((aligned(32)));
+
+// The incremental checksum update follows RFC 1624: HC' = ~(~HC + ~m + m'), with the 32-bit
+// addresses split into 16-bit words. The sums are folded with end-around carry, which gives the
+// same representative as csum_fold(), so the results match fix_addresses() bit for bit.
+
+static inline quint32 csumHalves(quint32 x)
+{
+	return (x & 0xffff) + (x >> 16);
+}
+
+static inline quint32 csumFold16(quint32 x)
+{
+	return csumHalves(csumHalves(x));
+}
+
+static void rewriteLanesScalar(NatLanes &lanes, int begin, int end)
+{
+	const quint32 natForeign = NAT_FOREIGN;
+	for (int i = begin; i < end; i++) {
+		quint32 s = lanes.saddr[i];
+		quint32 d = lanes.daddr[i];
+		quint32 s2 = s | natForeign;
+		quint32 d2 = d & ~natForeign;
+		quint32 deltaS = csumHalves(~s) + csumHalves(s2);
+		quint32 deltaD = csumHalves(~d) + csumHalves(d2);
+		lanes.ipCheck[i] = csumFold16((lanes.ipCheck[i] ^ 0xffff) + deltaS + deltaD) ^ 0xffff;
+		// fix_addresses() updates the L4 checksum in two steps, and does not touch a UDP checksum
+		// that became 0 ("no checksum") after the first one
+		quint32 l4 = csumFold16((lanes.l4Check[i] ^ 0xffff) + deltaS) ^ 0xffff;
+		quint32 l4b = csumFold16((l4 ^ 0xffff) + deltaD) ^ 0xffff;
+		lanes.l4Check[i] = (lanes.udp[i] && l4 == 0) ? 0 : l4b;
+		lanes.saddr[i] = s2;
+		lanes.daddr[i] = d2;
+	}
+}
+
+#if defined(__AVX2__)
+static inline __m256i csumHalves256(__m256i x, __m256i mask16)
+{
+	return _mm256_add_epi32(_mm256_and_si256(x, mask16), _mm256_srli_epi32(x, 16));
+}
+
+static inline __m256i csumFold256(__m256i x, __m256i mask16)
+{
+	return csumHalves256(csumHalves256(x, mask16), mask16);
+}
+
+// Processes the lanes in groups of 8. Returns the number of lanes processed.
+static int rewriteLanesSimd(NatLanes &lanes, int count)
+{
+	const __m256i natForeign = _mm256_set1_epi32(NAT_FOREIGN);
+	const __m256i mask16 = _mm256_set1_epi32(0xffff);
+	const __m256i ones = _mm256_set1_epi32(-1);
+	const __m256i zero = _mm256_setzero_si256();
+	int i;
+	for (i = 0; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_load_si256((const __m256i*)&lanes.saddr[i]);
+		__m256i d = _mm256_load_si256((const __m256i*)&lanes.daddr[i]);
+		__m256i ipCheck = _mm256_load_si256((const __m256i*)&lanes.ipCheck[i]);
+		__m256i l4Check = _mm256_load_si256((const __m256i*)&lanes.l4Check[i]);
+		__m256i udp = _mm256_load_si256((const __m256i*)&lanes.udp[i]);
+
+		__m256i s2 = _mm256_or_si256(s, natForeign);
+		__m256i d2 = _mm256_andnot_si256(natForeign, d);
+		__m256i deltaS = _mm256_add_epi32(csumHalves256(_mm256_xor_si256(s, ones), mask16), csumHalves256(s2, mask16));
+		__m256i deltaD = _mm256_add_epi32(csumHalves256(_mm256_xor_si256(d, ones), mask16), csumHalves256(d2, mask16));
+
+		ipCheck = _mm256_add_epi32(_mm256_xor_si256(ipCheck, mask16), _mm256_add_epi32(deltaS, deltaD));
+		ipCheck = _mm256_xor_si256(csumFold256(ipCheck, mask16), mask16);
+
+		__m256i l4 = _mm256_add_epi32(_mm256_xor_si256(l4Check, mask16), deltaS);
+		l4 = _mm256_xor_si256(csumFold256(l4, mask16), mask16);
+		__m256i l4b = _mm256_add_epi32(_mm256_xor_si256(l4, mask16), deltaD);
+		l4b = _mm256_xor_si256(csumFold256(l4b, mask16), mask16);
+		__m256i udpZero = _mm256_and_si256(udp, _mm256_cmpeq_epi32(l4, zero));
+		l4b = _mm256_andnot_si256(udpZero, l4b);
+
+		_mm256_store_si256((__m256i*)&lanes.saddr[i], s2);
+		_mm256_store_si256((__m256i*)&lanes.daddr[i], d2);
+		_mm256_store_si256((__m256i*)&lanes.ipCheck[i], ipCheck);
+		_mm256_store_si256((__m256i*)&lanes.l4Check[i], l4b);
+	}
+	return i;
+}
+#elif defined(__SSE4_1__)
+static inline __m128i csumHalves128(__m128i x, __m128i mask16)
+{
+	return _mm_add_epi32(_mm_and_si128(x, mask16), _mm_srli_epi32(x, 16));
+}
+
+static inline __m128i csumFold128(__m128i x, __m128i mask16)
+{
+	return csumHalves128(csumHalves128(x, mask16), mask16);
+}
+
+// Processes the lanes in groups of 4. Returns the number of lanes processed.
+static int rewriteLanesSimd(NatLanes &lanes, int count)
+{
+	const __m128i natForeign = _mm_set1_epi32(NAT_FOREIGN);
+	const __m128i mask16 = _mm_set1_epi32(0xffff);
+	const __m128i ones = _mm_set1_epi32(-1);
+	const __m128i zero = _mm_setzero_si128();
+	int i;
+	for (i = 0; i + 4 <= count; i += 4) {
+		__m128i s = _mm_load_si128((const __m128i*)&lanes.saddr[i]);
+		__m128i d = _mm_load_si128((const __m128i*)&lanes.daddr[i]);
+		__m128i ipCheck = _mm_load_si128((const __m128i*)&lanes.ipCheck[i]);
+		__m128i l4Check = _mm_load_si128((const __m128i*)&lanes.l4Check[i]);
+		__m128i udp = _mm_load_si128((const __m128i*)&lanes.udp[i]);
+
+		__m128i s2 = _mm_or_si128(s, natForeign);
+		__m128i d2 = _mm_andnot_si128(natForeign, d);
+		__m128i deltaS = _mm_add_epi32(csumHalves128(_mm_xor_si128(s, ones), mask16), csumHalves128(s2, mask16));
+		__m128i deltaD = _mm_add_epi32(csumHalves128(_mm_xor_si128(d, ones), mask16), csumHalves128(d2, mask16));
+
+		ipCheck = _mm_add_epi32(_mm_xor_si128(ipCheck, mask16), _mm_add_epi32(deltaS, deltaD));
+		ipCheck = _mm_xor_si128(csumFold128(ipCheck, mask16), mask16);
+
+		__m128i l4 = _mm_add_epi32(_mm_xor_si128(l4Check, mask16), deltaS);
+		l4 = _mm_xor_si128(csumFold128(l4, mask16), mask16);
+		__m128i l4b = _mm_add_epi32(_mm_xor_si128(l4, mask16), deltaD);
+		l4b = _mm_xor_si128(csumFold128(l4b, mask16), mask16);
+		__m128i udpZero = _mm_and_si128(udp, _mm_cmpeq_epi32(l4, zero));
+		l4b = _mm_andnot_si128(udpZero, l4b);
+
+		_mm_store_si128((__m128i*)&lanes.saddr[i], s2);
+		_mm_store_si128((__m128i*)&lanes.daddr[i], d2);
+		_mm_store_si128((__m128i*)&lanes.ipCheck[i], ipCheck);
+		_mm_store_si128((__m128i*)&lanes.l4Check[i], l4b);
+	}
+	return i;
+}
+#else
+static int rewriteLanesSimd(NatLanes &, int )
+{
+	return 0;
+}
+#endif
+
+const char *nat_rewrite_impl()
+{
+#if defined(__AVX2__)
+	return "AVX2";
+#elif defined(__SSE4_1__)
+	return "SSE4.1";
+#else
+	return "scalar";
+#endif
+}
+
+// Swaps the source and destination MAC addresses
+static inline void swapMacs(quint8 *eth)
+{
+#if defined(__SSE4_1__)
+	const __m128i order = _mm_setr_epi8(6, 7, 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 12, 13, 14, 15);
+	__m128i header = _mm_loadu_si128((const __m128i*)eth);
+	_mm_storeu_si128((__m128i*)eth, _mm_shuffle_epi8(header, order));
+#else
+	quint8 tmp[ETH_ALEN];
+	memcpy(tmp, eth, ETH_ALEN);
+	memcpy(eth, eth + ETH_ALEN, ETH_ALEN);
+	memcpy(eth + ETH_ALEN, tmp, ETH_ALEN);
+#endif
+}
+
+void nat_rewrite_burst(Packet **packets, int count)
+{
+	Q_ASSERT(count <= NAT_REWRITE_BURST);
+
+	NatLanes lanes;
+	struct iphdr *ips[NAT_REWRITE_BURST];
+	// NULL if the L4 checksum is not updated
+	quint16 *l4Checks[NAT_REWRITE_BURST];
+
+	for (int i = 0; i < count; i++) {
+		Packet *p = packets[i];
+		swapMacs(p->buffer);
+		struct iphdr *ip = (struct iphdr *)(p->buffer + p->offsets.l3_offset);
+		ips[i] = ip;
+		lanes.saddr[i] = ip->saddr;
+		lanes.daddr[i] = ip->daddr;
+		lanes.ipCheck[i] = ip->check;
+		lanes.l4Check[i] = 0;
+		lanes.udp[i] = 0;
+		l4Checks[i] = NULL;
+		if (ip->protocol == IPPROTO_UDP) {
+			struct udphdr *udp = (struct udphdr *)(((quint8*)ip) + ip->ihl*4);
+			if (udp->check) {
+				l4Checks[i] = (quint16*)&udp->check;
+				lanes.l4Check[i] = udp->check;
+				lanes.udp[i] = 0xffffffff;
+			}
+		} else if (ip->protocol == IPPROTO_TCP) {
+			struct tcphdr *tcp = (struct tcphdr *)(((quint8*)ip) + ip->ihl*4);
+			l4Checks[i] = (quint16*)&tcp->check;
+			lanes.l4Check[i] = tcp->check;
+		}
+	}
+
+	int done = rewriteLanesSimd(lanes, count);
+	rewriteLanesScalar(lanes, done, count);
+
+	for (int i = 0; i < count; i++) {
+		ips[i]->saddr = lanes.saddr[i];
+		ips[i]->daddr = lanes.daddr[i];
+		ips[i]->check = lanes.ipCheck[i];
+		if (l4Checks[i]) {
+			*l4Checks[i] = lanes.l4Check[i];
+		}
+		packets[i]->addressesRewritten = true;
+	}
+}
+
+// Bytes of each synthetic packet restored before every round of the benchmark
+#define NAT_BENCH_HEADER 64
+
+static void makeBenchmarkPacket(Packet *p, int index)
+{
+	p->init();
+	memset(p->buffer, 0, NAT_BENCH_HEADER);
+
+	struct ethhdr *eh = (struct ethhdr *)p->buffer;
+	for (int i = 0; i < ETH_ALEN; i++) {
+		eh->h_dest[i] = qrand() & 0xff;
+		eh->h_source[i] = qrand() & 0xff;
+	}
+	eh->h_proto = htons(ETH_P_IP);
+
+	p->offsets.l3_offset = sizeof(struct ethhdr);
+	struct iphdr *ip = (struct iphdr *)(p->buffer + p->offsets.l3_offset);
+	ip->version = 4;
+	ip->ihl = 5;
+	ip->ttl = 64;
+	ip->protocol = (index % 2) ? IPPROTO_UDP : IPPROTO_TCP;
+	// Addresses from the NAT subnet, in the direction accepted by the consumer
+	ip->saddr = htonl(0x0a000000 | (qrand() & 0x7fffff));
+	ip->daddr = htonl(0x0a000000 | (qrand() & 0x7fffff)) | NAT_FOREIGN;
+	// Arbitrary checksums: the incremental update does not depend on their validity
+	ip->check = qrand() & 0xffff;
+
+	p->offsets.l4_offset = p->offsets.l3_offset + ip->ihl * 4;
+	if (ip->protocol == IPPROTO_UDP) {
+		struct udphdr *udp = (struct udphdr *)(p->buffer + p->offsets.l4_offset);
+		// Some UDP packets without checksum
+		udp->check = (index % 8 == 1) ? 0 : (qrand() & 0xffff);
+	} else {
+		struct tcphdr *tcp = (struct tcphdr *)(p->buffer + p->offsets.l4_offset);
+		tcp->check = qrand() & 0xffff;
+	}
+	p->length = NAT_BENCH_HEADER;
+}
+
+int runNatRewriteBenchmark(int argc, char **argv)
+{
+	int numPackets = 4096;
+	int numRounds = 1000;
+	bool ok = true;
+	if (argc > 2) {
+		numPackets = QString(argv[2]).toInt(&ok);
+		ok = ok && numPackets > 0;
+	}
+	if (ok && argc > 3) {
+		numRounds = QString(argv[3]).toInt(&ok);
+		ok = ok && numRounds > 0;
+	}
+	if (!ok) {
+		fprintf(stderr, "Usage: line-router --bench-nat [packets] [rounds]\n");
+		return -1;
+	}
+
+	qsrand(1);
+	QVector<Packet*> packets(numPackets);
+	QVector<quint8> headers(numPackets * NAT_BENCH_HEADER);
+	QVector<quint8> scalarResult(numPackets * NAT_BENCH_HEADER);
+	for (int i = 0; i < numPackets; i++) {
+		packets[i] = new Packet();
+		makeBenchmarkPacket(packets[i], i);
+		memcpy(&headers[i * NAT_BENCH_HEADER], packets[i]->buffer, NAT_BENCH_HEADER);
+	}
+
+	quint64 timeScalar = 0;
+	quint64 timeBurst = 0;
+	int mismatches = 0;
+	for (int round = 0; round < numRounds; round++) {
+		for (int i = 0; i < numPackets; i++) {
+			memcpy(packets[i]->buffer, &headers[i * NAT_BENCH_HEADER], NAT_BENCH_HEADER);
+		}
+		quint64 t0 = get_current_time();
+		for (int i = 0; i < numPackets; i++) {
+			fix_addresses(packets[i]);
+		}
+		timeScalar += get_current_time() - t0;
+		if (round == 0) {
+			for (int i = 0; i < numPackets; i++) {
+				memcpy(&scalarResult[i * NAT_BENCH_HEADER], packets[i]->buffer, NAT_BENCH_HEADER);
+			}
+		}
+
+		for (int i = 0; i < numPackets; i++) {
+			memcpy(packets[i]->buffer, &headers[i * NAT_BENCH_HEADER], NAT_BENCH_HEADER);
+		}
+		t0 = get_current_time();
+		for (int i = 0; i < numPackets; i += NAT_REWRITE_BURST) {
+			nat_rewrite_burst(packets.data() + i, qMin(NAT_REWRITE_BURST, numPackets - i));
+		}
+		timeBurst += get_current_time() - t0;
+		if (round == 0) {
+			for (int i = 0; i < numPackets; i++) {
+				if (memcmp(&scalarResult[i * NAT_BENCH_HEADER], packets[i]->buffer, NAT_BENCH_HEADER) != 0) {
+					mismatches++;
+				}
+			}
+		}
+	}
+
+	const qreal total = qreal(numPackets) * numRounds;
+	printf("NAT rewrite benchmark: %s packets x %s rounds, burst %d\n",
+		   withCommas(numPackets), withCommas(numRounds), NAT_REWRITE_BURST);
+	printf("fix_addresses (scalar):     %.2f ns/packet\n", timeScalar / total);
+	printf("nat_rewrite_burst (%s): %.2f ns/packet (speedup %.2fx)\n",
+		   nat_rewrite_impl(), timeBurst / total, timeBurst ? qreal(timeScalar) / timeBurst : 0.0);
+	printf("Packets that differ from fix_addresses: %d\n", mismatches);
+
+	foreach (Packet *p, packets) {
+		delete p;
+	}
+	return mismatches == 0 ? 0 : -1;
+}
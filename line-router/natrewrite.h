@@ -0,0 +1,41 @@
+/*
+ *	Copyright (C) 2014 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef NATREWRITE_H
+#define NATREWRITE_H
+
+#include "pconsumer.h"
+
+// Maximum number of packets rewritten in one call of nat_rewrite_burst()
+#define NAT_REWRITE_BURST 32
+
+// Applies the same rewrite as fix_addresses() (MAC swap, NAT of the IP addresses and incremental
+// update of the IP and TCP/UDP checksums) to a burst of IPv4 packets, and sets addressesRewritten.
+// The checksums of the burst are computed in SIMD lanes (AVX2 or SSE4.1, depending on the target
+// of the build, with a scalar fallback); the results are identical to fix_addresses().
+// count must be at most NAT_REWRITE_BURST.
+void nat_rewrite_burst(Packet **packets, int count);
+
+// The name of the implementation selected at build time ("AVX2", "SSE4.1" or "scalar").
+const char *nat_rewrite_impl();
+
+// Micro-benchmark of nat_rewrite_burst() against fix_addresses() on synthetic packets.
+// Usage: line-router --bench-nat [packets] [rounds]
+int runNatRewriteBenchmark(int argc, char **argv);
+
+#endif // NATREWRITE_H
@@ -48,6 +48,9 @@ extern "C" {
 #include "../remote_config.h"
 #include "../line-gui/netgraphnode.h"
 #include "../util/ovector.h"
+#include "livestats.h"
+#include "threadlayout.h"
+#include "natrewrite.h"
 
 #define PROFILE_PCONSUMER 0
 
@@ -78,6 +81,29 @@ static quint64 jumbosReceived;
 static quint64 tsStart;
 static quint64 emulationDuration;
 
+static void publishConsumerStats(quint64 ts_now)
+{
+	LiveThreadStats &stats = liveStats->consumer;
+	quint64 dt = ts_now - stats.tsUpdate;
+	liveStatsWriteBegin(stats);
+	stats.pps = dt ? ((packetsReceived - stats.packets) * SEC_TO_NSEC) / dt : 0;
+	stats.packets = packetsReceived;
+	stats.bytes = bytesReceived;
+	stats.drops = jumbosReceived + miniJumbosReceived;
+	stats.tsUpdate = ts_now;
+	liveStatsWriteEnd(stats);
+}
+
+// Applies the NAT rewrite to the received packets and hands them to the scheduler
+static inline void flushReceivedBurst(Packet **burst, int &count)
+{
+	nat_rewrite_burst(burst, count);
+	for (int i = 0; i < count; i++) {
+		packetsIn.enqueue(burst[i]);
+	}
+	count = 0;
+}
+
 void* packet_consumer_thread(void* ) {
 	barrierInit.wait();
 	__sync_synchronize();
@@ -85,7 +111,7 @@ void* packet_consumer_thread(void* ) {
 	pthread_setname_np(pthread_self(), "line-packet-capture");
 
 	u_int numCPU = sysconf(_SC_NPROCESSORS_ONLN);
-	u_long core_id = CORE_CONSUMER;
+	u_long core_id = threadLayout.consumerCore;
 
 	if (bind2core(core_id) == 0) {
 		printf("Set thread consumer affinity to core %lu/%u\n", core_id, numCPU);
@@ -113,6 +139,14 @@ void* packet_consumer_thread(void* ) {
 
     tsStart = get_current_time();
 	tsFirstSentPacket = 0;
+	if (liveStats) {
+		liveStats->consumer.tsUpdate = tsStart;
+	}
+
+	// Accepted packets are rewritten (NAT) in bursts before being handed to the scheduler, so that
+	// the sender only has to transmit them. A burst is flushed as soon as the ring is empty.
+	Packet *burst[NAT_REWRITE_BURST];
+	int burstCount = 0;
 
 	Packet *p = nullptr;
 	while (1) {
@@ -207,8 +241,14 @@ void* packet_consumer_thread(void* ) {
 						RecordedPacketData data(p);
 						recordedData->recordedPacketData.append(data);
 					}
-					packetsIn.enqueue(p);
+					burst[burstCount++] = p;
 					p = nullptr;
+					if (burstCount == NAT_REWRITE_BURST) {
+						flushReceivedBurst(burst, burstCount);
+					}
+					if (liveStats && packetsReceived % LIVE_STATS_CONSUMER_BATCH == 0) {
+						publishConsumerStats(ts_now);
+					}
 				} else {
 					if (DEBUG_PACKETS)
 						printf("Dropped packet %d.%d.%d.%d -> %d.%d.%d.%d\n",
@@ -217,9 +257,22 @@ void* packet_consumer_thread(void* ) {
 				}
 			}
 		} else {
+			if (burstCount > 0) {
+				flushReceivedBurst(burst, burstCount);
+			}
 			//sched_yield();
 		}
 	}
+	// The scheduler is shutting down too, so the packets not handed to it yet go back to the
+	// pool, which is freed at exit
+	for (int i = 0; i < burstCount; i++) {
+		packetPool.enqueue(burst[i]);
+	}
+	burstCount = 0;
+	if (p != nullptr) {
+		packetPool.enqueue(p);
+		p = nullptr;
+	}
 	malloc_profile_pause_wrapper();
     emulationDuration = get_current_time() - tsStart;
 
@@ -243,6 +296,7 @@ void print_consumer_stats()
 	}
     printf("Jumbos received (dropped): %s\n", withCommas(jumbosReceived));
     printf("Jumbos exceeding MTU by up to 4 received (dropped) (means PMTUD enabled): %s\n", withCommas(miniJumbosReceived));
+	printf("NAT rewrite: %s, bursts of up to %d packets\n", nat_rewrite_impl(), NAT_REWRITE_BURST);
 
 #if QUEUE_IMPL == QUEUE_IMPL_SPIN
 	printf("Inter-thread communication: spinlock-protected queue\n");
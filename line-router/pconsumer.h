@@ -57,6 +57,7 @@ public:
 		ts_send = 0;
 		theoretical_delay = 0;
 		preparedForSend = false;
+		addressesRewritten = false;
 		length = 0;
 		memset(&offsets, 0, sizeof(offsets));
 		src_ip = 0;
@@ -106,6 +107,8 @@ public:
     // Ideally, equal to (ts_start_send - ts_start_proc).
     quint64 theoretical_delay;
 	bool preparedForSend;
+	// True if the NAT rewrite has been applied to buffer (see nat_rewrite_burst())
+	bool addressesRewritten;
 
     // frame length
     int length;
@@ -167,6 +170,14 @@ extern qreal bufferBloatFactor;
 
 extern bool flowTracking;
 
+// Periods (in ns) of the coarser tiers of the sampled edge timelines. Set by --timeline_tiers.
+extern QVector<quint64> timelineTierPeriods;
+// Number of items of each timeline tier kept in memory. Set by --timeline_ring_size.
+extern qint32 timelineRingCapacity;
+// The sender flushes the TX ring once for all the packets with deadlines within this window (ns).
+// 0 flushes after every packet. Set by --tx_batch_window.
+extern quint64 txBatchWindow;
+
 extern QueuingDiscipline gQueuingDiscipline;
 
 enum QosBufferScaling {
@@ -188,7 +199,7 @@ void warmMallocCache();
 
 int getInterfaceSpeedMbps(const char *interfaceName);
 
-// CPU affinity
+// Default CPU affinity (see RouterThreadLayout)
 #define CORE_CONSUMER 1
 
 #define SEC_TO_NSEC  1000000000ULL
@@ -23,6 +23,8 @@
 
 #include "pconsumer.h"
 #include "psender.h"
+#include "livestats.h"
+#include "threadlayout.h"
 
 #include <signal.h>
 #include <sched.h>
@@ -78,6 +80,9 @@ ExperimentIntervalMeasurements *pathIntervalMeasurements;
 ExperimentIntervalMeasurements *flowIntervalMeasurements;
 SampledPathFlowEvents *sampledPathFlowEvents;
 bool flowTracking;
+QVector<quint64> timelineTierPeriods;
+qint32 timelineRingCapacity;
+quint64 txBatchWindow;
 
 /* *************************************** */
 /*
@@ -823,6 +828,9 @@ int runPacketFilter(int argc, char **argv) {
 	qosBufferScaling = QosBufferScalingNone;
 	gQueuingDiscipline = QueuingDisciplineDropTail;
 	flowTracking = false;
+	timelineTierPeriods.clear();
+	timelineRingCapacity = 1024;
+	txBatchWindow = 1000ULL;
 
 	while (argc > 0) {
 		if (QString(argv[0]) == "--record") {
@@ -866,6 +874,43 @@ int runPacketFilter(int argc, char **argv) {
 			flowTracking = true;
 			argc--, argv++;
 			argc--, argv++;
+		} else if (QString(argv[0]) == "--timeline_tiers") {
+			// comma-separated list of periods in ns, e.g. 100000000,1000000000
+			timelineTierPeriods.clear();
+			foreach (QString period, QString(argv[1]).split(',', QString::SkipEmptyParts)) {
+				bool ok;
+				timelineTierPeriods << period.toULongLong(&ok);
+				Q_ASSERT_FORCE(ok);
+			}
+			qSort(timelineTierPeriods);
+			argc--, argv++;
+			argc--, argv++;
+		} else if (QString(argv[0]) == "--timeline_ring_size") {
+			bool ok;
+			timelineRingCapacity = QString(argv[1]).toInt(&ok);
+			Q_ASSERT_FORCE(ok && timelineRingCapacity > 0);
+			argc--, argv++;
+			argc--, argv++;
+		} else if (QString(argv[0]) == "--tx_batch_window") {
+			bool ok;
+			txBatchWindow = QString(argv[1]).toULongLong(&ok);
+			Q_ASSERT_FORCE(ok);
+			argc--, argv++;
+			argc--, argv++;
+		} else if (QString(argv[0]) == "--cores") {
+			if (argc < 2 || !threadLayout.parseCores(argv[1])) {
+				fprintf(stderr, "Usage: --cores <consumer>,<scheduler>,<sender>\n");
+				exit(EXIT_FAILURE);
+			}
+			argc--, argv++;
+			argc--, argv++;
+		} else if (QString(argv[0]) == "--numa_node") {
+			if (argc < 2 || !threadLayout.parseMemoryNode(argv[1])) {
+				fprintf(stderr, "Usage: --numa_node <node|auto>\n");
+				exit(EXIT_FAILURE);
+			}
+			argc--, argv++;
+			argc--, argv++;
 		} else if (QString(argv[0]) == "--qos_scale_buffers") {
 			if (QString(argv[1]) == "none") {
 				qosBufferScaling = QosBufferScalingNone;
@@ -916,8 +961,21 @@ int runPacketFilter(int argc, char **argv) {
 
 	QDir::setCurrent(QString("./%1").arg(simulationId));
 
+	if (!threadLayout.validate(device)) {
+		fprintf(stderr, "Invalid thread layout\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// The topology, the packet pool and the queues are shared by all router threads:
+	// allocate them on the chosen NUMA node
+	if (threadLayout.memoryNode >= 0) {
+		setPreferredMemoryNode(threadLayout.memoryNode);
+	}
+
 	loadTopology(graphFileName);
 
+	liveStatsCreate(netGraph->edges.count());
+
     pathIntervalMeasurements = new ExperimentIntervalMeasurements();
     pathIntervalMeasurements->initialize(get_current_time(),
                                          estimatedDuration,
@@ -951,6 +1009,10 @@ int runPacketFilter(int argc, char **argv) {
 	packetsIn.init(numPackets);
 	packetsOut.init(numPackets);
 
+	if (threadLayout.memoryNode >= 0) {
+		setPreferredMemoryNode(-1);
+	}
+
 	__sync_synchronize();
 
 	pthread_t scheduler_thread;
@@ -985,6 +1047,8 @@ int runPacketFilter(int argc, char **argv) {
 	sampledPathFlowEvents->save("sampled-path-flows.data");
 	delete sampledPathFlowEvents;
 
+	liveStatsDestroy();
+
 	OVector<Packet*> packets;
 	packetPool.dequeueAll(packets);
 	for (int i = 0; i < packets.count(); i++) {
@@ -51,6 +51,8 @@
 #include "pscheduler.h"
 #include "pconsumer.h"
 #include "psender.h"
+#include "livestats.h"
+#include "threadlayout.h"
 #include "qpairingheap.h"
 #include "bitarray.h"
 #include "../util/ovector.h"
@@ -87,6 +89,172 @@ qreal bufferBloatFactor;
 
 NetGraph *netGraph;
 
+// The most recent events kept in the full timelines
+#define TIMELINE_FULL_CAPACITY 100000
+
+// Timeline items evicted from the in-memory rings are appended here (see EdgeTimelineTiers)
+static QFile *edgeTimelineFile = NULL;
+static QDataStream *edgeTimelineStream = NULL;
+
+// Returns the tier periods of a sampled timeline with the given base period: the base period,
+// followed by the periods from --timeline_tiers that are coarser multiples of it.
+static QVector<quint64> getTimelineTierPeriods(quint64 samplingPeriod)
+{
+	QVector<quint64> periods;
+	periods << samplingPeriod;
+	foreach (quint64 period, timelineTierPeriods) {
+		if (period > periods.last() && period % samplingPeriod == 0) {
+			periods << period;
+		}
+	}
+	return periods;
+}
+
+// Drops the oldest events of a full timeline so that numEvents more fit in TIMELINE_FULL_CAPACITY
+static inline void makeRoomInTimelineFull(OVector<packetEvent> &timelineFull, int numEvents)
+{
+	while (timelineFull.count() + numEvents > TIMELINE_FULL_CAPACITY) {
+		timelineFull.removeFirst();
+	}
+}
+
+EdgeTimelineTiers::EdgeTimelineTiers()
+{
+	edgeIndex = -1;
+	queueIndex = -1;
+	tsFirst = 0;
+	capacity = 0;
+}
+
+void EdgeTimelineTiers::init(qint32 edgeIndex, qint32 queueIndex, QVector<quint64> periods, qint32 capacity, quint64 ts_now)
+{
+	Q_ASSERT_FORCE(!periods.isEmpty());
+	this->edgeIndex = edgeIndex;
+	this->queueIndex = queueIndex;
+	this->periods = periods;
+	// The last item of a ring is the current bucket, so we need room for at least one more
+	this->capacity = qMax(2, capacity);
+	rings.resize(periods.count());
+	for (int tier = 0; tier < rings.count(); tier++) {
+		rings[tier].clear();
+		rings[tier].reserve(this->capacity);
+		appendBucket(tier, ts_now, 0);
+	}
+	tsFirst = rings[0].first().timestamp;
+}
+
+bool EdgeTimelineTiers::isEmpty() const
+{
+	return rings.isEmpty() || rings.at(0).isEmpty();
+}
+
+void EdgeTimelineTiers::startBucket(quint64 ts_now, quint64 qload)
+{
+	// The current bucket of the finest tier is complete, account for it in the coarser tiers
+	EdgeTimelineItem closed = rings[0].last();
+	for (int tier = 1; tier < rings.count(); tier++) {
+		merge(tier, closed);
+	}
+	appendBucket(0, ts_now, qload);
+}
+
+EdgeTimelineItem &EdgeTimelineTiers::appendBucket(int tier, quint64 timestamp, quint64 qload)
+{
+	OVector<EdgeTimelineItem> &ring = rings[tier];
+	if (ring.count() >= capacity) {
+		evict(tier);
+	}
+	EdgeTimelineItem &current = ring.append();
+	current.clear();
+	current.timestamp = (timestamp / periods[tier]) * periods[tier];
+	current.queue_sampled = qload;
+	return current;
+}
+
+void EdgeTimelineTiers::merge(int tier, const EdgeTimelineItem &item)
+{
+	if (item.timestamp >= rings[tier].last().timestamp + periods[tier]) {
+		appendBucket(tier, item.timestamp, item.queue_sampled);
+	}
+	EdgeTimelineItem &current = rings[tier].last();
+	current.arrivals_p += item.arrivals_p;
+	current.arrivals_B += item.arrivals_B;
+	current.qdrops_p += item.qdrops_p;
+	current.qdrops_B += item.qdrops_B;
+	current.rdrops_p += item.rdrops_p;
+	current.rdrops_B += item.rdrops_B;
+	current.queue_avg += item.queue_avg;
+	current.queue_max = qMax(current.queue_max, item.queue_max);
+	if (flowTracking) {
+		current.flows.unite(item.flows);
+	}
+}
+
+void EdgeTimelineTiers::evict(int tier)
+{
+	OVector<EdgeTimelineItem> &ring = rings[tier];
+	if (edgeTimelineStream) {
+		*edgeTimelineStream << edgeIndex;
+		*edgeTimelineStream << queueIndex;
+		*edgeTimelineStream << qint32(tier);
+		*edgeTimelineStream << ring.first();
+	}
+	ring.removeFirst();
+}
+
+void EdgeTimelineTiers::flush()
+{
+	if (isEmpty())
+		return;
+	EdgeTimelineItem last = rings[0].last();
+	for (int tier = 1; tier < rings.count(); tier++) {
+		merge(tier, last);
+	}
+	for (int tier = 0; tier < rings.count(); tier++) {
+		while (!rings[tier].isEmpty()) {
+			evict(tier);
+		}
+	}
+	rings.clear();
+}
+
+void openEdgeTimelineStream()
+{
+	edgeTimelineFile = new QFile("edge-timelines-stream.dat");
+	if (!edgeTimelineFile->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qDebug() << __FILE__ << __LINE__ << "Could not open file" << edgeTimelineFile->fileName();
+		delete edgeTimelineFile;
+		edgeTimelineFile = NULL;
+		return;
+	}
+	edgeTimelineStream = new QDataStream(edgeTimelineFile);
+	edgeTimelineStream->setVersion(QDataStream::Qt_4_0);
+
+	qint32 ver = 1;
+	*edgeTimelineStream << ver;
+
+	qint32 numTimelines = 0;
+	for (int iEdge = 0; iEdge < netGraph->edges.count(); iEdge++) {
+		numTimelines += 1 + netGraph->edges[iEdge].queues.count();
+	}
+	*edgeTimelineStream << numTimelines;
+
+	for (int iEdge = 0; iEdge < netGraph->edges.count(); iEdge++) {
+		const NetGraphEdge &e = netGraph->edges[iEdge];
+		for (int queue = -1; queue < e.queues.count(); queue++) {
+			EdgeTimeline timeline;
+			timeline.edgeIndex = e.index;
+			timeline.queueIndex = queue;
+			timeline.timelineSamplingPeriod = e.timelineSamplingPeriod;
+			timeline.rate_Bps = e.rate_Bps;
+			timeline.delay_ms = e.delay_ms;
+			timeline.qcapacity = e.qcapacity;
+			*edgeTimelineStream << timeline;
+			*edgeTimelineStream << (queue < 0 ? e.timelineSampled.periods : e.queues[queue].timelineSampled.periods);
+		}
+	}
+}
+
 void NetGraphEdge::prepareEmulation(int npaths)
 {
     this->npaths = npaths;
@@ -111,22 +279,12 @@ void NetGraphEdge::prepareEmulation(int npaths)
 	qdelay_perpath.resize(npaths);
 
 	if (recordSampledTimeline) {
-        EdgeTimelineItem &current = timelineSampled.append();
-		current.clear();
-
-		quint64 ts_now = get_current_time();
-		current.timestamp = (ts_now / timelineSamplingPeriod) * timelineSamplingPeriod;
-
-		// preallocate
-		quint64 estimateSize = (estimatedDuration / timelineSamplingPeriod) * 1.1;
-		timelineSampled.reserve(estimateSize);
+		timelineSampled.init(index, -1, getTimelineTierPeriods(timelineSamplingPeriod),
+							 timelineRingCapacity, get_current_time());
 	}
 
 	if (recordFullTimeline) {
-		// preallocate for some number of packets
-		quint64 estimateSize = 10000;
-		estimateSize = qMin(estimateSize, 100000ULL);
-		timelineFull.reserve(estimateSize);
+		timelineFull.reserve(TIMELINE_FULL_CAPACITY);
 	}
 
     tsMin = ULLONG_MAX;
@@ -181,13 +339,11 @@ void NetGraphEdge::postEmulation()
             rdrops_perpath[p] += queues[q].rdrops_perpath[p];
             qdelay_perpath[p] += queues[q].qdelay_perpath[p];
         }
-		// timelineFull.append(queues[q].timelineFull);
-		// timelineSampled.append(queues[q].timelineSampled);
+        queues[q].timelineSampled.flush();
         tsMin = qMin(tsMin, queues[q].tsMin);
         tsMax = qMax(tsMax, queues[q].tsMax);
     }
-    qSort(timelineFull.begin(), timelineFull.end(), comparePacketEvent);
-    qSort(timelineSampled.begin(), timelineSampled.end(), compareEdgeTimelineItem);
+    timelineSampled.flush();
 }
 
 NetGraphEdgeQueue::NetGraphEdgeQueue()
@@ -266,23 +422,12 @@ NetGraphEdgeQueue::NetGraphEdgeQueue(const NetGraphEdge &edge, qint32 index)
     qdelay_perpath.resize(npaths);
 
     if (recordSampledTimeline) {
-        EdgeTimelineItem current;
-		current.clear();
-
-        quint64 ts_now = get_current_time();
-        current.timestamp = (ts_now / timelineSamplingPeriod) * timelineSamplingPeriod;
-		timelineSampled.append(current);
-
-		// preallocate
-		quint64 estimateSize = (estimatedDuration / timelineSamplingPeriod) * 1.1;
-		timelineSampled.reserve(estimateSize);
+		timelineSampled.init(edgeIndex, queueIndex, getTimelineTierPeriods(timelineSamplingPeriod),
+							 timelineRingCapacity, get_current_time());
     }
 
     if (recordFullTimeline) {
-        // preallocate for some number of packets
-        quint64 estimateSize = 10000;
-        estimateSize = qMin(estimateSize, 100000ULL);
-		timelineFull.reserve(estimateSize);
+		timelineFull.reserve(TIMELINE_FULL_CAPACITY);
     }
 
     tsMin = ULLONG_MAX;
@@ -376,6 +521,7 @@ void loadTopology(QString graphFileName)
 	netGraph->setFileName(graphFileName);
 	netGraph->loadFromFile();
 	netGraph->prepareEmulation();
+	openEdgeTimelineStream();
 }
 
 TokenBucket::TokenBucket()
@@ -716,34 +862,28 @@ stats:
 		queued_packets.last().recordedQueuedPacketDataIndex = recordedData->recordedQueuedPacketData.count() - 1;
 	}
 	if (recordSampledTimeline) {
-		if (ts_now >= timelineSampled.last().timestamp + timelineSamplingPeriod) {
-			// new time bracket, insert new aggregate
-            EdgeTimelineItem &current = timelineSampled.append();
-			current.clear();
-
-			current.timestamp = (ts_now / timelineSamplingPeriod) * timelineSamplingPeriod;
-			current.queue_sampled = qload;
-		}
-		// we're in the same time bracket, update the last item
-		timelineSampled.last().arrivals_p++;
-		timelineSampled.last().arrivals_B += p->length;
+		EdgeTimelineItem &current = timelineSampled.bucket(ts_now, qload);
+		current.arrivals_p++;
+		current.arrivals_B += p->length;
 		if (decision == DECISION_QDROP || droppedOther) {
-			timelineSampled.last().qdrops_p++;
-			timelineSampled.last().qdrops_B += p->length;
+			current.qdrops_p++;
+			current.qdrops_B += p->length;
 		}
 		if (decision == DECISION_RDROP) {
-			timelineSampled.last().rdrops_p++;
-			timelineSampled.last().rdrops_B += p->length;
+			current.rdrops_p++;
+			current.rdrops_B += p->length;
 		}
-		timelineSampled.last().queue_avg += qload;
-		timelineSampled.last().queue_max = qMax(timelineSampled.last().queue_max, qload);
+		current.queue_avg += qload;
+		current.queue_max = qMax(current.queue_max, qload);
 		if (flowTracking) {
 			FlowIdentifier flow(p);
-			timelineSampled.last().flows.insert(flow);
+			current.flows.insert(flow);
 		}
 	}
 
 	if (recordFullTimeline) {
+		// keep only the most recent events
+		makeRoomInTimelineFull(timelineFull, (decision == DECISION_QUEUE && droppedOther) ? 2 : 1);
 		packetEvent current;
 		current.timestamp = ts_now;
 		current.type = (decision == DECISION_QUEUE) ? PACKET_EVENT_QUEUED :
@@ -822,30 +962,24 @@ bool NetGraphEdge::enqueue(Packet *p, quint64 ts_now, quint64 &ts_exit)
 		for (int iq = 0; iq < queueCount; iq++) {
 			overallQload += queues[iq].qload;
 		}
-		if (ts_now >= timelineSampled.last().timestamp + timelineSamplingPeriod) {
-			// new time bracket, insert new aggregate
-            EdgeTimelineItem &current = timelineSampled.append();
-			current.clear();
-
-			current.timestamp = (ts_now / timelineSamplingPeriod) * timelineSamplingPeriod;
-			current.queue_sampled = overallQload;
-		}
-		// we're in the same time bracket, update the last item
-		timelineSampled.last().arrivals_p++;
-		timelineSampled.last().arrivals_B += p->length;
+		EdgeTimelineItem &current = timelineSampled.bucket(ts_now, overallQload);
+		current.arrivals_p++;
+		current.arrivals_B += p->length;
 		if (!queued) {
-			timelineSampled.last().qdrops_p++;
-			timelineSampled.last().qdrops_B += p->length;
+			current.qdrops_p++;
+			current.qdrops_B += p->length;
 		}
-		timelineSampled.last().queue_avg += overallQload;
-		timelineSampled.last().queue_max = qMax(timelineSampled.last().queue_max, overallQload);
+		current.queue_avg += overallQload;
+		current.queue_max = qMax(current.queue_max, overallQload);
 		if (flowTracking) {
 			FlowIdentifier flow(p);
-			timelineSampled.last().flows.insert(flow);
+			current.flows.insert(flow);
 		}
 	}
 
 	if (recordFullTimeline) {
+		// keep only the most recent events
+		makeRoomInTimelineFull(timelineFull, 1);
 		packetEvent current;
 		current.timestamp = ts_now;
 		current.type = queued ? PACKET_EVENT_QUEUED : PACKET_EVENT_QDROP;
@@ -1021,103 +1155,28 @@ int routePacket(Packet *p, quint64 ts_now, quint64 &ts_next)
 	}
 }
 
-EdgeTimeline computeEdgeTimelinesBinary(NetGraphEdge e, int queue, quint64 tsMin, quint64 tsMax)
-{
-    EdgeTimeline timeline;
-
-    // edge timeline range
-    if (!e.timelineSampled.isEmpty()) {
-        tsMin = qMin(tsMin, e.timelineSampled.first().timestamp);
-    }
-
-    tsMin = e.timelineSamplingPeriod ? (tsMin / e.timelineSamplingPeriod) * e.timelineSamplingPeriod : tsMin;
-
-    timeline.tsMin = tsMin;
-    timeline.tsMax = tsMax;
-
-    // edge properties
-    timeline.timelineSamplingPeriod = e.timelineSamplingPeriod;
-    timeline.rate_Bps = e.rate_Bps;
-    timeline.delay_ms = e.delay_ms;
-    timeline.qcapacity = e.qcapacity;
-
-    const OVector<EdgeTimelineItem> &timelineSampled = queue < 0 ? e.timelineSampled :
-                                                                   e.queues[queue].timelineSampled;
-
-    // unroll RLE data
-    quint64 lastTs = 0;
-    quint64 samplingPeriod = e.timelineSamplingPeriod;
-    quint64 lastQueueSampled = 0;
-    quint64 lastQueueAvg = 0;
-    quint64 lastQueueMax = 0;
-
-    foreach (EdgeTimelineItem item, timelineSampled) {
-        // "extrapolate"
-        while (item.timestamp > tsMin + lastTs + samplingPeriod) {
-            quint64 delta = ((e.rate_Bps * samplingPeriod) / SEC_TO_NSEC);
-            lastQueueSampled = (delta < lastQueueSampled) ? lastQueueSampled-delta : 0;
-            lastQueueAvg = (delta < lastQueueAvg) ? lastQueueAvg-delta : 0;
-            lastQueueMax = (delta < lastQueueMax) ? lastQueueMax-delta : 0;
-
-            lastTs += samplingPeriod;
-            EdgeTimelineItem newItem;
-            newItem.clear();
-            newItem.timestamp = lastTs;
-            newItem.queue_sampled = lastQueueSampled;
-            newItem.queue_avg = lastQueueAvg;
-            newItem.queue_max = lastQueueMax;
-            timeline.items.append(newItem);
-        }
-
-        lastTs = item.timestamp - tsMin;
-        lastQueueSampled = item.queue_sampled;
-        lastQueueAvg = item.arrivals_p ? item.queue_avg / item.arrivals_p : 0;
-        lastQueueMax = item.queue_max;
-
-        EdgeTimelineItem newItem;
-        newItem.clear();
-
-        newItem.timestamp = lastTs;
-        newItem.arrivals_p = item.arrivals_p;
-        newItem.arrivals_B = item.arrivals_B;
-        newItem.qdrops_p = item.qdrops_p;
-        newItem.qdrops_B = item.qdrops_B;
-        newItem.rdrops_p = item.rdrops_p;
-        newItem.rdrops_B = item.rdrops_B;
-        newItem.queue_sampled = lastQueueSampled;
-        newItem.queue_avg = lastQueueAvg;
-        newItem.queue_max = lastQueueMax;
-        newItem.flows = item.flows;
-        timeline.items.append(newItem);
-    }
-
-    return timeline;
-}
-
-void saveEdgeTimelinesBinary(quint64 tsMin, quint64 tsMax)
+void closeEdgeTimelineStream(quint64 tsMin, quint64 tsMax)
 {
-    QFile file(QString("edge-timelines.dat"));
-    file.open(QIODevice::WriteOnly);
-    QDataStream out(&file);
-    out.setVersion(QDataStream::Qt_4_0);
-
-    foreach (NetGraphEdge e, netGraph->edges) {
-        if (!e.timelineSampled.isEmpty()) {
-            tsMin = qMin(tsMin, e.timelineSampled.first().timestamp);
-        }
-    }
+	if (!edgeTimelineStream)
+		return;
 
-    EdgeTimelines edgeTmelines;
+	for (int iEdge = 0; iEdge < netGraph->edges.count(); iEdge++) {
+		const NetGraphEdge &e = netGraph->edges[iEdge];
+		if (e.recordSampledTimeline) {
+			tsMin = qMin(tsMin, e.timelineSampled.tsFirst);
+		}
+	}
 
-    foreach (NetGraphEdge e, netGraph->edges) {
-        QVector<EdgeTimeline> edgeQueueTimelines;
-        for (int queue = -1; queue < e.queueCount; queue++) {
-            edgeQueueTimelines << computeEdgeTimelinesBinary(e, queue, tsMin, tsMax);
-        }
-        edgeTmelines.timelines << edgeQueueTimelines;
-    }
+	// trailer
+	*edgeTimelineStream << qint32(-1);
+	*edgeTimelineStream << tsMin;
+	*edgeTimelineStream << tsMax;
 
-    out << edgeTmelines;
+	delete edgeTimelineStream;
+	edgeTimelineStream = NULL;
+	edgeTimelineFile->close();
+	delete edgeTimelineFile;
+	edgeTimelineFile = NULL;
 }
 
 void saveEdgeStats() {
@@ -1330,8 +1389,8 @@ void saveRecordedData()
 
 	tomoData.save("tomo-records.dat");
 
-	// edge timeline aggregates/samples
-    saveEdgeTimelinesBinary(tomoData.tsMin, tomoData.tsMax);
+	// edge timeline aggregates/samples (the items have been streamed during the emulation)
+	closeEdgeTimelineStream(tomoData.tsMin, tomoData.tsMax);
 }
 
 static quint64 max_loop_delay;
@@ -1356,6 +1415,53 @@ static OVector<quint64> highLatencyEventsMem;
 // thread cache
 static OVector<quint64> highLatencyEventsMemThread;
 
+// Publishes the scheduler and per-edge counters in the live stats segment.
+// loops, loopDelayTotal and loopDelayMax cover the non-idle loops since the previous call.
+static void publishSchedulerStats(quint64 ts_now, quint64 loops, quint64 loopDelayTotal, quint64 loopDelayMax)
+{
+	LiveThreadStats &stats = liveStats->scheduler;
+	LiveEdgeStats *edgeStats = liveStats->edges();
+	quint64 dt = ts_now - stats.tsUpdate;
+
+	liveStatsWriteBegin(stats);
+	for (int e = 0; e < netGraph->edges.count(); e++) {
+		const NetGraphEdge &edge = netGraph->edges.at(e);
+		quint64 packets = 0;
+		quint64 bytes = 0;
+		quint64 qdrops = 0;
+		quint64 rdrops = 0;
+		quint64 qload = 0;
+		quint64 qcapacity = 0;
+		for (int f = 0; f < edge.policers.count(); f++) {
+			packets += edge.policers[f].packets_in;
+			bytes += edge.policers[f].bytes;
+			qdrops += edge.policers[f].drops;
+		}
+		for (int q = 0; q < edge.queues.count(); q++) {
+			qload += edge.queues[q].qload;
+			qcapacity += edge.queues[q].qcapacity;
+			qdrops += edge.queues[q].qdrops;
+			rdrops += edge.queues[q].rdrops;
+		}
+		LiveEdgeStats &s = edgeStats[e];
+		s.pps = dt ? ((packets - s.packets) * SEC_TO_NSEC) / dt : 0;
+		s.packets = packets;
+		s.bytes = bytes;
+		s.qdrops = qdrops;
+		s.rdrops = rdrops;
+		s.qload = qload;
+		s.qcapacity = qcapacity;
+	}
+	stats.pps = dt ? ((numQueuingEvents - stats.packets) * SEC_TO_NSEC) / dt : 0;
+	stats.packets = numQueuingEvents;
+	stats.drops = packetsQdropped;
+	stats.loops += loops;
+	stats.loopDelayAvg = loops ? loopDelayTotal / loops : 0;
+	stats.loopDelayMax = loopDelayMax;
+	stats.tsUpdate = ts_now;
+	liveStatsWriteEnd(stats);
+}
+
 bool comparePacketDrainEvents(const Packet* a, const Packet* b) {
 	return a->ts_expected_exit < b->ts_expected_exit;
 }
@@ -1379,7 +1485,7 @@ void* packet_scheduler_thread(void* )
 	pthread_setname_np(pthread_self(), "line-packet-scheduler");
 
 	u_int numCPU = sysconf(_SC_NPROCESSORS_ONLN);
-	u_long core_id = CORE_SCHEDULER;
+	u_long core_id = threadLayout.schedulerCore;
 
 	if (bind2core(core_id) == 0) {
 		printf("Set thread scheduler affinity to core %lu/%u\n", core_id, numCPU);
@@ -1416,6 +1522,14 @@ void* packet_scheduler_thread(void* )
 	OVector<Packet*> newPackets;
 	newPackets.reserve(10000);
 
+	// live stats accumulated since the last publication
+	quint64 liveLoops = 0;
+	quint64 liveLoopDelayTotal = 0;
+	quint64 liveLoopDelayMax = 0;
+	if (liveStats) {
+		liveStats->scheduler.tsUpdate = tsStart;
+	}
+
 	barrierInitDone.wait();
 	barrierStart.wait();
 
@@ -1552,6 +1666,9 @@ void* packet_scheduler_thread(void* )
 					total_loop_delay += ts_after - ts_now;
 					total_loops++;
 				}
+				liveLoops++;
+				liveLoopDelayTotal += loop_delay;
+				liveLoopDelayMax = qMax(liveLoopDelayMax, loop_delay);
 				if (loop_delay >= MSEC_TO_NSEC &&
 					highLatencyEventsTs.count() < 100) {
 					highLatencyEventsTs << ts_now;
@@ -1576,6 +1693,13 @@ void* packet_scheduler_thread(void* )
 		}
 		// end stats
 		// qDebug() << "Loop took < " << max_loop_delay << "ns";
+
+		if (liveStats && ts_now >= liveStats->scheduler.tsUpdate + LIVE_STATS_PERIOD) {
+			publishSchedulerStats(ts_now, liveLoops, liveLoopDelayTotal, liveLoopDelayMax);
+			liveLoops = 0;
+			liveLoopDelayTotal = 0;
+			liveLoopDelayMax = 0;
+		}
 	}
 
 	malloc_profile_pause_wrapper();
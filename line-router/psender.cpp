@@ -47,6 +47,8 @@
 
 #include "psender.h"
 #include "pconsumer.h"
+#include "livestats.h"
+#include "threadlayout.h"
 #include "../remote_config.h"
 #include <netinet/ip.h>
 #include <netinet/udp.h>
@@ -376,7 +378,10 @@ bool send_packet(pfring *pd, Packet *p)
 	p->ts_send = ts_now;
 
 	if (!p->preparedForSend) {
-		fix_addresses(p);
+		// Normally done by the consumer, in bursts
+		if (!p->addressesRewritten) {
+			fix_addresses(p);
+		}
 		if (p->ecn_bit_set) {
 			set_ip_ecn_bit(p);
 		}
@@ -386,7 +391,8 @@ bool send_packet(pfring *pd, Packet *p)
 	while (1) {
 		// 1 = Flush possible transmission queues. If set to 0, you will decrease
 		// your CPU usage but at thecost of sending packets in trains and thus at
-		// larger latency
+		// larger latency.
+		// The sender flushes once per batch instead (see flushTxBatch()).
 		const int flush_packets = 0;
 		int rc = pfring_send(pd, (char*)p->buffer, p->length, flush_packets);
 		if (rc == PF_RING_ERROR_INVALID_ARGUMENT) {
@@ -455,6 +461,46 @@ static quint64 bytesSent;
 static quint64 tsStart;
 static quint64 emulationDuration;
 
+// Transmit batching: packets are queued on the TX ring without flushing, and the ring is flushed
+// once per batch. A batch is opened by its first packet and closed when a packet with a deadline
+// (ts_expected_exit) past the window arrives, when it is full, or when the clock passes the end
+// of the window. Thus no packet waits more than txBatchWindow after its deadline for the flush.
+#define TX_BATCH_MAX 64
+// Batch sizes 1, 2-3, 4-7, 8-15, 16-31, 32-63, 64
+#define TX_BATCH_HISTOGRAM_BINS 7
+
+static int txBatchSize;
+static quint64 txBatchWindowEnd;
+static quint64 txBatches;
+static quint64 txBatchedPackets;
+static quint64 txBatchSizeMax;
+static quint64 txBatchSizeHistogram[TX_BATCH_HISTOGRAM_BINS];
+
+static void flushTxBatch(pfring *pd)
+{
+	pfring_flush_tx_packets(pd);
+	txBatches++;
+	txBatchedPackets += txBatchSize;
+	txBatchSizeMax = qMax(txBatchSizeMax, quint64(txBatchSize));
+	int bin = 0;
+	while ((2 << bin) <= txBatchSize && bin < TX_BATCH_HISTOGRAM_BINS - 1)
+		bin++;
+	txBatchSizeHistogram[bin]++;
+	txBatchSize = 0;
+}
+
+static void publishSenderStats(quint64 ts_now)
+{
+	LiveThreadStats &stats = liveStats->sender;
+	quint64 dt = ts_now - stats.tsUpdate;
+	liveStatsWriteBegin(stats);
+	stats.pps = dt ? ((packetsSent - stats.packets) * SEC_TO_NSEC) / dt : 0;
+	stats.packets = packetsSent;
+	stats.bytes = bytesSent;
+	stats.tsUpdate = ts_now;
+	liveStatsWriteEnd(stats);
+}
+
 void* packet_sender_thread(void* )
 {
 	barrierInit.wait();
@@ -463,7 +509,7 @@ void* packet_sender_thread(void* )
 	pthread_setname_np(pthread_self(), "line-packet-sender");
 
 	u_int numCPU = sysconf(_SC_NPROCESSORS_ONLN);
-	u_long core_id = CORE_SENDER;
+	u_long core_id = threadLayout.senderCore;
 
 	if (bind2core(core_id) == 0) {
 		printf("Set thread sender affinity to core %lu/%u\n", core_id, numCPU);
@@ -504,6 +550,12 @@ void* packet_sender_thread(void* )
 	packetsSentSendDelayRelAvg = 0;
 	packetsSentSendDelayRelMax = 0;
     bytesSent = 0;
+	txBatchSize = 0;
+	txBatchWindowEnd = 0;
+	txBatches = 0;
+	txBatchedPackets = 0;
+	txBatchSizeMax = 0;
+	memset(txBatchSizeHistogram, 0, sizeof(txBatchSizeHistogram));
 
 	OVector<Packet*> newPackets;
     newPackets.reserve(1000);
@@ -512,6 +564,9 @@ void* packet_sender_thread(void* )
 	barrierStart.wait();
 
 	tsStart = get_current_time();
+	if (liveStats) {
+		liveStats->sender.tsUpdate = tsStart;
+	}
 
 	while (1) {
 		if (do_shutdown) {
@@ -522,20 +577,46 @@ void* packet_sender_thread(void* )
 		packetsOut.dequeueAll(newPackets);
 
 		if (!newPackets.isEmpty()) {
+			// the time of the last transmission, to avoid reading the clock just for the live stats
+			quint64 ts_last_send = 0;
 			for (int iPacket = 0; iPacket < newPackets.count(); iPacket++) {
 				Packet *p = newPackets[iPacket];
-				if (!p->dropped && send_packet(pd, p)) {
+				if (p->dropped)
+					continue;
+				// Packets that did not cross any queue have no exit time
+				quint64 deadline = p->ts_expected_exit ? p->ts_expected_exit : p->ts_start_send;
+				if (txBatchSize > 0 && (deadline >= txBatchWindowEnd || txBatchSize >= TX_BATCH_MAX)) {
+					flushTxBatch(pd);
+				}
+				if (txBatchSize == 0) {
+					txBatchWindowEnd = deadline + txBatchWindow;
+				}
+				if (send_packet(pd, p)) {
 					bytesSent += p->length;
+					ts_last_send = p->ts_send;
+					txBatchSize++;
 				}
 			}
+			if (txBatchSize > 0 && ts_last_send >= txBatchWindowEnd) {
+				flushTxBatch(pd);
+			}
+			if (liveStats && ts_last_send >= liveStats->sender.tsUpdate + LIVE_STATS_PERIOD) {
+				publishSenderStats(ts_last_send);
+			}
 			packetPool.enqueue(newPackets);
 			newPackets.clear();
 		} else {
+			if (txBatchSize > 0 && get_current_time() >= txBatchWindowEnd) {
+				flushTxBatch(pd);
+			}
 			//sched_yield();
 		}
 	}
 	malloc_profile_pause_wrapper();
 
+	if (txBatchSize > 0) {
+		flushTxBatch(pd);
+	}
 	pfring_close(pd);
 
 	emulationDuration = get_current_time() - tsStart;
@@ -572,4 +653,20 @@ void print_sender_stats()
 	printf("Send delay (relative to theoretical, ideally 0): avg %llu%%, max %llu%%\n",
 		   packetsSentSendDelayRelAvg / qMax(packetsSentStatsCount, 1ULL),
 		   packetsSentSendDelayRelMax);
+	printf("Transmit batches: %s, avg %.2f packets/batch, max %llu (window " TS_FORMAT ")\n",
+		   withCommas(txBatches),
+		   txBatches ? qreal(txBatchedPackets) / txBatches : 0.0,
+		   txBatchSizeMax,
+		   TS_FORMAT_PARAM(txBatchWindow));
+	printf("Transmit batch sizes:");
+	for (int bin = 0; bin < TX_BATCH_HISTOGRAM_BINS; bin++) {
+		int first = 1 << bin;
+		int last = bin < TX_BATCH_HISTOGRAM_BINS - 1 ? (2 << bin) - 1 : TX_BATCH_MAX;
+		if (first == last) {
+			printf(" %d: %s", first, withCommas(txBatchSizeHistogram[bin]));
+		} else {
+			printf(" %d-%d: %s", first, last, withCommas(txBatchSizeHistogram[bin]));
+		}
+	}
+	printf("\n");
 }
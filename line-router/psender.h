@@ -28,6 +28,8 @@ extern SyncQueueType<Packet*> packetsOut;
 
 #define CORE_SENDER 3
 
+void fix_addresses(Packet *p);
+
 void* packet_sender_thread(void* );
 void print_sender_stats();
 
@@ -0,0 +1,221 @@
+/*
+ *	Copyright (C) 2014 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "threadlayout.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/syscall.h>
+
+#include "pconsumer.h"
+#include "pscheduler.h"
+#include "psender.h"
+
+// From <numaif.h>; defined here to avoid depending on libnuma
+#ifndef MPOL_DEFAULT
+#define MPOL_DEFAULT 0
+#endif
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+RouterThreadLayout threadLayout;
+
+RouterThreadLayout::RouterThreadLayout()
+{
+	consumerCore = CORE_CONSUMER;
+	schedulerCore = CORE_SCHEDULER;
+	senderCore = CORE_SENDER;
+	memoryNode = -1;
+	nicNode = -1;
+}
+
+bool RouterThreadLayout::parseCores(QString text)
+{
+	QStringList tokens = text.split(",");
+	if (tokens.count() != 3)
+		return false;
+	QList<qint32> cores;
+	foreach (QString token, tokens) {
+		bool ok;
+		qint32 core = token.trimmed().toInt(&ok);
+		if (!ok || core < 0)
+			return false;
+		cores << core;
+	}
+	consumerCore = cores[0];
+	schedulerCore = cores[1];
+	senderCore = cores[2];
+	return true;
+}
+
+bool RouterThreadLayout::parseMemoryNode(QString text)
+{
+	if (text == "auto") {
+		memoryNode = AutoNode;
+		return true;
+	}
+	bool ok;
+	qint32 node = text.toInt(&ok);
+	if (!ok || node < -1)
+		return false;
+	memoryNode = node;
+	return true;
+}
+
+// Reads a file from sysfs. Returns an empty string if it cannot be read.
+static QString readSysFile(QString fileName)
+{
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly))
+		return QString();
+	return QString(file.readAll()).trimmed();
+}
+
+// Parses a CPU list in the kernel format, e.g. "1-3,5"
+static QSet<qint32> parseCpuList(QString text)
+{
+	QSet<qint32> result;
+	foreach (QString range, text.split(",", QString::SkipEmptyParts)) {
+		QStringList bounds = range.split("-");
+		bool ok1, ok2;
+		qint32 first = bounds.first().toInt(&ok1);
+		qint32 last = bounds.last().toInt(&ok2);
+		if (!ok1 || !ok2)
+			continue;
+		for (qint32 cpu = first; cpu <= last; cpu++) {
+			result.insert(cpu);
+		}
+	}
+	return result;
+}
+
+static bool coreExists(int core)
+{
+	return QFile::exists(QString("/sys/devices/system/cpu/cpu%1").arg(core));
+}
+
+static bool nodeExists(int node)
+{
+	return QFile::exists(QString("/sys/devices/system/node/node%1").arg(node));
+}
+
+int getCoreNumaNode(int core)
+{
+	QDir dir(QString("/sys/devices/system/cpu/cpu%1").arg(core));
+	foreach (QString entry, dir.entryList(QStringList() << "node*", QDir::Dirs | QDir::NoDotAndDotDot)) {
+		bool ok;
+		int node = entry.mid(4).toInt(&ok);
+		if (ok)
+			return node;
+	}
+	return -1;
+}
+
+int getInterfaceNumaNode(const char *interfaceName)
+{
+	bool ok;
+	int node = readSysFile(QString("/sys/class/net/%1/device/numa_node").arg(interfaceName)).toInt(&ok);
+	// The kernel reports -1 for devices on single-node machines
+	if (!ok || node < 0)
+		return -1;
+	return node;
+}
+
+bool setPreferredMemoryNode(int node)
+{
+	long result;
+	if (node < 0) {
+		result = syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+	} else {
+		unsigned long mask = 1UL << node;
+		result = syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, sizeof(mask) * 8);
+	}
+	if (result != 0) {
+		printf("Could not set the memory policy to node %d: %s\n", node, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+bool RouterThreadLayout::validate(const char *interfaceName)
+{
+	bool ok = true;
+
+	nicNode = getInterfaceNumaNode(interfaceName);
+	if (nicNode >= 0) {
+		printf("NIC %s is on NUMA node %d\n", interfaceName, nicNode);
+	} else {
+		printf("NIC %s: NUMA node unknown\n", interfaceName);
+	}
+
+	if (memoryNode == AutoNode) {
+		memoryNode = nicNode;
+	}
+	if (memoryNode >= 0 && (memoryNode >= (qint32)(sizeof(unsigned long) * 8) || !nodeExists(memoryNode))) {
+		fprintf(stderr, "NUMA node %d does not exist\n", memoryNode);
+		ok = false;
+	}
+
+	QSet<qint32> isolated = parseCpuList(readSysFile("/sys/devices/system/cpu/isolated"));
+
+	QList<QPair<QString, qint32> > roles;
+	roles << qMakePair(QString("consumer"), consumerCore)
+		  << qMakePair(QString("scheduler"), schedulerCore)
+		  << qMakePair(QString("sender"), senderCore);
+	QSet<qint32> usedCores;
+	for (int i = 0; i < roles.count(); i++) {
+		QString role = roles[i].first;
+		qint32 core = roles[i].second;
+		if (!coreExists(core)) {
+			fprintf(stderr, "Core %d (%s thread) does not exist\n", core, role.toLatin1().constData());
+			ok = false;
+			continue;
+		}
+		int node = getCoreNumaNode(core);
+		printf("Thread %-9s on core %d, NUMA node %d%s\n",
+			   role.toLatin1().constData(), core, node,
+			   isolated.contains(core) ? ", isolated" : "");
+		if (usedCores.contains(core)) {
+			printf("Warning: core %d is shared by several router threads; they busy-poll and will compete for it\n", core);
+		}
+		usedCores.insert(core);
+		if (!isolated.isEmpty() && !isolated.contains(core)) {
+			printf("Warning: core %d is not isolated (isolcpus)\n", core);
+		}
+		if (nicNode >= 0 && node >= 0 && node != nicNode) {
+			printf("Warning: the %s thread runs on NUMA node %d, but the NIC is on node %d\n",
+				   role.toLatin1().constData(), node, nicNode);
+		}
+	}
+	if (isolated.isEmpty()) {
+		printf("Warning: no isolated cores (isolcpus), the router threads may be preempted\n");
+	}
+
+	if (memoryNode >= 0) {
+		printf("Packet pool and queues allocated on NUMA node %d\n", memoryNode);
+		if (nicNode >= 0 && memoryNode != nicNode) {
+			printf("Warning: the packet memory is on NUMA node %d, but the NIC is on node %d\n", memoryNode, nicNode);
+		}
+	} else {
+		printf("Packet pool and queues allocated on the local NUMA node\n");
+	}
+
+	return ok;
+}
@@ -0,0 +1,66 @@
+/*
+ *	Copyright (C) 2014 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef THREADLAYOUT_H
+#define THREADLAYOUT_H
+
+#include <QtCore>
+
+// Placement of the router threads on cores, and of the memory they share (packet pool,
+// inter-thread queues, topology) on a NUMA node.
+// Set with --cores <consumer>,<scheduler>,<sender> and --numa_node <node|auto>.
+class RouterThreadLayout {
+public:
+	RouterThreadLayout();
+
+	qint32 consumerCore;
+	qint32 schedulerCore;
+	qint32 senderCore;
+
+	// NUMA node where the shared memory is allocated. -1 means no preference (allocate on the
+	// node of the main thread). AutoNode means the node of the NIC.
+	qint32 memoryNode;
+	static const qint32 AutoNode = -2;
+
+	// NUMA node of the NIC, -1 if unknown. Set by validate().
+	qint32 nicNode;
+
+	// Parses "consumer,scheduler,sender". Returns false on error.
+	bool parseCores(QString text);
+	// Parses a node number or "auto". Returns false on error.
+	bool parseMemoryNode(QString text);
+
+	// Reads the NUMA node of the NIC, resolves AutoNode, checks that the cores and the node exist
+	// and prints the layout, with warnings for cross-socket placement, shared or non-isolated cores.
+	// Returns false if the layout cannot be used.
+	bool validate(const char *interfaceName);
+};
+
+extern RouterThreadLayout threadLayout;
+
+// Returns the NUMA node of a CPU core, or -1 if unknown.
+int getCoreNumaNode(int core);
+
+// Returns the NUMA node of the PCI device of a network interface, or -1 if unknown.
+int getInterfaceNumaNode(const char *interfaceName);
+
+// Sets the preferred NUMA node for the memory allocated from now on by the calling thread.
+// A node of -1 restores the default (local) policy. Returns false on error.
+bool setPreferredMemoryNode(int node);
+
+#endif // THREADLAYOUT_H
@@ -0,0 +1,355 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "batch_processing.h"
+
+#include <climits>
+#include <errno.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "chronometer.h"
+#include "result_processing.h"
+#include "util.h"
+
+// Estimated peak memory needed to process an experiment, as a multiple of the size of its interval
+// measurement files (they are loaded, resampled and copied per analysis stage)
+#define BATCH_MEMORY_FACTOR 4
+
+class BatchRun {
+public:
+	BatchRun() :
+		estimatedMemory(0),
+		process(NULL),
+		tStart(0),
+		durationMs(0),
+		exitCode(-1),
+		status("pending") {}
+
+	QString workingDir;
+	quint64 estimatedMemory;
+	QProcess *process;
+	qint64 tStart;
+	quint64 durationMs;
+	int exitCode;
+	// pending, running, ok, failed, crashed, missing
+	QString status;
+	// key: "link" or "seq"; value: detection result ("true positive" etc.) -> count
+	QHash<QString, QHash<QString, int> > detectionResults;
+};
+
+static QStringList expandExperimentPattern(QString pattern)
+{
+	if (!pattern.contains('*') && !pattern.contains('?') && !pattern.contains('[')) {
+		return QStringList() << pattern;
+	}
+	QFileInfo info(pattern);
+	QDir dir(info.path());
+	QStringList result;
+	foreach (QString name, dir.entryList(QStringList() << info.fileName(),
+										 QDir::Dirs | QDir::NoDotAndDotDot,
+										 QDir::Name)) {
+		result << (info.path() == "." && !pattern.startsWith("./") ? name : info.path() + "/" + name);
+	}
+	if (result.isEmpty()) {
+		qDebug() << "No experiment matches" << pattern;
+	}
+	return result;
+}
+
+static bool isExperimentArg(QString arg)
+{
+	return QFileInfo(arg).isDir() || arg.contains('*') || arg.contains('?') || arg.contains('[');
+}
+
+static quint64 estimateMemory(QString workingDir, bool perFlowAnalysis)
+{
+	QString fileName = workingDir + "/" + (!perFlowAnalysis ? "interval-measurements.data" : "flow-interval-measurements.data");
+	return QFileInfo(fileName).size() * BATCH_MEMORY_FACTOR;
+}
+
+// Counts the detection results of the link and link sequence analysis reports written for processParams
+static void readDetectionResults(BatchRun &run, QStringList processParams)
+{
+	QHash<QString, QString> reports;
+	if (!analysisReportFileNames(run.workingDir, processParams, reports["link"], reports["seq"])) {
+		qDebug() << "Could not find the analysis reports of" << run.workingDir;
+		return;
+	}
+	foreach (QString kind, reports.keys()) {
+		QString content;
+		if (!readFile(run.workingDir + "/" + reports[kind], content))
+			continue;
+		foreach (QString line, content.split("\n")) {
+			if (line.startsWith("Result\t")) {
+				run.detectionResults[kind][line.mid(QString("Result\t").length())]++;
+			}
+		}
+	}
+}
+
+static bool startRun(BatchRun &run, QString program, QStringList processParams)
+{
+	run.process = new QProcess();
+	// Keep the output of each experiment separate, and make sure the pipes never fill up
+	run.process->setStandardOutputFile(run.workingDir + "/" + "process-results.log");
+	run.process->setStandardErrorFile(run.workingDir + "/" + "process-results.log", QIODevice::Append);
+	run.tStart = currentTimeMs();
+	run.process->start(program, QStringList() << "--process-results" << run.workingDir << processParams);
+	if (!run.process->waitForStarted(-1)) {
+		qDebug() << "Could not start" << program << "for" << run.workingDir << ":" << run.process->errorString();
+		delete run.process;
+		run.process = NULL;
+		run.status = "failed";
+		return false;
+	}
+	run.status = "running";
+	return true;
+}
+
+static void finishRun(BatchRun &run, QStringList processParams)
+{
+	run.durationMs = currentTimeMs() - run.tStart;
+	run.exitCode = run.process->exitCode();
+	if (run.process->exitStatus() == QProcess::CrashExit) {
+		run.status = "crashed";
+	} else if (run.exitCode != 0) {
+		run.status = "failed";
+	} else {
+		run.status = "ok";
+	}
+	delete run.process;
+	run.process = NULL;
+	if (run.status == "ok") {
+		readDetectionResults(run, processParams);
+	}
+}
+
+// Blocks until one of the child processes exits, and returns its pid (or -1 on error). The child is not
+// reaped: QProcess collects its exit status.
+static pid_t waitForAnyChild()
+{
+	siginfo_t info;
+	memset(&info, 0, sizeof(info));
+	while (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) < 0) {
+		if (errno != EINTR) {
+			qDebug() << __FILE__ << __LINE__ << "waitid failed:" << strerror(errno);
+			return -1;
+		}
+	}
+	return info.si_pid;
+}
+
+static QString summaryTable(const QList<BatchRun> &runs)
+{
+	QStringList kinds = QStringList() << "link" << "seq";
+	QStringList results = QStringList() << "true positive" << "false positive"
+										<< "true negative" << "false negative"
+										<< "undecidable";
+	QString table;
+	table += "Experiment\tStatus\tExit code\tDuration\tMemory estimate (MB)";
+	foreach (QString kind, kinds) {
+		foreach (QString result, results) {
+			table += QString("\t%1 %2").arg(kind).arg(result);
+		}
+	}
+	table += "\n";
+	foreach (BatchRun run, runs) {
+		table += QString("%1\t%2\t%3\t%4\t%5")
+				 .arg(run.workingDir)
+				 .arg(run.status)
+				 .arg(run.exitCode)
+				 .arg(Chronometer::durationToString(run.durationMs))
+				 .arg(run.estimatedMemory / (1024 * 1024));
+		foreach (QString kind, kinds) {
+			foreach (QString result, results) {
+				table += QString("\t%1").arg(run.detectionResults[kind].value(result, 0));
+			}
+		}
+		table += "\n";
+	}
+	return table;
+}
+
+bool processResultsBatch(QStringList params)
+{
+	QStringList experiments;
+	QStringList processParams;
+	int numJobs = getNumCoresLinux();
+	quint64 memoryBudget = getAvailableMemoryLinux() / 10 * 8;
+	QString summaryFileName = "batch-summary.txt";
+	bool perFlowAnalysis = false;
+	bool hasThreads = false;
+	while (!params.isEmpty()) {
+		QString param = params.takeFirst();
+		if (param == "jobs") {
+			bool ok = false;
+			if (!params.isEmpty())
+				numJobs = params.takeFirst().toInt(&ok);
+			if (!ok || numJobs < 1) {
+				qDebug() << "Bad argument for jobs:" << params;
+				return false;
+			}
+		} else if (param == "memory") {
+			bool ok = false;
+			if (!params.isEmpty())
+				memoryBudget = params.takeFirst().toULongLong(&ok) * 1024ULL * 1024ULL;
+			if (!ok) {
+				qDebug() << "Bad argument for memory:" << params;
+				return false;
+			}
+		} else if (param == "list") {
+			QString listText;
+			if (params.isEmpty() || !readFile(params.takeFirst(), listText)) {
+				qDebug() << "Bad argument for list:" << params;
+				return false;
+			}
+			foreach (QString line, listText.split("\n", QString::SkipEmptyParts)) {
+				experiments << expandExperimentPattern(line.trimmed());
+			}
+		} else if (param == "summary") {
+			if (params.isEmpty()) {
+				qDebug() << "Missing argument for summary:" << params;
+				return false;
+			}
+			summaryFileName = params.takeFirst();
+		} else if (processParams.isEmpty() && isExperimentArg(param)) {
+			experiments << expandExperimentPattern(param);
+		} else {
+			// Options of --process-results, passed as they are
+			if (param == "flows")
+				perFlowAnalysis = true;
+			if (param == "threads")
+				hasThreads = true;
+			processParams << param;
+		}
+	}
+	if (experiments.isEmpty()) {
+		qDebug() << "No experiments to process";
+		return false;
+	}
+	if (memoryBudget == 0) {
+		memoryBudget = ULLONG_MAX;
+	}
+	numJobs = qMin(numJobs, experiments.count());
+	if (!hasThreads) {
+		// Share the cores between the experiments processed concurrently
+		processParams << "threads" << QString::number(qMax(1, getNumCoresLinux() / numJobs));
+	}
+
+	QString program = QFile::symLinkTarget("/proc/self/exe");
+	if (program.isEmpty()) {
+		program = "line-runner";
+	}
+
+	QList<BatchRun> runs;
+	foreach (QString experiment, experiments) {
+		BatchRun run;
+		run.workingDir = experiment;
+		if (!QFileInfo(experiment).isDir()) {
+			run.status = "missing";
+		} else {
+			run.estimatedMemory = estimateMemory(experiment, perFlowAnalysis);
+		}
+		runs << run;
+	}
+
+	qDebug() << QString("Processing %1 experiments, %2 at a time, memory budget %3 MB")
+				.arg(runs.count())
+				.arg(numJobs)
+				.arg(memoryBudget == ULLONG_MAX ? QString("unlimited") : QString::number(memoryBudget / (1024 * 1024)));
+
+	Chronometer chrono("Batch processing:", true);
+	int next = 0;
+	int numDone = 0;
+	QList<int> running;
+	quint64 usedMemory = 0;
+	while (next < runs.count() || !running.isEmpty()) {
+		// Start experiments in order while there is a free job slot and enough memory. An experiment
+		// that does not fit in the budget at all is processed alone.
+		while (next < runs.count() && running.count() < numJobs) {
+			BatchRun &run = runs[next];
+			if (run.status == "missing") {
+				numDone++;
+				qDebug() << QString("[%1/%2] %3: missing").arg(numDone).arg(runs.count()).arg(run.workingDir);
+				next++;
+				continue;
+			}
+			if (!running.isEmpty() && usedMemory + run.estimatedMemory > memoryBudget)
+				break;
+			if (!startRun(run, program, processParams)) {
+				numDone++;
+				next++;
+				continue;
+			}
+			usedMemory += run.estimatedMemory;
+			running << next;
+			next++;
+		}
+
+		if (running.isEmpty())
+			continue;
+
+		// Sleep until the first experiment finishes, whichever it is
+		pid_t pid = waitForAnyChild();
+		int finished = -1;
+		foreach (int i, running) {
+			if (runs[i].process->pid() == pid) {
+				finished = i;
+				break;
+			}
+		}
+		if (finished < 0) {
+			if (pid < 0) {
+				// Should not happen; wait for the oldest experiment instead
+				finished = running.first();
+			} else {
+				// Not one of ours: reap it, otherwise waitid() keeps returning it
+				waitpid(pid, NULL, WNOHANG);
+				continue;
+			}
+		}
+
+		BatchRun &run = runs[finished];
+		run.process->waitForFinished(-1);
+		finishRun(run, processParams);
+		usedMemory -= run.estimatedMemory;
+		running.removeAll(finished);
+		numDone++;
+		qDebug() << QString("[%1/%2] %3: %4 (%5)")
+					.arg(numDone)
+					.arg(runs.count())
+					.arg(run.workingDir)
+					.arg(run.status)
+					.arg(Chronometer::durationToString(run.durationMs));
+	}
+
+	QString summary = summaryTable(runs);
+	saveFile(summaryFileName, summary);
+	printf("%s", summary.toLatin1().constData());
+	fflush(stdout);
+
+	int numFailed = 0;
+	foreach (BatchRun run, runs) {
+		if (run.status != "ok")
+			numFailed++;
+	}
+	qDebug() << QString("Processed %1 experiments, %2 failed").arg(runs.count()).arg(numFailed)
+			 << chrono.elapsedText("");
+	return numFailed == 0;
+}
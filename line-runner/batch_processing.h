@@ -0,0 +1,46 @@
+/*
+ *	Copyright (C) 2014 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; version 2 is the only version of this
+ *  license which this program may be distributed under.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef BATCH_PROCESSING_H
+#define BATCH_PROCESSING_H
+
+#include <QtCore>
+
+#ifdef HAVE_RESULT_PROCESSING
+
+// Processes the results of many experiments concurrently, each one in a separate line-runner
+// --process-results process, so that a failure or crash affects only its own experiment.
+// params: experiment directories or glob patterns (e.g. "sweep/quad.*"), and optionally:
+//	jobs <n>			maximum number of experiments processed at the same time (default: number of cores)
+//	memory <MB>			memory budget (default: 80% of the available memory)
+//	list <file>			file with one experiment directory per line
+//	summary <file>		merged summary table (default: batch-summary.txt)
+// Any other parameter is passed to --process-results.
+// Returns true if all the experiments have been processed successfully.
+bool processResultsBatch(QStringList params);
+
+#else
+
+inline bool processResultsBatch(QStringList params) {
+	Q_UNUSED(params);
+	return true;
+}
+
+#endif
+
+#endif // BATCH_PROCESSING_H
@@ -81,10 +81,16 @@ HEADERS += \
     simulate_experiment.h \
     export_matlab.h \
     result_processing.h \
+    result_cache.h \
+    batch_processing.h \
+    report_writer.h \
     ../util/bitarray.h
 
 exists(result_processing.cpp) {
     SOURCES += result_processing.cpp
+    SOURCES += result_cache.cpp
+    SOURCES += batch_processing.cpp
+    SOURCES += report_writer.cpp
     DEFINES += HAVE_RESULT_PROCESSING
 }
 
@@ -19,6 +19,7 @@
 #include <QtCore>
 #include <QDebug>
 
+#include "batch_processing.h"
 #include "deploy.h"
 #include "export_matlab.h"
 #include "run_experiment.h"
@@ -93,6 +94,16 @@ int main(int argc, char **argv) {
 					param = shiftCmdLineArg(argc, argv);
 					extraParams << param;
 				}
+			} else if (arg == "--process-results-batch") {
+				command = arg;
+				extraParams.clear();
+				while (true) {
+					QString param = peekCmdLineArg(argc, argv);
+					if (param.isEmpty() || param.startsWith("--"))
+						break;
+					param = shiftCmdLineArg(argc, argv);
+					extraParams << param;
+				}
 			} else if (arg == "--path-pairs-coverage-master") {
 				command = arg;
 			} else if (arg == "--path-pairs-coverage") {
@@ -132,6 +143,12 @@ int main(int argc, char **argv) {
 			}
 		}
 
+		if (command == "--process-results-batch") {
+			if (!processResultsBatch(extraParams)) {
+				exit(-1);
+			}
+		}
+
 		if (command == "--run") {
 			if (!runExperiment(paramsFileName)) {
 				exit(-1);
@@ -0,0 +1,55 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "report_writer.h"
+
+ReportWriter::ReportWriter(QString fileName) :
+	file(fileName),
+	ok(true)
+{
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qDebug() << "Could not open file in write mode, file name:" << fileName;
+		ok = false;
+	}
+	stream.setDevice(&file);
+	// Like saveFile(QString name, QString content), which uses QString::toAscii()
+	stream.setCodec("ISO-8859-1");
+}
+
+ReportWriter::~ReportWriter()
+{
+	close();
+}
+
+bool ReportWriter::close()
+{
+	if (!file.isOpen())
+		return ok;
+	stream.flush();
+	if (stream.status() != QTextStream::Ok || !file.flush()) {
+		qDebug() << "Write error, file name:" << file.fileName();
+		ok = false;
+	}
+	file.close();
+	return ok;
+}
+
+QString ReportWriter::fileName() const
+{
+	return file.fileName();
+}
@@ -0,0 +1,55 @@
+/*
+ *	Copyright (C) 2011 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef REPORT_WRITER_H
+#define REPORT_WRITER_H
+
+#include <QtCore>
+
+// Writes a text report straight to a buffered file, instead of building it in a QString and saving
+// it at the end. The text is encoded the same way as saveFile() does.
+//
+// Usage:
+//	ReportWriter report(fileName);
+//	report << "Link\t" << e + 1 << "\n";
+//	if (!report.close())
+//		return false;
+class ReportWriter
+{
+public:
+	ReportWriter(QString fileName);
+	~ReportWriter();
+
+	template <typename T>
+	ReportWriter &operator<<(const T &value) {
+		stream << value;
+		return *this;
+	}
+
+	// Flushes and closes the file. Returns false if opening or writing the file failed.
+	bool close();
+
+	QString fileName() const;
+
+protected:
+	QFile file;
+	QTextStream stream;
+	bool ok;
+};
+
+#endif // REPORT_WRITER_H
@@ -0,0 +1,267 @@
+/*
+ *	Copyright (C) 2014 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "result_cache.h"
+
+ResultCache::ResultCache(QString workingDir, bool enabled) :
+	workingDir(QDir(workingDir).absolutePath()),
+	enabled(enabled),
+	fileHashesChanged(false)
+{
+	cacheDir = this->workingDir + "/" + RESULT_CACHE_DIR;
+	if (enabled) {
+		QDir(this->workingDir).mkpath(RESULT_CACHE_DIR);
+		loadIndex();
+	}
+}
+
+ResultCache::~ResultCache()
+{
+	if (enabled && fileHashesChanged) {
+		saveIndex();
+	}
+}
+
+QByteArray ResultCache::fileHash(QString fileName)
+{
+	QFileInfo info(fileName);
+	if (!info.exists())
+		return QByteArray();
+
+	QString key = info.absoluteFilePath();
+	FileState &state = fileHashes[key];
+	if (!state.hash.isEmpty() &&
+		state.size == info.size() &&
+		state.mtime == info.lastModified().toTime_t()) {
+		return state.hash;
+	}
+
+	QFile file(fileName);
+	if (!file.open(QIODevice::ReadOnly)) {
+		qDebug() << __FILE__ << __LINE__ << "Failed to open file:" << file.fileName();
+		fileHashes.remove(key);
+		return QByteArray();
+	}
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	while (!file.atEnd()) {
+		QByteArray chunk = file.read(1 << 20);
+		if (chunk.isEmpty())
+			break;
+		hash.addData(chunk);
+	}
+	state.size = info.size();
+	state.mtime = info.lastModified().toTime_t();
+	state.hash = hash.result();
+	fileHashesChanged = true;
+	return state.hash;
+}
+
+QByteArray ResultCache::stageKey(QString stageName, QStringList inputFiles, QStringList parameters)
+{
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	QByteArray header;
+	{
+		QDataStream out(&header, QIODevice::WriteOnly);
+		out.setVersion(QDataStream::Qt_4_0);
+		out << qint32(RESULT_CACHE_VERSION);
+		out << stageName;
+		out << parameters;
+		out << qint32(inputFiles.count());
+	}
+	hash.addData(header);
+	foreach (QString fileName, inputFiles) {
+		// Only the contents matter, not where the file is
+		QByteArray fileHashValue = fileHash(fileName);
+		hash.addData(fileHashValue.isEmpty() ? QByteArray("missing") : fileHashValue);
+	}
+	return hash.result().toHex();
+}
+
+QString ResultCache::stageFileName(QByteArray key)
+{
+	return cacheDir + "/" + QString(key) + ".stage";
+}
+
+bool ResultCache::store(QByteArray key, QStringList outputFiles)
+{
+	if (!enabled)
+		return false;
+
+	// Stored relative to the working directory, so that the experiment can be moved
+	QStringList outputs;
+	foreach (QString outputFile, outputFiles) {
+		QString output = QDir(workingDir).relativeFilePath(QFileInfo(outputFile).absoluteFilePath());
+		if (output.startsWith("../") || QDir::isAbsolutePath(output)) {
+			qDebug() << __FILE__ << __LINE__ << "Output file outside of the working directory:" << outputFile;
+			return false;
+		}
+		if (!outputs.contains(output)) {
+			outputs << output;
+		}
+	}
+
+	QString fileName = stageFileName(key);
+	QFile file(fileName + ".tmp");
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qDebug() << __FILE__ << __LINE__ << "Failed to open file:" << file.fileName();
+		return false;
+	}
+	QDataStream out(&file);
+	out.setVersion(QDataStream::Qt_4_0);
+	out << qint32(RESULT_CACHE_VERSION);
+	out << key;
+	out << qint32(outputs.count());
+	foreach (QString output, outputs) {
+		QFile outputFile(workingDir + "/" + output);
+		if (!outputFile.open(QIODevice::ReadOnly)) {
+			qDebug() << __FILE__ << __LINE__ << "Failed to open file:" << outputFile.fileName();
+			file.remove();
+			return false;
+		}
+		out << output;
+		out << qCompress(outputFile.readAll());
+	}
+	if (out.status() != QDataStream::Ok) {
+		qDebug() << __FILE__ << __LINE__ << "Error writing file:" << file.fileName();
+		file.remove();
+		return false;
+	}
+	file.close();
+	// Replace atomically, so that an interrupted run never leaves a truncated entry
+	QFile::remove(fileName);
+	if (!file.rename(fileName)) {
+		qDebug() << __FILE__ << __LINE__ << "Could not rename" << file.fileName() << "to" << fileName;
+		return false;
+	}
+	return true;
+}
+
+bool ResultCache::restore(QByteArray key)
+{
+	if (!enabled)
+		return false;
+
+	QFile file(stageFileName(key));
+	if (!file.exists())
+		return false;
+	if (!file.open(QIODevice::ReadOnly)) {
+		qDebug() << __FILE__ << __LINE__ << "Failed to open file:" << file.fileName();
+		return false;
+	}
+	QDataStream in(&file);
+	in.setVersion(QDataStream::Qt_4_0);
+
+	qint32 version;
+	QByteArray storedKey;
+	qint32 count;
+	in >> version >> storedKey >> count;
+	if (in.status() != QDataStream::Ok || version != RESULT_CACHE_VERSION || storedKey != key || count < 0) {
+		qDebug() << __FILE__ << __LINE__ << "Ignoring bad cache entry:" << file.fileName();
+		return false;
+	}
+
+	QList<QPair<QString, QByteArray> > outputs;
+	for (qint32 i = 0; i < count; i++) {
+		QString output;
+		QByteArray content;
+		in >> output >> content;
+		if (in.status() != QDataStream::Ok) {
+			qDebug() << __FILE__ << __LINE__ << "Ignoring bad cache entry:" << file.fileName();
+			return false;
+		}
+		outputs << QPair<QString, QByteArray>(output, content);
+	}
+
+	for (int i = 0; i < outputs.count(); i++) {
+		QString outputName = workingDir + "/" + outputs[i].first;
+		QByteArray content = qUncompress(outputs[i].second);
+		QFile outputFile(outputName);
+		// Leave identical files untouched
+		if (outputFile.exists() && outputFile.size() == content.size()) {
+			if (outputFile.open(QIODevice::ReadOnly) && outputFile.readAll() == content)
+				continue;
+			outputFile.close();
+		}
+		QDir().mkpath(QFileInfo(outputName).absolutePath());
+		if (!outputFile.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+			outputFile.write(content) != content.size()) {
+			qDebug() << __FILE__ << __LINE__ << "Error writing file:" << outputFile.fileName();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ResultCache::loadIndex()
+{
+	QFile file(cacheDir + "/index.data");
+	if (!file.exists())
+		return true;
+	if (!file.open(QIODevice::ReadOnly)) {
+		qDebug() << __FILE__ << __LINE__ << "Failed to open file:" << file.fileName();
+		return false;
+	}
+	QDataStream in(&file);
+	in.setVersion(QDataStream::Qt_4_0);
+	qint32 version;
+	in >> version;
+	if (version != RESULT_CACHE_VERSION)
+		return true;
+	in >> fileHashes;
+	if (in.status() != QDataStream::Ok) {
+		qDebug() << __FILE__ << __LINE__ << "Error reading file:" << file.fileName();
+		fileHashes.clear();
+		return false;
+	}
+	return true;
+}
+
+bool ResultCache::saveIndex()
+{
+	QFile file(cacheDir + "/index.data");
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		qDebug() << __FILE__ << __LINE__ << "Failed to open file:" << file.fileName();
+		return false;
+	}
+	QDataStream out(&file);
+	out.setVersion(QDataStream::Qt_4_0);
+	out << qint32(RESULT_CACHE_VERSION);
+	out << fileHashes;
+	if (out.status() != QDataStream::Ok) {
+		qDebug() << __FILE__ << __LINE__ << "Error writing file:" << file.fileName();
+		return false;
+	}
+	fileHashesChanged = false;
+	return true;
+}
+
+QDataStream& operator<<(QDataStream& s, const ResultCache::FileState& d)
+{
+	s << d.size;
+	s << d.mtime;
+	s << d.hash;
+	return s;
+}
+
+QDataStream& operator>>(QDataStream& s, ResultCache::FileState& d)
+{
+	s >> d.size;
+	s >> d.mtime;
+	s >> d.hash;
+	return s;
+}
@@ -0,0 +1,85 @@
+/*
+ *	Copyright (C) 2014 Ovidiu Mara
+ *
+ *	This program is free software; you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation; either version 2 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You should have received a copy of the GNU General Public License
+ *	along with this program; if not, write to the Free Software
+ *	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <QtCore>
+
+// Directory of the cache, inside the working directory of the experiment
+#define RESULT_CACHE_DIR "result-cache"
+// Increment this when the output of a stage changes for the same inputs (e.g. after fixing a bug
+// in the analysis), to invalidate all the cached stages.
+#define RESULT_CACHE_VERSION 2
+
+// Cache of the result processing stages of one experiment.
+// A stage is identified by a key, the SHA-1 of its name, of the contents of its input files and
+// of its parameters. The output files that the stage reports are stored in
+// RESULT_CACHE_DIR/<key>.stage. When a stage runs again with the same key, its outputs are restored
+// from there and the stage is skipped.
+//
+// Usage:
+//	QByteArray key = cache.stageKey("name", inputFiles, parameters);
+//	if (!cache.restore(key)) {
+//		QStringList outputFiles;
+//		if (runStage(..., &outputFiles))
+//			cache.store(key, outputFiles);
+//	}
+class ResultCache
+{
+public:
+	ResultCache(QString workingDir, bool enabled = true);
+	~ResultCache();
+
+	QByteArray stageKey(QString stageName, QStringList inputFiles, QStringList parameters);
+	// If the stage with this key is cached, restores its outputs and returns true.
+	bool restore(QByteArray key);
+	// Stores the files written by the stage as its outputs. They must be in the working directory.
+	bool store(QByteArray key, QStringList outputFiles);
+
+	// SHA-1 of the contents of a file (empty if it cannot be read). Remembered in the index of
+	// the cache as long as the size and modification time of the file do not change.
+	QByteArray fileHash(QString fileName);
+
+	class FileState {
+	public:
+		FileState() : size(0), mtime(0) {}
+		qint64 size;
+		// Modification time (s since epoch)
+		qint64 mtime;
+		// Content hash, empty if not computed
+		QByteArray hash;
+	};
+
+protected:
+	QString stageFileName(QByteArray key);
+	bool loadIndex();
+	bool saveIndex();
+
+	QString workingDir;
+	QString cacheDir;
+	bool enabled;
+	// key: file name
+	QHash<QString, FileState> fileHashes;
+	bool fileHashesChanged;
+};
+
+QDataStream& operator<<(QDataStream& s, const ResultCache::FileState& d);
+QDataStream& operator>>(QDataStream& s, ResultCache::FileState& d);
+
+#endif // RESULT_CACHE_H
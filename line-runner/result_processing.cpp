@@ -22,6 +22,8 @@
 
 #include "intervalmeasurements.h"
 #include "netgraph.h"
+#include "report_writer.h"
+#include "result_cache.h"
 #include "run_experiment_params.h"
 #include "tomodata.h"
 
@@ -38,7 +40,10 @@ bool processResults(QString workingDir,
                     qreal lossThreshold,
                     int numResamplings,
                     qreal gapThreshold,
-                    bool perFlowAnalysis);
+                    bool perFlowAnalysis,
+                    int numThreads,
+                    bool benchmarkThreads,
+                    bool useCache);
 
 QString guessGraphName(QString workingDir) {
     QString simulationText;
@@ -71,7 +76,10 @@ bool processResults(QString paramsFileName,
                     qreal lossThreshold,
                     int numResamplings,
                     qreal gapThreshold,
-                    bool perFlowAnalysis) {
+                    bool perFlowAnalysis,
+                    int numThreads,
+                    bool benchmarkThreads,
+                    bool useCache) {
     QString workingDir;
     QString graphName;
     QString experimentSuffix;
@@ -101,10 +109,13 @@ bool processResults(QString paramsFileName,
                           lossThreshold,
                           numResamplings,
                           gapThreshold,
-                          perFlowAnalysis);
+                          perFlowAnalysis,
+                          numThreads,
+                          benchmarkThreads,
+                          useCache);
 }
 
-bool loadGraph(QString workingDir, QString graphName, NetGraph &g)
+QString graphFileName(QString workingDir, QString graphName)
 {
     // Remove path
     if (graphName.contains("/")) {
@@ -114,14 +125,54 @@ bool loadGraph(QString workingDir, QString graphName, NetGraph &g)
     if (!graphName.endsWith(".graph"))
         graphName += ".graph";
     // Add path
-    g.setFileName(workingDir + "/" + graphName);
+    return workingDir + "/" + graphName;
+}
+
+bool loadGraph(QString workingDir, QString graphName, NetGraph &g)
+{
+    g.setFileName(graphFileName(workingDir, graphName));
     if (!g.loadFromFile()) {
         return false;
     }
     return true;
 }
 
-bool computePathCongestionProbabilities(QString workingDir, QString graphName, QString experimentSuffix, quint64 resamplePeriod)
+QString linkAnalysisReportName(QString experimentSuffix, quint64 intervalSize, qreal lossThreshold)
+{
+    return QString("link-analysis-%1-%2-lossth-%3")
+            .arg(experimentSuffix)
+            .arg(timeToString(intervalSize))
+            .arg(lossThreshold);
+}
+
+QString seqAnalysisReportName(QString experimentSuffix, quint64 intervalSize, qreal binSize,
+                              qreal lossThreshold, int numSamplingIterations, qreal gapThreshold)
+{
+    return QString("seq-analysis-%1-%2-bins-%3-lossth-%4-samplings-%5-gapth-%6")
+            .arg(experimentSuffix)
+            .arg(timeToString(intervalSize))
+            .arg(binSize, 0, 'f')
+            .arg(lossThreshold, 0, 'f', 2)
+            .arg(numSamplingIterations)
+            .arg(gapThreshold);
+}
+
+// The interval size of the analysis reports depends on the measured interval size, which is only known
+// after loading the measurements. It is saved so that the report names can be found without loading them.
+bool saveAnalysisIntervalSize(QString workingDir, quint64 intervalSize, QStringList *outputFiles)
+{
+    QString fileName = workingDir + "/" + "analysis-interval-size.txt";
+    if (!saveFile(fileName, QString::number(intervalSize)))
+        return false;
+    if (outputFiles) {
+        *outputFiles << fileName;
+    }
+    return true;
+}
+
+bool computePathCongestionProbabilities(QString workingDir, QString graphName, QString experimentSuffix, quint64 resamplePeriod,
+                                        bool useCache,
+                                        QStringList *outputFiles = NULL)
 {
     NetGraph g;
     if (!loadGraph(workingDir, graphName, g))
@@ -153,14 +204,16 @@ bool computePathCongestionProbabilities(QString workingDir, QString graphName, Q
     QVector<QVector<qreal> > pathCongestionProbabilities;
 
     ExperimentIntervalMeasurements experimentIntervalMeasurements;
-    if (!experimentIntervalMeasurements.load(workingDir + "/" + "interval-measurements.data")) {
+    if (!experimentIntervalMeasurements.loadResampled(workingDir + "/" + "interval-measurements.data",
+                                                      resamplePeriod, useCache)) {
         return false;
     }
 
-    experimentIntervalMeasurements = experimentIntervalMeasurements.resample(resamplePeriod);
-
     Q_ASSERT_FORCE(experimentIntervalMeasurements.numPaths == g.paths.count());
 
+    IntervalCountMatrix counts;
+    counts.extract(experimentIntervalMeasurements);
+
     foreach (qreal threshold, thresholds) {
         QVector<qreal> pathCongestionProbByThreshold;
         for (int p = 0; p < experimentIntervalMeasurements.numPaths; p++) {
@@ -172,7 +225,7 @@ bool computePathCongestionProbabilities(QString workingDir, QString graphName, Q
             const int lastTransientCut = lastTransientCutSec * 1.0e9 / experimentIntervalMeasurements.intervalSize;
             for (int interval = firstTransientCut; interval < experimentIntervalMeasurements.numIntervals() - lastTransientCut; interval++) {
                 bool ok;
-                qreal loss = 1.0 - experimentIntervalMeasurements.intervalMeasurements[interval].pathMeasurements[p].successRate(&ok);
+                qreal loss = 1.0 - counts.pathSuccessRate(p, interval, &ok);
                 if (!ok)
                     continue;
                 numIntervals++;
@@ -188,36 +241,41 @@ bool computePathCongestionProbabilities(QString workingDir, QString graphName, Q
 
     // save result
 
-    QString dataFile;
-    dataFile += "Experiment\t" + experimentSuffix + "\n";
+    ReportWriter dataFile(workingDir + "/" + "path-congestion-probs.txt");
+    dataFile << "Experiment\t" << experimentSuffix << "\n";
     for (int t = -2; t < thresholds.count(); t++) {
         if (t == -2) {
-            dataFile += "Path";
+            dataFile << "Path";
         } else if (t == -1) {
-            dataFile += "Class";
+            dataFile << "Class";
         } else {
-            dataFile += QString("%1").arg(thresholds[t] * 100.0);
+            dataFile << QString::number(thresholds[t] * 100.0);
         }
         for (int p = 0; p < experimentIntervalMeasurements.numPaths; p++) {
             if (pathTrafficClass[p] < 0)
                 continue;
             if (t == -2) {
-                dataFile += QString("\tP%1").arg(p + 1);
+                dataFile << "\tP" << p + 1;
             } else if (t == -1) {
-                dataFile += QString("\t%1").arg(pathTrafficClass[p]);
+                dataFile << "\t" << pathTrafficClass[p];
             } else {
-                dataFile += QString("\t%1").arg(pathCongestionProbabilities[t][p] * 100.0, 0, 'f', 2);
+                dataFile << "\t" << QString::number(pathCongestionProbabilities[t][p] * 100.0, 'f', 2);
             }
         }
-        dataFile += "\n";
+        dataFile << "\n";
     }
-    if (!saveFile(workingDir + "/" + "path-congestion-probs.txt", dataFile))
+    if (!dataFile.close())
         return false;
+    if (outputFiles) {
+        *outputFiles << dataFile.fileName();
+    }
 
     return true;
 }
 
-bool dumpPathIntervalData(QString workingDir, QString graphName, QString experimentSuffix, quint64 resamplePeriod)
+bool dumpPathIntervalData(QString workingDir, QString graphName, QString experimentSuffix, quint64 resamplePeriod,
+                          bool useCache,
+                          QStringList *outputFiles = NULL)
 {
     NetGraph g;
     if (!loadGraph(workingDir, graphName, g))
@@ -230,12 +288,11 @@ bool dumpPathIntervalData(QString workingDir, QString graphName, QString experim
     QVector<QVector<qreal> > pathLossRates;
 
     ExperimentIntervalMeasurements experimentIntervalMeasurements;
-    if (!experimentIntervalMeasurements.load(workingDir + "/" + "interval-measurements.data")) {
+    if (!experimentIntervalMeasurements.loadResampled(workingDir + "/" + "interval-measurements.data",
+                                                      resamplePeriod, useCache)) {
         return false;
     }
 
-    experimentIntervalMeasurements = experimentIntervalMeasurements.resample(resamplePeriod);
-
     Q_ASSERT_FORCE(experimentIntervalMeasurements.numPaths == g.paths.count());
 
     for (int i = 0; i < experimentIntervalMeasurements.numIntervals(); i++) {
@@ -249,31 +306,34 @@ bool dumpPathIntervalData(QString workingDir, QString graphName, QString experim
 
     // save result
 
-    QString dataFile;
-    dataFile += "Experiment\t" + experimentSuffix + "\n";
+    ReportWriter dataFile(workingDir + "/" + "path-interval-data.txt");
+    dataFile << "Experiment\t" << experimentSuffix << "\n";
     for (int i = -2; i < experimentIntervalMeasurements.numIntervals(); i++) {
         if (i == -2) {
-            dataFile += "Path";
+            dataFile << "Path";
         } else if (i == -1) {
-            dataFile += "Class";
+            dataFile << "Class";
         } else {
-            dataFile += QString("%1").arg(i);
+            dataFile << i;
         }
         for (int p = 0; p < experimentIntervalMeasurements.numPaths; p++) {
             if (pathTrafficClass[p] < 0)
                 continue;
             if (i == -2) {
-                dataFile += QString("\tP%1").arg(p + 1);
+                dataFile << "\tP" << p + 1;
             } else if (i == -1) {
-                dataFile += QString("\t%1").arg(pathTrafficClass[p]);
+                dataFile << "\t" << pathTrafficClass[p];
             } else {
-                dataFile += QString("\t%1").arg(pathLossRates[i][p] * 100.0, 0, 'f', 2);
+                dataFile << "\t" << QString::number(pathLossRates[i][p] * 100.0, 'f', 2);
             }
         }
-        dataFile += "\n";
+        dataFile << "\n";
     }
-    if (!saveFile(workingDir + "/" + "path-interval-data.txt", dataFile))
+    if (!dataFile.close())
         return false;
+    if (outputFiles) {
+        *outputFiles << dataFile.fileName();
+    }
 
     return true;
 }
@@ -297,12 +357,174 @@ qreal distance(QList<qreal> cluster1, QList<qreal> cluster2)
 #define USE_INTERVAL_MASK 0
 #define LINK_USE_INTERVAL_MASK 0
 
+// Lists of values grouped by bin and traffic class.
+// The analyses use packed integer keys; the "b<bin>c<class>" strings of the reports are built only
+// once per key by toStringHash(). The keys are kept in the order in which they were first seen, so
+// the hashes built from them are the same as if the strings had been used from the start.
+class ClassBinValues {
+public:
+    static quint64 key(qint32 bin, qint32 trafficClass) {
+        return (quint64(quint32(bin)) << 32) | quint32(trafficClass);
+    }
+    static qint32 bin(quint64 key) {
+        return qint32(key >> 32);
+    }
+    static qint32 trafficClass(quint64 key) {
+        return qint32(key & 0xFFFFffffULL);
+    }
+
+    void append(quint64 key, qreal value) {
+        int index = keyIndex.value(key, -1);
+        if (index < 0) {
+            index = keys.count();
+            keyIndex.insert(key, index);
+            keys.append(key);
+            values.append(QList<qreal>());
+        }
+        values[index] << value;
+    }
+
+    bool isEmpty() const {
+        return keys.isEmpty();
+    }
+
+    // key: "b<bin>c<class>"
+    QHash<QString, QList<qreal> > toStringHash() const {
+        QHash<QString, QList<qreal> > result;
+        for (int index = 0; index < keys.count(); index++) {
+            result[QString("b%1c%2").arg(bin(keys[index])).arg(trafficClass(keys[index]))] = values[index];
+        }
+        return result;
+    }
+
+    // "b<bin>" for each bin
+    QSet<QString> binSet() const {
+        QSet<QString> result;
+        foreach (quint64 k, keys) {
+            result.insert(QString("b%1").arg(bin(k)));
+        }
+        return result;
+    }
+
+    // index: order of first appearance
+    QVector<quint64> keys;
+    QVector<QList<qreal> > values;
+    // key: packed key; value: index in keys
+    QHash<quint64, int> keyIndex;
+};
+
+// Computes the congestion probabilities of the paths that cross one link, grouped by bin and class.
+// Only reads the shared data, so that the links can be analyzed in parallel (see parallelFor()).
+class EdgeAnalysis {
+public:
+    EdgeAnalysis(const ExperimentIntervalMeasurements &experimentIntervalMeasurements,
+                 const IntervalCountMatrix &counts,
+                 const QVector<int> &pathTrafficClass,
+                 int firstTransientCut,
+                 int lastTransientCut,
+                 qreal binSize,
+                 qreal lossThreshold,
+                 QVector<ClassBinValues> &edgeClassPathCongProbs) :
+        experimentIntervalMeasurements(experimentIntervalMeasurements),
+        counts(counts),
+        pathTrafficClass(pathTrafficClass),
+        firstTransientCut(firstTransientCut),
+        lastTransientCut(lastTransientCut),
+        binSize(binSize),
+        lossThreshold(lossThreshold),
+        edgeClassPathCongProbs(edgeClassPathCongProbs)
+    {}
+
+    // Analyzes edge e and stores the result in edgeClassPathCongProbs[e]
+    void operator()(int e);
+
+    const ExperimentIntervalMeasurements &experimentIntervalMeasurements;
+    // The counters of experimentIntervalMeasurements
+    const IntervalCountMatrix &counts;
+    const QVector<int> &pathTrafficClass;
+    const int firstTransientCut;
+    const int lastTransientCut;
+    const qreal binSize;
+    const qreal lossThreshold;
+    QVector<ClassBinValues> &edgeClassPathCongProbs;
+};
+
+void EdgeAnalysis::operator()(int e)
+{
+    QVector<bool> intervalMask;
+    intervalMask.fill(false, experimentIntervalMeasurements.numIntervals());
+    for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
+        intervalMask[i] = true;
+        if (USE_INTERVAL_MASK || LINK_USE_INTERVAL_MASK) {
+            for (int p = 0; p < experimentIntervalMeasurements.numPaths; p++) {
+                int ep = counts.pathEdgeIndex(e, p);
+                if (ep < 0 || counts.pathEdgeTotalInFlight(ep) == 0)
+                    continue;
+                if (counts.pathEdgeInFlight(ep, i) < minNumPackets) {
+                    intervalMask[i] = false;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (int p = 0; p < experimentIntervalMeasurements.numPaths; p++) {
+        int ep = counts.pathEdgeIndex(e, p);
+        if (ep < 0 || counts.pathEdgeTotalInFlight(ep) == 0)
+            continue;
+
+        qreal congestionProbability = 0;
+        int numIntervals = 0;
+        qreal ppi = 0;
+        for (int interval = firstTransientCut; interval < experimentIntervalMeasurements.numIntervals() - lastTransientCut; interval++) {
+            if (!intervalMask[interval])
+                continue;
+            bool ok;
+            qreal loss = 1.0 - counts.pathEdgeSuccessRate(ep, interval, &ok);
+            if (!ok)
+                continue;
+            if (counts.pathEdgeInFlight(ep, interval) < minNumPackets)
+                continue;
+            numIntervals++;
+            if (loss >= lossThreshold) {
+                congestionProbability += 1.0;
+            }
+            ppi += counts.pathEdgeInFlight(ep, interval);
+        }
+        congestionProbability /= qMax(1, numIntervals);
+        ppi /= qMax(1, numIntervals);
+
+        int bin = 1 + int(ppi / binSize);
+
+        edgeClassPathCongProbs[e].append(ClassBinValues::key(bin, 1 + pathTrafficClass[p]), congestionProbability);
+    }
+}
+
+// Writes the values as percentages separated by ", ", with firstSeparator before the first one.
+void writePercentages(ReportWriter &report, const QList<qreal> &values, const char *firstSeparator)
+{
+    for (int i = 0; i < values.count(); i++) {
+        report << (i == 0 ? firstSeparator : ", ") << QString::number(values[i] * 100.0);
+    }
+}
+
+// Writes the links (numbered from 1) separated by ", ".
+void writeLinks(ReportWriter &report, const QList<qint32> &links)
+{
+    for (int i = 0; i < links.count(); i++) {
+        report << (i == 0 ? "" : ", ") << links[i] + 1;
+    }
+}
+
 // Analysis of per-link data
 bool nonNeutralityAnalysis(QString workingDir, QString graphName, QString experimentSuffix,
                            quint64 resamplePeriod,
                            qreal binSize,
                            qreal lossThreshold,
-                           bool perFlowAnalysis)
+                           bool perFlowAnalysis,
+                           int numThreads,
+                           bool useCache,
+                           QStringList *outputFiles = NULL)
 {
     const qreal gapThreshold = 33.0 / 100.0;
 
@@ -315,15 +537,14 @@ bool nonNeutralityAnalysis(QString workingDir, QString graphName, QString experi
                                                      : g.getConnectionTrafficClass();
 
     ExperimentIntervalMeasurements experimentIntervalMeasurements;
-    if (!experimentIntervalMeasurements.load(workingDir + "/" +
-                                             ( !perFlowAnalysis
-                                             ? "interval-measurements.data"
-                                             : "flow-interval-measurements.data"))) {
+    if (!experimentIntervalMeasurements.loadResampled(workingDir + "/" +
+                                                      ( !perFlowAnalysis
+                                                      ? "interval-measurements.data"
+                                                      : "flow-interval-measurements.data"),
+                                                      resamplePeriod, useCache)) {
         return false;
     }
 
-    experimentIntervalMeasurements = experimentIntervalMeasurements.resample(resamplePeriod);
-
     Q_ASSERT_FORCE(experimentIntervalMeasurements.numEdges == g.edges.count());
     Q_ASSERT_FORCE(experimentIntervalMeasurements.numPaths == !perFlowAnalysis ? g.paths.count()
                                                                                : g.connections.count());
@@ -333,63 +554,29 @@ bool nonNeutralityAnalysis(QString workingDir, QString graphName, QString experi
     const int firstTransientCut = firstTransientCutSec * 1.0e9 / experimentIntervalMeasurements.intervalSize;
     const int lastTransientCut = lastTransientCutSec * 1.0e9 / experimentIntervalMeasurements.intervalSize;
 
+    IntervalCountMatrix counts;
+    counts.extract(experimentIntervalMeasurements);
+
     // first index: edge
     // second index (key): bin + class
     // third index: arbitrary path index
-    QList<QHash<QString, QList<qreal> > > edgeClassPathCongProbs;
-    QList<QSet<QString> > edgeBins;
-    for (int e = 0; e < experimentIntervalMeasurements.numEdges; e++) {
-        edgeClassPathCongProbs << QHash<QString, QList<qreal> >();
-        edgeBins << QSet<QString>();
-
-        QVector<bool> intervalMask;
-        intervalMask.fill(false, experimentIntervalMeasurements.numIntervals());
-        for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
-            intervalMask[i] = true;
-            if (USE_INTERVAL_MASK || LINK_USE_INTERVAL_MASK) {
-                for (int p = 0; p < experimentIntervalMeasurements.numPaths; p++) {
-                    QInt32Pair ep = QInt32Pair(e, p);
-                    if (experimentIntervalMeasurements.globalMeasurements.perPathEdgeMeasurements[ep].numPacketsInFlight == 0)
-                        continue;
-                    if (experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep].numPacketsInFlight < minNumPackets) {
-                        intervalMask[i] = false;
-                        break;
-                    }
-                }
-            }
-        }
-
-        for (int p = 0; p < experimentIntervalMeasurements.numPaths; p++) {
-            QInt32Pair ep = QInt32Pair(e, p);
-            if (experimentIntervalMeasurements.globalMeasurements.perPathEdgeMeasurements[ep].numPacketsInFlight == 0)
-                continue;
-
-            qreal congestionProbability = 0;
-            int numIntervals = 0;
-            qreal ppi = 0;
-            for (int interval = firstTransientCut; interval < experimentIntervalMeasurements.numIntervals() - lastTransientCut; interval++) {
-                if (!intervalMask[interval])
-                    continue;
-                bool ok;
-                qreal loss = 1.0 -
-                             experimentIntervalMeasurements.intervalMeasurements[interval].perPathEdgeMeasurements[ep].successRate(&ok);
-                if (!ok)
-                    continue;
-                if (experimentIntervalMeasurements.intervalMeasurements[interval].perPathEdgeMeasurements[ep].numPacketsInFlight < minNumPackets)
-                    continue;
-                numIntervals++;
-                if (loss >= lossThreshold) {
-                    congestionProbability += 1.0;
-                }
-                ppi += experimentIntervalMeasurements.intervalMeasurements[interval].perPathEdgeMeasurements[ep].numPacketsInFlight;
-            }
-            congestionProbability /= qMax(1, numIntervals);
-            ppi /= qMax(1, numIntervals);
-
-            int bin = 1 + int(ppi / binSize);
-
-            edgeClassPathCongProbs[e][QString("b%1c%2").arg(bin).arg(1 + pathTrafficClass[p])] << congestionProbability;
-            edgeBins[e].insert(QString("b%1").arg(bin));
+    QVector<QHash<QString, QList<qreal> > > edgeClassPathCongProbs(experimentIntervalMeasurements.numEdges);
+    QVector<QSet<QString> > edgeBins(experimentIntervalMeasurements.numEdges);
+    {
+        Chronometer chrono("Per-link analysis");
+        QVector<ClassBinValues> edgeClassBinValues(experimentIntervalMeasurements.numEdges);
+        EdgeAnalysis edgeAnalysis(experimentIntervalMeasurements,
+                                  counts,
+                                  pathTrafficClass,
+                                  firstTransientCut,
+                                  lastTransientCut,
+                                  binSize,
+                                  lossThreshold,
+                                  edgeClassBinValues);
+        parallelFor(experimentIntervalMeasurements.numEdges, edgeAnalysis, numThreads);
+        for (int e = 0; e < experimentIntervalMeasurements.numEdges; e++) {
+            edgeClassPathCongProbs[e] = edgeClassBinValues[e].toStringHash();
+            edgeBins[e] = edgeClassBinValues[e].binSet();
         }
     }
 
@@ -432,45 +619,67 @@ bool nonNeutralityAnalysis(QString workingDir, QString graphName, QString experi
         }
     }
 
+    QString reportName = workingDir + "/" +
+                         linkAnalysisReportName(experimentSuffix,
+                                                experimentIntervalMeasurements.intervalSize,
+                                                lossThreshold);
+    if (!saveAnalysisIntervalSize(workingDir, experimentIntervalMeasurements.intervalSize, outputFiles))
+        return false;
+
     // save txt report
-    QString dataFile;
-    dataFile += QString("Experiment\t%1\tinterval\t%2\n").arg(experimentSuffix).arg(experimentIntervalMeasurements.intervalSize / 1.0e9);
-    dataFile += "\n";
+    ReportWriter dataFile(reportName + ".txt");
+    dataFile << QString("Experiment\t%1\tinterval\t%2\n").arg(experimentSuffix).arg(experimentIntervalMeasurements.intervalSize / 1.0e9);
+    dataFile << "\n";
     for (int e = 0; e < experimentIntervalMeasurements.numEdges; e++) {
-        dataFile += QString("Link\t%1\t%2").arg(e + 1).arg(g.edges[e].isNeutral() ? "neutral" : g.edges[e].policerCount > 1 ? "policing" : "shaping");
-        dataFile += "\n";
+        dataFile << QString("Link\t%1\t%2").arg(e + 1).arg(g.edges[e].isNeutral() ? "neutral" : g.edges[e].policerCount > 1 ? "policing" : "shaping");
+        dataFile << "\n";
         foreach (QString c, sorted(edgeClassPathCongProbs[e].uniqueKeys())) {
-            dataFile += QString("Class\t%1").arg(c);
+            dataFile << QString("Class\t%1").arg(c);
             foreach (qreal prob, edgeClassPathCongProbs[e][c]) {
-                dataFile += QString("\t%1").arg(prob * 100.0);
+                dataFile << "\t" << QString::number(prob * 100.0);
             }
-            dataFile += "\n";
+            dataFile << "\n";
         }
 
-        dataFile += QString("Neutral clues");
+        dataFile << QString("Neutral clues");
         foreach (qreal c, edgeNeutralClues[e]) {
-            dataFile += QString("\t%1").arg(c * 100.0);
+            dataFile << "\t" << QString::number(c * 100.0);
         }
-        dataFile += "\n";
+        dataFile << "\n";
 
-        dataFile += QString("Non-neutral clues");
+        dataFile << QString("Non-neutral clues");
         foreach (qreal c, edgeNonNeutralClues[e]) {
-            dataFile += QString("\t%1").arg(c * 100.0);
+            dataFile << "\t" << QString::number(c * 100.0);
         }
-        dataFile += "\n";
+        dataFile << "\n";
 
-        dataFile += QString("Detection\t%1\n").arg(edgeDetectedNeutrality[e]);
-        dataFile += QString("Result\t%1\n").arg(edgeDetectionResult[e]);
+        dataFile << QString("Detection\t%1\n").arg(edgeDetectedNeutrality[e]);
+        dataFile << QString("Result\t%1\n").arg(edgeDetectionResult[e]);
 
-        dataFile += "\n";
+        dataFile << "\n";
     }
-    if (!saveFile(workingDir + "/" +
-                  QString("link-analysis-%1-%2-lossth-%3.txt")
-                  .arg(experimentSuffix)
-                  .arg(timeToString(experimentIntervalMeasurements.intervalSize))
-                  .arg(lossThreshold),
-                  dataFile))
+    if (!dataFile.close())
         return false;
+    if (outputFiles) {
+        *outputFiles << dataFile.fileName();
+    }
+
+    // save result table (one row per link)
+    ReportWriter table(reportName + ".csv");
+    table << "link,type,detection,result,neutral_clues,non_neutral_clues\n";
+    for (int e = 0; e < experimentIntervalMeasurements.numEdges; e++) {
+        table << e + 1 << ","
+              << (g.edges[e].isNeutral() ? "neutral" : g.edges[e].policerCount > 1 ? "policing" : "shaping") << ","
+              << edgeDetectedNeutrality[e] << ","
+              << edgeDetectionResult[e] << ","
+              << edgeNeutralClues[e].count() << ","
+              << edgeNonNeutralClues[e].count() << "\n";
+    }
+    if (!table.close())
+        return false;
+    if (outputFiles) {
+        *outputFiles << table.fileName();
+    }
 
     // save html report
     QString nonNeutralLinksStr;
@@ -495,8 +704,8 @@ bool nonNeutralityAnalysis(QString workingDir, QString graphName, QString experi
         htmlTraffic += QString("</li>\n");
     }
 
-    QString html;
-    html = QString("<!DOCTYPE html>\n"
+    ReportWriter html(reportName + ".html");
+    html << QString("<!DOCTYPE html>\n"
                    "<html>\n"
                    "<head>\n"
                    "  <meta charset=\"UTF-8\">\n"
@@ -522,7 +731,7 @@ bool nonNeutralityAnalysis(QString workingDir, QString graphName, QString experi
            .arg(htmlTraffic)
            .arg(timeToString(experimentIntervalMeasurements.intervalSize));
 
-    html += QString("    <table>\n"
+    html << QString("    <table>\n"
                     "    <tbody>\n"
                     "      <tr>\n"
                     "        <th colspan=\"1\" class=\"vcenter\">Link</th>\n"
@@ -538,20 +747,20 @@ bool nonNeutralityAnalysis(QString workingDir, QString graphName, QString experi
         if (edgeDetectionResult[e].contains("undecidable"))
             continue;
 
-        html += QString("      <tr>\n");
+        html << QString("      <tr>\n");
 
         // link
-        html += QString("      <td>");
-        html += QString("%1 ").arg(e + 1);
-        html += QString("      </td>\n");
+        html << QString("      <td>");
+        html << QString("%1 ").arg(e + 1);
+        html << QString("      </td>\n");
 
         // type
-        html += QString("      <td nowrap>");
-        html += (g.edges[e].isNeutral() ? "neutral" : "non-neutral");
-        html += QString("      </td>\n");
+        html << QString("      <td nowrap>");
+        html << (g.edges[e].isNeutral() ? "neutral" : "non-neutral");
+        html << QString("      </td>\n");
 
         // result
-        html += QString("      <td nowrap style=\"background-color:%1\">")
+        html << QString("      <td nowrap style=\"background-color:%1\">")
                 .arg(edgeDetectionResult[e].contains("false") ?
                          "#f99" :
                          edgeDetectionResult[e].contains("positive") ?
@@ -559,52 +768,44 @@ bool nonNeutralityAnalysis(QString workingDir, QString graphName, QString experi
                              edgeDetectionResult[e].contains("undecidable") ?
                                  "#ff9" :
                                  "#fff");
-        html += edgeDetectionResult[e];
-        html += QString("      </td>\n");
+        html << edgeDetectionResult[e];
+        html << QString("      </td>\n");
 
         // class 1 real
-        html += QString("      <td>");
+        html << QString("      <td>");
         foreach (QString classBin, sorted(edgeClassPathCongProbs[e].uniqueKeys())) {
             if (classBin.endsWith("1")) {
-                html += QString("%1:").arg(classBin);
-                foreach (qreal prob, edgeClassPathCongProbs[e][classBin]) {
-                    html += QString("%1%2").arg(html.endsWith(":") ? " " : ", ").arg(prob * 100.0);
-                }
-                html += "<br/>";
+                html << classBin << ":";
+                writePercentages(html, edgeClassPathCongProbs[e][classBin], " ");
+                html << "<br/>";
             }
         }
-        html += QString("      </td>\n");
+        html << QString("      </td>\n");
 
         // class 2 real
-        html += QString("      <td>");
+        html << QString("      <td>");
         foreach (QString classBin, sorted(edgeClassPathCongProbs[e].uniqueKeys())) {
             if (classBin.endsWith("2")) {
-                html += QString("%1:").arg(classBin);
-                foreach (qreal prob, edgeClassPathCongProbs[e][classBin]) {
-                    html += QString("%1%2").arg(html.endsWith(":") ? " " : ", ").arg(prob * 100.0);
-                }
-                html += "<br/>";
+                html << classBin << ":";
+                writePercentages(html, edgeClassPathCongProbs[e][classBin], " ");
+                html << "<br/>";
             }
         }
-        html += QString("      </td>\n");
+        html << QString("      </td>\n");
 
         // neutral clues
-        html += QString("      <td>");
-        foreach (qreal c, edgeNeutralClues[e]) {
-            html += QString("%1%2").arg(html.endsWith(">") ? "" : ", ").arg(c * 100.0);
-        }
-        html += QString("      </td>\n");
+        html << QString("      <td>");
+        writePercentages(html, edgeNeutralClues[e], "");
+        html << QString("      </td>\n");
 
         // non-neutral clues
-        html += QString("      <td>");
-        foreach (qreal c, edgeNonNeutralClues[e]) {
-            html += QString("%1%2").arg(html.endsWith(">") ? "" : ", ").arg(c * 100.0);
-        }
-        html += QString("      </td>\n");
+        html << QString("      <td>");
+        writePercentages(html, edgeNonNeutralClues[e], "");
+        html << QString("      </td>\n");
 
-        html += QString("      </tr>\n");
+        html << QString("      </tr>\n");
     }
-    html += QString("    </tbody>\n"
+    html << QString("    </tbody>\n"
                     "    </table>\n");
 
     int truePositives = 0;
@@ -632,62 +833,455 @@ bool nonNeutralityAnalysis(QString workingDir, QString graphName, QString experi
         }
     }
 
-    html += QString("    <p>True positives: %1 / %2 = %3 %</p>\n")
+    html << QString("    <p>True positives: %1 / %2 = %3 %</p>\n")
             .arg(truePositives)
             .arg(totalNonNeutral)
             .arg(truePositives * 100.0 / qMax(totalNonNeutral, 1));
 
-    html += QString("    <p>True negatives: %1 / %2 = %3 %</p>\n")
+    html << QString("    <p>True negatives: %1 / %2 = %3 %</p>\n")
             .arg(trueNegatives)
             .arg(totalNeutral)
             .arg(trueNegatives * 100.0 / qMax(totalNeutral, 1));
 
-    html += QString("    <p>False positives: %1 / %2 = %3 %</p>\n")
+    html << QString("    <p>False positives: %1 / %2 = %3 %</p>\n")
             .arg(falsePositives)
             .arg(totalNeutral)
             .arg(falsePositives * 100.0 / qMax(totalNeutral, 1));
 
-    html += QString("    <p>False negatives: %1 / %2 = %3 %</p>\n")
+    html << QString("    <p>False negatives: %1 / %2 = %3 %</p>\n")
             .arg(falseNegatives)
             .arg(totalNonNeutral)
             .arg(falseNegatives * 100.0 / qMax(totalNonNeutral, 1));
 
-    html += QString("  </div>\n"
+    html << QString("  </div>\n"
                     "</div>\n"
 					"<script src=\"../../../html/todo.js\"></script>\n"
 					"<script src=\"../../../html/toc.js\"></script>\n"
                     "</body>\n"
                     "</html>\n");
 
-    if (!saveFile(workingDir + "/" +
-                  QString("link-analysis-%1-%2-lossth-%3.html")
-                  .arg(experimentSuffix)
-                  .arg(timeToString(experimentIntervalMeasurements.intervalSize))
-                  .arg(lossThreshold),
-                  html))
+    if (!html.close())
         return false;
+    if (outputFiles) {
+        *outputFiles << html.fileName();
+    }
 
     QDir::setCurrent(workingDir);
 	QProcess::execute("../../../plotting-scripts-new/plot-edge-class-path-cong-prob.py",
                       QStringList()
                       << "--in"
-                      << QString("link-analysis-%1-%2-lossth-%3.txt")
-                      .arg(experimentSuffix)
-                      .arg(timeToString(experimentIntervalMeasurements.intervalSize))
-                      .arg(lossThreshold)
+                      << linkAnalysisReportName(experimentSuffix,
+                                                experimentIntervalMeasurements.intervalSize,
+                                                lossThreshold) + ".txt"
                       << "--out"
                       << QString("link-analysis-%1").arg(lossThreshold, 0, 'f', 2));
 
     return true;
 }
 
+// Seed of the random generator used to resample the paths of a link sequence, given its sorted links.
+// It only depends on the links, so the results do not depend on the order or the thread in
+// which the link sequences are analyzed.
+quint32 linkSequenceSeed(const QList<qint32> &sortedLinks)
+{
+    quint32 seed = 2166136261U;
+    foreach (qint32 e, sortedLinks) {
+        seed = (seed ^ quint32(e)) * 16777619U;
+    }
+    return seed;
+}
+
+// Results of nonNeutralityDetection() for one link sequence
+class LinkSequenceDetectionResult {
+public:
+    LinkSequenceDetectionResult() : pathPair11(false), pathPair22(false) {}
+    bool pathPair11;
+    bool pathPair22;
+    // key: class&bin
+    // value: list of probs of congestion
+    ClassBinValues classBin2computedProbsCongestion;
+    ClassBinValues classBin2trueProbsCongestion;
+    // Debug output, printed after the analysis in the order of the link sequences
+    QStringList log;
+};
+
+// Resamples the end-to-end data of the paths of one link sequence and estimates its congestion
+// probability. Only reads the shared data, so that the link sequences can be analyzed in parallel
+// (see parallelFor()).
+class LinkSequenceDetection {
+public:
+    LinkSequenceDetection(const ExperimentIntervalMeasurements &experimentIntervalMeasurements,
+                          const IntervalCountMatrix &counts,
+                          const QList<QInt32Set> &linkSequences,
+                          const QVector<QList<qint32> > &sequenceLinks,
+                          const QVector<QVector<bool> > &sequenceIntervalMask,
+                          const QVector<QVector<int> > &sequencePPI,
+                          const QVector<QSet<QPair<qint32, qint32> > > &sequencePathPairs,
+                          const QVector<QSet<qint32> > &sequencePaths,
+                          const QVector<int> &pathTrafficClass,
+                          int firstTransientCut,
+                          int lastTransientCut,
+                          qreal binSize,
+                          qreal lossThreshold,
+                          int numSamplingIterations,
+                          bool diagnostic,
+                          QVector<LinkSequenceDetectionResult> &results) :
+        experimentIntervalMeasurements(experimentIntervalMeasurements),
+        counts(counts),
+        linkSequences(linkSequences),
+        sequenceLinks(sequenceLinks),
+        sequenceIntervalMask(sequenceIntervalMask),
+        sequencePPI(sequencePPI),
+        sequencePathPairs(sequencePathPairs),
+        sequencePaths(sequencePaths),
+        pathTrafficClass(pathTrafficClass),
+        firstTransientCut(firstTransientCut),
+        lastTransientCut(lastTransientCut),
+        binSize(binSize),
+        lossThreshold(lossThreshold),
+        numSamplingIterations(numSamplingIterations),
+        diagnostic(diagnostic),
+        results(results)
+    {}
+
+    // Analyzes the link sequence with id index and stores the result in results[index]
+    void operator()(int index);
+
+    const ExperimentIntervalMeasurements &experimentIntervalMeasurements;
+    // The counters of experimentIntervalMeasurements
+    const IntervalCountMatrix &counts;
+    // index: link sequence id
+    const QList<QInt32Set> &linkSequences;
+    // index: link sequence id; value: sorted links
+    const QVector<QList<qint32> > &sequenceLinks;
+    // first index: link sequence id; second index: interval
+    const QVector<QVector<bool> > &sequenceIntervalMask;
+    // first index: link sequence id; second index: interval; value: min(each path's ppi)
+    const QVector<QVector<int> > &sequencePPI;
+    // index: link sequence id
+    const QVector<QSet<QPair<qint32, qint32> > > &sequencePathPairs;
+    const QVector<QSet<qint32> > &sequencePaths;
+    const QVector<int> &pathTrafficClass;
+    const int firstTransientCut;
+    const int lastTransientCut;
+    const qreal binSize;
+    const qreal lossThreshold;
+    const int numSamplingIterations;
+    const bool diagnostic;
+    QVector<LinkSequenceDetectionResult> &results;
+};
+
+void LinkSequenceDetection::operator()(int index)
+{
+    const QInt32Set &linkSequence = linkSequences[index];
+    LinkSequenceDetectionResult &result = results[index];
+    std::mt19937 generator(linkSequenceSeed(sequenceLinks[index]));
+
+    const QVector<bool> &intervalMask = sequenceIntervalMask[index];
+    const QVector<int> &intervalPPI = sequencePPI[index];
+
+    // index: interval
+    // value: true if all data for the interval is valid
+    QVector<bool> intervalValid;
+    // first index: interval
+    // second index: path
+    // value: true if path is good, false if path is congested, undefined if intervalValid[interval] is false
+    QVector<QVector<bool> > intervalPathState;
+
+    intervalValid.fill(false, experimentIntervalMeasurements.numIntervals());
+    intervalPathState.resize(experimentIntervalMeasurements.numIntervals());
+
+    for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
+        if (!intervalMask[i])
+            continue;
+        intervalValid[i] = true;
+        // index: path
+        // value: number of samples for which the path is detected as good
+        QVector<int> pathGoodCount;
+        pathGoodCount.fill(0, experimentIntervalMeasurements.numPaths);
+        // index: path
+        // value: number of samples for which the path is detected as congested
+        QVector<int> pathCongestedCount;
+        pathCongestedCount.fill(0, experimentIntervalMeasurements.numPaths);
+
+        // foreach path, resample end-to-end data and use threshold to decide if path is good
+        foreach (qint32 p, sequencePaths[index]) {
+            if (counts.pathInFlight(p, i) < minNumPackets ||
+                intervalPPI[i] < minNumPackets) {
+                intervalValid[i] = false;
+                break;
+            }
+            const LinkIntervalMeasurement &pathMeasurement = experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p];
+            for (int samplingIteration = 0; samplingIteration < numSamplingIterations; samplingIteration++) {
+                bool ok;
+                qreal loss = 1.0 - pathMeasurement.sampledSuccessRate(intervalPPI[i], generator, &ok);
+                if (!ok) {
+                    intervalValid[i] = false;
+                    break;
+                }
+
+                if (loss < lossThreshold) {
+                    pathGoodCount[p]++;
+                } else {
+                    pathCongestedCount[p]++;
+                }
+            }
+        }
+
+        if (!intervalValid[i])
+            continue;
+
+        intervalPathState[i].resize(experimentIntervalMeasurements.numPaths);
+        // foreach path, pick the majority to decide if path is good
+        foreach (qint32 p, sequencePaths[index]) {
+            intervalPathState[i][p] = pathGoodCount[p] > pathCongestedCount[p];
+        }
+    }
+
+    // The interval states as bitsets, one bit per interval after the transient cuts:
+    // bit set in validIntervals if the interval is valid;
+    // bit set in pathGoodIntervals[p] if the interval is valid and path p is good.
+    // The probabilities of the path pairs are then popcounts of whole words.
+    BitArray validIntervals;
+    QVector<BitArray> pathGoodIntervals(experimentIntervalMeasurements.numPaths);
+    for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
+        validIntervals.append(intervalValid[i]);
+    }
+    foreach (qint32 p, sequencePaths[index]) {
+        for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
+            pathGoodIntervals[p].append(intervalValid[i] && intervalPathState[i][p]);
+        }
+    }
+    const qreal numValidIntervals = validIntervals.countOnes();
+
+    QString sequenceLog;
+    QDebug(&sequenceLog) << "sequence" << linkSequence << intervalValid.count(true) << "intervals";
+    result.log << sequenceLog;
+
+    foreach (QInt32Pair pathPair, sequencePathPairs[index]) {
+        qint32 p1 = pathPair.first;
+        qint32 p2 = pathPair.second;
+
+        // compute prob. of non-congestion for path 1, for path 2, and for paths 1 & 2
+        // (interval is non-congested if both paths are non-congested)
+        qreal probGood1 = pathGoodIntervals[p1].countOnes() / qMax(1.0, numValidIntervals);
+        qreal probGood2 = pathGoodIntervals[p2].countOnes() / qMax(1.0, numValidIntervals);
+        qreal probGood12 = pathGoodIntervals[p1].countOnesAnd(pathGoodIntervals[p2]) / qMax(1.0, numValidIntervals);
+
+        // this is the estimated probability of non-congestion for the link sequence
+        qreal estimatedProbGoodSequence = qMin(1.0, qMax(0.0, probGood1 * probGood2 / qMax(1.602e-19, probGood12)));
+
+        // compute the ground truth for comparison
+        // note that we do not resample here... so there might be some extra difference because of this
+        qreal trueProbGoodSequence = 0;
+        qreal trueProbGoodCount = 0;
+        QVector<bool> trueStateSequence;
+        trueStateSequence.fill(true, experimentIntervalMeasurements.numIntervals());
+        for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
+            if (counts.pathInFlight(p1, i) <= minNumPackets &&
+                counts.pathInFlight(p2, i) <= minNumPackets) {
+                continue;
+            }
+            if (!intervalValid[i])
+                continue;
+            bool congestedInterval = false;
+            foreach (qint32 e, linkSequence) {
+                int ep1 = counts.pathEdgeIndex(e, p1);
+                int ep2 = counts.pathEdgeIndex(e, p2);
+                bool ok1 = false;
+                qreal loss1 = ep1 < 0 ? 1.0 : 1.0 - counts.pathEdgeSuccessRate(ep1, i, &ok1);
+                bool ok2 = false;
+                qreal loss2 = ep2 < 0 ? 1.0 : 1.0 - counts.pathEdgeSuccessRate(ep2, i, &ok2);
+                if (ok1 && ok2) {
+                    if (loss1 >= lossThreshold &&
+                        loss2 >= lossThreshold) {
+                        congestedInterval = true;
+                        break;
+                    }
+                }
+            }
+            trueStateSequence[i] = !congestedInterval;
+            if (!congestedInterval) {
+                trueProbGoodSequence += 1;
+            }
+            trueProbGoodCount += 1;
+        }
+        trueProbGoodSequence /= qMax(1.0, trueProbGoodCount);
+
+        // save the result in the appropriate class group
+        int ppi1 = 1;
+        int ppi2 = 1;
+        int class1 = pathTrafficClass[p1] + 1;
+        int class2 = pathTrafficClass[p2] + 1;
+        int bin1 = 1 + int(ppi1 / binSize);
+        int bin2 = 1 + int(ppi2 / binSize);
+
+        if (class1 == class2) {
+            if (class1 == 1 && class2 == 1) {
+                result.pathPair11 = true;
+            } else if (class1 == 2 && class2 == 2) {
+                result.pathPair22 = true;
+            }
+
+            if (bin1 == bin2) {
+                quint64 key = ClassBinValues::key(bin1, class1);
+                result.classBin2computedProbsCongestion.append(key, 1.0 - estimatedProbGoodSequence);
+                result.classBin2trueProbsCongestion.append(key, 1.0 - trueProbGoodSequence);
+                QString pairLog;
+                QDebug(&pairLog) << linkSequence << "->" << (p1 + 1) << (p2 + 1)
+                                 << "estimated" << 100 * (1.0 - estimatedProbGoodSequence)
+                                 << "true" << 100 * (1.0 - trueProbGoodSequence);
+                result.log << pairLog;
+            }
+        }
+
+        if (diagnostic) {
+            // Diagnostic code
+            if (linkSequence == (QList<qint32>() << 0 << 2).toSet() &&
+                ((p1 == 0 && p2 == 2) || (p1 == 4 && p2 == 6)) ) {
+                QFile file1(QString("p%1.txt").arg(p1 + 1));
+                QFile file2(QString("p%1.txt").arg(p2 + 1));
+                file1.open(QFile::WriteOnly | QFile::Truncate);
+                file2.open(QFile::WriteOnly | QFile::Truncate);
+
+                QTextStream out1(&file1);
+                QTextStream out2(&file2);
+                out1 << "Data for path " << (p1 + 1) << "\n";
+                out2 << "Data for path " << (p2 + 1) << "\n";
+                for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
+                    if (!intervalMask[i])
+                        continue;
+                    if (!intervalValid[i])
+                        continue;
+                    if (experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[0].numPacketsDropped > 0 ||
+                        experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[2].numPacketsDropped > 0 ||
+                        experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[4].numPacketsDropped > 0 ||
+                        experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[6].numPacketsDropped > 0) {
+
+                        out1 << "\n";
+                        out2 << "\n";
+
+                        out1 << "\n";
+                        out2 << "\n";
+
+                        out1 << "======================================================================\n";
+                        out2 << "======================================================================\n";
+
+                        out1 << "Interval " << (i + 1) << "\n";
+                        out2 << "Interval " << (i + 1) << "\n";
+
+                        out1 << "\n";
+                        out2 << "\n";
+
+                        out1 << "Real end-to-end data\n";
+                        out2 << "Real end-to-end data\n";
+
+                        out1 << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].numPacketsDropped
+                             << " / "
+                             << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].numPacketsInFlight
+                             << " => " << (100 * experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].successRate())
+                             << " %"
+                             << "\n";
+                        out2 << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].numPacketsDropped
+                             << " / "
+                             << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].numPacketsInFlight
+                             << " => " << (100 * experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].successRate())
+                             << " %"
+                             << "\n";
+
+                        int numLines1 = experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].events.toString().count('\n');
+                        int numLines2 = experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].events.toString().count('\n');
+                        int numLinesMax = qMax(qMax(experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[0].events.toString().count('\n'),
+                                               experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[2].events.toString().count('\n')),
+                                qMax(experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[4].events.toString().count('\n'),
+                                experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[6].events.toString().count('\n')));
+
+                        out1 << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].events.toString() << "\n";
+                        out2 << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].events.toString() << "\n";
+                        for (; numLines1 < numLinesMax; numLines1++) {
+                            out1 << "\n";
+                        }
+                        for (; numLines2 < numLinesMax; numLines2++) {
+                            out2 << "\n";
+                        }
+
+                        out1 << "Sampled end-to-end data\n";
+                        out2 << "Sampled end-to-end data\n";
+
+                        out1 << QString("State: %1\n").arg(intervalPathState[i][p1] ? "good" : "congested");
+                        out2 << QString("State: %1\n").arg(intervalPathState[i][p2] ? "good" : "congested");
+
+                        out1 << "\n";
+                        out2 << "\n";
+
+                        out1 << "True sequence data\n";
+                        out2 << "True sequence data\n";
+
+                        out1 << QString("State: %1\n").arg(trueStateSequence[i] ? "good" : "congested");
+                        out2 << QString("State: %1\n").arg(trueStateSequence[i] ? "good" : "congested");
+
+                        out1 << "\n";
+                        out2 << "\n";
+
+                        foreach (qint32 e, linkSequence) {
+                            out1 << QString("Drops on link %1:\n").arg(e + 1);
+                            out2 << QString("Drops on link %1:\n").arg(e + 1);
+
+                            QInt32Pair ep1 = QInt32Pair(e, p1);
+                            QInt32Pair ep2 = QInt32Pair(e, p2);
+                            QInt32Pair e0 = QInt32Pair(e, 0);
+                            QInt32Pair e2 = QInt32Pair(e, 2);
+                            QInt32Pair e4 = QInt32Pair(e, 4);
+                            QInt32Pair e6 = QInt32Pair(e, 6);
+                            out1 << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep1].numPacketsDropped
+                                 << " / "
+                                 << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep1].numPacketsInFlight
+                                 << " => " << (100 * experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep1].successRate())
+                                 << " %"
+                                 << "\n";
+                            out2 << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep2].numPacketsDropped
+                                 << " / "
+                                 << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep2].numPacketsInFlight
+                                 << " => " << (100 * experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep2].successRate())
+                                 << " %"
+                                 << "\n";
+
+                            int numLines1 = experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep1].events.toString().count('\n');
+                            int numLines2 = experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep2].events.toString().count('\n');
+                            int numLinesMax = qMax(qMax(experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[e0].events.toString().count('\n'),
+                                                   experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[e2].events.toString().count('\n')),
+                                    qMax(experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[e4].events.toString().count('\n'),
+                                    experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[e6].events.toString().count('\n')));
+
+                            out1 << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep1].events.toString() << "\n";
+                            out2 << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep2].events.toString() << "\n";
+                            for (; numLines1 < numLinesMax; numLines1++) {
+                                out1 << "\n";
+                            }
+                            for (; numLines2 < numLinesMax; numLines2++) {
+                                out2 << "\n";
+                            }
+
+                            out1 << "\n";
+                            out2 << "\n";
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
 // Analysis of end-to-end data
 bool nonNeutralityDetection(QString workingDir, QString graphName, QString experimentSuffix, quint64 resamplePeriod,
                             qreal binSize,
                             qreal lossThreshold,
                             int numSamplingIterations,
                             qreal gapThreshold,
-                            bool perFlowAnalysis)
+                            bool perFlowAnalysis,
+                            int numThreads,
+                            bool useCache,
+                            QStringList *outputFiles = NULL)
 {
     bool diagnostic = true;
 
@@ -710,15 +1304,14 @@ bool nonNeutralityDetection(QString workingDir, QString graphName, QString exper
     }
 
     ExperimentIntervalMeasurements experimentIntervalMeasurements;
-    if (!experimentIntervalMeasurements.load(workingDir + "/" +
-                                             ( !perFlowAnalysis
-                                             ? "interval-measurements.data"
-                                             : "flow-interval-measurements.data"))) {
+    if (!experimentIntervalMeasurements.loadResampled(workingDir + "/" +
+                                                      ( !perFlowAnalysis
+                                                      ? "interval-measurements.data"
+                                                      : "flow-interval-measurements.data"),
+                                                      resamplePeriod, useCache)) {
         return false;
     }
 
-    experimentIntervalMeasurements = experimentIntervalMeasurements.resample(resamplePeriod);
-
     Q_ASSERT_FORCE(experimentIntervalMeasurements.numEdges == g.edges.count());
     Q_ASSERT_FORCE(experimentIntervalMeasurements.numPaths == !perFlowAnalysis ? g.paths.count()
                                                                                : g.connections.count());
@@ -737,6 +1330,9 @@ bool nonNeutralityDetection(QString workingDir, QString graphName, QString exper
     const int firstTransientCut = firstTransientCutSec * 1.0e9 / experimentIntervalMeasurements.intervalSize;
     const int lastTransientCut = lastTransientCutSec * 1.0e9 / experimentIntervalMeasurements.intervalSize;
 
+    IntervalCountMatrix counts;
+    counts.extract(experimentIntervalMeasurements);
+
     QHash<QSet<qint32>, bool> linkSequence2neutrality;
     QHash<QSet<qint32>, bool> linkSequence2pathPair11;
     QHash<QSet<qint32>, bool> linkSequence2pathPair22;
@@ -758,14 +1354,14 @@ bool nonNeutralityDetection(QString workingDir, QString graphName, QString exper
             if (USE_INTERVAL_MASK) {
                 bool foundOne = false;
                 for (int p = 0; p < experimentIntervalMeasurements.numPaths; p++) {
-                    QInt32Pair ep = QInt32Pair(e, p);
+                    int ep = counts.pathEdgeIndex(e, p);
                     // It's OK to use this, it's essentially checking the routing matrix. Not cheating.
-                    if (experimentIntervalMeasurements.globalMeasurements.perPathEdgeMeasurements[ep].numPacketsInFlight == 0)
+                    if (ep < 0 || counts.pathEdgeTotalInFlight(ep) == 0)
                         continue;
                     // This is not OK to do (cheating), wo we won't do it; keep the code here for checking:
                     //if (experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep].numPacketsInFlight < minNumPackets) {
                     // This is OK to do (use end-to-end data):
-                    if (experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p].numPacketsInFlight < minNumPackets) {
+                    if (counts.pathInFlight(p, i) < minNumPackets) {
                         linkIntervalMask[e][i] = false;
                         break;
                     } else {
@@ -778,16 +1374,24 @@ bool nonNeutralityDetection(QString workingDir, QString graphName, QString exper
             }
         }
     }
-    // first key: link sequence
+    // Link sequences, interned into dense ids in the order in which they are first seen, so that
+    // the set of links is hashed once per path pair instead of on every lookup.
+    // index: id
+    QList<QInt32Set> linkSequences;
+    QHash<QSet<qint32>, int> linkSequence2Id;
+    // index: id; value: the links of the sequence, sorted (canonical form)
+    QVector<QList<qint32> > sequenceLinks;
+    // first index: id
     // second index: interval
-    QHash<QSet<qint32>, QVector<bool> > linkSequence2IntervalMask;
+    QVector<QVector<bool> > sequenceIntervalMask;
     // value: min(each path's ppi)
-    QHash<QSet<qint32>, QVector<int> > linkSequence2PPI;
-    QHash<QSet<qint32>, QSet<QPair<qint32, qint32> > > linkSequence2PathPairs;
-    QHash<QSet<qint32>, QSet<qint32> > linkSequence2Paths;
+    QVector<QVector<int> > sequencePPI;
+    QVector<QSet<QPair<qint32, qint32> > > sequencePathPairs;
+    QVector<QSet<qint32> > sequencePaths;
     QHash<QSet<qint32>, QList<qint32> > linkSequence2OrderedLinkSequence;
 
-    // Compute linkSequence2PPI
+    Chronometer chronoSequences("Link sequence interning", true);
+    // Compute sequencePPI
     for (int p1 = 0; p1 < experimentIntervalMeasurements.numPaths; p1++) {
         const NetGraphPath &path1 = !perFlowAnalysis ? g.paths[p1] : g.paths[connection2path[p1]];
         if (backgroundHosts.contains(path1.source + 1) || backgroundHosts.contains(path1.dest + 1))
@@ -804,57 +1408,62 @@ bool nonNeutralityDetection(QString workingDir, QString graphName, QString exper
             foreach (NetGraphEdge edge, commonEdges) {
                 linkSequence.insert(edge.index);
             }
-            if (!linkSequence2OrderedLinkSequence.contains(linkSequence)) {
+            int id = linkSequence2Id.value(linkSequence, -1);
+            if (id < 0) {
+                id = linkSequences.count();
+                linkSequence2Id.insert(linkSequence, id);
+                linkSequences << linkSequence;
+                sequenceLinks << sorted(linkSequence.toList());
+
                 linkSequence2OrderedLinkSequence[linkSequence].clear();
                 foreach (NetGraphEdge edge, path1.edgeList) {
                     if (commonEdges.contains(edge)) {
                         linkSequence2OrderedLinkSequence[linkSequence] << edge.index;
                     }
                 }
-            }
 
-            // linkSequence2neutrality
-            bool neutrality = true;
-            foreach (NetGraphEdge edge, commonEdges) {
-                neutrality = neutrality && edge.isNeutral();
-            }
-            linkSequence2neutrality[linkSequence] = neutrality;
-            // linkSequence2Paths
-            linkSequence2PathPairs[linkSequence].insert(QInt32Pair(p1, p2));
-            linkSequence2Paths[linkSequence].insert(p1);
-            linkSequence2Paths[linkSequence].insert(p2);
-            // linkSequence2PPI
-            if (!linkSequence2PPI.contains(linkSequence)) {
-                linkSequence2PPI[linkSequence].resize(experimentIntervalMeasurements.numIntervals());
-                for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
-                    int ppi = qMin(experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].numPacketsInFlight,
-                                   experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].numPacketsInFlight);
-                    linkSequence2PPI[linkSequence][i] = ppi;
+                // linkSequence2neutrality
+                bool neutrality = true;
+                foreach (NetGraphEdge edge, commonEdges) {
+                    neutrality = neutrality && edge.isNeutral();
                 }
-            } else {
+                linkSequence2neutrality[linkSequence] = neutrality;
+
+                sequencePathPairs << QSet<QPair<qint32, qint32> >();
+                sequencePaths << QSet<qint32>();
+
+                // sequencePPI
+                sequencePPI << QVector<int>(experimentIntervalMeasurements.numIntervals());
                 for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
-                    int ppi = qMin(experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].numPacketsInFlight,
-                                   experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].numPacketsInFlight);
-                    linkSequence2PPI[linkSequence][i] = qMin(linkSequence2PPI[linkSequence][i], ppi);
+                    int ppi = qMin(counts.pathInFlight(p1, i), counts.pathInFlight(p2, i));
+                    sequencePPI[id][i] = ppi;
                 }
-            }
-            // linkSequence2IntervalMask
-            if (!linkSequence2IntervalMask.contains(linkSequence)) {
-                QList<qint32> links = linkSequence.toList();
-                linkSequence2IntervalMask[linkSequence] = linkIntervalMask[links.first()];
+
+                // sequenceIntervalMask
+                const QList<qint32> &links = sequenceLinks[id];
+                sequenceIntervalMask << linkIntervalMask[links.first()];
                 foreach (qint32 e, links) {
                     for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
                         if (USE_INTERVAL_MASK) {
-                            linkSequence2IntervalMask[linkSequence][i] = linkSequence2IntervalMask[linkSequence][i] &&
-                                                                         linkIntervalMask[e][i];
+                            sequenceIntervalMask[id][i] = sequenceIntervalMask[id][i] && linkIntervalMask[e][i];
                         } else {
-                            linkSequence2IntervalMask[linkSequence][i] = true;
+                            sequenceIntervalMask[id][i] = true;
                         }
                     }
                 }
+            } else {
+                for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
+                    int ppi = qMin(counts.pathInFlight(p1, i), counts.pathInFlight(p2, i));
+                    sequencePPI[id][i] = qMin(sequencePPI[id][i], ppi);
+                }
             }
+            // sequencePathPairs, sequencePaths
+            sequencePathPairs[id].insert(QInt32Pair(p1, p2));
+            sequencePaths[id].insert(p1);
+            sequencePaths[id].insert(p2);
         }
     }
+    qDebug() << chronoSequences.elapsedText(QString("intern %1 link sequences").arg(linkSequences.count()));
 
     // Strategy:
     // foreach linkSeq
@@ -867,319 +1476,46 @@ bool nonNeutralityDetection(QString workingDir, QString graphName, QString exper
     //       pick the majority of decisions to decide if path is good
     //     foreach path pair (p1, p2) such that class[p1] == class[p2]:
     //       compute the estimated congestion probability of the link sequence and record it with the class
-    foreach (QInt32Set linkSequence, linkSequence2PathPairs.uniqueKeys()) {
-        const QVector<bool> &intervalMask = linkSequence2IntervalMask[linkSequence];
-        const QVector<int> &intervalPPI = linkSequence2PPI[linkSequence];
-
-        // index: interval
-        // value: true if all data for the interval is valid
-        QVector<bool> intervalValid;
-        // first index: interval
-        // second index: path
-        // value: true if path is good, false if path is congested, undefined if intervalValid[interval] is false
-        QVector<QVector<bool> > intervalPathState;
-
-        intervalValid.fill(false, experimentIntervalMeasurements.numIntervals());
-        intervalPathState.resize(experimentIntervalMeasurements.numIntervals());
-
-        for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
-            if (!intervalMask[i])
-                continue;
-            intervalValid[i] = true;
-            // index: path
-            // value: number of samples for which the path is detected as good
-            QVector<int> pathGoodCount;
-            pathGoodCount.fill(0, experimentIntervalMeasurements.numPaths);
-            // index: path
-            // value: number of samples for which the path is detected as congested
-            QVector<int> pathCongestedCount;
-            pathCongestedCount.fill(0, experimentIntervalMeasurements.numPaths);
-
-            // foreach path, resample end-to-end data and use threshold to decide if path is good
-            foreach (qint32 p, linkSequence2Paths[linkSequence]) {
-                if (experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p].numPacketsInFlight < minNumPackets ||
-                    intervalPPI[i] < minNumPackets) {
-                    intervalValid[i] = false;
-                    break;
-                }
-                for (int samplingIteration = 0; samplingIteration < numSamplingIterations; samplingIteration++) {
-                    GraphIntervalMeasurements resampledMeasurements = experimentIntervalMeasurements.intervalMeasurements[i];
-                    resampledMeasurements.pathMeasurements[p].sample(intervalPPI[i]);
-
-                    bool ok;
-                    qreal loss = 1.0 - resampledMeasurements.pathMeasurements[p].successRate(&ok);
-                    if (!ok) {
-                        intervalValid[i] = false;
-                        break;
-                    }
-
-                    if (loss < lossThreshold) {
-                        pathGoodCount[p]++;
-                    } else {
-                        pathCongestedCount[p]++;
-                    }
-                }
-            }
-
-            if (!intervalValid[i])
-                continue;
-
-            intervalPathState[i].resize(experimentIntervalMeasurements.numPaths);
-            // foreach path, pick the majority to decide if path is good
-            foreach (qint32 p, linkSequence2Paths[linkSequence]) {
-                intervalPathState[i][p] = pathGoodCount[p] > pathCongestedCount[p];
-            }
+    Chronometer chronoDetection("Link sequence detection", true);
+    QVector<LinkSequenceDetectionResult> linkSequenceResults(linkSequences.count());
+    LinkSequenceDetection linkSequenceDetection(experimentIntervalMeasurements,
+                                                counts,
+                                                linkSequences,
+                                                sequenceLinks,
+                                                sequenceIntervalMask,
+                                                sequencePPI,
+                                                sequencePathPairs,
+                                                sequencePaths,
+                                                pathTrafficClass,
+                                                firstTransientCut,
+                                                lastTransientCut,
+                                                binSize,
+                                                lossThreshold,
+                                                numSamplingIterations,
+                                                diagnostic,
+                                                linkSequenceResults);
+    parallelFor(linkSequences.count(), linkSequenceDetection, numThreads);
+
+    // Merge in the order in which the link sequences were analyzed before they were interned
+    // (the uniqueKeys() order of a hash keyed by link sequence), as a serial run would
+    foreach (QInt32Set linkSequence, linkSequence2Id.uniqueKeys()) {
+        const LinkSequenceDetectionResult &result = linkSequenceResults[linkSequence2Id.value(linkSequence)];
+        foreach (QString line, result.log) {
+            qDebug("%s", qPrintable(line));
         }
-
-        qDebug() << "sequence" << linkSequence << intervalValid.count(true) << "intervals";
-
-        foreach (QInt32Pair pathPair, linkSequence2PathPairs[linkSequence]) {
-            qint32 p1 = pathPair.first;
-            qint32 p2 = pathPair.second;
-
-            // compute prob. of non-congestion for path 1
-            qreal probGood1 = 0;
-            qreal probGood1Count = 0;
-            for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
-                if (intervalValid[i]) {
-                    if (intervalPathState[i][p1]) {
-                        probGood1 += 1;
-                    }
-                    probGood1Count += 1;
-                }
-            }
-            probGood1 /= qMax(1.0, probGood1Count);
-
-            // compute prob. of non-congestion for path 2
-            qreal probGood2 = 0;
-            qreal probGood2Count = 0;
-            for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
-                if (intervalValid[i]) {
-                    if (intervalPathState[i][p2]) {
-                        probGood2 += 1;
-                    }
-                    probGood2Count += 1;
-                }
-            }
-            probGood2 /= qMax(1.0, probGood2Count);
-
-            // compute prob. of non-congestion for paths 1 & 2 (interval is non-congested if both paths are non-congested)
-            qreal probGood12 = 0;
-            qreal probGood12Count = 0;
-            for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
-                if (intervalValid[i]) {
-                    if (intervalPathState[i][p1] &&
-                        intervalPathState[i][p2]) {
-                        probGood12 += 1;
-                    }
-                    probGood12Count += 1;
-                }
-            }
-            probGood12 /= qMax(1.0, probGood12Count);
-
-            // this is the estimated probability of non-congestion for the link sequence
-            qreal estimatedProbGoodSequence = qMin(1.0, qMax(0.0, probGood1 * probGood2 / qMax(1.602e-19, probGood12)));
-
-            // compute the ground truth for comparison
-            // note that we do not resample here... so there might be some extra difference because of this
-            qreal trueProbGoodSequence = 0;
-            qreal trueProbGoodCount = 0;
-            QVector<bool> trueStateSequence;
-            trueStateSequence.fill(true, experimentIntervalMeasurements.numIntervals());
-            for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
-                if (experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].numPacketsInFlight <= minNumPackets &&
-                    experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].numPacketsInFlight <= minNumPackets) {
-                    continue;
-                }
-                if (!intervalValid[i])
-                    continue;
-                bool congestedInterval = false;
-                foreach (qint32 e, linkSequence) {
-                    QInt32Pair ep1 = QInt32Pair(e, p1);
-                    QInt32Pair ep2 = QInt32Pair(e, p2);
-                    bool ok1;
-                    qreal loss1 = 1.0 - experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep1].successRate(&ok1);
-                    bool ok2;
-                    qreal loss2 = 1.0 - experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep2].successRate(&ok2);
-                    if (ok1 && ok2) {
-                        if (loss1 >= lossThreshold &&
-                            loss2 >= lossThreshold) {
-                            congestedInterval = true;
-                            break;
-                        }
-                    }
-                }
-                trueStateSequence[i] = !congestedInterval;
-                if (!congestedInterval) {
-                    trueProbGoodSequence += 1;
-                }
-                trueProbGoodCount += 1;
-            }
-            trueProbGoodSequence /= qMax(1.0, trueProbGoodCount);
-
-            // save the result in the appropriate class group
-            int ppi1 = 1;
-            int ppi2 = 1;
-            int class1 = pathTrafficClass[p1] + 1;
-            int class2 = pathTrafficClass[p2] + 1;
-            int bin1 = 1 + int(ppi1 / binSize);
-            int bin2 = 1 + int(ppi2 / binSize);
-
-            if (class1 == class2) {
-                if (class1 == 1 && class2 == 1) {
-                    linkSequence2pathPair11[linkSequence] = true;
-                } else if (class1 == 2 && class2 == 2) {
-                    linkSequence2pathPair22[linkSequence] = true;
-                }
-
-                if (bin1 == bin2) {
-                    QString key = QString("b%1c%2").arg(bin1).arg(class1);
-                    linkSequence2ClassBin2computedProbsCongestion[linkSequence][key] << 1.0 - estimatedProbGoodSequence;
-                    linkSequence2ClassBin2trueProbsCongestion[linkSequence][key] << 1.0 - trueProbGoodSequence;
-                    linkSequence2Bins[linkSequence].insert(QString("b%1").arg(bin1));
-                    qDebug() << linkSequence << "->" << (p1 + 1) << (p2 + 1)
-                             << "estimated" << 100 * (1.0 - estimatedProbGoodSequence)
-                             << "true" << 100 * (1.0 - trueProbGoodSequence)
-                                ;
-                }
-            }
-
-            if (diagnostic) {
-                // Diagnostic code
-                if (linkSequence == (QList<qint32>() << 0 << 2).toSet() &&
-                    ((p1 == 0 && p2 == 2) || (p1 == 4 && p2 == 6)) ) {
-                    QFile file1(QString("p%1.txt").arg(p1 + 1));
-                    QFile file2(QString("p%1.txt").arg(p2 + 1));
-                    file1.open(QFile::WriteOnly | QFile::Truncate);
-                    file2.open(QFile::WriteOnly | QFile::Truncate);
-
-                    QTextStream out1(&file1);
-                    QTextStream out2(&file2);
-                    out1 << "Data for path " << (p1 + 1) << "\n";
-                    out2 << "Data for path " << (p2 + 1) << "\n";
-                    for (int i = firstTransientCut; i < experimentIntervalMeasurements.numIntervals() - lastTransientCut; i++) {
-                        if (!intervalMask[i])
-                            continue;
-                        if (!intervalValid[i])
-                            continue;
-                        if (experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[0].numPacketsDropped > 0 ||
-                            experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[2].numPacketsDropped > 0 ||
-                            experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[4].numPacketsDropped > 0 ||
-                            experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[6].numPacketsDropped > 0) {
-
-                            out1 << "\n";
-                            out2 << "\n";
-
-                            out1 << "\n";
-                            out2 << "\n";
-
-                            out1 << "======================================================================\n";
-                            out2 << "======================================================================\n";
-
-                            out1 << "Interval " << (i + 1) << "\n";
-                            out2 << "Interval " << (i + 1) << "\n";
-
-                            out1 << "\n";
-                            out2 << "\n";
-
-                            out1 << "Real end-to-end data\n";
-                            out2 << "Real end-to-end data\n";
-
-                            out1 << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].numPacketsDropped
-                                 << " / "
-                                 << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].numPacketsInFlight
-                                 << " => " << (100 * experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].successRate())
-                                 << " %"
-                                 << "\n";
-                            out2 << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].numPacketsDropped
-                                 << " / "
-                                 << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].numPacketsInFlight
-                                 << " => " << (100 * experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].successRate())
-                                 << " %"
-                                 << "\n";
-
-                            int numLines1 = experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].events.toString().count('\n');
-                            int numLines2 = experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].events.toString().count('\n');
-                            int numLinesMax = qMax(qMax(experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[0].events.toString().count('\n'),
-                                                   experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[2].events.toString().count('\n')),
-                                    qMax(experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[4].events.toString().count('\n'),
-                                    experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[6].events.toString().count('\n')));
-
-                            out1 << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p1].events.toString() << "\n";
-                            out2 << experimentIntervalMeasurements.intervalMeasurements[i].pathMeasurements[p2].events.toString() << "\n";
-                            for (; numLines1 < numLinesMax; numLines1++) {
-                                out1 << "\n";
-                            }
-                            for (; numLines2 < numLinesMax; numLines2++) {
-                                out2 << "\n";
-                            }
-
-                            out1 << "Sampled end-to-end data\n";
-                            out2 << "Sampled end-to-end data\n";
-
-                            out1 << QString("State: %1\n").arg(intervalPathState[i][p1] ? "good" : "congested");
-                            out2 << QString("State: %1\n").arg(intervalPathState[i][p2] ? "good" : "congested");
-
-                            out1 << "\n";
-                            out2 << "\n";
-
-                            out1 << "True sequence data\n";
-                            out2 << "True sequence data\n";
-
-                            out1 << QString("State: %1\n").arg(trueStateSequence[i] ? "good" : "congested");
-                            out2 << QString("State: %1\n").arg(trueStateSequence[i] ? "good" : "congested");
-
-                            out1 << "\n";
-                            out2 << "\n";
-
-                            foreach (qint32 e, linkSequence) {
-                                out1 << QString("Drops on link %1:\n").arg(e + 1);
-                                out2 << QString("Drops on link %1:\n").arg(e + 1);
-
-                                QInt32Pair ep1 = QInt32Pair(e, p1);
-                                QInt32Pair ep2 = QInt32Pair(e, p2);
-                                QInt32Pair e0 = QInt32Pair(e, 0);
-                                QInt32Pair e2 = QInt32Pair(e, 2);
-                                QInt32Pair e4 = QInt32Pair(e, 4);
-                                QInt32Pair e6 = QInt32Pair(e, 6);
-                                out1 << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep1].numPacketsDropped
-                                     << " / "
-                                     << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep1].numPacketsInFlight
-                                     << " => " << (100 * experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep1].successRate())
-                                     << " %"
-                                     << "\n";
-                                out2 << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep2].numPacketsDropped
-                                     << " / "
-                                     << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep2].numPacketsInFlight
-                                     << " => " << (100 * experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep2].successRate())
-                                     << " %"
-                                     << "\n";
-
-                                int numLines1 = experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep1].events.toString().count('\n');
-                                int numLines2 = experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep2].events.toString().count('\n');
-                                int numLinesMax = qMax(qMax(experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[e0].events.toString().count('\n'),
-                                                       experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[e2].events.toString().count('\n')),
-                                        qMax(experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[e4].events.toString().count('\n'),
-                                        experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[e6].events.toString().count('\n')));
-
-                                out1 << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep1].events.toString() << "\n";
-                                out2 << experimentIntervalMeasurements.intervalMeasurements[i].perPathEdgeMeasurements[ep2].events.toString() << "\n";
-                                for (; numLines1 < numLinesMax; numLines1++) {
-                                    out1 << "\n";
-                                }
-                                for (; numLines2 < numLinesMax; numLines2++) {
-                                    out2 << "\n";
-                                }
-
-                                out1 << "\n";
-                                out2 << "\n";
-                            }
-                        }
-                    }
-                }
-            }
+        if (result.pathPair11) {
+            linkSequence2pathPair11[linkSequence] = true;
+        }
+        if (result.pathPair22) {
+            linkSequence2pathPair22[linkSequence] = true;
+        }
+        if (!result.classBin2computedProbsCongestion.isEmpty()) {
+            linkSequence2ClassBin2computedProbsCongestion[linkSequence] = result.classBin2computedProbsCongestion.toStringHash();
+            linkSequence2ClassBin2trueProbsCongestion[linkSequence] = result.classBin2trueProbsCongestion.toStringHash();
+            linkSequence2Bins[linkSequence] = result.classBin2computedProbsCongestion.binSet();
         }
     }
+    qDebug() << chronoDetection.elapsedText(QString("analyze %1 link sequences").arg(linkSequences.count()));
 
     // Detection
     QHash<QSet<qint32>, QList<qreal> > linkSequence2NeutralClues;
@@ -1446,74 +1782,102 @@ bool nonNeutralityDetection(QString workingDir, QString graphName, QString exper
     }
     qreal coverage = nonNeutralLinksDetected.count() / qMax(1, actualNonNeutralLinks.count());
 
+    QString reportName = workingDir + "/" +
+                         seqAnalysisReportName(experimentSuffix,
+                                               experimentIntervalMeasurements.intervalSize,
+                                               binSize,
+                                               lossThreshold,
+                                               numSamplingIterations,
+                                               gapThreshold);
+    if (!saveAnalysisIntervalSize(workingDir, experimentIntervalMeasurements.intervalSize, outputFiles))
+        return false;
+
     // save result
-    QString dataFile;
-    dataFile += QString("Experiment\t%1\tinterval\t%2\n").arg(experimentSuffix).arg(experimentIntervalMeasurements.intervalSize / 1.0e9);
-    dataFile += QString("Non-neutral links");
+    ReportWriter dataFile(reportName + ".txt");
+    dataFile << QString("Experiment\t%1\tinterval\t%2\n").arg(experimentSuffix).arg(experimentIntervalMeasurements.intervalSize / 1.0e9);
+    dataFile << QString("Non-neutral links");
     foreach (NetGraphEdge edge, g.edges) {
         if (!edge.isNeutral()) {
-            dataFile += QString("\t%1").arg(edge.index + 1);
+            dataFile << QString("\t%1").arg(edge.index + 1);
         }
     }
-    dataFile += "\n";
-    dataFile += "\n";
+    dataFile << "\n";
+    dataFile << "\n";
     foreach (QInt32Set linkSequence, linkSequence2neutrality.uniqueKeys()) {
         if (!linkSequence2pathPair11[linkSequence] || !linkSequence2pathPair22[linkSequence])
             continue;
 
-        dataFile += QString("Link sequence\t");
-        dataFile += QString("neutrality\t%1\t").arg(linkSequence2neutrality[linkSequence] ? "neutral" : "non-neutral");
-        dataFile += QString("links");
+        dataFile << QString("Link sequence\t");
+        dataFile << QString("neutrality\t%1\t").arg(linkSequence2neutrality[linkSequence] ? "neutral" : "non-neutral");
+        dataFile << QString("links");
         foreach (qint32 e, linkSequence2OrderedLinkSequence[linkSequence]) {
-            dataFile += QString("\t%1").arg(e + 1);
+            dataFile << QString("\t%1").arg(e + 1);
         }
-        dataFile += "\n";
+        dataFile << "\n";
 
         foreach (QString classBin, sorted(linkSequence2ClassBin2computedProbsCongestion[linkSequence].uniqueKeys())) {
-            dataFile += QString("Class\t%1").arg(classBin);
+            dataFile << QString("Class\t%1").arg(classBin);
             foreach (qreal prob, linkSequence2ClassBin2computedProbsCongestion[linkSequence][classBin]) {
-                dataFile += QString("\t%1").arg(prob * 100.0);
+                dataFile << "\t" << QString::number(prob * 100.0);
             }
-            dataFile += "\n";
+            dataFile << "\n";
         }
-        dataFile += "\n";
+        dataFile << "\n";
 
         foreach (QString classBin, sorted(linkSequence2ClassBin2trueProbsCongestion[linkSequence].uniqueKeys())) {
-            dataFile += QString("True class\t%1").arg(classBin);
+            dataFile << QString("True class\t%1").arg(classBin);
             foreach (qreal prob, linkSequence2ClassBin2trueProbsCongestion[linkSequence][classBin]) {
-                dataFile += QString("\t%1").arg(prob * 100.0);
+                dataFile << "\t" << QString::number(prob * 100.0);
             }
-            dataFile += "\n";
+            dataFile << "\n";
         }
-        dataFile += "\n";
+        dataFile << "\n";
 
-        dataFile += QString("Neutral clues");
+        dataFile << QString("Neutral clues");
         foreach (qreal c, linkSequence2NeutralClues[linkSequence]) {
-            dataFile += QString("\t%1").arg(c * 100.0);
+            dataFile << "\t" << QString::number(c * 100.0);
         }
-        dataFile += "\n";
+        dataFile << "\n";
 
-        dataFile += QString("Non-neutral clues");
+        dataFile << QString("Non-neutral clues");
         foreach (qreal c, linkSequence2NonNeutralClues[linkSequence]) {
-            dataFile += QString("\t%1").arg(c * 100.0);
+            dataFile << "\t" << QString::number(c * 100.0);
         }
-        dataFile += "\n";
+        dataFile << "\n";
+
+        dataFile << QString("Detection\t%1\n").arg(linkSequence2DetectedNeutrality[linkSequence]);
+        dataFile << QString("Result\t%1\n").arg(linkSequence2DetectionResult[linkSequence]);
 
-        dataFile += QString("Detection\t%1\n").arg(linkSequence2DetectedNeutrality[linkSequence]);
-        dataFile += QString("Result\t%1\n").arg(linkSequence2DetectionResult[linkSequence]);
+        dataFile << "\n";
+    }
+    if (!dataFile.close())
+        return false;
+    if (outputFiles) {
+        *outputFiles << dataFile.fileName();
+    }
 
-        dataFile += "\n";
+    // save result table (one row per link sequence, links separated by spaces)
+    ReportWriter table(reportName + ".csv");
+    table << "links,type,detection,result,kept,neutral_clues,non_neutral_clues\n";
+    foreach (QInt32Set linkSequence, linkSequence2neutrality.uniqueKeys()) {
+        if (!linkSequence2pathPair11[linkSequence] || !linkSequence2pathPair22[linkSequence])
+            continue;
+        const QList<qint32> &links = linkSequence2OrderedLinkSequence[linkSequence];
+        for (int i = 0; i < links.count(); i++) {
+            table << (i == 0 ? "" : " ") << links[i] + 1;
+        }
+        table << "," << (linkSequence2neutrality[linkSequence] ? "neutral" : "non-neutral")
+              << "," << linkSequence2DetectedNeutrality[linkSequence]
+              << "," << linkSequence2DetectionResult[linkSequence]
+              << "," << (nonNeutralSequencesKept.contains(linkSequence) ? "yes" : "no")
+              << "," << linkSequence2NeutralClues[linkSequence].count()
+              << "," << linkSequence2NonNeutralClues[linkSequence].count() << "\n";
     }
-    QString dataName = workingDir + "/" +
-                       QString("seq-analysis-%1-%2-bins-%3-lossth-%4-samplings-%5-gapth-%6")
-                       .arg(experimentSuffix)
-                       .arg(timeToString(experimentIntervalMeasurements.intervalSize))
-                       .arg(binSize, 0, 'f')
-                       .arg(lossThreshold, 0, 'f', 2)
-                       .arg(numSamplingIterations)
-                       .arg(gapThreshold) + ".txt";
-    if (!saveFile(dataName, dataFile))
+    if (!table.close())
         return false;
+    if (outputFiles) {
+        *outputFiles << table.fileName();
+    }
 
     // save html report
     QString nonNeutralLinksStr;
@@ -1538,8 +1902,8 @@ bool nonNeutralityDetection(QString workingDir, QString graphName, QString exper
         htmlTraffic += QString("</li>\n");
     }
 
-    QString html;
-    html = QString("<!DOCTYPE html>\n"
+    ReportWriter html(reportName + ".html");
+    html << QString("<!DOCTYPE html>\n"
                    "<html>\n"
                    "<head>\n"
                    "  <meta charset=\"UTF-8\">\n"
@@ -1573,17 +1937,16 @@ bool nonNeutralityDetection(QString workingDir, QString graphName, QString exper
            .arg(numSamplingIterations)
            .arg(gapThreshold * 100.0);
 
-    html += QString("    <img src=\"%1/class-path-cong-probs-links.png\"></img>\n")
+    html << QString("    <img src=\"%1/class-path-cong-probs-links.png\"></img>\n")
             .arg(QString("link-analysis-%1").arg(lossThreshold, 0, 'f', 2));
-    html += QString("    <img src=\"%1/link-seq-cong-prob-all.png\"></img>\n")
-            .arg(QString("seq-analysis-%1-%2-bins-%3-lossth-%4-samplings-%5-gapth-%6")
-                 .arg(experimentSuffix)
-                 .arg(timeToString(experimentIntervalMeasurements.intervalSize))
-                 .arg(binSize, 0, 'f')
-                 .arg(lossThreshold, 0, 'f', 2)
-                 .arg(numSamplingIterations)
-                 .arg(gapThreshold));
-    html += QString("    <table>\n"
+    html << QString("    <img src=\"%1/link-seq-cong-prob-all.png\"></img>\n")
+            .arg(seqAnalysisReportName(experimentSuffix,
+                                       experimentIntervalMeasurements.intervalSize,
+                                       binSize,
+                                       lossThreshold,
+                                       numSamplingIterations,
+                                       gapThreshold));
+    html << QString("    <table>\n"
                     "    <tbody>\n"
                     "      <tr>\n"
                     "        <th colspan=\"1\" class=\"vcenter\">#</th>\n"
@@ -1607,28 +1970,28 @@ bool nonNeutralityDetection(QString workingDir, QString graphName, QString exper
         if (linkSequence2DetectionResult[linkSequence].contains("undecidable"))
             continue;
 
-        html += QString("      <tr>\n");
+        html << QString("      <tr>\n");
 
         // #
-        html += QString("      <td>");
-        html += QString("%1 ").arg(rowIndex + 1);
+        html << QString("      <td>");
+        html << QString("%1 ").arg(rowIndex + 1);
         rowIndex++;
-        html += QString("      </td>\n");
+        html << QString("      </td>\n");
 
         // seq
-        html += QString("      <td>");
+        html << QString("      <td>");
         foreach (qint32 e, linkSequence2OrderedLinkSequence[linkSequence]) {
-            html += QString("%1 ").arg(e + 1);
+            html << QString("%1 ").arg(e + 1);
         }
-        html += QString("      </td>\n");
+        html << QString("      </td>\n");
 
         // type
-        html += QString("      <td nowrap>");
-        html += (linkSequence2neutrality[linkSequence] ? "neutral" : "non-neutral");
-        html += QString("      </td>\n");
+        html << QString("      <td nowrap>");
+        html << (linkSequence2neutrality[linkSequence] ? "neutral" : "non-neutral");
+        html << QString("      </td>\n");
 
         // result
-        html += QString("      <td nowrap style=\"background-color:%1\">")
+        html << QString("      <td nowrap style=\"background-color:%1\">")
                 .arg(linkSequence2DetectionResult[linkSequence].contains("false") ?
                          "#f99" :
                          linkSequence2DetectionResult[linkSequence].contains("positive") ?
@@ -1636,188 +1999,225 @@ bool nonNeutralityDetection(QString workingDir, QString graphName, QString exper
                              linkSequence2DetectionResult[linkSequence].contains("undecidable") ?
                                  "#ff9" :
                                  "#fff");
-        html += linkSequence2DetectionResult[linkSequence];
-        html += QString("      </td>\n");
+        html << linkSequence2DetectionResult[linkSequence];
+        html << QString("      </td>\n");
 
         // kept
-        html += QString("      <td nowrap>%1</td>\n")
+        html << QString("      <td nowrap>%1</td>\n")
                 .arg(linkSequence2DetectedNeutrality[linkSequence] == "neutral" ?
                          "kept" : nonNeutralSequencesKept.contains(linkSequence) ?
                              "KEPT" : "discarded");
 
         // class 1 estimated
-        html += QString("      <td>");
+        html << QString("      <td>");
         foreach (QString classBin, sorted(linkSequence2ClassBin2computedProbsCongestion[linkSequence].uniqueKeys())) {
             if (classBin.endsWith("1")) {
-                html += QString("%1:").arg(classBin);
-                foreach (qreal prob, linkSequence2ClassBin2computedProbsCongestion[linkSequence][classBin]) {
-                    html += QString("%1%2").arg(html.endsWith(":") ? " " : ", ").arg(prob * 100.0);
-                }
-                html += "<br/>";
+                html << classBin << ":";
+                writePercentages(html, linkSequence2ClassBin2computedProbsCongestion[linkSequence][classBin], " ");
+                html << "<br/>";
             }
         }
-        html += QString("      </td>\n");
+        html << QString("      </td>\n");
 
         // class 1 real
-        html += QString("      <td>");
+        html << QString("      <td>");
         foreach (QString classBin, sorted(linkSequence2ClassBin2trueProbsCongestion[linkSequence].uniqueKeys())) {
             if (classBin.endsWith("1")) {
-                html += QString("%1:").arg(classBin);
-                foreach (qreal prob, linkSequence2ClassBin2trueProbsCongestion[linkSequence][classBin]) {
-                    html += QString("%1%2").arg(html.endsWith(":") ? " " : ", ").arg(prob * 100.0);
-                }
-                html += "<br/>";
+                html << classBin << ":";
+                writePercentages(html, linkSequence2ClassBin2trueProbsCongestion[linkSequence][classBin], " ");
+                html << "<br/>";
             }
         }
-        html += QString("      </td>\n");
+        html << QString("      </td>\n");
 
         // class 2 estimated
-        html += QString("  <td>");
+        html << QString("  <td>");
         foreach (QString classBin, sorted(linkSequence2ClassBin2computedProbsCongestion[linkSequence].uniqueKeys())) {
             if (classBin.endsWith("2")) {
-                html += QString("%1:").arg(classBin);
-                foreach (qreal prob, linkSequence2ClassBin2computedProbsCongestion[linkSequence][classBin]) {
-                    html += QString("%1%2").arg(html.endsWith(":") ? " " : ", ").arg(prob * 100.0);
-                }
-                html += "<br/>";
+                html << classBin << ":";
+                writePercentages(html, linkSequence2ClassBin2computedProbsCongestion[linkSequence][classBin], " ");
+                html << "<br/>";
             }
         }
-        html += QString("      </td>\n");
+        html << QString("      </td>\n");
 
         // class 2 real
-        html += QString("      <td>");
+        html << QString("      <td>");
         foreach (QString classBin, sorted(linkSequence2ClassBin2trueProbsCongestion[linkSequence].uniqueKeys())) {
             if (classBin.endsWith("2")) {
-                html += QString("%1:").arg(classBin);
-                foreach (qreal prob, linkSequence2ClassBin2trueProbsCongestion[linkSequence][classBin]) {
-                    html += QString("%1%2").arg(html.endsWith(":") ? " " : ", ").arg(prob * 100.0);
-                }
-                html += "<br/>";
+                html << classBin << ":";
+                writePercentages(html, linkSequence2ClassBin2trueProbsCongestion[linkSequence][classBin], " ");
+                html << "<br/>";
             }
         }
-        html += QString("      </td>\n");
+        html << QString("      </td>\n");
 
         // neutral clues
-        html += QString("      <td>");
-        foreach (qreal c, linkSequence2NeutralClues[linkSequence]) {
-            html += QString("%1%2").arg(html.endsWith(">") ? "" : ", ").arg(c * 100.0);
-        }
-        html += QString("      </td>\n");
+        html << QString("      <td>");
+        writePercentages(html, linkSequence2NeutralClues[linkSequence], "");
+        html << QString("      </td>\n");
 
         // non-neutral clues
-        html += QString("      <td>");
-        foreach (qreal c, linkSequence2NonNeutralClues[linkSequence]) {
-            html += QString("%1%2").arg(html.endsWith(">") ? "" : ", ").arg(c * 100.0);
-        }
-        html += QString("      </td>\n");
+        html << QString("      <td>");
+        writePercentages(html, linkSequence2NonNeutralClues[linkSequence], "");
+        html << QString("      </td>\n");
 
-        html += QString("      </tr>\n");
+        html << QString("      </tr>\n");
     }
-    html += QString("    </tbody>\n"
+    html << QString("    </tbody>\n"
                     "    </table>\n");
 
-    html += QString("    <p>True positives: %1 / %2 = %3 %</p>\n")
+    html << QString("    <p>True positives: %1 / %2 = %3 %</p>\n")
             .arg(truePositives)
             .arg(totalNonNeutral)
             .arg(truePositives * 100.0 / qMax(totalNonNeutral, 1));
 
-    html += QString("    <p>True negatives: %1 / %2 = %3 %</p>\n")
+    html << QString("    <p>True negatives: %1 / %2 = %3 %</p>\n")
             .arg(trueNegatives)
             .arg(totalNeutral)
             .arg(trueNegatives * 100.0 / qMax(totalNeutral, 1));
 
-    html += QString("    <p>False positives: %1 / %2 = %3 %</p>\n")
+    html << QString("    <p>False positives: %1 / %2 = %3 %</p>\n")
             .arg(falsePositives)
             .arg(totalNeutral)
             .arg(falsePositives * 100.0 / qMax(totalNeutral, 1));
 
-    html += QString("    <p>False negatives: %1 / %2 = %3 %</p>\n")
+    html << QString("    <p>False negatives: %1 / %2 = %3 %</p>\n")
             .arg(falseNegatives)
             .arg(totalNonNeutral)
             .arg(falseNegatives * 100.0 / qMax(totalNonNeutral, 1));
 
-    html += QString("    <p>Coverage: ");
-    html += QString("%1 correctly detected as non-neutral (").arg(nonNeutralLinksDetected.count());
-    foreach (qint32 e, sorted(nonNeutralLinksDetected.toList())) {
-        html += QString("%1%2").arg(html.endsWith("(") ? "" : ", ").arg(e + 1);
-    }
-    html += QString(") / %1 actually non-neutral (").arg(actualNonNeutralLinks.count());
-    foreach (qint32 e, sorted(actualNonNeutralLinks.toList())) {
-        html += QString("%1%2").arg(html.endsWith("(") ? "" : ", ").arg(e + 1);
-    }
-    html += QString(") = %1 %").arg(coverage * 100.0);
-    html += QString("</p>\n");
+    html << QString("    <p>Coverage: ");
+    html << QString("%1 correctly detected as non-neutral (").arg(nonNeutralLinksDetected.count());
+    writeLinks(html, sorted(nonNeutralLinksDetected.toList()));
+    html << QString(") / %1 actually non-neutral (").arg(actualNonNeutralLinks.count());
+    writeLinks(html, sorted(actualNonNeutralLinks.toList()));
+    html << QString(") = %1 %").arg(coverage * 100.0);
+    html << QString("</p>\n");
 
-    html += QString("    <p>Granularity: %1</p>\n")
+    html << QString("    <p>Granularity: %1</p>\n")
             .arg(granularity);
 
-    html += QString("<p>Link sequence trimming</p>");
+    html << QString("<p>Link sequence trimming</p>");
     foreach (QInt32Set linkSequence, linkSequence2neutrality.uniqueKeys()) {
-        html += QString("      <ul>");
+        html << QString("      <ul>");
         if (linkSequence2DetectedNeutrality[linkSequence] == "non-neutral") {
-            html += QString("        <li>&lt;");
-            foreach (qint32 e, linkSequence2OrderedLinkSequence[linkSequence]) {
-                html += QString("%1%2").arg(html.endsWith(";") ? "" : ", ").arg(e + 1);
-            }
-            html += QString("&gt; decision: %1<br/>\n").arg(nonNeutralSequencesKept.contains(linkSequence) ? "KEEP" : "discard");
-            html += QString("        Reason:<br/>\n");
-            html += QString(nonNeutralSequences2KeepReason[linkSequence])
+            html << QString("        <li>&lt;");
+            writeLinks(html, linkSequence2OrderedLinkSequence[linkSequence]);
+            html << QString("&gt; decision: %1<br/>\n").arg(nonNeutralSequencesKept.contains(linkSequence) ? "KEEP" : "discard");
+            html << QString("        Reason:<br/>\n");
+            html << QString(nonNeutralSequences2KeepReason[linkSequence])
                     .replace("<", "&lt;")
                     .replace(">", "&gt;")
                     .replace("\n", "<br/>");
-            html += QString("        </li>\n");
+            html << QString("        </li>\n");
         }
-        html += QString("      </ul>\n");
+        html << QString("      </ul>\n");
     }
 
-    html += QString("  </div>\n"
+    html << QString("  </div>\n"
                     "</div>\n"
 					"<script src=\"../../../html/todo.js\"></script>\n"
 					"<script src=\"../../../html/toc.js\"></script>\n"
                     "</body>\n"
                     "</html>\n");
 
-    QString htmlName = workingDir + "/" +
-                       QString("seq-analysis-%1-%2-bins-%3-lossth-%4-samplings-%5-gapth-%6")
-                       .arg(experimentSuffix)
-                       .arg(timeToString(experimentIntervalMeasurements.intervalSize))
-                       .arg(binSize, 0, 'f')
-                       .arg(lossThreshold, 0, 'f', 2)
-                       .arg(numSamplingIterations)
-                       .arg(gapThreshold) + ".html";
-    if (!saveFile(htmlName, html))
+    QString htmlName = html.fileName();
+    if (!html.close())
         return false;
+    if (outputFiles) {
+        *outputFiles << html.fileName();
+    }
 
     QDir::setCurrent(workingDir);
 	QProcess::execute("../../../plotting-scripts-new/plot-edge-seq-cong-prob.py",
                       QStringList()
                       << "--in"
-                      << QString("seq-analysis-%1-%2-bins-%3-lossth-%4-samplings-%5-gapth-%6")
-                      .arg(experimentSuffix)
-                      .arg(timeToString(experimentIntervalMeasurements.intervalSize))
-                      .arg(binSize, 0, 'f')
-                      .arg(lossThreshold, 0, 'f', 2)
-                      .arg(numSamplingIterations)
-                      .arg(gapThreshold) + ".txt"
+                      << seqAnalysisReportName(experimentSuffix,
+                                               experimentIntervalMeasurements.intervalSize,
+                                               binSize,
+                                               lossThreshold,
+                                               numSamplingIterations,
+                                               gapThreshold) + ".txt"
                       << "--out"
-                      << QString("seq-analysis-%1-%2-bins-%3-lossth-%4-samplings-%5-gapth-%6")
-                      .arg(experimentSuffix)
-                      .arg(timeToString(experimentIntervalMeasurements.intervalSize))
-                      .arg(binSize, 0, 'f')
-                      .arg(lossThreshold, 0, 'f', 2)
-                      .arg(numSamplingIterations)
-                      .arg(gapThreshold));
+                      << seqAnalysisReportName(experimentSuffix,
+                                               experimentIntervalMeasurements.intervalSize,
+                                               binSize,
+                                               lossThreshold,
+                                               numSamplingIterations,
+                                               gapThreshold));
 	QProcess::execute("../../../plotting-scripts-new/inline-html-images.py", QStringList() << htmlName);
 
     return true;
 }
 
+// Runs the analysis with 1, 2, 4 ... maxThreads threads, and prints the running times and whether
+// the text reports are identical to those of the single-threaded run.
+bool benchmarkAnalysisThreads(QString workingDir, QString graphName, QString experimentSuffix,
+                              quint64 resamplePeriod, qreal binSize,
+                              qreal lossThreshold,
+                              int numResamplings,
+                              qreal gapThreshold,
+                              bool perFlowAnalysis,
+                              int maxThreads,
+                              bool useCache)
+{
+    QList<int> threadCounts;
+    for (int numThreads = 1; numThreads < maxThreads; numThreads *= 2) {
+        threadCounts << numThreads;
+    }
+    threadCounts << qMax(1, maxThreads);
+
+    const QStringList reportFilters = QStringList() << "link-analysis-*.txt" << "seq-analysis-*.txt";
+    QHash<QString, QString> referenceReports;
+    QList<quint64> durations;
+    bool allIdentical = true;
+    foreach (int numThreads, threadCounts) {
+        Chronometer chrono("", true);
+        nonNeutralityAnalysis(workingDir, graphName, experimentSuffix,
+                              resamplePeriod, binSize,
+                              lossThreshold,
+                              perFlowAnalysis,
+                              numThreads,
+                              useCache);
+        nonNeutralityDetection(workingDir, graphName, experimentSuffix,
+                               resamplePeriod, binSize,
+                               lossThreshold, numResamplings, gapThreshold,
+                               perFlowAnalysis,
+                               numThreads,
+                               useCache);
+        durations << chrono.elapsedMs();
+
+        QHash<QString, QString> reports;
+        foreach (QString fileName, QDir(workingDir).entryList(reportFilters, QDir::Files, QDir::Name)) {
+            QString content;
+            readFile(workingDir + "/" + fileName, content);
+            reports[fileName] = content;
+        }
+        if (referenceReports.isEmpty()) {
+            referenceReports = reports;
+        }
+        bool identical = reports == referenceReports;
+        allIdentical = allIdentical && identical;
+
+        qDebug() << QString("Threads: %1 Duration: %2 Speedup: %3 Reports: %4")
+                    .arg(numThreads)
+                    .arg(Chronometer::durationToString(durations.last()))
+                    .arg(qreal(durations.first()) / qMax(1ULL, durations.last()), 0, 'f', 2)
+                    .arg(identical ? "identical" : "DIFFERENT");
+    }
+    return allIdentical;
+}
+
 bool processResults(QString workingDir, QString graphName, QString experimentSuffix,
                     quint64 resamplePeriod, qreal binSize,
                     qreal lossThreshold,
                     int numResamplings,
                     qreal gapThreshold,
-                    bool perFlowAnalysis)
+                    bool perFlowAnalysis,
+                    int numThreads,
+                    bool benchmarkThreads,
+                    bool useCache)
 {
     NetGraph g;
     if (!loadGraph(workingDir, graphName, g))
@@ -1825,39 +2225,123 @@ bool processResults(QString workingDir, QString graphName, QString experimentSuf
 
 	saveFile(workingDir + "/" + "graph.txt", g.toText());
     saveFile(workingDir + "/" + "experiment-suffix.txt", experimentSuffix);
-    computePathCongestionProbabilities(workingDir, graphName, experimentSuffix, resamplePeriod);
-    dumpPathIntervalData(workingDir, graphName, experimentSuffix, resamplePeriod);
-    nonNeutralityAnalysis(workingDir, graphName, experimentSuffix,
-                          resamplePeriod, binSize,
-                          lossThreshold,
-                          perFlowAnalysis);
-    nonNeutralityDetection(workingDir, graphName, experimentSuffix,
-                           resamplePeriod, binSize,
-                           lossThreshold, numResamplings, gapThreshold,
-                           perFlowAnalysis);
+
+    // Each stage is keyed by its input files and parameters; it is skipped and its output files are
+    // restored if it already ran with the same ones (see ResultCache).
+    // The number of threads is not a parameter: it does not change the outputs.
+    ResultCache cache(workingDir, useCache);
+    const QStringList pathInputs = QStringList()
+                                   << graphFileName(workingDir, graphName)
+                                   << workingDir + "/" + "interval-measurements.data";
+    const QStringList analysisInputs = QStringList()
+                                       << graphFileName(workingDir, graphName)
+                                       << workingDir + "/" + (!perFlowAnalysis
+                                                              ? "interval-measurements.data"
+                                                              : "flow-interval-measurements.data");
+    const QStringList pathParameters = QStringList()
+                                       << experimentSuffix
+                                       << QString::number(resamplePeriod);
+    const QStringList analysisParameters = QStringList(pathParameters)
+                                           << QString::number(binSize, 'g', 17)
+                                           << QString::number(lossThreshold, 'g', 17)
+                                           << QString::number(perFlowAnalysis);
+    const QStringList detectionParameters = QStringList(analysisParameters)
+                                            << QString::number(numResamplings)
+                                            << QString::number(gapThreshold, 'g', 17);
+
+    QByteArray key = cache.stageKey("path-congestion-probabilities", pathInputs, pathParameters);
+    if (cache.restore(key)) {
+        qDebug() << "Path congestion probabilities: cached";
+    } else {
+        QStringList outputFiles;
+        if (computePathCongestionProbabilities(workingDir, graphName, experimentSuffix, resamplePeriod, useCache, &outputFiles))
+            cache.store(key, outputFiles);
+    }
+
+    key = cache.stageKey("path-interval-data", pathInputs, pathParameters);
+    if (cache.restore(key)) {
+        qDebug() << "Path interval data: cached";
+    } else {
+        QStringList outputFiles;
+        if (dumpPathIntervalData(workingDir, graphName, experimentSuffix, resamplePeriod, useCache, &outputFiles))
+            cache.store(key, outputFiles);
+    }
+
+    if (benchmarkThreads) {
+        return benchmarkAnalysisThreads(workingDir, graphName, experimentSuffix,
+                                        resamplePeriod, binSize,
+                                        lossThreshold, numResamplings, gapThreshold,
+                                        perFlowAnalysis,
+                                        numThreads,
+                                        useCache);
+    }
+
+    key = cache.stageKey("non-neutrality-analysis", analysisInputs, analysisParameters);
+    if (cache.restore(key)) {
+        qDebug() << "Link analysis: cached";
+    } else {
+        QStringList outputFiles;
+        if (nonNeutralityAnalysis(workingDir, graphName, experimentSuffix,
+                                  resamplePeriod, binSize,
+                                  lossThreshold,
+                                  perFlowAnalysis,
+                                  numThreads,
+                                  useCache,
+                                  &outputFiles))
+            cache.store(key, outputFiles);
+    }
+
+    key = cache.stageKey("non-neutrality-detection", analysisInputs, detectionParameters);
+    if (cache.restore(key)) {
+        qDebug() << "Link sequence analysis: cached";
+    } else {
+        QStringList outputFiles;
+        if (nonNeutralityDetection(workingDir, graphName, experimentSuffix,
+                                   resamplePeriod, binSize,
+                                   lossThreshold, numResamplings, gapThreshold,
+                                   perFlowAnalysis,
+                                   numThreads,
+                                   useCache,
+                                   &outputFiles))
+            cache.store(key, outputFiles);
+    }
 
 	return true;
 }
 
-bool processResults(QStringList params)
+class ProcessResultsParams {
+public:
+    ProcessResultsParams() :
+        resamplePeriod(0),
+        binSize(1.0e9),
+        perFlowAnalysis(false),
+        lossThreshold(1.0 / 100.0),
+        numResamplings(1),
+        gapThreshold(50.0 / 100.0),
+        numThreads(getNumCoresLinux()),
+        benchmarkThreads(false),
+        useCache(true) {}
+
+    quint64 resamplePeriod;
+    qreal binSize;
+    bool perFlowAnalysis;
+    qreal lossThreshold;
+    int numResamplings;
+    qreal gapThreshold;
+    int numThreads;
+    bool benchmarkThreads;
+    bool useCache;
+};
+
+// Parses the options of --process-results that follow the experiment
+static bool parseProcessResultsParams(QStringList params, ProcessResultsParams &p)
 {
-    if (params.isEmpty()) {
-        qDebug() << "Missing argument for processResults";
-        return false;
-    }
-    QString fileName = params.takeFirst();
-    quint64 resamplePeriod = 0;
-    qreal binSize = 1.0e9;
-    bool perFlowAnalysis = false;
-    qreal lossThreshold = 1.0 / 100.0;
-    int numResamplings = 1;
-    qreal gapThreshold = 50.0 / 100.0;
     while (!params.isEmpty()) {
         if (params.first() == "resample") {
             params.removeFirst();
             if (!params.isEmpty()) {
                 bool ok;
-                resamplePeriod = timeFromString(params.first(), &ok);
+                p.resamplePeriod = timeFromString(params.first(), &ok);
                 if (!ok) {
                     qDebug() << "Bad argument for resample:" << params;
                     return false;
@@ -1872,7 +2356,7 @@ bool processResults(QStringList params)
             params.removeFirst();
             if (!params.isEmpty()) {
                 bool ok;
-                binSize = params.first().toDouble(&ok);
+                p.binSize = params.first().toDouble(&ok);
                 if (!ok) {
                     qDebug() << "Bad argument for bin:" << params;
                     return false;
@@ -1885,18 +2369,18 @@ bool processResults(QStringList params)
             }
         } else if (params.first() == "flows") {
             params.removeFirst();
-            perFlowAnalysis = true;
+            p.perFlowAnalysis = true;
             continue;
         } else if (params.first() == "paths") {
             params.removeFirst();
-            perFlowAnalysis = false;
+            p.perFlowAnalysis = false;
             continue;
         } else if (params.first() == "lossThreshold") {
             params.removeFirst();
             if (!params.isEmpty()) {
                 bool ok;
-                lossThreshold = params.first().toDouble(&ok);
-                if (!ok || lossThreshold < 0 || lossThreshold > 1) {
+                p.lossThreshold = params.first().toDouble(&ok);
+                if (!ok || p.lossThreshold < 0 || p.lossThreshold > 1) {
                     qDebug() << "Bad argument for lossThreshold:" << params;
                     return false;
                 }
@@ -1910,8 +2394,8 @@ bool processResults(QStringList params)
             params.removeFirst();
             if (!params.isEmpty()) {
                 bool ok;
-                numResamplings = params.first().toInt(&ok);
-                if (!ok || numResamplings < 0) {
+                p.numResamplings = params.first().toInt(&ok);
+                if (!ok || p.numResamplings < 0) {
                     qDebug() << "Bad argument for numResamplings:" << params;
                     return false;
                 }
@@ -1925,8 +2409,8 @@ bool processResults(QStringList params)
             params.removeFirst();
             if (!params.isEmpty()) {
                 bool ok;
-                gapThreshold = params.first().toDouble(&ok);
-                if (!ok || gapThreshold < 0) {
+                p.gapThreshold = params.first().toDouble(&ok);
+                if (!ok || p.gapThreshold < 0) {
                     qDebug() << "Bad argument for gapThreshold:" << params;
                     return false;
                 }
@@ -1936,9 +2420,66 @@ bool processResults(QStringList params)
                 qDebug() << "Missing argument for bin:" << params;
                 return false;
             }
+        } else if (params.first() == "threads") {
+            params.removeFirst();
+            if (!params.isEmpty()) {
+                bool ok;
+                p.numThreads = params.first().toInt(&ok);
+                if (!ok || p.numThreads < 1) {
+                    qDebug() << "Bad argument for threads:" << params;
+                    return false;
+                }
+                params.removeFirst();
+                continue;
+            } else {
+                qDebug() << "Missing argument for threads:" << params;
+                return false;
+            }
+        } else if (params.first() == "benchmarkThreads") {
+            params.removeFirst();
+            p.benchmarkThreads = true;
+            continue;
+        } else if (params.first() == "noCache") {
+            params.removeFirst();
+            p.useCache = false;
+            continue;
         }
         qDebug() << "Bad argument for --process-results:" << params;
         return false;
     }
-    return processResults(fileName, resamplePeriod, binSize, lossThreshold, numResamplings, gapThreshold, perFlowAnalysis);
+    return true;
+}
+
+bool processResults(QStringList params)
+{
+    if (params.isEmpty()) {
+        qDebug() << "Missing argument for processResults";
+        return false;
+    }
+    QString fileName = params.takeFirst();
+    ProcessResultsParams p;
+    if (!parseProcessResultsParams(params, p))
+        return false;
+    return processResults(fileName, p.resamplePeriod, p.binSize, p.lossThreshold, p.numResamplings, p.gapThreshold,
+                          p.perFlowAnalysis, p.numThreads, p.benchmarkThreads, p.useCache);
+}
+
+bool analysisReportFileNames(QString workingDir, QStringList params, QString &linkReport, QString &seqReport)
+{
+    ProcessResultsParams p;
+    if (!parseProcessResultsParams(params, p))
+        return false;
+    QString experimentSuffix;
+    QString intervalSizeText;
+    if (!readFile(workingDir + "/" + "experiment-suffix.txt", experimentSuffix) ||
+        !readFile(workingDir + "/" + "analysis-interval-size.txt", intervalSizeText))
+        return false;
+    bool ok;
+    quint64 intervalSize = intervalSizeText.trimmed().toULongLong(&ok);
+    if (!ok)
+        return false;
+    linkReport = linkAnalysisReportName(experimentSuffix, intervalSize, p.lossThreshold) + ".txt";
+    seqReport = seqAnalysisReportName(experimentSuffix, intervalSize, p.binSize,
+                                      p.lossThreshold, p.numResamplings, p.gapThreshold) + ".txt";
+    return true;
 }
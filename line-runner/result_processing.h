@@ -25,6 +25,11 @@
 
 bool processResults(QStringList params);
 
+// Gets the file names (relative to workingDir) of the link and link sequence analysis reports written by
+// processResults() for the experiment workingDir, given the same options that follow the experiment.
+// Returns false if the options are invalid or the experiment has not been analyzed.
+bool analysisReportFileNames(QString workingDir, QStringList params, QString &linkReport, QString &seqReport);
+
 #else
 
 inline bool processResults(QStringList params) {
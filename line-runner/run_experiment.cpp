@@ -320,8 +320,11 @@ bool doGenericSimulation(NetGraph &g, const RunParams &runParams)
 	if (!mustStop) {
 		// Start the clients
 		foreach (PointerSsh ssh, sshHosts) {
-            QString multiplexerCmd = QString("line-traffic --master %1.graph").
-									 arg(runParams.graphName);
+			// Per-flow records (see line-traffic/flowlog.h)
+			QString multiplexerCmd = QString("line-traffic --master %1.graph --flow-log %2/flows-%3.log").
+									 arg(runParams.graphName).
+									 arg(testId).
+									 arg(ssh->getHostname());
 			qDebug() << QString("Multiplexer command: %1").arg(multiplexerCmd);
 			allKeys[ssh.data()] = multiplexerKeys[ssh.data()] = ssh->startProcess(multiplexerCmd);
 		}
@@ -553,6 +556,14 @@ bool doGenericSimulation(NetGraph &g, const RunParams &runParams)
 		}
 	}
 
+	// Save the flow logs
+	foreach (PointerSsh ssh, sshHosts) {
+		if (!ssh->downloadFromRemote(QString("%1/flows-%2.log").arg(testId).arg(ssh->getHostname()),
+									 runParams.workingDir)) {
+			qError() << "Could not download the flow log.";
+		}
+	}
+
 	// Cleanup
 	foreach (PointerSsh ssh, sshAll) {
 		QString key = ssh->startProcess("rm", QStringList() << QString("-rf") <<
@@ -18,9 +18,190 @@
 
 #include "simulate_experiment.h"
 
+#include "chronometer.h"
 #include "intervalmeasurements.h"
 #include "util.h"
 
+// Number of intervals generated at a time, before their counters are recorded
+#define SIMULATION_CHUNK_INTERVALS 1024
+
+// Packet counts generated for a chunk of consecutive intervals of the simulation, in flat arrays.
+// A path hop is the position of an edge along a path; the hops of all the paths are numbered
+// consecutively, starting at pathHopOffset[path].
+class SimulatedIntervals {
+public:
+	SimulatedIntervals(int numIntervals, int numPaths, int numPathHops) :
+		numPaths(numPaths),
+		numPathHops(numPathHops),
+		pathPacketsInFlight(numIntervals * numPaths),
+		edgePacketsInFlight(numIntervals * numPathHops),
+		edgePacketsDropped(numIntervals * numPathHops)
+	{}
+
+	int numPaths;
+	int numPathHops;
+	// Index: interval in the chunk * numPaths + path
+	QVector<int> pathPacketsInFlight;
+	// Index: interval in the chunk * numPathHops + path hop
+	QVector<int> edgePacketsInFlight;
+	QVector<int> edgePacketsDropped;
+};
+
+// Generates the packets forwarded and dropped in each interval, given the congestion state of the links.
+// Intervals are independent, so they can be generated in parallel. Each one uses its own random generator,
+// seeded from seed and the index of the interval, so the result does not depend on the number of threads.
+// operator()(k) generates interval firstInterval + k into position k of result.
+class IntervalSimulation {
+public:
+	IntervalSimulation(const QVector<QVector<BitArray> > &linkCongestionPerClass,
+					   const QVector<QVector<qint32> > &pathEdges,
+					   const QVector<int> &pathHopOffset,
+					   const QVector<qint32> &connection2path,
+					   const QVector<int> &connectionTrafficClass,
+					   qreal minLossRateOfCongestedLink,
+					   qreal maxLossRateOfCongestedLink,
+					   qreal minLossRateOfGoodLink,
+					   qreal maxLossRateOfGoodLink,
+					   qreal congestedRateNoise,
+					   qreal goodRateNoise,
+					   int numPackets,
+					   bool perfectDropSampling,
+					   quint32 seed,
+					   SimulatedIntervals &result) :
+		firstInterval(0),
+		linkCongestionPerClass(linkCongestionPerClass),
+		pathEdges(pathEdges),
+		pathHopOffset(pathHopOffset),
+		connection2path(connection2path),
+		connectionTrafficClass(connectionTrafficClass),
+		minLossRateOfCongestedLink(minLossRateOfCongestedLink),
+		maxLossRateOfCongestedLink(maxLossRateOfCongestedLink),
+		minLossRateOfGoodLink(minLossRateOfGoodLink),
+		maxLossRateOfGoodLink(maxLossRateOfGoodLink),
+		congestedRateNoise(congestedRateNoise),
+		goodRateNoise(goodRateNoise),
+		numPackets(numPackets),
+		perfectDropSampling(perfectDropSampling),
+		seed(seed),
+		result(result)
+	{
+		numTrafficClasses = linkCongestionPerClass.isEmpty() ? 0 : linkCongestionPerClass.first().count();
+		// Random numbers needed per interval: a loss rate per link and class, then a noisy rate per
+		// connection and link along its path
+		numRandomValues = linkCongestionPerClass.count() * numTrafficClasses;
+		for (int c = 0; c < connection2path.count(); c++) {
+			numRandomValues += pathEdges[connection2path[c]].count();
+		}
+	}
+
+	void operator()(int k) {
+		const int i = firstInterval + k;
+		std::seed_seq seedSequence{seed, quint32(i)};
+		std::mt19937 randGen(seedSequence);
+
+		// Draw all the uniform values of the interval at once
+		QVector<qreal> randomValues(numRandomValues);
+		for (int r = 0; r < numRandomValues; r++) {
+			randomValues[r] = frandmt(randGen);
+		}
+		int nextRandom = 0;
+
+		// Loss rate per link, per class; index: link * numTrafficClasses + class
+		QVector<qreal> transRatePerClass(linkCongestionPerClass.count() * numTrafficClasses);
+		for (int e = 0; e < linkCongestionPerClass.count(); e++) {
+			for (int c = 0; c < numTrafficClasses; c++) {
+				qreal u = randomValues[nextRandom++];
+				if (linkCongestionPerClass[e][c].testBit(i)) {
+					transRatePerClass[e * numTrafficClasses + c] =
+							1.0 - (minLossRateOfCongestedLink + (maxLossRateOfCongestedLink - minLossRateOfCongestedLink) * u);
+				} else {
+					transRatePerClass[e * numTrafficClasses + c] =
+							1.0 - (minLossRateOfGoodLink + (maxLossRateOfGoodLink - minLossRateOfGoodLink) * u);
+				}
+			}
+		}
+
+		int *pathPacketsInFlight = result.pathPacketsInFlight.data() + k * result.numPaths;
+		int *edgePacketsInFlight = result.edgePacketsInFlight.data() + k * result.numPathHops;
+		int *edgePacketsDropped = result.edgePacketsDropped.data() + k * result.numPathHops;
+		qFill(pathPacketsInFlight, pathPacketsInFlight + result.numPaths, 0);
+		qFill(edgePacketsInFlight, edgePacketsInFlight + result.numPathHops, 0);
+		qFill(edgePacketsDropped, edgePacketsDropped + result.numPathHops, 0);
+
+		// Forward packets over each connection.
+		// Noise is added to the rate of the class to get the transmission rate of each flow; it is only
+		// needed for the links along the path of the flow.
+		QVector<qreal> transRatePerHop;
+		for (int c = 0; c < connection2path.count(); c++) {
+			int p = connection2path[c];
+			int trafficClass = connectionTrafficClass[c];
+			const QVector<qint32> &edges = pathEdges[p];
+			int *hopPacketsInFlight = edgePacketsInFlight + pathHopOffset[p];
+			int *hopPacketsDropped = edgePacketsDropped + pathHopOffset[p];
+			transRatePerHop.resize(edges.count());
+			for (int hop = 0; hop < edges.count(); hop++) {
+				qint32 e = edges[hop];
+				bool congested = linkCongestionPerClass[e][trafficClass].testBit(i);
+				qreal cleanRate = transRatePerClass[e * numTrafficClasses + trafficClass];
+				qreal noise = congested ? congestedRateNoise : goodRateNoise;
+				qreal a = qMax(0.0, cleanRate);
+				qreal b = qMin(1.0, cleanRate + noise);
+				transRatePerHop[hop] = a + (b - a) * randomValues[nextRandom++];
+			}
+
+			pathPacketsInFlight[p] += numPackets;
+			if (!perfectDropSampling) {
+				for (int packet = 0; packet < numPackets; packet++) {
+					for (int hop = 0; hop < edges.count(); hop++) {
+						// Count packet before queueing
+						hopPacketsInFlight[hop]++;
+						// Decide if it is dropped
+						if (frandex2mt(randGen) > transRatePerHop[hop]) {
+							// The packet does not reach any other edges. As a side effect, this reduces the number of
+							// samples for edges that are further on the path, reducing the quality of the sampling.
+							hopPacketsDropped[hop]++;
+							break;
+						}
+					}
+				}
+			} else {
+				int packetsInFlight = numPackets;
+				for (int hop = 0; hop < edges.count(); hop++) {
+					hopPacketsInFlight[hop] += packetsInFlight;
+					int numDropped = (1.0 - transRatePerHop[hop]) * packetsInFlight;
+					hopPacketsDropped[hop] += numDropped;
+					packetsInFlight -= numDropped;
+					if (packetsInFlight <= 0) {
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	// Index of the first interval of the chunk
+	int firstInterval;
+
+protected:
+	const QVector<QVector<BitArray> > &linkCongestionPerClass;
+	const QVector<QVector<qint32> > &pathEdges;
+	const QVector<int> &pathHopOffset;
+	const QVector<qint32> &connection2path;
+	const QVector<int> &connectionTrafficClass;
+	qreal minLossRateOfCongestedLink;
+	qreal maxLossRateOfCongestedLink;
+	qreal minLossRateOfGoodLink;
+	qreal maxLossRateOfGoodLink;
+	qreal congestedRateNoise;
+	qreal goodRateNoise;
+	int numPackets;
+	bool perfectDropSampling;
+	quint32 seed;
+	int numTrafficClasses;
+	int numRandomValues;
+	SimulatedIntervals &result;
+};
+
 bool runSimulation(NetGraph &g, RunParams runParams) {
 	QString testId = runParams.workingDir.split('/', QString::SkipEmptyParts).last();
 	{
@@ -173,17 +354,15 @@ bool runSimulation(NetGraph &g, RunParams runParams) {
 
 	const int numIntervals = runParams.estimatedDuration / runParams.intervalSize;
 
-	QVector<QVector<QVector<bool> > > linkCongestionPerClassPerInterval;
+	// 1st index: link, 2nd index: class; one bit per interval, set if congested
+	QVector<QVector<BitArray> > linkCongestionPerClassPerInterval;
 	linkCongestionPerClassPerInterval.resize(g.edges.count());
 	QVector<int> intervals(numIntervals);
 	for (int i = 0; i < numIntervals; i++) {
 		intervals[i] = i;
 	}
 	foreach (NetGraphEdge e, g.edges) {
-		linkCongestionPerClassPerInterval[e.index].resize(numTrafficClasses);
-		for (int c = 0; c < numTrafficClasses; c++) {
-			linkCongestionPerClassPerInterval[e.index][c].resize(numIntervals);
-		}
+		linkCongestionPerClassPerInterval[e.index].fill(BitArray(numIntervals), numTrafficClasses);
 		bool neutral = e.isNeutral();
 		if (!perfectCongestionSampling) {
 			for (int i = 0; i < numIntervals; i++) {
@@ -198,7 +377,7 @@ bool runSimulation(NetGraph &g, RunParams runParams) {
 							congested = frandex2mt(randGen) < linkCongestionProbabilityPerClass[e.index][c];
 						}
 					}
-					linkCongestionPerClassPerInterval[e.index][c][i] = congested;
+					linkCongestionPerClassPerInterval[e.index][c].setBit(i, congested);
 				}
 			}
 		} else {
@@ -207,7 +386,7 @@ bool runSimulation(NetGraph &g, RunParams runParams) {
 				for (int i = 0; i < numIntervals * linkCongestionProbabilityPerClass[e.index][0]; i++) {
 					// All traffic classes are congested at the same time
 					for (int c = 0; c < numTrafficClasses; c++) {
-						linkCongestionPerClassPerInterval[e.index][c][intervals[i]] = true;
+						linkCongestionPerClassPerInterval[e.index][c].setBit(intervals[i], 1);
 					}
 				}
 			} else {
@@ -215,14 +394,14 @@ bool runSimulation(NetGraph &g, RunParams runParams) {
 				// Congest class 0 first, which makes all other classes congested
 				for (int i = 0; i < numIntervals * linkCongestionProbabilityPerClass[e.index][0]; i++) {
 					for (int c = 0; c < numTrafficClasses; c++) {
-						linkCongestionPerClassPerInterval[e.index][c][intervals[i]] = true;
+						linkCongestionPerClassPerInterval[e.index][c].setBit(intervals[i], 1);
 					}
 				}
 				// Now congest classes 1+
 				for (int c = 0; c < numTrafficClasses; c++) {
 					qShuffle(intervals);
 					for (int i = 0; i < numIntervals * linkCongestionProbabilityPerClass[e.index][c]; i++) {
-						linkCongestionPerClassPerInterval[e.index][c][intervals[i]] = true;
+						linkCongestionPerClassPerInterval[e.index][c].setBit(intervals[i], 1);
 					}
 				}
 			}
@@ -231,9 +410,14 @@ bool runSimulation(NetGraph &g, RunParams runParams) {
 
 	QVector<qint32> connection2path = g.getConnection2PathMapping();
 	QVector<QVector<qint32> > pathEdges;
+	QVector<int> pathHopOffset;
+	int numPathHops = 0;
 	{
 		pathEdges.resize(g.paths.count());
+		pathHopOffset.resize(g.paths.count());
 		for (int p = 0; p < g.paths.count(); p++) {
+			pathHopOffset[p] = numPathHops;
+			numPathHops += g.paths[p].edgeList.count();
 			pathEdges[p].resize(g.paths[p].edgeList.count());
 			int iEdge = 0;
 			foreach (NetGraphEdge e, g.paths[p].edgeList) {
@@ -253,87 +437,67 @@ bool runSimulation(NetGraph &g, RunParams runParams) {
                                                   g.getSparseRoutingMatrixTransposed(),
                                                   1400);
 
-		for (int i = 0; i < numIntervals; i++) {
-			qDebug() << QString("Generating data for interval %1...").arg(i + 1);
-			// The current time is stored in t.
-			// Add 1 ns to make sure we are not exactly between intervals; normally not a problem, but better be safe.
-			quint64 t = i * runParams.intervalSize + 1;
+		const int numPackets = 10000;
+		const int packetSize = 1000;
 
-			// 1st index: link, 2nd index: connection (flow)
-			QList<QList<qreal> > linkTransRatesPerFlow;
-			foreach (NetGraphEdge e, g.edges) {
-				QList<qreal> transRatePerClass;
-				for (int c = 0; c < numTrafficClasses; c++) {
-					bool congested = linkCongestionPerClassPerInterval[e.index][c][i];
-					if (congested) {
-						transRatePerClass << 1.0 - frand2mt(randGen,
-															minLossRateOfCongestedLink,
-															maxLossRateOfCongestedLink);
-					} else {
-						transRatePerClass << 1.0 - frand2mt(randGen,
-															minLossRateOfGoodLink,
-															maxLossRateOfGoodLink);
-					}
-				}
-				// Add noise to get transmission rates per flow
-				QList<qreal> transRatePerFlow;
-				for (int c = 0; c < g.connections.count(); c++) {
-					int trafficClass = g.connections[c].trafficClass;
-					bool congested = linkCongestionPerClassPerInterval[e.index][trafficClass][i];
-					qreal cleanRate = transRatePerClass[trafficClass];
-					qreal noise = congested ? congestedRateNoise : goodRateNoise;
-					qreal noisyRate = frand2mt(randGen,
-											   qMax(0.0, cleanRate),
-											   qMin(1.0, cleanRate + noise));
-					transRatePerFlow << noisyRate;
-				}
-				linkTransRatesPerFlow << transRatePerFlow;
-			}
+		QVector<int> connectionTrafficClass(g.connections.count());
+		for (int c = 0; c < g.connections.count(); c++) {
+			connectionTrafficClass[c] = g.connections[c].trafficClass;
+		}
 
-			// Forward packets over each connection
-			const int numPackets = 10000;
-            const int packetSize = 1000;
-			for (int c = 0; c < g.connections.count(); c++) {
-				int p = connection2path[c];
-				if (!perfectDropSampling) {
-					for (int packet = 0; packet < numPackets; packet++) {
-                        experimentIntervalMeasurements.countPacketInFLightPath(p, t, t, packetSize, 1);
-						bool dropped = false;
-						foreach (qint32 e, pathEdges[p]) {
-							qreal transRate = linkTransRatesPerFlow[e][c];
-							// Count packet before queueing
-                            experimentIntervalMeasurements.countPacketInFLightEdge(e, p, t, t, packetSize, 1);
-							// Decide if it is dropped
-							qreal v = frandex2mt(randGen);
-							if (v > transRate) {
-								// drop
-								dropped = true;
-							}
-							// Count as dropped if necessary, and stop forwarding along the path
-							if (dropped) {
-                                experimentIntervalMeasurements.countPacketDropped(e, p, t, t, packetSize, 1);
-								// The packet does not reach any other edges. As a side effect, this reduces the number of
-								// samples for edges that are further on the path, reducing the quality of the sampling.
-								break;
-							}
-						}
-					}
-				} else {
-					int packetsInFlight = numPackets;
-                    experimentIntervalMeasurements.countPacketInFLightPath(p, t, t, packetSize, packetsInFlight);
-					foreach (qint32 e, pathEdges[p]) {
-                        experimentIntervalMeasurements.countPacketInFLightEdge(e, p, t, t, packetSize, packetsInFlight);
-						qreal transRate = linkTransRatesPerFlow[e][c];
-						int numDropped = (1.0 - transRate) * packetsInFlight;
-                        experimentIntervalMeasurements.countPacketDropped(e, p, t, t, packetSize, numDropped);
-						packetsInFlight -= numDropped;
-						if (packetsInFlight <= 0) {
+		qDebug() << QString("Generating data for %1 intervals...").arg(numIntervals);
+		Chronometer chrono("Simulation", true);
+		// Generated and recorded one chunk at a time, so that memory does not grow with the number of intervals
+		SimulatedIntervals simulatedIntervals(qMin(numIntervals, SIMULATION_CHUNK_INTERVALS),
+											  pathEdges.count(),
+											  numPathHops);
+		IntervalSimulation intervalSimulation(linkCongestionPerClassPerInterval,
+											  pathEdges,
+											  pathHopOffset,
+											  connection2path,
+											  connectionTrafficClass,
+											  minLossRateOfCongestedLink,
+											  maxLossRateOfCongestedLink,
+											  minLossRateOfGoodLink,
+											  maxLossRateOfGoodLink,
+											  congestedRateNoise,
+											  goodRateNoise,
+											  numPackets,
+											  perfectDropSampling,
+											  randGen(),
+											  simulatedIntervals);
+		for (int firstInterval = 0; firstInterval < numIntervals; firstInterval += SIMULATION_CHUNK_INTERVALS) {
+			int chunkIntervals = qMin(SIMULATION_CHUNK_INTERVALS, numIntervals - firstInterval);
+			intervalSimulation.firstInterval = firstInterval;
+			parallelFor(chunkIntervals, intervalSimulation, getNumCoresLinux());
+
+			// Record the counters, adding up the connections that share a path
+			for (int k = 0; k < chunkIntervals; k++) {
+				// The current time is stored in t.
+				// Add 1 ns to make sure we are not exactly between intervals; normally not a problem, but better be safe.
+				quint64 t = quint64(firstInterval + k) * runParams.intervalSize + 1;
+				const int *pathPacketsInFlight = simulatedIntervals.pathPacketsInFlight.constData() + k * pathEdges.count();
+				const int *edgePacketsInFlight = simulatedIntervals.edgePacketsInFlight.constData() + k * numPathHops;
+				const int *edgePacketsDropped = simulatedIntervals.edgePacketsDropped.constData() + k * numPathHops;
+				for (int p = 0; p < pathEdges.count(); p++) {
+					if (pathPacketsInFlight[p] == 0)
+						continue;
+					experimentIntervalMeasurements.countPacketInFLightPath(p, t, t, packetSize,
+																		   pathPacketsInFlight[p]);
+					for (int hop = 0; hop < pathEdges[p].count(); hop++) {
+						int pathHop = pathHopOffset[p] + hop;
+						if (edgePacketsInFlight[pathHop] == 0)
 							break;
-						}
+						qint32 e = pathEdges[p][hop];
+						experimentIntervalMeasurements.countPacketInFLightEdge(e, p, t, t, packetSize,
+																			   edgePacketsInFlight[pathHop]);
+						experimentIntervalMeasurements.countPacketDropped(e, p, t, t, packetSize,
+																		  edgePacketsDropped[pathHop]);
 					}
 				}
 			}
 		}
+		qDebug() << chrono.elapsedText("generate the interval data");
 
 		experimentIntervalMeasurements.save(runParams.workingDir + "/interval-measurements.data");
 	}
@@ -0,0 +1,41 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "connectiontype.h"
+
+ConnectionType connectionTypeFromName(QString basicType)
+{
+	if (basicType == "TCP") {
+		return ConnectionTypeTCP;
+	} else if (basicType == "TCPx") {
+		return ConnectionTypeTCPx;
+	} else if (basicType == "TCP-Poisson-Pareto") {
+		return ConnectionTypeTCPPoissonPareto;
+	} else if (basicType == "TCP-DASH") {
+		return ConnectionTypeTCPDash;
+	} else if (basicType == "TCP-Trace") {
+		return ConnectionTypeTCPTrace;
+	} else if (basicType == "UDP-CBR") {
+		return ConnectionTypeUDPCBR;
+	} else if (basicType == "UDP-VBR") {
+		return ConnectionTypeUDPVBR;
+	} else if (basicType == "UDP-VCBR") {
+		return ConnectionTypeUDPVCBR;
+	}
+	return ConnectionTypeUnknown;
+}
@@ -0,0 +1,41 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef CONNECTIONTYPE_H
+#define CONNECTIONTYPE_H
+
+#include <QtCore>
+
+// The connection types supported by line-traffic. The basicType string of each connection is
+// resolved once after loading the graph, so that the per-event code does not compare strings.
+enum ConnectionType {
+	ConnectionTypeUnknown = 0,
+	ConnectionTypeTCP,
+	ConnectionTypeTCPx,
+	ConnectionTypeTCPPoissonPareto,
+	ConnectionTypeTCPDash,
+	ConnectionTypeTCPTrace,
+	ConnectionTypeUDPCBR,
+	ConnectionTypeUDPVBR,
+	ConnectionTypeUDPVCBR
+};
+
+// Returns ConnectionTypeUnknown for unsupported types.
+ConnectionType connectionTypeFromName(QString basicType);
+
+#endif // CONNECTIONTYPE_H
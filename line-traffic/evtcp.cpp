@@ -19,14 +19,20 @@
 #include "evtcp.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <linux/tcp.h>
+#include <linux/errqueue.h>
+#include <sys/uio.h>
 
 #include "chronometer.h"
+#include "flowlog.h"
+#include "payload.h"
+#include "slabpool.h"
 #include "util.h"
 
 #ifdef DEBUG
@@ -34,6 +40,11 @@
 #endif
 #define DEBUG 0
 
+// MSG_ZEROCOPY appeared in Linux 4.14
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define TCP_HAVE_ZEROCOPY 1
+#endif
+
 bool setTCPSocketReceiveWindow(int fd, int win) {
 	int recv_win = win;
 	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &recv_win, sizeof(recv_win)) < 0) {
@@ -53,6 +64,23 @@ bool setTCPSocketCongestionControl(int fd, QString congestionControl) {
 	return true;
 }
 
+// Returns false if the kernel does not support MSG_ZEROCOPY (the sends are then copied as usual)
+bool setTCPSocketZeroCopy(int fd) {
+#ifdef TCP_HAVE_ZEROCOPY
+	int one = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+		return false;
+	}
+	return true;
+#else
+	Q_UNUSED(fd);
+	return false;
+#endif
+}
+
+// Watchers of the endpoints of the calling thread
+static thread_local SlabPool<struct ev_io> ioWatcherPool;
+
 TCPClient::TCPClient(int fd) :
 	ReaderWriter(fd)
 {
@@ -67,6 +95,12 @@ TCPClient::TCPClient(int fd) :
 	loop = NULL;
 	transferCompletedCallback = NULL;
 	transferCompletedCallbackArg = NULL;
+	pendingPayload = 0;
+	pendingPayloadNullTerminated = false;
+	zeroCopy = false;
+	zeroCopyOutstanding = 0;
+	tCreate = getCurrentTimeNanosec();
+	transferCompleted = false;
 }
 
 TCPClient::~TCPClient()
@@ -74,17 +108,17 @@ TCPClient::~TCPClient()
 	qDebugT() << fd();
 	if (w_connect) {
 		ev_io_stop(loop, w_connect);
-		free(w_connect);
+		ioWatcherPool.release(w_connect);
 		w_connect = 0;
 	}
 	if (w_read) {
 		ev_io_stop(loop, w_read);
-		free(w_read);
+		ioWatcherPool.release(w_read);
 		w_read = 0;
 	}
 	if (w_write) {
 		ev_io_stop(loop, w_write);
-		free(w_write);
+		ioWatcherPool.release(w_write);
 		w_write = 0;
 	}
 }
@@ -98,43 +132,176 @@ TCPClient* TCPClient::makeTCPClient(int fd, void *arg)
 // never call this directly
 qint64 TCPClient::read()
 {
+	// The data is passed to onRead() as views of this buffer (QByteArray::fromRawData()),
+	// so it is never copied. The views are valid only until onRead() returns.
+	static __thread char buffer[TCP_READ_BUFFER];
 	qint64 result = 0;
-	QByteArray readBuffer;
+	struct iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = TCP_READ_BUFFER;
+	if (zeroCopyOutstanding > 0) {
+		// A non-empty error queue is reported as readable (EPOLLERR) until it is drained, so the
+		// completions must be reaped here too, not only on the next write
+		reapZeroCopyCompletions();
+	}
 	while (1) {
-		char buffer[20000];
-		ssize_t count = recv(m_fd, buffer, 20000, 0);
-		if (count <= 0) {
-			if (count == EWOULDBLOCK || count == EAGAIN) {
-				// nothing
-			} else {
-				result = count;
-			}
-		} else {
-			result += count;
+		ssize_t count = readv(m_fd, &iov, 1);
+		if (count == 0) {
+			// closed by the peer
+			return 0;
+		} else if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			// Nothing more to read (EAGAIN), or an error
+			return result > 0 ? result : -1;
 		}
-		if (count <= 0)
-			break;
-		readBuffer.append(buffer, count);
+		result += count;
+		totalRead += count;
+		onRead(QByteArray::fromRawData(buffer, count));
+		if (count < TCP_READ_BUFFER)
+			return result;
 	}
-	totalRead += readBuffer.count();
-	onRead(readBuffer);
-	return result;
 }
 
 // call this to write
 void TCPClient::write(QByteArray b)
 {
+	if (pendingPayload > 0) {
+		copyPendingPayload();
+	}
 	writeBuffer.append(b);
+	flushWrites();
+}
+
+// call this to write
+void TCPClient::writePayload(qint64 length, bool nullTerminated)
+{
+	if (length <= 0)
+		return;
+	if (pendingPayloadNullTerminated) {
+		// The terminator must stay in the middle of the stream
+		copyPendingPayload();
+	}
+	pendingPayload += length;
+	pendingPayloadNullTerminated = nullTerminated;
+	flushWrites();
+}
+
+void TCPClient::copyPendingPayload()
+{
+	while (pendingPayload > 0) {
+		qint64 chunk = qMin(pendingPayload, (qint64)PAYLOAD_SIZE);
+		const char *data = (pendingPayloadNullTerminated && chunk == pendingPayload) ?
+							   payloadDataNullTerminated(chunk) :
+							   payloadData(chunk);
+		writeBuffer.append(data, chunk);
+		pendingPayload -= chunk;
+	}
+	pendingPayloadNullTerminated = false;
+}
+
+void TCPClient::flushWrites()
+{
+	if (zeroCopyOutstanding > 0) {
+		reapZeroCopyCompletions();
+	}
+
+	while (!writeBuffer.isEmpty() || pendingPayload > 0) {
+		// Only the payload region may be sent with MSG_ZEROCOPY: the kernel reads the pages until
+		// the completion is reaped, while the space of writeBuffer is reused as soon as it is
+		// consumed. If the payload is going to be sent without copying, writeBuffer goes out first
+		// in a send of its own.
+		bool zeroCopyPayload = false;
+#ifdef TCP_HAVE_ZEROCOPY
+		zeroCopyPayload = zeroCopy && pendingPayload >= TCP_ZEROCOPY_MIN;
+#endif
+		struct iovec iov[TCP_WRITE_IOV];
+		int iovcnt = writeBuffer.segments(iov);
+		qint64 total = writeBuffer.count();
+		// The payload region is immutable, so several buffers can point to it
+		qint64 payloadLeft = pendingPayload;
+		while (payloadLeft > 0 && iovcnt < TCP_WRITE_IOV && (writeBuffer.isEmpty() || !zeroCopyPayload)) {
+			qint64 chunk = qMin(payloadLeft, (qint64)PAYLOAD_SIZE);
+			const char *data = (pendingPayloadNullTerminated && chunk == payloadLeft) ?
+								   payloadDataNullTerminated(chunk) :
+								   payloadData(chunk);
+			iov[iovcnt].iov_base = (void*)data;
+			iov[iovcnt].iov_len = chunk;
+			total += chunk;
+			payloadLeft -= chunk;
+			iovcnt++;
+		}
+
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
 
-	while (!writeBuffer.isEmpty()) {
-		ssize_t count = send(m_fd, writeBuffer.constData(), writeBuffer.count(), 0);
+		int flags = 0;
+#ifdef TCP_HAVE_ZEROCOPY
+		if (zeroCopyPayload && writeBuffer.isEmpty() && pendingPayload - payloadLeft >= TCP_ZEROCOPY_MIN) {
+			flags |= MSG_ZEROCOPY;
+		}
+		Q_ASSERT(!(flags & MSG_ZEROCOPY) || writeBuffer.isEmpty());
+#endif
+		ssize_t count = sendmsg(m_fd, &msg, flags);
+#ifdef TCP_HAVE_ZEROCOPY
+		if (count < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+			// Too many notifications pending (optmem limit): send this one with a copy
+			reapZeroCopyCompletions();
+			flags &= ~MSG_ZEROCOPY;
+			count = sendmsg(m_fd, &msg, flags);
+		}
+		if (count > 0 && (flags & MSG_ZEROCOPY)) {
+			zeroCopyOutstanding++;
+		}
+#endif
 		if (count <= 0)
 			break;
-		writeBuffer.remove(0, count);
 		totalWritten += count;
+
+		qint64 fromBuffer = qMin((qint64)count, (qint64)writeBuffer.count());
+		writeBuffer.consume(fromBuffer);
+		pendingPayload -= count - fromBuffer;
+		if (pendingPayload == 0) {
+			pendingPayloadNullTerminated = false;
+		}
+		// A partial send means the socket buffer is full
+		if (count < total)
+			break;
 	}
 }
 
+void TCPClient::reapZeroCopyCompletions()
+{
+#ifdef TCP_HAVE_ZEROCOPY
+	while (zeroCopyOutstanding > 0) {
+		char control[128];
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(m_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+		for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR)
+				continue;
+			struct sock_extended_err *err = (struct sock_extended_err*)CMSG_DATA(cm);
+			if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			// The notification covers the sends numbered ee_info to ee_data
+			quint32 completed = err->ee_data - err->ee_info + 1;
+			zeroCopyOutstanding -= qMin(zeroCopyOutstanding, completed);
+			if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				// The kernel copied the data anyway (e.g. loopback, or a NIC without scatter-gather):
+				// zero-copy would only add the notification overhead
+				zeroCopy = false;
+			}
+		}
+	}
+#endif
+}
+
 TCPServer::TCPServer(int fd) :
 	m_fd(fd)
 {
@@ -148,7 +315,7 @@ TCPServer::~TCPServer()
 	qDebugT() << fd();
 	if (w_accept) {
 		ev_io_stop(loop, w_accept);
-		free(w_accept);
+		ioWatcherPool.release(w_accept);
 	}
 }
 
@@ -164,24 +331,62 @@ int TCPServer::fd()
 }
 
 // key = fd
-static QHash<int, TCPClient*> tcpClients;
-static QHash<int, TCPServer*> tcpServers;
-static QHash<int, TCPClient*> tcpServerConnections;
+// Each event loop thread has its own tables: an endpoint is only used by the thread that created it.
+static thread_local QHash<int, TCPClient*> tcpClients;
+static thread_local QHash<int, TCPServer*> tcpServers;
+static thread_local QHash<int, TCPClient*> tcpServerConnections;
 
 static void tcp_server_accept_cb(struct ev_loop *loop, struct ev_io *watcher, int revents);
 static void tcp_server_write_cb(struct ev_loop *loop, struct ev_io *watcher, int revents);
 static void tcp_server_read_cb(struct ev_loop *loop, struct ev_io *watcher, int revents);
 
+// Appends the outcome of the flow of c to the flow log of the thread. Call before closing the socket.
+static void tcp_log_flow(TCPClient *c, bool sink, bool peerClosed)
+{
+	if (!flowLogEnabled())
+		return;
+	FlowLogRecord record;
+	memset(&record, 0, sizeof(record));
+	record.tStart_ns = c->tCreate;
+	record.tEnd_ns = getCurrentTimeNanosec();
+	record.bytesSent = c->totalWritten;
+	record.bytesReceived = c->totalRead;
+	inet_pton(AF_INET, c->localAddress.toLatin1().constData(), &record.localIP);
+	inet_pton(AF_INET, c->remoteAddress.toLatin1().constData(), &record.remoteIP);
+	record.localPort = c->localPort;
+	record.remotePort = c->remotePort;
+	if (sink) {
+		record.flags |= FLOW_LOG_SINK;
+		if (peerClosed) {
+			record.flags |= FLOW_LOG_PEER_CLOSED;
+		}
+	} else if (c->transferCompleted) {
+		record.flags |= FLOW_LOG_COMPLETED;
+	}
+	struct tcp_info info;
+	socklen_t length = sizeof(info);
+	if (getsockopt(c->fd(), IPPROTO_TCP, TCP_INFO, &info, &length) == 0) {
+		record.retransmits = info.tcpi_total_retrans;
+		record.rtt_us = info.tcpi_rtt;
+		record.rttVar_us = info.tcpi_rttvar;
+		record.cwnd_segments = info.tcpi_snd_cwnd;
+		record.flags |= FLOW_LOG_TCP_INFO;
+	}
+	flowLogRecord(record);
+}
+
 static void closeAll()
 {
 	qDebugT();
 	foreach (TCPClient *c, tcpClients.values()) {
+		tcp_log_flow(c, false, false);
 		close(c->fd());
 		c->stop();
 		delete c;
 	}
 	tcpClients.clear();
 	foreach (TCPClient *c, tcpServerConnections.values()) {
+		tcp_log_flow(c, true, false);
 		close(c->fd());
 		c->stop();
 		delete c;
@@ -207,6 +412,8 @@ void tcp_close_client(int fd)
         TCPClient *c = tcpClients[fd];
 		int port = c->localPort;
 		QString address = c->localAddress;
+		tcp_log_flow(c, false, false);
+		c->reapZeroCopyCompletions();
         close(c->fd());
         c->stop();
 		tcpClients.remove(fd);
@@ -217,6 +424,8 @@ void tcp_close_client(int fd)
 			// emulations, or 192.168 in experiments with real traffic.
 			if (sc->remoteAddress.split(".").mid(2) == address.split(".").mid(2) &&
 				sc->remotePort == port) {
+				tcp_log_flow(sc, true, false);
+				sc->reapZeroCopyCompletions();
 				close(sc->fd());
 				sc->stop();
 				tcpServerConnections.remove(sc->fd());
@@ -227,21 +436,25 @@ void tcp_close_client(int fd)
     }
 }
 
-QSet<int> tcp_fds_to_close;
+static thread_local QSet<int> tcp_fds_to_close;
 
 void tcp_deferred_close_client_helper(int, void *)
 {
-	foreach (int fd, tcp_fds_to_close) {
+	// The callbacks may defer more closes: those go into the now empty set, which arms a new
+	// ev_once for them
+	QSet<int> fds = tcp_fds_to_close;
+	tcp_fds_to_close.clear();
+	foreach (int fd, fds) {
 		qDebugT() << fd;
 		if (tcpClients.contains(fd)) {
 			TCPClient *c = tcpClients[fd];
+			c->transferCompleted = true;
 			if (c->transferCompletedCallback) {
 				c->transferCompletedCallback(c->transferCompletedCallbackArg);
 			}
 		}
 		tcp_close_client(fd);
 	}
-	tcp_fds_to_close.clear();
 }
 
 void tcp_deferred_close_client(int fd)
@@ -249,8 +462,11 @@ void tcp_deferred_close_client(int fd)
 	qDebugT() << fd;
 	if (tcpClients.contains(fd)) {
 		TCPClient *c = tcpClients[fd];
+		// The helper closes all the fds in the set
+		if (tcp_fds_to_close.isEmpty()) {
+			ev_once(c->loop, -1, 0, 0, tcp_deferred_close_client_helper, 0);
+		}
 		tcp_fds_to_close.insert(fd);
-		ev_once(c->loop, -1, 0, 0, tcp_deferred_close_client_helper, 0);
 	}
 }
 
@@ -262,8 +478,8 @@ static void tcp_server_accept_cb(struct ev_loop *loop, struct ev_io *watcher, in
 	socklen_t client_len = sizeof(client_addr);
 	char client_addr_str[200] = "";
 	int client_fd;
-	struct ev_io *w_client_write = (struct ev_io*) malloc(sizeof(struct ev_io));
-	struct ev_io *w_client_read = (struct ev_io*) malloc(sizeof(struct ev_io));
+	struct ev_io *w_client_write = ioWatcherPool.allocate();
+	struct ev_io *w_client_read = ioWatcherPool.allocate();
 
 	if (EV_ERROR & revents) {
 		perror("got invalid event");
@@ -271,7 +487,7 @@ static void tcp_server_accept_cb(struct ev_loop *loop, struct ev_io *watcher, in
 	}
 
 	// Accept client request
-	client_fd = accept(watcher->fd, (struct sockaddr *)&client_addr, &client_len);
+	client_fd = accept4(watcher->fd, (struct sockaddr *)&client_addr, &client_len, SOCK_NONBLOCK);
 	qDebugT() << client_fd;
 
 	if (client_fd < 0) {
@@ -279,11 +495,6 @@ static void tcp_server_accept_cb(struct ev_loop *loop, struct ev_io *watcher, in
 		exit(-1);
 	}
 
-	if (fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL, 0) | O_NONBLOCK) < 0) {
-		perror("fcntl error");
-		exit(-1);
-	}
-
 	if (tcpServers[watcher->fd]->tcpReceiveWindow > 0) {
 		if (!setTCPSocketReceiveWindow(client_fd, tcpServers[watcher->fd]->tcpReceiveWindow)) {
 			perror("Error setting receive window size\n");
@@ -301,6 +512,7 @@ static void tcp_server_accept_cb(struct ev_loop *loop, struct ev_io *watcher, in
 	inet_ntop(AF_INET, &client_addr.sin_addr.s_addr, client_addr_str, 200);
 
 	tcpServerConnections[client_fd] = tcpServers[watcher->fd]->clientFactoryCallback(client_fd, tcpServers[watcher->fd]->clientFactoryCallbackArg);
+	tcpServerConnections[client_fd]->zeroCopy = setTCPSocketZeroCopy(client_fd);
 	tcpServerConnections[client_fd]->localAddress = tcpServers[watcher->fd]->localAddress;
 	tcpServerConnections[client_fd]->localPort = tcpServers[watcher->fd]->localPort;
 	tcpServerConnections[client_fd]->remoteAddress = client_addr_str;
@@ -343,6 +555,8 @@ static void tcp_server_read_cb(struct ev_loop *loop, struct ev_io *watcher, int
 	if (code == 0) {
 		// close
 		int fd = watcher->fd;
+		tcp_log_flow(tcpServerConnections[fd], true, true);
+		tcpServerConnections[fd]->reapZeroCopyCompletions();
 		close(fd);
 		tcpServerConnections[fd]->stop();
 		delete tcpServerConnections[fd];
@@ -426,7 +640,7 @@ qint32 tcp_server(struct ev_loop *loop,
 {
 	int fd;
 	struct sockaddr_in addr;
-	struct ev_io *w_accept = (struct ev_io*) malloc(sizeof(struct ev_io));
+	struct ev_io *w_accept = ioWatcherPool.allocate();
 
 	qDebugT() << "TCP server:" << address << ":" << port << "rwin" << tcpReceiveWindow;
 
@@ -518,24 +732,20 @@ qint32 tcp_client(struct ev_loop *loop,
 				  void *transferCompletedCallbackArg)
 {
 	int client_fd;
-	struct ev_io *w_connect = (struct ev_io*) malloc(sizeof(struct ev_io));
-	struct ev_io *w_read = (struct ev_io*) malloc(sizeof(struct ev_io));
+	struct ev_io *w_connect = ioWatcherPool.allocate();
+	struct ev_io *w_read = ioWatcherPool.allocate();
 	struct sockaddr_in addr;
 
 	qDebugT() << "TCP client:" << localAddress  << address << ":" << port << "class" << trafficClass;
 
 	// Create client socket
-	if ((client_fd = socket(PF_INET, SOCK_STREAM, 0)) < 0) {
+	if ((client_fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
 		perror("socket error");
 		exit(-1);
 	}
 
 	qDebugT() << client_fd;
 
-	if (fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL, 0) | O_NONBLOCK) < 0) {
-		perror("fcntl error");
-		exit(-1);
-	}
 	int reuseaddr = 1;
 	if (setsockopt(client_fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) < 0) {
 		perror("socket error");
@@ -591,6 +801,7 @@ qint32 tcp_client(struct ev_loop *loop,
 	tcpClients[client_fd]->w_connect = w_connect;
 	tcpClients[client_fd]->w_read = w_read;
 	tcpClients[client_fd]->loop = loop;
+	tcpClients[client_fd]->zeroCopy = setTCPSocketZeroCopy(client_fd);
 	tcpClients[client_fd]->transferCompletedCallback = transferCompletedCallback;
 	tcpClients[client_fd]->transferCompletedCallbackArg = transferCompletedCallbackArg;
 
@@ -23,12 +23,21 @@
 #include <QtCore>
 
 #include "readerwriter.h"
+#include "ringbuffer.h"
 
 class TCPClient;
 typedef TCPClient* (*TCPClientFactoryCallback)(int, void*);
 
 typedef void (*TCPClientTransferCompletedCallback)(void*);
 
+// Size of the receive buffer; onRead() is called for at most this many bytes at a time
+#define TCP_READ_BUFFER 65536
+// Maximum number of buffers passed to one sendmsg() call
+#define TCP_WRITE_IOV 16
+// Sends of at least this many payload bytes use MSG_ZEROCOPY, if the kernel supports it.
+// Below this, pinning the pages costs more than the copy.
+#define TCP_ZEROCOPY_MIN 32768
+
 class TCPClient : public ReaderWriter {
 public:
 	TCPClient(int fd = -1);
@@ -38,11 +47,29 @@ public:
 
 	// Call this to write
 	virtual void write(QByteArray b);
+	// Call this to write length bytes of the shared payload (see payload.h). Nothing is copied:
+	// the bytes are sent straight from the payload region, and only their count is queued if the
+	// socket buffer is full. If nullTerminated is set, the last byte is '\0'.
+	void writePayload(qint64 length, bool nullTerminated = false);
 	// Never call this directly.
-	// The parameter b is ignored
+	// Calls onRead() with the data received. Returns 0 if the connection was closed by the peer.
 	virtual qint64 read();
-
-	QByteArray writeBuffer;
+	// Reads the zero-copy completion notifications from the error queue of the socket.
+	// Called before reading, writing and closing.
+	void reapZeroCopyCompletions();
+
+	RingBuffer writeBuffer;
+	// Payload bytes queued after writeBuffer
+	qint64 pendingPayload;
+	bool pendingPayloadNullTerminated;
+	// Set if the socket accepts MSG_ZEROCOPY
+	bool zeroCopy;
+	// Number of zero-copy sends not yet acknowledged by the kernel
+	quint32 zeroCopyOutstanding;
+	// Creation time of the endpoint (ns), for the flow log
+	quint64 tCreate;
+	// Set when the source finished its transfer (tcp_deferred_close_client())
+	bool transferCompleted;
 	struct ev_io *w_connect;
 	struct ev_io *w_read;
 	struct ev_io *w_write;
@@ -51,6 +78,12 @@ public:
 	// Other parameters
 	TCPClientTransferCompletedCallback transferCompletedCallback;
 	void *transferCompletedCallbackArg;
+
+protected:
+	// Sends writeBuffer, then pendingPayload, with as few syscalls as possible
+	void flushWrites();
+	// Moves pendingPayload into writeBuffer (to keep the order of the data when write() is called)
+	void copyPendingPayload();
 };
 
 class TCPServer {
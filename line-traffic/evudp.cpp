@@ -24,9 +24,11 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <sys/poll.h>
+#include <string.h>
+#include <sys/socket.h>
 
 #include "chronometer.h"
+#include "payload.h"
 #include "util.h"
 
 #ifdef DEBUG
@@ -43,8 +45,12 @@ UDPClient::UDPClient(int fd) :
 	totalRead = 0;
 	totalWritten = 0;
 	loop = NULL;
+	server = NULL;
 	w_read = NULL;
 	w_write = NULL;
+	w_pace = NULL;
+	paced = false;
+	writeBlocked = false;
 }
 
 UDPClient::~UDPClient()
@@ -60,6 +66,11 @@ UDPClient::~UDPClient()
 		free(w_write);
 		w_write = 0;
 	}
+	if (w_pace) {
+		ev_timer_stop(loop, w_pace);
+		free(w_pace);
+		w_pace = 0;
+	}
 }
 
 UDPClient* UDPClient::makeUDPClient(int fd, void *arg)
@@ -81,17 +92,118 @@ void UDPClient::write(QByteArray b)
 	if (b.count() <= 0 || b.count() > 65536)
 		return;
 
+	if (server) {
+		writeBlocked = !server->queueWrite(remote_addr, b);
+		if (!writeBlocked) {
+			totalWritten += b.count();
+		}
+		return;
+	}
+
 	ssize_t count;
 
 	count = sendto(fd(), b.constData(), b.count(), 0, (struct sockaddr *) &remote_addr, sizeof(remote_addr));
 	if (count <= 0) {
-		perror("sendto");
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			writeBlocked = true;
+		} else {
+			perror("sendto");
+		}
 		return;
 	}
+	writeBlocked = false;
 
 	totalWritten += count;
 }
 
+int UDPClient::writeBurst(const char *data, int length, int count)
+{
+	if (length <= 0 || length > 65536 || count <= 0)
+		return 0;
+	count = qMin(count, UDP_SEND_BURST);
+
+	struct iovec iov;
+	iov.iov_base = (void*)data;
+	iov.iov_len = length;
+	struct mmsghdr msgs[UDP_SEND_BURST];
+	memset(msgs, 0, count * sizeof(struct mmsghdr));
+	for (int i = 0; i < count; i++) {
+		msgs[i].msg_hdr.msg_name = &remote_addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(remote_addr);
+		msgs[i].msg_hdr.msg_iov = &iov;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int sent = sendmmsg(fd(), msgs, count, 0);
+	if (sent < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			writeBlocked = true;
+		} else {
+			perror("sendmmsg");
+		}
+		return 0;
+	}
+	// A partial burst means the socket buffer filled up
+	writeBlocked = sent < count;
+
+	for (int i = 0; i < sent; i++) {
+		totalWritten += msgs[i].msg_len;
+	}
+	return sent;
+}
+
+void UDPClient::writeFrame(const char *header, int headerLength, int frameSize)
+{
+	if (headerLength < 0 || headerLength > frameSize || frameSize <= 0 || frameSize > 65536)
+		return;
+
+	struct iovec iov[2];
+	iov[0].iov_base = (void*)header;
+	iov[0].iov_len = headerLength;
+	iov[1].iov_base = (void*)payloadData(frameSize - headerLength);
+	iov[1].iov_len = frameSize - headerLength;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &remote_addr;
+	msg.msg_namelen = sizeof(remote_addr);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	ssize_t count = sendmsg(fd(), &msg, 0);
+	if (count <= 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			writeBlocked = true;
+		} else {
+			perror("sendmsg");
+		}
+		return;
+	}
+	writeBlocked = false;
+
+	totalWritten += count;
+}
+
+void UDPClient::onPace()
+{
+	// reimplement in child
+}
+
+void UDPClient::schedulePacing(qreal delay)
+{
+	if (!w_pace)
+		return;
+	ev_timer_stop(loop, w_pace);
+	ev_timer_set(w_pace, qMax(delay, 0.0), 0.0);
+	ev_timer_start(loop, w_pace);
+}
+
+void UDPClient::waitWritable()
+{
+	if (!w_write)
+		return;
+	ev_io_start(loop, w_write);
+}
+
 UDPServer::UDPServer(int fd) :
 	m_fd(fd)
 {
@@ -99,10 +211,15 @@ UDPServer::UDPServer(int fd) :
 	loop = NULL;
 	w_read = NULL;
 	w_write = NULL;
+	writeQueueHead = 0;
+	writeQueueDropped = 0;
 }
 
 UDPServer::~UDPServer()
 {
+	if (writeQueueDropped > 0) {
+		qDebug() << "UDP server" << localAddress << localPort << "dropped" << writeQueueDropped << "queued datagrams";
+	}
 	if (w_read) {
 		ev_io_stop(loop, w_read);
 		free(w_read);
@@ -126,11 +243,197 @@ int UDPServer::fd()
 	return m_fd;
 }
 
+bool UDPServer::queueWrite(const struct sockaddr_in &peer, const QByteArray &data)
+{
+	if (writeQueue.count() - writeQueueHead >= UDP_SERVER_QUEUE_MAX) {
+		writeQueueDropped++;
+		return false;
+	}
+	writeQueue.resize(writeQueue.count() + 1);
+	writeQueue.last().peer = peer;
+	writeQueue.last().data = data;
+	// The whole queue is sent from the next EV_WRITE event
+	if (!ev_is_active(w_write)) {
+		ev_io_start(loop, w_write);
+	}
+	return true;
+}
+
+void UDPServer::flushWrites()
+{
+	struct mmsghdr msgs[UDP_SEND_BURST];
+	struct iovec iovecs[UDP_SEND_BURST];
+	while (writeQueueHead < writeQueue.count()) {
+		int count = qMin(UDP_SEND_BURST, writeQueue.count() - writeQueueHead);
+		memset(msgs, 0, count * sizeof(struct mmsghdr));
+		for (int i = 0; i < count; i++) {
+			QueuedDatagram &d = writeQueue[writeQueueHead + i];
+			iovecs[i].iov_base = (void*)d.data.constData();
+			iovecs[i].iov_len = d.data.count();
+			msgs[i].msg_hdr.msg_name = &d.peer;
+			msgs[i].msg_hdr.msg_namelen = sizeof(d.peer);
+			msgs[i].msg_hdr.msg_iov = &iovecs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int sent = sendmmsg(m_fd, msgs, count, 0);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				// Continue when the socket becomes writable
+				compactWriteQueue();
+				return;
+			}
+			perror("server sendmmsg");
+			// Drop the datagram that failed
+			sent = 1;
+		}
+		writeQueueHead += sent;
+		if (sent < count) {
+			// The socket buffer is full
+			compactWriteQueue();
+			return;
+		}
+	}
+	// Keep the capacity for the next batch
+	writeQueue.resize(0);
+	writeQueueHead = 0;
+	ev_io_stop(loop, w_write);
+}
+
+void UDPServer::compactWriteQueue()
+{
+	// Under a steady backlog the queue is never empty, so the sent prefix is removed once it is
+	// at least half of the queue: the queue stays below twice UDP_SERVER_QUEUE_MAX, and each
+	// datagram is moved at most once on average
+	if (writeQueueHead >= UDP_SEND_BURST && writeQueueHead * 2 >= writeQueue.count()) {
+		writeQueue.remove(0, writeQueueHead);
+		writeQueueHead = 0;
+	}
+}
+
+const quint64 UDPClientTable::EmptyKey;
+
+UDPClientTable::UDPClientTable()
+{
+	clear();
+}
+
+int UDPClientTable::home(quint64 key) const
+{
+	return int((key * 0x9E3779B97F4A7C15ULL) >> (64 - m_bits));
+}
+
+int UDPClientTable::find(quint64 key) const
+{
+	const int mask = m_keys.count() - 1;
+	int i = home(key);
+	while (m_keys[i] != key && m_keys[i] != EmptyKey) {
+		i = (i + 1) & mask;
+	}
+	return i;
+}
+
+UDPClient *UDPClientTable::value(quint64 key) const
+{
+	return m_values[find(key)];
+}
+
+void UDPClientTable::insert(quint64 key, UDPClient *client)
+{
+	Q_ASSERT(key != EmptyKey);
+	// Keep the load factor below 1/2
+	if (2 * (m_count + 1) > m_keys.count()) {
+		rehash(2 * m_keys.count());
+	}
+	int i = find(key);
+	if (m_keys[i] == EmptyKey) {
+		m_keys[i] = key;
+		m_count++;
+	}
+	m_values[i] = client;
+}
+
+void UDPClientTable::remove(quint64 key)
+{
+	const int mask = m_keys.count() - 1;
+	int i = find(key);
+	if (m_keys[i] == EmptyKey)
+		return;
+	m_keys[i] = EmptyKey;
+	m_values[i] = NULL;
+	m_count--;
+	// Backward shift deletion: move up the following items of the cluster that can no longer be
+	// reached from their home slot
+	for (int j = (i + 1) & mask; m_keys[j] != EmptyKey; j = (j + 1) & mask) {
+		int k = home(m_keys[j]);
+		bool reachable = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+		if (!reachable) {
+			m_keys[i] = m_keys[j];
+			m_values[i] = m_values[j];
+			m_keys[j] = EmptyKey;
+			m_values[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+void UDPClientTable::clear()
+{
+	m_bits = 4;
+	m_keys = QVector<quint64>(1 << m_bits, EmptyKey);
+	m_values = QVector<UDPClient*>(1 << m_bits, NULL);
+	m_count = 0;
+}
+
+int UDPClientTable::count() const
+{
+	return m_count;
+}
+
+QList<quint64> UDPClientTable::keys() const
+{
+	QList<quint64> result;
+	for (int i = 0; i < m_keys.count(); i++) {
+		if (m_keys[i] != EmptyKey) {
+			result << m_keys[i];
+		}
+	}
+	return result;
+}
+
+QList<UDPClient*> UDPClientTable::values() const
+{
+	QList<UDPClient*> result;
+	for (int i = 0; i < m_keys.count(); i++) {
+		if (m_keys[i] != EmptyKey) {
+			result << m_values[i];
+		}
+	}
+	return result;
+}
+
+void UDPClientTable::rehash(int capacity)
+{
+	QVector<quint64> oldKeys = m_keys;
+	QVector<UDPClient*> oldValues = m_values;
+	m_bits = 0;
+	while ((1 << m_bits) < capacity) {
+		m_bits++;
+	}
+	m_keys = QVector<quint64>(1 << m_bits, EmptyKey);
+	m_values = QVector<UDPClient*>(1 << m_bits, NULL);
+	for (int i = 0; i < oldKeys.count(); i++) {
+		if (oldKeys[i] != EmptyKey) {
+			int j = find(oldKeys[i]);
+			m_keys[j] = oldKeys[i];
+			m_values[j] = oldValues[i];
+		}
+	}
+}
+
 // key = fd
-static QHash<int, UDPClient*> UDPClients;
-static QHash<int, UDPServer*> UDPServers;
-// serverfd -> ip:port -> UDPClien*
-static QHash<int, QHash<QString, UDPClient*> > UDPServerConnections;
+// Each event loop thread has its own tables: an endpoint is only used by the thread that created it.
+static thread_local QHash<int, UDPClient*> UDPClients;
+static thread_local QHash<int, UDPServer*> UDPServers;
 
 static void udp_server_read_cb(struct ev_loop *loop, struct ev_io *watcher, int revents);
 static void udp_server_write_cb(struct ev_loop *loop, struct ev_io *watcher, int revents);
@@ -144,13 +447,13 @@ static void closeAll()
 		delete c;
 	}
 	UDPClients.clear();
-	foreach (int server_fd, UDPServerConnections.uniqueKeys()) {
-		foreach (UDPClient *c, UDPServerConnections[server_fd].values()) {
+	foreach (UDPServer *s, UDPServers.values()) {
+		foreach (UDPClient *c, s->clients.values()) {
 			c->stop();
 			delete c;
 		}
+		s->clients.clear();
 	}
-	UDPServerConnections.clear();
 	foreach (UDPServer *s, UDPServers.values()) {
 		close(s->fd());
 		delete s;
@@ -176,9 +479,9 @@ void udp_close_client(int fd)
 		UDPClients.remove(fd);
 		delete c;
 		c = NULL;
-		foreach (int server_fd, UDPServerConnections.uniqueKeys()) {
-			foreach (QString clientKey, UDPServerConnections[server_fd].uniqueKeys()) {
-				UDPClient *sc = UDPServerConnections[server_fd][clientKey];
+		foreach (UDPServer *s, UDPServers.values()) {
+			foreach (quint64 clientKey, s->clients.keys()) {
+				UDPClient *sc = s->clients.value(clientKey);
 				// NOTE: this filter ignores the first 16 bits of the IP address, matching both 10.0 or 10.128 in
 				// emulations, or 192.168 in experiments with real traffic.
 				if (sc->remoteAddress.split(".").mid(2) ==
@@ -189,7 +492,7 @@ void udp_close_client(int fd)
 					// All we need to do here is remove and free the server's client data structure.
 					delete sc;
 					sc = NULL;
-					UDPServerConnections[server_fd].remove(clientKey);
+					s->clients.remove(clientKey);
 				}
 			}
 		}
@@ -197,53 +500,78 @@ void udp_close_client(int fd)
 }
 
 #define BUFSIZE 65536
-static void udp_server_read_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
-	Q_UNUSED(loop);
 
+// Creates the endpoint for a datagram received by server from a new IP:port combination
+static UDPClient *udp_server_new_client(struct ev_loop *loop, UDPServer *server, const struct sockaddr_in &client_addr)
+{
+	char client_addr_str[200] = "";
+	inet_ntop(AF_INET, &client_addr.sin_addr.s_addr, client_addr_str, 200);
+	qDebugT() << "UDP server: new client" << QString("%1:%2:%3").arg(server->fd()).arg(client_addr_str).arg(ntohs(client_addr.sin_port));
+
+	UDPClient *c = server->clientFactoryCallback(server->fd(), server->clientFactoryCallbackArg);
+	c->localAddress = server->localAddress;
+	c->localPort = server->localPort;
+	c->remoteAddress = client_addr_str;
+	c->remotePort = ntohs(client_addr.sin_port);
+	c->remote_addr = client_addr;
+	// These two must be NULL, because the server "client" actually shares the fd and watcher of the server.
+	c->w_read = NULL;
+	c->w_write = NULL;
+	c->loop = loop;
+	c->server = server;
+	server->clients.insert(udpPeerKey(client_addr), c);
+	c->onConnect();
+	return c;
+}
+
+static void udp_server_read_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
 	if (EV_ERROR & revents) {
 		perror("got invalid event");
 		return;
 	}
 
-	struct sockaddr_in client_addr;
-	socklen_t client_addr_len = sizeof(client_addr);
-	char client_addr_str[200] = "";
-	ssize_t count = 0;
-	char buffer[BUFSIZE];
+	UDPServer *server = static_cast<UDPServer*>(watcher->data);
 
-	if ((count = recvfrom(watcher->fd, buffer, BUFSIZE, 0, (struct sockaddr *) &client_addr, &client_addr_len)) < 0) {
-		perror("server recvfrom");
-		return;
+	// Shared by all the servers of the thread; allocated once
+	static thread_local char *buffers = NULL;
+	if (!buffers) {
+		buffers = (char*) malloc(UDP_RECV_BURST * BUFSIZE);
 	}
-
-	inet_ntop(AF_INET, &client_addr.sin_addr.s_addr, client_addr_str, 200);
-	QString clientKey = QString("%1:%2:%3").arg(watcher->fd).arg(client_addr_str).arg(ntohs(client_addr.sin_port));
-
-	if (!UDPServerConnections.contains(watcher->fd)) {
-		UDPServerConnections[watcher->fd] = QHash<QString, UDPClient*>();
+	struct mmsghdr msgs[UDP_RECV_BURST];
+	struct iovec iovecs[UDP_RECV_BURST];
+	struct sockaddr_in client_addrs[UDP_RECV_BURST];
+	memset(msgs, 0, sizeof(msgs));
+	for (int i = 0; i < UDP_RECV_BURST; i++) {
+		iovecs[i].iov_base = buffers + i * BUFSIZE;
+		iovecs[i].iov_len = BUFSIZE;
+		msgs[i].msg_hdr.msg_name = &client_addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(client_addrs[i]);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
 	}
-	if (!UDPServerConnections[watcher->fd].contains(clientKey)) {
-		qDebugT() << "UDP server: new client" << clientKey;
-		UDPServerConnections[watcher->fd][clientKey] =
-				UDPServers[watcher->fd]->clientFactoryCallback(watcher->fd,
-															   UDPServers[watcher->fd]->clientFactoryCallbackArg);
-		UDPServerConnections[watcher->fd][clientKey]->localAddress = UDPServers[watcher->fd]->localAddress;
-		UDPServerConnections[watcher->fd][clientKey]->localPort = UDPServers[watcher->fd]->localPort;
-		UDPServerConnections[watcher->fd][clientKey]->remoteAddress = client_addr_str;
-		UDPServerConnections[watcher->fd][clientKey]->remotePort = ntohs(client_addr.sin_port);
-		UDPServerConnections[watcher->fd][clientKey]->remote_addr = client_addr;
-		// These two must be NULL, because the server "client" actually shares the fd and watcher of the server.
-		UDPServerConnections[watcher->fd][clientKey]->w_read = NULL;
-		UDPServerConnections[watcher->fd][clientKey]->w_write = NULL;
-		UDPServerConnections[watcher->fd][clientKey]->loop = loop;
-		UDPServerConnections[watcher->fd][clientKey]->onConnect();
+
+	int received = recvmmsg(watcher->fd, msgs, UDP_RECV_BURST, MSG_DONTWAIT, NULL);
+	if (received < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("server recvmmsg");
+		}
+		return;
 	}
 
-	if (count > 0) {
-		UDPServerConnections[watcher->fd][clientKey]->read(QByteArray(buffer, count));
-	} else if (count == 0) {
-		qDebugT() << "UDP server: closing connection to client" << clientKey;
-		UDPServerConnections[watcher->fd][clientKey]->stop();
+	for (int i = 0; i < received; i++) {
+		UDPClient *c = server->clients.value(udpPeerKey(client_addrs[i]));
+		if (!c) {
+			c = udp_server_new_client(loop, server, client_addrs[i]);
+		}
+		ssize_t count = msgs[i].msg_len;
+		if (count > 0) {
+			c->read(QByteArray((const char*)iovecs[i].iov_base, count));
+			// Lets the endpoint reply (its datagrams are queued in the server)
+			c->onWrite();
+		} else if (count == 0) {
+			qDebugT() << "UDP server: closing connection to client" << c->remoteAddress << c->remotePort;
+			c->stop();
+		}
 	}
 }
 
@@ -255,16 +583,8 @@ static void udp_server_write_cb(struct ev_loop *loop, struct ev_io *watcher, int
 		return;
 	}
 
-	foreach (UDPClient *c, UDPServerConnections[watcher->fd]) {
-		// make sure we can still write
-		struct pollfd pfds[1];
-		pfds[0].fd = watcher->fd;
-		pfds[0].events = POLLOUT;
-		poll(pfds, 1, 0);
-		if ((pfds[0].revents & POLLOUT) != 0) {
-			c->onWrite();
-		}
-	}
+	UDPServer *server = static_cast<UDPServer*>(watcher->data);
+	server->flushWrites();
 }
 
 static void udp_client_write_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
@@ -275,7 +595,23 @@ static void udp_client_write_cb(struct ev_loop *loop, struct ev_io *watcher, int
 		return;
 	}
 
-	UDPClients[watcher->fd]->onWrite();
+	UDPClient *c = UDPClients[watcher->fd];
+	if (c->paced) {
+		// Woken up after a blocked write: resume pacing
+		ev_io_stop(loop, watcher);
+		c->writeBlocked = false;
+		c->onPace();
+	} else {
+		c->onWrite();
+	}
+}
+
+static void udp_client_pace_cb(struct ev_loop *loop, struct ev_timer *watcher, int revents) {
+	Q_UNUSED(loop);
+	Q_UNUSED(revents);
+
+	UDPClient *c = static_cast<UDPClient*>(watcher->data);
+	c->onPace();
 }
 
 static void udp_client_read_cb(struct ev_loop *loop, struct ev_io *watcher, int revents) {
@@ -364,9 +700,11 @@ qint32 udp_server(struct ev_loop *loop, const char *address, int port,
 
 	// Initialize and start a watcher to read datagrams
 	ev_io_init(w_read, udp_server_read_cb, fd, EV_READ);
+	w_read->data = UDPServers[fd];
 	ev_io_start(loop, w_read);
+	// Started only while datagrams are queued (see UDPServer::queueWrite())
 	ev_io_init(w_write, udp_server_write_cb, fd, EV_WRITE);
-	ev_io_start(loop, w_write);
+	w_write->data = UDPServers[fd];
 
     // ALl fine
     return fd;
@@ -453,7 +791,16 @@ qint32 udp_client(struct ev_loop *loop, const char *localAddress, const char *ad
 
 	// Initialize and start a watcher
 	ev_io_init(w_write, udp_client_write_cb, client_fd, EV_WRITE);
-	ev_io_start(loop, w_write);
+	if (UDPClients[client_fd]->paced) {
+		// Paced sources are woken up by a timer instead; the first one fires immediately
+		struct ev_timer *w_pace = (struct ev_timer*) malloc(sizeof(struct ev_timer));
+		ev_timer_init(w_pace, udp_client_pace_cb, 0.0, 0.0);
+		w_pace->data = UDPClients[client_fd];
+		UDPClients[client_fd]->w_pace = w_pace;
+		ev_timer_start(loop, w_pace);
+	} else {
+		ev_io_start(loop, w_write);
+	}
 
 	// Initialize and start a watcher
 	ev_io_init(w_read, udp_client_read_cb, client_fd, EV_READ);
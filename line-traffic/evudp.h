@@ -30,9 +30,24 @@
 // 8 B UDP
 #define UDP_HEADER_OVERHEAD 42
 
+// Maximum number of datagrams a paced source sends per timer wakeup
+#define UDP_PACING_BURST 16
+// A paced source sends in one wakeup the datagrams due within this interval (s). This bounds
+// the timer rate, and thus the CPU cost, of fast flows.
+#define UDP_PACING_SLACK 100.0e-6
+
+// Maximum number of datagrams sent per sendmmsg() call
+#define UDP_SEND_BURST 32
+// Maximum number of datagrams received per recvmmsg() call
+#define UDP_RECV_BURST 32
+// Maximum number of datagrams a server queues for its peers; more are dropped, as if the socket
+// buffer was full
+#define UDP_SERVER_QUEUE_MAX 4096
+
 qreal udpRawRate2PayloadRate(qreal rawRate, int frameSize);
 
 class UDPClient;
+class UDPServer;
 typedef UDPClient* (*UDPClientFactoryCallback)(int, void*);
 
 class UDPClient : public ReaderWriter {
@@ -47,15 +62,71 @@ public:
 
 	// never call this directly
 	void read(QByteArray b);
-	// call this to write
+	// call this to write. Server endpoints queue the datagram in their server (see UDPServer).
 	void write(QByteArray b);
+	// Sends count copies of the same datagram with one syscall (at most UDP_SEND_BURST).
+	// Returns the number of datagrams sent.
+	int writeBurst(const char *data, int length, int count);
+	// Sends one datagram of frameSize bytes made of the header followed by shared payload bytes
+	// (see payload.h), without copying them into a buffer.
+	void writeFrame(const char *header, int headerLength, int frameSize);
+
+	// Pacing (client endpoints only). A paced source is not called on every EV_WRITE event (a UDP
+	// socket is almost always writable); instead, onPace() is called by w_pace at the time set by
+	// the last schedulePacing() call. Set paced in the constructor to enable it.
+	virtual void onPace();
+	void schedulePacing(qreal delay);
+	// Calls onPace() when the socket becomes writable again (use after writeBlocked is set).
+	void waitWritable();
 
 	struct sockaddr_in remote_addr;
 	struct ev_loop *loop;
+	// The server of a server endpoint; NULL for client endpoints
+	UDPServer *server;
 	struct ev_io *w_read;
 	struct ev_io *w_write;
+	struct ev_timer *w_pace;
+	bool paced;
+	// True if the last write failed because the socket buffer was full
+	bool writeBlocked;
+};
+
+// Packs the IPv4 address and port of a peer into an integer key (network byte order, 48 bits)
+inline quint64 udpPeerKey(const struct sockaddr_in &addr)
+{
+	return (quint64(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+}
+
+// Clients of a UDP server keyed by udpPeerKey(). Open addressing with linear probing, so that
+// demultiplexing a datagram costs one multiplicative hash and usually one probe.
+class UDPClientTable {
+public:
+	UDPClientTable();
+	UDPClient *value(quint64 key) const;
+	void insert(quint64 key, UDPClient *client);
+	void remove(quint64 key);
+	void clear();
+	int count() const;
+	QList<quint64> keys() const;
+	QList<UDPClient*> values() const;
+
+protected:
+	static const quint64 EmptyKey = ~0ULL;
+	int home(quint64 key) const;
+	// The index of key, or of the empty slot where it would be inserted
+	int find(quint64 key) const;
+	void rehash(int capacity);
+
+	QVector<quint64> m_keys;
+	QVector<UDPClient*> m_values;
+	int m_bits;
+	int m_count;
 };
 
+// The endpoints of a server share its socket. Their datagrams are queued in the server and sent in
+// batches (sendmmsg) when the socket is writable, so w_write is active only while the queue is not
+// empty, and the cost of an event does not depend on the number of peers.
+// The server endpoints are called (onWrite()) after each datagram they receive.
 class UDPServer {
 public:
 	inline UDPServer(int fd = -1);
@@ -63,6 +134,24 @@ public:
 	void setFd(int fd);
 	int fd();
 
+	// Queues a datagram for peer. Returns false if the queue is full (the datagram is dropped).
+	bool queueWrite(const struct sockaddr_in &peer, const QByteArray &data);
+	// Sends the queued datagrams; waits for EV_WRITE if the socket buffer fills up.
+	void flushWrites();
+	// Removes the datagrams already sent from the front of writeQueue
+	void compactWriteQueue();
+
+	struct QueuedDatagram {
+		struct sockaddr_in peer;
+		QByteArray data;
+	};
+
+	// The endpoints of the peers that sent datagrams to this server
+	UDPClientTable clients;
+	// Datagrams not yet sent start at writeQueueHead
+	QVector<QueuedDatagram> writeQueue;
+	int writeQueueHead;
+	quint64 writeQueueDropped;
 	int m_fd;
 	UDPClientFactoryCallback clientFactoryCallback;
 	void *clientFactoryCallbackArg;
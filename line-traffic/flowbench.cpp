@@ -0,0 +1,144 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "flowbench.h"
+
+#include <ev.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "evtcp.h"
+#include "tcpsink.h"
+#include "tcpparetosource.h"
+#include "timingwheel.h"
+#include "chronometer.h"
+#include "util.h"
+
+// Pareto shape of the flow sizes
+#define FLOW_BENCH_ALPHA 1.5
+
+static struct ev_loop *benchLoop = NULL;
+static qreal benchRate = 1000.0;
+static int benchPort = 20000;
+static ev_tstamp benchEnd = 0;
+static TCPParetoSourceArg benchParams;
+static quint64 flowsStarted = 0;
+static quint64 flowsCompleted = 0;
+static quint64 maxFlowsOpen = 0;
+
+static void flowCompletedCallback(void *arg)
+{
+	Q_UNUSED(arg);
+	flowsCompleted++;
+}
+
+static void flowArrivalCallback(void *arg, ev_tstamp deadline)
+{
+	Q_UNUSED(arg);
+	if (deadline >= benchEnd)
+		return;
+	// Spread the flows over 127.0.1.0/24, otherwise the ephemeral ports run out (TIME_WAIT)
+	char localAddress[32];
+	snprintf(localAddress, sizeof(localAddress), "127.0.1.%d", 1 + int(flowsStarted % 254));
+	tcp_client(benchLoop, localAddress, "127.0.0.1", benchPort, 0,
+			   TCPParetoSource::makeTCPParetoSource, &benchParams, 0, QString(),
+			   flowCompletedCallback, NULL);
+	flowsStarted++;
+	maxFlowsOpen = qMax(maxFlowsOpen, flowsStarted - flowsCompleted);
+
+	qreal delay = -log(1.0 - frandex()) / benchRate;
+	TimingWheel::threadWheel(benchLoop)->scheduleAt(deadline + delay, flowArrivalCallback, NULL);
+}
+
+static void benchTimeoutCallback(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	Q_UNUSED(w);
+	Q_UNUSED(revents);
+	ev_unloop(loop, EVUNLOOP_ALL);
+}
+
+static qreal getCpuTime()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1.0e-6 +
+			usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1.0e-6;
+}
+
+int runFlowBenchmark(int argc, char **argv)
+{
+	qreal seconds = 10.0;
+	qreal meanSize = 20000.0;
+	bool ok = true;
+	if (argc > 0) {
+		seconds = QString(argv[0]).toDouble(&ok);
+		ok = ok && seconds > 0;
+	}
+	if (ok && argc > 1) {
+		benchRate = QString(argv[1]).toDouble(&ok);
+		ok = ok && benchRate > 0;
+	}
+	if (ok && argc > 2) {
+		meanSize = QString(argv[2]).toDouble(&ok);
+		ok = ok && meanSize >= 1;
+	}
+	if (ok && argc > 3) {
+		benchPort = QString(argv[3]).toInt(&ok);
+	}
+	if (!ok) {
+		fprintf(stderr, "Usage: line-traffic --bench-flows [seconds] [flows_per_second] [mean_size_bytes] [port]\n");
+		return -1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	benchParams.alpha = FLOW_BENCH_ALPHA;
+	benchParams.scale = meanSize * (FLOW_BENCH_ALPHA - 1.0) / FLOW_BENCH_ALPHA;
+
+	benchLoop = ev_default_loop(0);
+	tcp_server(benchLoop, "127.0.0.1", benchPort, TCPSink::makeTCPSink, new TCPSinkArg(true));
+
+	ev_now_update(benchLoop);
+	benchEnd = ev_now(benchLoop) + seconds;
+	TimingWheel::threadWheel(benchLoop)->schedule(0, flowArrivalCallback, NULL);
+
+	// Let the last flows complete
+	ev_timer timeout;
+	ev_timer_init(&timeout, benchTimeoutCallback, seconds + 1.0, 0.0);
+	ev_timer_start(benchLoop, &timeout);
+
+	quint64 tStart = getCurrentTimeNanosec();
+	qreal cpuStart = getCpuTime();
+	ev_loop(benchLoop, 0);
+	qreal duration = (getCurrentTimeNanosec() - tStart) * 1.0e-9;
+	qreal cpu = getCpuTime() - cpuStart;
+
+	fprintf(stderr, "TCP flow benchmark: %.0f flows/s requested, mean size %.0f B (Pareto, alpha %.1f), %.1f s, %.1f s CPU\n",
+			benchRate, meanSize, FLOW_BENCH_ALPHA, duration, cpu);
+	fprintf(stderr, "Started: %s flows, %s flows/s\n",
+			withCommas(flowsStarted), withCommas(quint64(flowsStarted / seconds)));
+	fprintf(stderr, "Completed: %s flows, at most %s open at once\n",
+			withCommas(flowsCompleted), withCommas(maxFlowsOpen));
+	fprintf(stderr, "CPU per 1000 flows: %.3f s (both endpoints)\n",
+			flowsStarted > 0 ? cpu * 1000.0 / flowsStarted : 0.0);
+
+	tcp_close_all();
+	return 0;
+}
@@ -0,0 +1,28 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef FLOWBENCH_H
+#define FLOWBENCH_H
+
+// Loopback benchmark of the flow setup path: Poisson arrivals of short TCP flows with Pareto
+// sizes (as for TCP-Poisson-Pareto connections), driven by the timing wheel, on one event loop.
+// Prints the achieved arrival and completion rates and the CPU time per 1000 flows.
+// Usage: line-traffic --bench-flows [seconds] [flows_per_second] [mean_size_bytes] [port]
+int runFlowBenchmark(int argc, char **argv);
+
+#endif // FLOWBENCH_H
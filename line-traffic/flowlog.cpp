@@ -0,0 +1,207 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "flowlog.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "chronometer.h"
+#include "util.h"
+
+static_assert(sizeof(FlowLogRecord) == 64, "FlowLogRecord must match the file format");
+static_assert(sizeof(FlowLogHeader) == 32, "FlowLogHeader must match the file format");
+
+// Records copied by the main thread per call to pop()
+#define FLOW_LOG_BATCH 256
+
+static FILE *flowLogFile = NULL;
+static FlowLogRing *flowLogRings = NULL;
+static int flowLogRingCount = 0;
+// Ring of the calling thread; NULL if the thread does not log
+static thread_local FlowLogRing *threadFlowLogRing = NULL;
+
+FlowLogRing::FlowLogRing() :
+	dropped(0),
+	head(0),
+	tail(0)
+{
+}
+
+bool FlowLogRing::push(const FlowLogRecord &record)
+{
+	quint64 h = head.load(std::memory_order_relaxed);
+	if (h - tail.load(std::memory_order_acquire) >= FLOW_LOG_RING_SIZE) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	records[h & (FLOW_LOG_RING_SIZE - 1)] = record;
+	head.store(h + 1, std::memory_order_release);
+	return true;
+}
+
+int FlowLogRing::pop(FlowLogRecord *result, int maxCount)
+{
+	quint64 t = tail.load(std::memory_order_relaxed);
+	quint64 available = head.load(std::memory_order_acquire) - t;
+	int count = int(qMin(available, quint64(maxCount)));
+	for (int i = 0; i < count; i++) {
+		result[i] = records[(t + i) & (FLOW_LOG_RING_SIZE - 1)];
+	}
+	tail.store(t + count, std::memory_order_release);
+	return count;
+}
+
+bool flowLogOpen(QString fileName, int numThreads)
+{
+	Q_ASSERT_FORCE(!flowLogFile && numThreads > 0);
+	flowLogFile = fopen(fileName.toLocal8Bit().constData(), "ab");
+	if (!flowLogFile) {
+		perror("Could not open the flow log");
+		return false;
+	}
+
+	FlowLogHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FLOW_LOG_MAGIC, 8);
+	header.version = FLOW_LOG_VERSION;
+	header.recordSize = sizeof(FlowLogRecord);
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	header.tWall_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	header.tClock_ns = getCurrentTimeNanosec();
+	if (fwrite(&header, sizeof(header), 1, flowLogFile) != 1) {
+		perror("Could not write the flow log");
+		return false;
+	}
+
+	flowLogRings = new FlowLogRing[numThreads];
+	flowLogRingCount = numThreads;
+	return true;
+}
+
+void flowLogAttachThread(int threadIndex)
+{
+	if (!flowLogRings)
+		return;
+	Q_ASSERT_FORCE(0 <= threadIndex && threadIndex < flowLogRingCount);
+	threadFlowLogRing = &flowLogRings[threadIndex];
+}
+
+bool flowLogEnabled()
+{
+	return threadFlowLogRing != NULL;
+}
+
+void flowLogRecord(const FlowLogRecord &record)
+{
+	if (threadFlowLogRing) {
+		threadFlowLogRing->push(record);
+	}
+}
+
+void flowLogFlush()
+{
+	if (!flowLogFile)
+		return;
+	FlowLogRecord records[FLOW_LOG_BATCH];
+	for (int t = 0; t < flowLogRingCount; t++) {
+		int count;
+		while ((count = flowLogRings[t].pop(records, FLOW_LOG_BATCH)) > 0) {
+			if (fwrite(records, sizeof(FlowLogRecord), count, flowLogFile) != size_t(count)) {
+				perror("Could not write the flow log");
+				return;
+			}
+		}
+	}
+	fflush(flowLogFile);
+}
+
+void flowLogClose()
+{
+	if (!flowLogFile)
+		return;
+	flowLogFlush();
+	quint64 dropped = 0;
+	for (int t = 0; t < flowLogRingCount; t++) {
+		dropped += flowLogRings[t].dropped.load(std::memory_order_relaxed);
+	}
+	if (dropped > 0) {
+		fprintf(stderr, "Flow log: %s records dropped (ring full)\n", withCommas(dropped));
+	}
+	fclose(flowLogFile);
+	flowLogFile = NULL;
+	delete [] flowLogRings;
+	flowLogRings = NULL;
+	flowLogRingCount = 0;
+}
+
+int printFlowLog(int argc, char **argv)
+{
+	if (argc != 1) {
+		fprintf(stderr, "Usage: line-traffic --print-flow-log file\n");
+		return -1;
+	}
+	FILE *f = fopen(argv[0], "rb");
+	if (!f) {
+		perror("Could not open the flow log");
+		return -1;
+	}
+
+	printf("# start_s end_s fct_s local remote sent_B received_B retransmits rtt_us rttvar_us cwnd flags\n");
+	FlowLogHeader header;
+	bool ok = true;
+	while (fread(&header, sizeof(header), 1, f) == 1) {
+		if (memcmp(header.magic, FLOW_LOG_MAGIC, 8) != 0 ||
+			header.version != FLOW_LOG_VERSION ||
+			header.recordSize != sizeof(FlowLogRecord)) {
+			fprintf(stderr, "Unsupported flow log format\n");
+			ok = false;
+			break;
+		}
+		// The times are printed relative to the start of the run
+		printf("# run started at %.3f (Unix time)\n", header.tWall_ns * 1.0e-9);
+		FlowLogRecord record;
+		while (fread(&record, sizeof(record), 1, f) == 1) {
+			if (memcmp(&record, FLOW_LOG_MAGIC, 8) == 0) {
+				// Header of the next run
+				fseek(f, -(long)sizeof(record), SEEK_CUR);
+				break;
+			}
+			char local[INET_ADDRSTRLEN] = "";
+			char remote[INET_ADDRSTRLEN] = "";
+			inet_ntop(AF_INET, &record.localIP, local, sizeof(local));
+			inet_ntop(AF_INET, &record.remoteIP, remote, sizeof(remote));
+			printf("%.6f %.6f %.6f %s:%u %s:%u %llu %llu %u %u %u %u %s%s%s%s\n",
+				   (qint64)(record.tStart_ns - header.tClock_ns) * 1.0e-9,
+				   (qint64)(record.tEnd_ns - header.tClock_ns) * 1.0e-9,
+				   (record.tEnd_ns - record.tStart_ns) * 1.0e-9,
+				   local, record.localPort, remote, record.remotePort,
+				   (unsigned long long)record.bytesSent, (unsigned long long)record.bytesReceived,
+				   record.retransmits, record.rtt_us, record.rttVar_us, record.cwnd_segments,
+				   (record.flags & FLOW_LOG_SINK) ? "sink" : "source",
+				   (record.flags & FLOW_LOG_COMPLETED) ? ",completed" : "",
+				   (record.flags & FLOW_LOG_PEER_CLOSED) ? ",peer-closed" : "",
+				   (record.flags & FLOW_LOG_TCP_INFO) ? "" : ",no-tcp-info");
+		}
+	}
+	fclose(f);
+	return ok ? 0 : -1;
+}
@@ -0,0 +1,114 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef FLOWLOG_H
+#define FLOWLOG_H
+
+#include <atomic>
+#include <QtCore>
+
+// Per-flow binary telemetry.
+// Each event loop thread appends one FlowLogRecord per TCP endpoint it closes to its own
+// single-producer/single-consumer ring, without locks or syscalls; the main thread drains the
+// rings periodically into an append-only file.
+// File layout (native byte order): a FlowLogHeader, then FlowLogRecords. Every run appends a new
+// header followed by its records. Use "line-traffic --print-flow-log file" to print it as text.
+#define FLOW_LOG_MAGIC "LINEFLW1"
+#define FLOW_LOG_VERSION 1
+// Records per thread (power of two). When a ring is full, the records are dropped and counted.
+#define FLOW_LOG_RING_SIZE 8192
+// Interval at which the main thread drains the rings (s)
+#define FLOW_LOG_FLUSH_INTERVAL 0.1
+
+// Record flags
+// The endpoint is the receiver (sink) of the flow
+#define FLOW_LOG_SINK 0x01
+// The source finished its transfer (set only for sources)
+#define FLOW_LOG_COMPLETED 0x02
+// The peer closed the connection (set only for sinks)
+#define FLOW_LOG_PEER_CLOSED 0x04
+// The TCP_INFO fields are valid
+#define FLOW_LOG_TCP_INFO 0x08
+
+struct FlowLogHeader {
+	char magic[8];
+	quint32 version;
+	quint32 recordSize;
+	// Wall clock time of the start of the run (ns since the epoch); the record times use the
+	// clock of getCurrentTimeNanosec()
+	quint64 tWall_ns;
+	quint64 tClock_ns;
+};
+
+struct FlowLogRecord {
+	// Socket creation (source) or accept (sink), and close
+	quint64 tStart_ns;
+	quint64 tEnd_ns;
+	quint64 bytesSent;
+	quint64 bytesReceived;
+	// IPv4 addresses in network byte order, ports in host byte order
+	quint32 localIP;
+	quint32 remoteIP;
+	quint16 localPort;
+	quint16 remotePort;
+	// TCP_INFO snapshot taken just before the close
+	quint32 retransmits;
+	quint32 rtt_us;
+	quint32 rttVar_us;
+	quint32 cwnd_segments;
+	quint8 flags;
+	quint8 reserved[3];
+};
+
+// Lock-free ring between one event loop thread (producer) and the main thread (consumer)
+class FlowLogRing {
+public:
+	FlowLogRing();
+	// Producer. Returns false (and counts the record as dropped) if the ring is full.
+	bool push(const FlowLogRecord &record);
+	// Consumer. Copies at most maxCount records to records, returns the number copied.
+	int pop(FlowLogRecord *records, int maxCount);
+
+	std::atomic<quint64> dropped;
+
+protected:
+	FlowLogRecord records[FLOW_LOG_RING_SIZE];
+	// Written by the producer
+	std::atomic<quint64> head __attribute__((aligned(64)));
+	// Written by the consumer
+	std::atomic<quint64> tail __attribute__((aligned(64)));
+};
+
+// Opens the log for appending, with one ring per event loop thread. Returns false on error.
+bool flowLogOpen(QString fileName, int numThreads);
+// Called by each event loop thread before running its loop.
+void flowLogAttachThread(int threadIndex);
+// Returns true if the calling thread logs its flows.
+bool flowLogEnabled();
+// Called by the event loop threads.
+void flowLogRecord(const FlowLogRecord &record);
+// Called by the main thread: writes the records queued by all the threads.
+void flowLogFlush();
+// Called by the main thread after the event loop threads have exited.
+void flowLogClose();
+
+// Prints a flow log as text, one flow per line.
+// Usage: line-traffic --print-flow-log file
+int printFlowLog(int argc, char **argv);
+
+#endif // FLOWLOG_H
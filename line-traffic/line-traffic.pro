@@ -63,7 +63,18 @@ exists( ../line.pro ) {
 		tcpparetosource.cpp \
 		readerwriter.cpp \
 		tcpsource.cpp \
-		udpsource.cpp
+		udpsource.cpp \
+		udpbench.cpp \
+		payload.cpp \
+		ringbuffer.cpp \
+		tcpbench.cpp \
+		trafficthreads.cpp \
+		connectiontype.cpp \
+		timingwheel.cpp \
+		slabpool.cpp \
+		flowbench.cpp \
+		tracereplay.cpp \
+		flowlog.cpp
 
 	HEADERS += \
 		../line-gui/netgraphpath.h \
@@ -89,6 +100,17 @@ exists( ../line.pro ) {
 		readerwriter.h \
 		tcpsource.h \
 		udpsource.h \
+		udpbench.h \
+		payload.h \
+		ringbuffer.h \
+		tcpbench.h \
+		trafficthreads.h \
+		connectiontype.h \
+		timingwheel.h \
+		slabpool.h \
+		flowbench.h \
+		tracereplay.h \
+		flowlog.h \
 		../line-gui/qrgb-line.h
 
 	OTHER_FILES += \
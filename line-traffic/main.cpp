@@ -41,6 +41,16 @@
 #include "udpsink.h"
 #include "udpcbr.h"
 #include "udpvbr.h"
+#include "udpbench.h"
+#include "tcpbench.h"
+#include "flowbench.h"
+#include "trafficthreads.h"
+#include "connectiontype.h"
+#include "timingwheel.h"
+#include "tracereplay.h"
+#include "flowlog.h"
+#include "payload.h"
+#include "chronometer.h"
 #include "util.h"
 
 #ifdef DEBUG
@@ -48,21 +58,35 @@
 #endif
 #define DEBUG 0
 
+// Shared by all the event loop threads. After the threads start, the connection and node lists
+// must not be copied (e.g. by foreach), otherwise the next non-const access would detach them.
+NetGraph netGraph;
+// Event loop thread of each connection, -1 if no endpoint is on this host
+QVector<int> connection2Thread;
+QVector<TrafficThread*> trafficThreads;
+// One entry per thread
+TrafficThreadStats *trafficStats = NULL;
+// Resolved once after loading the graph (one entry per connection)
+QVector<ConnectionType> connectionTypes;
+QVector<QByteArray> connectionSourceIPs;
+QVector<QByteArray> connectionDestIPs;
+QVector<QByteArray> connectionDestForeignIPs;
+// For TCP-Trace connections, created on first start by the thread of the connection
+TraceReplay **connectionTraces = NULL;
+
 void sigint_cb(struct ev_loop *loop, struct ev_signal *w, int revents)
 {
 	Q_UNUSED(w);
 	Q_UNUSED(revents);
-	fprintf(stderr, "\nKeyboard interrupt: closing all connections...\n\n");
-	tcp_close_all();
-	udp_close_all();
+	fprintf(stderr, "\nInterrupted: closing all connections...\n\n");
+	foreach (TrafficThread *thread, trafficThreads) {
+		thread->requestStop();
+	}
 
 	ev_unloop(loop, EVUNLOOP_ALL);
 }
 
-NetGraph netGraph;
-QHash<ev_timer *, int> onOffTimer2Connection;
-
-void poissonStartConnectionTimeoutHandler(int revents, void *arg);
+void poissonStartConnectionTimeoutHandler(void *arg, ev_tstamp deadline);
 void connectionTransferCompletedHandler(void *arg);
 
 // Assigns port numbers to connections.
@@ -81,48 +105,51 @@ void initConnection(struct ev_loop *loop, NetGraphConnection &c)
 	if (netGraph.nodes[c.dest].maskedOut)
 		return;
 
-	if (c.basicType == "TCP") {
-        int port = netGraph.connections[c.index].port;
-		c.serverFD = tcp_server(loop, qPrintable(netGraph.nodes[c.dest].ip()), port,
+	const char *serverIP = connectionDestIPs.at(c.index).constData();
+	switch (connectionTypes.at(c.index)) {
+	case ConnectionTypeTCP:
+		c.serverFD = tcp_server(loop, serverIP, c.port,
 								TCPSink::makeTCPSink, NULL,
 								c.tcpReceiveWindowSize,
 								c.tcpCongestionControl);
-	} else if (c.basicType == "TCPx") {
+		break;
+	case ConnectionTypeTCPx:
 		for (int i = 0; i < c.multiplier; i++) {
-            int port = netGraph.connections[c.index].ports[i];
-			c.serverFDs.insert(tcp_server(loop, qPrintable(netGraph.nodes[c.dest].ip()), port,
+			c.serverFDs.insert(tcp_server(loop, serverIP, c.ports[i],
 							   TCPSink::makeTCPSink, NULL, c.tcpReceiveWindowSize, c.tcpCongestionControl));
-        }
-	} else if (c.basicType == "TCP-Poisson-Pareto") {
-		int port = netGraph.connections[c.index].port;
-		c.serverFD = tcp_server(loop, qPrintable(netGraph.nodes[c.dest].ip()), port,
+		}
+		break;
+	case ConnectionTypeTCPPoissonPareto:
+		c.serverFD = tcp_server(loop, serverIP, c.port,
 				TCPSink::makeTCPSink, new TCPSinkArg(true), c.tcpReceiveWindowSize, c.tcpCongestionControl);
 		// The first transmission is delayed exponentially
 		c.delayStart = true;
-    } else if (c.basicType == "TCP-DASH") {
-        int port = netGraph.connections[c.index].port;
-        c.serverFD = tcp_server(loop, qPrintable(netGraph.nodes[c.dest].ip()), port,
-                TCPSink::makeTCPSink, new TCPSinkArg(true), c.tcpReceiveWindowSize, c.tcpCongestionControl);
-    } else if (c.basicType == "UDP-CBR") {
-		int port = netGraph.connections[c.index].port;
-		c.serverFD = udp_server(loop, qPrintable(netGraph.nodes[c.dest].ip()), port,
+		break;
+	case ConnectionTypeTCPDash:
+	case ConnectionTypeTCPTrace:
+		c.serverFD = tcp_server(loop, serverIP, c.port,
+				TCPSink::makeTCPSink, new TCPSinkArg(true), c.tcpReceiveWindowSize, c.tcpCongestionControl);
+		break;
+	case ConnectionTypeUDPCBR:
+	case ConnectionTypeUDPVCBR:
+		c.serverFD = udp_server(loop, serverIP, c.port,
 								UDPSink::makeUDPSink);
-	} else if (c.basicType == "UDP-VBR") {
-		int port = netGraph.connections[c.index].port;
-		c.serverFD = udp_server(loop, qPrintable(netGraph.nodes[c.dest].ip()), port,
+		break;
+	case ConnectionTypeUDPVBR:
+		c.serverFD = udp_server(loop, serverIP, c.port,
 								UDPVBRSink::makeUDPVBRSink);
-	} else if (c.basicType == "UDP-VCBR") {
-		int port = netGraph.connections[c.index].port;
-		c.serverFD = udp_server(loop, qPrintable(netGraph.nodes[c.dest].ip()), port,
-								UDPSink::makeUDPSink);
-	} else {
+		break;
+	default:
 		qDebug() << __FILE__ << __LINE__ << __FUNCTION__ << "Could not parse parameters" << c.encodedType;
 		Q_ASSERT_FORCE(false);
 	}
 }
 
 // Starts clients (sources).
-void startConnection(NetGraphConnection &c)
+// For Poisson connections, arrivalTime is the time at which this arrival was scheduled (in the
+// time base of ev_now()); the next one is scheduled relative to it, so that the arrival rate is
+// not affected by the resolution of the timing wheel. Negative means now.
+void startConnection(NetGraphConnection &c, ev_tstamp arrivalTime)
 {
 	qDebugT();
 	if (c.maskedOut)
@@ -130,29 +157,28 @@ void startConnection(NetGraphConnection &c)
 	if (netGraph.nodes[c.source].maskedOut)
 		return;
 	struct ev_loop *loop = static_cast<struct ev_loop *>(c.ev_loop);
-	if (c.basicType == "TCP") {
-        int port = netGraph.connections[c.index].port;
-		c.clientFD = tcp_client(loop, qPrintable(netGraph.nodes[c.source].ip()),
-				qPrintable(netGraph.nodes[c.dest].ipForeign()), port,
+	const char *clientIP = connectionSourceIPs.at(c.index).constData();
+	const char *serverIP = connectionDestForeignIPs.at(c.index).constData();
+	switch (connectionTypes.at(c.index)) {
+	case ConnectionTypeTCP:
+		c.clientFD = tcp_client(loop, clientIP, serverIP, c.port,
 				c.trafficClass, TCPSource::makeTCPSource, NULL, c.tcpReceiveWindowSize, c.tcpCongestionControl);
-	} else if (c.basicType == "TCPx") {
-        c.clientFDs.clear();
+		break;
+	case ConnectionTypeTCPx:
+		c.clientFDs.clear();
 		for (int i = 0; i < c.multiplier; i++) {
-            int port = netGraph.connections[c.index].ports[i];
-			c.clientFDs.insert(tcp_client(loop, qPrintable(netGraph.nodes[c.source].ip()),
-							   qPrintable(netGraph.nodes[c.dest].ipForeign()), port,
+			c.clientFDs.insert(tcp_client(loop, clientIP, serverIP, c.ports[i],
 					c.trafficClass, TCPSource::makeTCPSource, NULL, c.tcpReceiveWindowSize, c.tcpCongestionControl));
-        }
-	} else if (c.basicType == "TCP-Poisson-Pareto") {
+		}
+		break;
+	case ConnectionTypeTCPPoissonPareto: {
 		TCPParetoSourceArg paretoParams;
 		paretoParams.alpha = c.paretoAlpha;
 		paretoParams.scale = c.paretoScale_b / 8.0;
 
 		if (!c.delayStart) {
 			qDebugT() << "Creating Poisson connection";
-			int port = netGraph.connections[c.index].port;
-			c.clientFD = tcp_client(loop, qPrintable(netGraph.nodes[c.source].ip()),
-					qPrintable(netGraph.nodes[c.dest].ipForeign()), port,
+			c.clientFD = tcp_client(loop, clientIP, serverIP, c.port,
 					c.trafficClass, TCPParetoSource::makeTCPParetoSource, &paretoParams, c.tcpReceiveWindowSize,
 					c.tcpCongestionControl,
 					c.sequential ? connectionTransferCompletedHandler : NULL,
@@ -163,40 +189,54 @@ void startConnection(NetGraphConnection &c)
 			c.delayStart = false;
 			qreal delay = -log(1.0 - frandex()) / c.poissonRate;
 			qDebugT() << "Delaying Poisson connection" << delay;
-			ev_once(loop, -1, 0, delay, poissonStartConnectionTimeoutHandler, &c);
+			ev_tstamp deadline = (arrivalTime >= 0 ? arrivalTime : ev_now(loop)) + delay;
+			TimingWheel::threadWheel(loop)->scheduleAt(deadline, poissonStartConnectionTimeoutHandler, &c);
+		}
+		break;
+	}
+	case ConnectionTypeTCPDash: {
+		TCPDashSourceArg params(c.rate_Mbps * 1.0e6 / 8.0,
+								c.bufferingRate_Mbps * 1.0e6 / 8.0,
+								c.bufferingTime_s,
+								c.streamingPeriod_s);
+		qDebugT() << "Creating DASH connection";
+		c.clientFD = tcp_client(loop, clientIP, serverIP, c.port,
+				c.trafficClass, TCPDashSource::makeTCPDashSource, &params, c.tcpReceiveWindowSize,
+				c.tcpCongestionControl);
+		break;
+	}
+	case ConnectionTypeTCPTrace:
+		if (!connectionTraces[c.index]) {
+			connectionTraces[c.index] = new TraceReplay(loop, c.traceFile, c.traceLoop,
+														connectionSourceIPs.at(c.index),
+														connectionDestForeignIPs.at(c.index),
+														c.port, c.trafficClass, c.tcpReceiveWindowSize,
+														c.tcpCongestionControl);
 		}
-    } else if (c.basicType == "TCP-DASH") {
-        TCPDashSourceArg params(c.rate_Mbps * 1.0e6 / 8.0,
-                                c.bufferingRate_Mbps * 1.0e6 / 8.0,
-                                c.bufferingTime_s,
-                                c.streamingPeriod_s);
-        qDebugT() << "Creating DASH connection";
-        int port = netGraph.connections[c.index].port;
-        c.clientFD = tcp_client(loop, qPrintable(netGraph.nodes[c.source].ip()),
-                qPrintable(netGraph.nodes[c.dest].ipForeign()), port,
-                c.trafficClass, TCPDashSource::makeTCPDashSource, &params, c.tcpReceiveWindowSize,
-                c.tcpCongestionControl);
-    } else if (c.basicType == "UDP-CBR") {
+		qDebugT() << "Replaying trace" << c.traceFile;
+		connectionTraces[c.index]->start();
+		break;
+	case ConnectionTypeUDPCBR: {
 		qreal rate_Bps = c.rate_Mbps * 1.0e6 / 8.0;
-		int port = netGraph.connections[c.index].port;
 		UDPCBRSourceArg params(rate_Bps, 1400, c.poisson);
-		c.clientFD = udp_client(loop, qPrintable(netGraph.nodes[c.source].ip()),
-				qPrintable(netGraph.nodes[c.dest].ipForeign()), port, c.trafficClass,
+		c.clientFD = udp_client(loop, clientIP, serverIP, c.port, c.trafficClass,
 				UDPCBRSource::makeUDPCBRSource, &params);
-	} else if (c.basicType == "UDP-VBR") {
-		int port = netGraph.connections[c.index].port;
+		break;
+	}
+	case ConnectionTypeUDPVBR: {
 		UDPVBRSourceArg params(1000);
-		c.clientFD = udp_client(loop, qPrintable(netGraph.nodes[c.source].ip()),
-				qPrintable(netGraph.nodes[c.dest].ipForeign()), port, c.trafficClass,
+		c.clientFD = udp_client(loop, clientIP, serverIP, c.port, c.trafficClass,
 				UDPVBRSource::makeUDPVBRSource, &params);
-	} else if (c.basicType == "UDP-VCBR") {
+		break;
+	}
+	case ConnectionTypeUDPVCBR: {
 		qreal rate_Bps = c.rate_Mbps * 1.0e6 / 8.0;
-		int port = netGraph.connections[c.index].port;
 		UDPVCBRSourceArg params(rate_Bps);
-		c.clientFD = udp_client(loop, qPrintable(netGraph.nodes[c.source].ip()),
-				qPrintable(netGraph.nodes[c.dest].ipForeign()), port, c.trafficClass,
+		c.clientFD = udp_client(loop, clientIP, serverIP, c.port, c.trafficClass,
 				UDPVCBRSource::makeUDPVCBRSource, &params);
-	} else {
+		break;
+	}
+	default:
 		qDebug() << __FILE__ << __LINE__ << __FUNCTION__ << "Could not parse parameters" << c.encodedType;
 		Q_ASSERT_FORCE(false);
 	}
@@ -211,17 +251,29 @@ void stopConnection(NetGraphConnection &c)
 	if (netGraph.nodes[c.source].maskedOut)
 		return;
 
-	if (c.basicType == "TCP") {
-        tcp_close_client(c.clientFD);
-        c.clientFD = -1;
-	} else if (c.basicType == "TCPx") {
+	switch (connectionTypes.at(c.index)) {
+	case ConnectionTypeTCP:
+		tcp_close_client(c.clientFD);
+		c.clientFD = -1;
+		break;
+	case ConnectionTypeTCPx:
 		foreach (int fd, c.clientFDs) {
 			tcp_close_client(fd);
-        }
-	} else if (c.basicType == "UDP-CBR" || c.basicType == "UDP-VBR" || c.basicType == "UDP-VCBR") {
+		}
+		break;
+	case ConnectionTypeTCPTrace:
+		// The flows in progress finish their transfers
+		if (connectionTraces[c.index]) {
+			connectionTraces[c.index]->stop();
+		}
+		break;
+	case ConnectionTypeUDPCBR:
+	case ConnectionTypeUDPVBR:
+	case ConnectionTypeUDPVCBR:
 		udp_close_client(c.clientFD);
 		c.clientFD = -1;
-	} else {
+		break;
+	default:
 		qDebug() << __FILE__ << __LINE__ << __FUNCTION__ << "Could not parse parameters" << c.encodedType;
 		Q_ASSERT_FORCE(false);
 	}
@@ -235,38 +287,29 @@ void connectionTransferCompleted(NetGraphConnection &c)
 	if (netGraph.nodes[c.source].maskedOut)
 		return;
 
-	if (c.basicType == "TCP") {
-		// Nothing to do
-	} else if (c.basicType == "TCPx") {
-		// Nothing to do
-	} else if (c.basicType == "TCP-Poisson-Pareto") {
+	switch (connectionTypes.at(c.index)) {
+	case ConnectionTypeTCPPoissonPareto:
 		netGraph.connections[c.index].delayStart = true;
-		ev_once(static_cast<struct ev_loop*>(c.ev_loop),
-				-1, 0, 0, poissonStartConnectionTimeoutHandler, &netGraph.connections[c.index]);
-	} else if (c.basicType == "TCP-Repeated-Pareto") {
-		// Nothing to do
-    } else if (c.basicType == "TCP-DASH") {
-        // Nothing to do
-    } else if (c.basicType == "UDP-CBR") {
-		// Nothing to do
-	} else if (c.basicType == "UDP-VBR") {
-		// Nothing to do
-	} else if (c.basicType == "UDP-VCBR") {
-		// Nothing to do
-	} else {
+		TimingWheel::threadWheel(static_cast<struct ev_loop*>(c.ev_loop))->schedule(
+				0, poissonStartConnectionTimeoutHandler, &netGraph.connections[c.index]);
+		break;
+	case ConnectionTypeUnknown:
 		qDebug() << __FILE__ << __LINE__ << __FUNCTION__ << "Could not parse parameters" << c.encodedType;
 		Q_ASSERT_FORCE(false);
+		break;
+	default:
+		// Nothing to do
+		break;
 	}
 }
 
+// The timers point to their connection (data)
 void timeout_start_connection(struct ev_loop *loop, ev_timer *w, int revents)
 {
 	qDebugT();
 	Q_UNUSED(loop);
     Q_UNUSED(revents);
-	if (onOffTimer2Connection.contains(w)) {
-		startConnection(netGraph.connections[onOffTimer2Connection[w]]);
-    }
+	startConnection(*static_cast<NetGraphConnection*>(w->data), -1);
 }
 
 void timeout_stop_connection(struct ev_loop *loop, ev_timer *w, int revents)
@@ -274,46 +317,103 @@ void timeout_stop_connection(struct ev_loop *loop, ev_timer *w, int revents)
 	qDebugT();
     Q_UNUSED(loop);
     Q_UNUSED(revents);
-	if (onOffTimer2Connection.contains(w)) {
-		stopConnection(netGraph.connections[onOffTimer2Connection[w]]);
-    }
+	stopConnection(*static_cast<NetGraphConnection*>(w->data));
 }
 
-void createOnOffTimers()
+// Creates the timers of the connections of an event loop thread.
+void createOnOffTimers(struct ev_loop *loop, int threadIndex)
 {
 	qDebugT();
-    foreach (NetGraphConnection c, netGraph.connections) {
+	for (int iConnection = 0; iConnection < netGraph.connections.count(); iConnection++) {
+		if (connection2Thread[iConnection] != threadIndex)
+			continue;
+		NetGraphConnection &c = netGraph.connections[iConnection];
 		if (c.maskedOut)
 			continue;
 		if (netGraph.nodes[c.source].maskedOut)
-			return;
+			continue;
 		qreal firstStart = c.onOff ? frand() * (c.onDurationMax + c.offDurationMax) : frand();
 		qreal onDuration = c.onOff ? c.onDurationMin + frand() * (c.onDurationMax - c.onDurationMin) : 0.0;
 		qreal offDuration = c.onOff ? c.offDurationMin + frand() * (c.offDurationMax - c.offDurationMin) : 0.0;
 
-		struct ev_loop *loop = static_cast<struct ev_loop*>(c.ev_loop);
         {
             ev_timer *timerOn = (ev_timer *)malloc(sizeof(ev_timer));
-			onOffTimer2Connection[timerOn] = c.index;
 			ev_timer_init(timerOn, timeout_start_connection, firstStart, c.onOff ? onDuration + offDuration : 0.0);
+			timerOn->data = &c;
 			ev_timer_start(loop, timerOn);
         }
 		if (c.onOff) {
             ev_timer *timerOff = (ev_timer *)malloc(sizeof(ev_timer));
-			onOffTimer2Connection[timerOff] = c.index;
 			ev_timer_init(timerOff, timeout_stop_connection, firstStart + onDuration, onDuration + offDuration);
+			timerOff->data = &c;
             ev_timer_start(loop, timerOff);
         }
     }
 }
 
-void poissonStartConnectionTimeoutHandler(int revents, void *arg)
+// Runs in each event loop thread: creates the servers and timers of its connections.
+void setupTrafficThread(struct ev_loop *loop, int threadIndex)
 {
-	qDebugT();
+	qDebugT() << threadIndex;
+	flowLogAttachThread(threadIndex);
+	for (int iConnection = 0; iConnection < netGraph.connections.count(); iConnection++) {
+		if (connection2Thread[iConnection] != threadIndex)
+			continue;
+		netGraph.connections[iConnection].ev_loop = loop;
+		initConnection(loop, netGraph.connections[iConnection]);
+	}
+
+	// Generate on-off events
+	createOnOffTimers(loop, threadIndex);
+}
+
+// Prints the totals of all the threads, and the rates since the previous call
+void printTrafficStats()
+{
+	static quint64 lastWritten = 0;
+	static quint64 lastRead = 0;
+	static quint64 tLast = 0;
+	quint64 tNow = getCurrentTimeNanosec();
+	qreal interval = tLast ? qMax(1.0e-9, (tNow - tLast) * 1.0e-9) : 1.0;
+	quint64 written = 0;
+	quint64 read = 0;
+	int endpoints = 0;
+	for (int t = 0; t < trafficThreads.count(); t++) {
+		written += trafficStats[t].bytesWritten.load(std::memory_order_relaxed);
+		read += trafficStats[t].bytesRead.load(std::memory_order_relaxed);
+		endpoints += trafficStats[t].endpoints.load(std::memory_order_relaxed);
+	}
+	fprintf(stderr, "Traffic: %d threads, %d endpoints, sent %s B (%s Mbps), received %s B (%s Mbps)\n",
+			trafficThreads.count(), endpoints,
+			withCommas(written), withCommas(quint64((written - lastWritten) * 8.0e-6 / interval)),
+			withCommas(read), withCommas(quint64((read - lastRead) * 8.0e-6 / interval)));
+	lastWritten = written;
+	lastRead = read;
+	tLast = tNow;
+}
+
+void stats_timeout_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	Q_UNUSED(loop);
+	Q_UNUSED(w);
+	Q_UNUSED(revents);
+	printTrafficStats();
+}
+
+void flow_log_timeout_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	Q_UNUSED(loop);
+	Q_UNUSED(w);
 	Q_UNUSED(revents);
+	flowLogFlush();
+}
+
+void poissonStartConnectionTimeoutHandler(void *arg, ev_tstamp deadline)
+{
+	qDebugT();
 	Q_ASSERT_FORCE(arg != NULL);
 	NetGraphConnection &c = *static_cast<NetGraphConnection *>(arg);
-	startConnection(c);
+	startConnection(c, deadline);
 }
 
 void connectionTransferCompletedHandler(void *arg)
@@ -324,80 +424,74 @@ void connectionTransferCompletedHandler(void *arg)
 	connectionTransferCompleted(c);
 }
 
-bool stopMaster = false;
-void masterSignalCallback(int ) {
-	stopMaster = true;
-}
-
-void runMaster(int argc, char **argv)
+int main(int argc, char **argv)
 {
-	signal(SIGINT, masterSignalCallback);
-	signal(SIGTERM, masterSignalCallback);
-
-	long numCpu = sysconf(_SC_NPROCESSORS_ONLN) / 2;
-	qDebug() << "Spawning" << numCpu << "processes...";
-
-	QVector<QProcess*> children;
-	for (int iChild = 0; iChild < numCpu; iChild++) {
-		QProcess *child = new QProcess();
-		QStringList args;
-		for (int i = 0; i < argc; i++) {
-			args << argv[i];
-		}
-		args << "--child" << QString::number(iChild) << QString::number(numCpu);
+	unsigned int seed = clock() ^ time(NULL) ^ getpid();
+	qDebug() << "seed:" << seed;
+	srand(seed);
 
-		child->setProcessChannelMode(QProcess::MergedChannels);
-        child->start("line-traffic", args);
+	argc--, argv++;
 
-		children << child;
+	if (argc < 1) {
+		fprintf(stderr, "Wrong args\n");
+		exit(-1);
 	}
 
-	while (!stopMaster) {
-		sleep(1);
+	// Default: one event loop thread. With --master: one per two CPUs.
+	int numThreads = 1;
+	if (QString(argv[0]) == "--master") {
+		argc--, argv++;
+		numThreads = qMax(1L, sysconf(_SC_NPROCESSORS_ONLN) / 2);
 	}
 
-	for (int iChild = 0; iChild < numCpu; iChild++) {
-		kill(children[iChild]->pid(), 2); // SIGINT
+	if (QString(argv[0]) == "--bench-udp") {
+		argc--, argv++;
+		return runUdpBenchmark(argc, argv);
 	}
 
-	for (int iChild = 0; iChild < numCpu; iChild++) {
-		children[iChild]->waitForFinished();
-		qDebug() << children[iChild]->readAll();
+	if (QString(argv[0]) == "--bench-tcp") {
+		argc--, argv++;
+		return runTcpBenchmark(argc, argv);
 	}
-}
 
-int main(int argc, char **argv)
-{
-	unsigned int seed = clock() ^ time(NULL) ^ getpid();
-	qDebug() << "seed:" << seed;
-	srand(seed);
+	if (QString(argv[0]) == "--bench-flows") {
+		argc--, argv++;
+		return runFlowBenchmark(argc, argv);
+	}
 
-	argc--, argv++;
+	if (QString(argv[0]) == "--convert-trace") {
+		argc--, argv++;
+		return convertTrace(argc, argv);
+	}
+
+	if (QString(argv[0]) == "--print-flow-log") {
+		argc--, argv++;
+		return printFlowLog(argc, argv);
+	}
 
 	if (argc < 1) {
 		fprintf(stderr, "Wrong args\n");
 		exit(-1);
 	}
 
-	if (QString(argv[0]) == "--master") {
-		argc--, argv++;
-		runMaster(argc, argv);
-		exit(0);
-	}
-
 	QString netgraphFileName = argv[0];
 	argc--, argv++;
 
-	int workerIndex = 0;
-	int numWorkers = 1;
+	QString flowLogFileName;
 
 	while (argc > 0) {
 		QString arg = argv[0];
 		argc--, argv++;
-		if (arg == "--child" && argc == 2) {
-			workerIndex = QString(argv[0]).toInt();
+		if (arg == "--threads" && argc >= 1) {
+			bool ok;
+			numThreads = QString(argv[0]).toInt(&ok);
 			argc--, argv++;
-			numWorkers = QString(argv[0]).toInt();
+			if (!ok || numThreads < 1) {
+				fprintf(stderr, "Wrong args\n");
+				exit(-1);
+			}
+		} else if (arg == "--flow-log" && argc >= 1) {
+			flowLogFileName = argv[0];
 			argc--, argv++;
 		} else {
 			fprintf(stderr, "Wrong args\n");
@@ -418,16 +512,37 @@ int main(int argc, char **argv)
 	assignPorts();
 
 	for (int c = 0; c < netGraph.connections.count(); c++) {
-		netGraph.connections[c].maskedOut = c % numWorkers != workerIndex;
+		NetGraphConnection &connection = netGraph.connections[c];
+		connectionTypes << connectionTypeFromName(connection.basicType);
+		connectionSourceIPs << netGraph.nodes[connection.source].ip().toLatin1();
+		connectionDestIPs << netGraph.nodes[connection.dest].ip().toLatin1();
+		connectionDestForeignIPs << netGraph.nodes[connection.dest].ipForeign().toLatin1();
 	}
+	connectionTraces = new TraceReplay*[netGraph.connections.count()]();
+
 	QStringList allInterfaceIPs = getAllInterfaceIPs();
 	for (int n = 0; n < netGraph.nodes.count(); n++) {
 		netGraph.nodes[n].maskedOut = !allInterfaceIPs.contains(netGraph.nodes[n].ip());
 	}
 
+	trafficStats = new TrafficThreadStats[numThreads];
+	connection2Thread = assignConnectionsToThreads(netGraph, numThreads, trafficStats);
+	for (int c = 0; c < netGraph.connections.count(); c++) {
+		netGraph.connections[c].maskedOut = connection2Thread[c] < 0;
+	}
+
 	// important to ignore SIGPIPE....who designed read/write this way?!
 	signal(SIGPIPE, SIG_IGN);
 
+	// Shared by all the sources
+	initPayload();
+
+	if (!flowLogFileName.isEmpty()) {
+		if (!flowLogOpen(flowLogFileName, numThreads)) {
+			exit(-1);
+		}
+	}
+
 	struct ev_loop *loop = ev_default_loop(0);
     QString backendName;
     int backendCode = ev_backend(loop);
@@ -448,35 +563,47 @@ int main(int argc, char **argv)
     }
     fprintf(stderr, "Event loop backend: %s\n", backendName.toLatin1().data());
 
-	for (int c = 0; c < netGraph.connections.count(); c++) {
-		if (!netGraph.connections[c].maskedOut) {
-			netGraph.connections[c].ev_loop = loop;
-		}
-	}
-
 	struct ev_signal signal_watcher;
     ev_signal_init(&signal_watcher, sigint_cb, SIGINT);
 	ev_signal_start(loop, &signal_watcher);
+	struct ev_signal sigterm_watcher;
+	ev_signal_init(&sigterm_watcher, sigint_cb, SIGTERM);
+	ev_signal_start(loop, &sigterm_watcher);
+
+	ev_timer stats_watcher;
+	ev_timer_init(&stats_watcher, stats_timeout_cb, 10.0, 10.0);
+	ev_timer_start(loop, &stats_watcher);
+	printTrafficStats();
+
+	ev_timer flow_log_watcher;
+	if (!flowLogFileName.isEmpty()) {
+		ev_timer_init(&flow_log_watcher, flow_log_timeout_cb, FLOW_LOG_FLUSH_INTERVAL, FLOW_LOG_FLUSH_INTERVAL);
+		ev_timer_start(loop, &flow_log_watcher);
+	}
 
 	fprintf(stderr, "Connection count: %d\n", netGraph.connections.count());
 
-	// Create servers
-	foreach (NetGraphConnection c, netGraph.connections) {
-		if (c.maskedOut)
-			continue;
-		if (netGraph.nodes[c.dest].maskedOut)
-			continue;
-		initConnection(loop, netGraph.connections[c.index]);
+	// Each thread creates its servers and timers, then runs its loop
+	long numCpu = sysconf(_SC_NPROCESSORS_ONLN);
+	for (int t = 0; t < numThreads; t++) {
+		trafficThreads << new TrafficThread(t, t % numCpu, setupTrafficThread, &trafficStats[t]);
+	}
+	foreach (TrafficThread *thread, trafficThreads) {
+		thread->start();
 	}
 
-	// Generate on-off events
-	createOnOffTimers();
-
-	// Start infinite loop
+	// The main loop only handles signals and prints the stats
 	ev_loop(loop, 0);
 
-	tcp_close_all();
-	udp_close_all();
+	foreach (TrafficThread *thread, trafficThreads) {
+		thread->wait();
+	}
+	printTrafficStats();
+	flowLogClose();
+	foreach (TrafficThread *thread, trafficThreads) {
+		delete thread;
+	}
+	trafficThreads.clear();
 
 	return 0;
 
@@ -0,0 +1,63 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "payload.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "util.h"
+
+// Layout: PAYLOAD_SIZE bytes of 'z', followed by '\0'
+static char *payloadRegion = NULL;
+
+void initPayload()
+{
+	if (payloadRegion)
+		return;
+	size_t size = PAYLOAD_SIZE + 1;
+	void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED) {
+		perror("mmap");
+		exit(-1);
+	}
+	memset(region, 'z', PAYLOAD_SIZE);
+	((char*)region)[PAYLOAD_SIZE] = '\0';
+	// Any write to the payload by mistake crashes instead of corrupting the data of the other flows
+	if (mprotect(region, size, PROT_READ) < 0) {
+		perror("mprotect");
+		exit(-1);
+	}
+	payloadRegion = (char*)region;
+}
+
+const char *payloadData(qint64 length)
+{
+	Q_ASSERT_FORCE(0 <= length && length <= PAYLOAD_SIZE);
+	initPayload();
+	return payloadRegion;
+}
+
+const char *payloadDataNullTerminated(qint64 length)
+{
+	Q_ASSERT_FORCE(0 <= length && length <= PAYLOAD_SIZE + 1);
+	initPayload();
+	return payloadRegion + PAYLOAD_SIZE + 1 - length;
+}
@@ -0,0 +1,42 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <QtCore>
+
+// Size of the shared payload region. Longer transfers send the region several times.
+#define PAYLOAD_SIZE (1 << 20)
+
+// The traffic sources send constant bytes ('z'). Instead of filling a new buffer for every frame
+// or chunk, they all send from one read-only region allocated once per process, which the kernel
+// can also transmit without copying (MSG_ZEROCOPY).
+
+// Allocates the payload region. Called from main(), before the event loop starts; the other
+// functions call it too if needed.
+void initPayload();
+
+// Returns the address of length (at most PAYLOAD_SIZE) payload bytes.
+const char *payloadData(qint64 length = PAYLOAD_SIZE);
+
+// Returns the address of length (at most PAYLOAD_SIZE + 1) bytes that end with a '\0' terminator,
+// which marks the end of a transfer for TCPSink.
+const char *payloadDataNullTerminated(qint64 length);
+
+#endif // PAYLOAD_H
@@ -19,6 +19,7 @@
 #include "readerwriter.h"
 
 #include "chronometer.h"
+#include "slabpool.h"
 #include "util.h"
 
 #ifdef DEBUG
@@ -26,6 +27,13 @@
 #endif
 #define DEBUG 0
 
+// The endpoints of the calling thread. Each event loop thread creates, uses and deletes its own
+// endpoints, so this needs no locking.
+static thread_local QSet<ReaderWriter*> threadEndpoints;
+// Bytes transferred by the deleted endpoints of the calling thread
+static thread_local quint64 threadDeletedBytesRead = 0;
+static thread_local quint64 threadDeletedBytesWritten = 0;
+
 ReaderWriter::ReaderWriter(int fd)
 	: m_fd(fd)
 {
@@ -33,10 +41,35 @@ ReaderWriter::ReaderWriter(int fd)
 	stopped = false;
 	totalRead = 0;
 	totalWritten = 0;
+	threadEndpoints.insert(this);
 }
 
 ReaderWriter::~ReaderWriter()
 {
+	threadEndpoints.remove(this);
+	threadDeletedBytesRead += totalRead;
+	threadDeletedBytesWritten += totalWritten;
+}
+
+void *ReaderWriter::operator new(size_t size)
+{
+	return slabAllocate(size);
+}
+
+void ReaderWriter::operator delete(void *p, size_t size)
+{
+	slabFree(p, size);
+}
+
+void getThreadTrafficTotals(quint64 &bytesWritten, quint64 &bytesRead, int &endpoints)
+{
+	bytesWritten = threadDeletedBytesWritten;
+	bytesRead = threadDeletedBytesRead;
+	foreach (ReaderWriter *rw, threadEndpoints) {
+		bytesWritten += rw->totalWritten;
+		bytesRead += rw->totalRead;
+	}
+	endpoints = threadEndpoints.count();
 }
 
 void ReaderWriter::onConnect()
@@ -27,6 +27,11 @@ public:
 	ReaderWriter(int fd = 0);
 	virtual ~ReaderWriter();
 
+	// Endpoints are allocated from per-thread slab pools (see slabpool.h): short flows create and
+	// delete one for every transfer.
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+
 	virtual void onConnect();
 	virtual void onRead(QByteArray buffer);
 	virtual void onWrite();
@@ -71,4 +76,8 @@ public:
 	quint16 remotePort;
 };
 
+// Sums the bytes transferred by the endpoints created by the calling thread, including the ones
+// already deleted. endpoints is set to the number of endpoints currently open.
+void getThreadTrafficTotals(quint64 &bytesWritten, quint64 &bytesRead, int &endpoints);
+
 #endif // READERWRITER_H
@@ -0,0 +1,104 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "ringbuffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+RingBuffer::RingBuffer(int capacity)
+{
+	m_capacity = 1;
+	while (m_capacity < capacity)
+		m_capacity *= 2;
+	// Allocated on first use: most connections never queue anything
+	m_data = NULL;
+	m_head = 0;
+	m_count = 0;
+}
+
+RingBuffer::~RingBuffer()
+{
+	free(m_data);
+}
+
+void RingBuffer::reserve(int capacity)
+{
+	int newCapacity = m_capacity;
+	while (newCapacity < capacity)
+		newCapacity *= 2;
+	if (m_data && newCapacity == m_capacity)
+		return;
+	char *newData = (char*)malloc(newCapacity);
+	Q_ASSERT_FORCE(newData);
+	// Linearize
+	struct iovec iov[2];
+	int n = segments(iov);
+	int offset = 0;
+	for (int i = 0; i < n; i++) {
+		memcpy(newData + offset, iov[i].iov_base, iov[i].iov_len);
+		offset += iov[i].iov_len;
+	}
+	free(m_data);
+	m_data = newData;
+	m_capacity = newCapacity;
+	m_head = 0;
+}
+
+void RingBuffer::append(const char *data, int length)
+{
+	if (length <= 0)
+		return;
+	Q_ASSERT_FORCE(m_count <= INT_MAX - length);
+	reserve(m_count + length);
+	int tail = (m_head + m_count) & (m_capacity - 1);
+	int first = qMin(length, m_capacity - tail);
+	memcpy(m_data + tail, data, first);
+	memcpy(m_data, data + first, length - first);
+	m_count += length;
+}
+
+int RingBuffer::segments(struct iovec *iov) const
+{
+	if (m_count == 0)
+		return 0;
+	int first = qMin(m_count, m_capacity - m_head);
+	iov[0].iov_base = m_data + m_head;
+	iov[0].iov_len = first;
+	if (first == m_count)
+		return 1;
+	iov[1].iov_base = m_data;
+	iov[1].iov_len = m_count - first;
+	return 2;
+}
+
+void RingBuffer::consume(int length)
+{
+	Q_ASSERT_FORCE(0 <= length && length <= m_count);
+	m_count -= length;
+	// Restart from the beginning when empty, so that the next sends are not split in two
+	m_head = (m_count == 0) ? 0 : ((m_head + length) & (m_capacity - 1));
+}
+
+void RingBuffer::clear()
+{
+	m_head = 0;
+	m_count = 0;
+}
@@ -0,0 +1,62 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <sys/uio.h>
+#include <QtCore>
+
+// Circular byte buffer used for the data queued on a socket.
+// Appending and consuming do not move the queued data; the data is passed to writev()/sendmsg()
+// as at most two segments. The capacity is a power of two; it doubles (as many times as needed)
+// whenever more data is queued than it can hold. It is not fixed, because TCPClient::write() must
+// accept data of any size: the sources have no backpressure other than the socket buffer.
+class RingBuffer {
+public:
+	RingBuffer(int capacity = 65536);
+	~RingBuffer();
+
+	inline int count() const { return m_count; }
+	inline bool isEmpty() const { return m_count == 0; }
+	inline int capacity() const { return m_capacity; }
+
+	void append(const char *data, int length);
+	void append(const QByteArray &data) { append(data.constData(), data.count()); }
+	// Fills iov with the queued data, in order. Returns the number of segments (0, 1 or 2).
+	// Never pass them to a MSG_ZEROCOPY send: consume() frees the space for the next append(),
+	// while the kernel reads zero-copy pages until the completion is reaped.
+	int segments(struct iovec *iov) const;
+	// Removes length bytes from the front
+	void consume(int length);
+	void clear();
+
+protected:
+	void reserve(int capacity);
+
+	char *m_data;
+	int m_capacity;
+	// Position of the first byte
+	int m_head;
+	int m_count;
+
+private:
+	Q_DISABLE_COPY(RingBuffer)
+};
+
+#endif // RINGBUFFER_H
@@ -0,0 +1,98 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "slabpool.h"
+
+#define SLAB_CLASS_SIZE 64
+#define SLAB_CLASS_COUNT 16
+
+// One pool per size class: class i holds blocks of (i + 1) * SLAB_CLASS_SIZE bytes
+template<int N>
+struct SlabClassObject {
+	char data[N * SLAB_CLASS_SIZE];
+};
+
+static thread_local SlabPool<SlabClassObject<1> > pool1;
+static thread_local SlabPool<SlabClassObject<2> > pool2;
+static thread_local SlabPool<SlabClassObject<3> > pool3;
+static thread_local SlabPool<SlabClassObject<4> > pool4;
+static thread_local SlabPool<SlabClassObject<5> > pool5;
+static thread_local SlabPool<SlabClassObject<6> > pool6;
+static thread_local SlabPool<SlabClassObject<7> > pool7;
+static thread_local SlabPool<SlabClassObject<8> > pool8;
+static thread_local SlabPool<SlabClassObject<9> > pool9;
+static thread_local SlabPool<SlabClassObject<10> > pool10;
+static thread_local SlabPool<SlabClassObject<11> > pool11;
+static thread_local SlabPool<SlabClassObject<12> > pool12;
+static thread_local SlabPool<SlabClassObject<13> > pool13;
+static thread_local SlabPool<SlabClassObject<14> > pool14;
+static thread_local SlabPool<SlabClassObject<15> > pool15;
+static thread_local SlabPool<SlabClassObject<16> > pool16;
+
+#define SLAB_CLASS_CASE(N) \
+	case N - 1: \
+		if (p) { pool##N.release((SlabClassObject<N>*)p); return NULL; } \
+		return pool##N.allocate();
+
+// Allocates (p == NULL) or releases (p != NULL) a block of size class sizeClass
+static void *slabClassOp(int sizeClass, void *p)
+{
+	switch (sizeClass) {
+		SLAB_CLASS_CASE(1)
+		SLAB_CLASS_CASE(2)
+		SLAB_CLASS_CASE(3)
+		SLAB_CLASS_CASE(4)
+		SLAB_CLASS_CASE(5)
+		SLAB_CLASS_CASE(6)
+		SLAB_CLASS_CASE(7)
+		SLAB_CLASS_CASE(8)
+		SLAB_CLASS_CASE(9)
+		SLAB_CLASS_CASE(10)
+		SLAB_CLASS_CASE(11)
+		SLAB_CLASS_CASE(12)
+		SLAB_CLASS_CASE(13)
+		SLAB_CLASS_CASE(14)
+		SLAB_CLASS_CASE(15)
+		SLAB_CLASS_CASE(16)
+	}
+	Q_ASSERT_FORCE(false);
+	return NULL;
+}
+
+void *slabAllocate(size_t size)
+{
+	int sizeClass = (size + SLAB_CLASS_SIZE - 1) / SLAB_CLASS_SIZE - 1;
+	if (size == 0 || sizeClass >= SLAB_CLASS_COUNT) {
+		void *p = malloc(qMax(size, (size_t)1));
+		Q_ASSERT_FORCE(p);
+		return p;
+	}
+	return slabClassOp(sizeClass, NULL);
+}
+
+void slabFree(void *p, size_t size)
+{
+	if (!p)
+		return;
+	int sizeClass = (size + SLAB_CLASS_SIZE - 1) / SLAB_CLASS_SIZE - 1;
+	if (size == 0 || sizeClass >= SLAB_CLASS_COUNT) {
+		free(p);
+		return;
+	}
+	slabClassOp(sizeClass, p);
+}
@@ -0,0 +1,88 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef SLABPOOL_H
+#define SLABPOOL_H
+
+#include <stdlib.h>
+#include <QtCore>
+
+#include "util.h"
+
+// Fixed-size object pool. Objects are carved from slabs of SLAB_POOL_OBJECTS and recycled through
+// a free list, so allocating and releasing one costs a few instructions instead of a malloc/free.
+// Slabs are never returned to the system. The memory is not initialized (intended for libev
+// watchers and other POD structures). Not thread-safe: use one pool per thread.
+#define SLAB_POOL_OBJECTS 256
+
+template<typename T>
+class SlabPool
+{
+public:
+	SlabPool() : freeList(NULL), allocated(0) {}
+
+	T *allocate() {
+		if (!freeList) {
+			grow();
+		}
+		FreeNode *node = freeList;
+		freeList = node->next;
+		allocated++;
+		return reinterpret_cast<T*>(node);
+	}
+
+	void release(T *object) {
+		if (!object)
+			return;
+		FreeNode *node = reinterpret_cast<FreeNode*>(object);
+		node->next = freeList;
+		freeList = node;
+		allocated--;
+	}
+
+	// Number of objects in use
+	qint64 count() const {
+		return allocated;
+	}
+
+protected:
+	union FreeNode {
+		FreeNode *next;
+		char object[sizeof(T)];
+	};
+
+	void grow() {
+		FreeNode *slab = (FreeNode*)malloc(SLAB_POOL_OBJECTS * sizeof(FreeNode));
+		Q_ASSERT_FORCE(slab);
+		for (int i = 0; i < SLAB_POOL_OBJECTS; i++) {
+			slab[i].next = (i + 1 < SLAB_POOL_OBJECTS) ? &slab[i + 1] : freeList;
+		}
+		freeList = slab;
+	}
+
+	FreeNode *freeList;
+	qint64 allocated;
+};
+
+// Variable-size allocation from per-thread pools of size classes (multiples of 64 B up to 1 KB;
+// larger blocks use malloc). slabFree() must be given the size passed to slabAllocate().
+// Memory freed by another thread than the one that allocated it is recycled by the freeing thread.
+void *slabAllocate(size_t size);
+void slabFree(void *p, size_t size);
+
+#endif // SLABPOOL_H
@@ -0,0 +1,109 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "tcpbench.h"
+
+#include <ev.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "evtcp.h"
+#include "tcpsource.h"
+#include "chronometer.h"
+#include "util.h"
+
+class TCPBenchSink : public TCPClient {
+public:
+	TCPBenchSink(int fd, quint64 *reads) : TCPClient(fd), reads(reads) {}
+	static TCPClient* makeTCPBenchSink(int fd, void *arg) {
+		return new TCPBenchSink(fd, (quint64*)arg);
+	}
+	virtual void onRead(QByteArray) {
+		(*reads)++;
+	}
+	quint64 *reads;
+};
+
+static TCPClient *benchSource = NULL;
+
+static TCPClient* makeTCPBenchSource(int fd, void *arg)
+{
+	benchSource = TCPSource::makeTCPSource(fd, arg);
+	return benchSource;
+}
+
+static void benchTimeoutCallback(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	Q_UNUSED(w);
+	Q_UNUSED(revents);
+	ev_unloop(loop, EVUNLOOP_ALL);
+}
+
+static qreal getCpuTime()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1.0e-6 +
+			usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1.0e-6;
+}
+
+int runTcpBenchmark(int argc, char **argv)
+{
+	qreal seconds = 5.0;
+	int port = 20000;
+	bool ok = true;
+	if (argc > 0) {
+		seconds = QString(argv[0]).toDouble(&ok);
+		ok = ok && seconds > 0;
+	}
+	if (ok && argc > 1) {
+		port = QString(argv[1]).toInt(&ok);
+	}
+	if (!ok) {
+		fprintf(stderr, "Usage: line-traffic --bench-tcp [seconds] [port]\n");
+		return -1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	struct ev_loop *loop = ev_default_loop(0);
+	quint64 reads = 0;
+	tcp_server(loop, "127.0.0.1", port, TCPBenchSink::makeTCPBenchSink, &reads);
+	tcp_client(loop, "127.0.0.1", "127.0.0.1", port, 0, makeTCPBenchSource, NULL);
+
+	ev_timer timeout;
+	ev_timer_init(&timeout, benchTimeoutCallback, seconds, 0.0);
+	ev_timer_start(loop, &timeout);
+
+	quint64 tStart = getCurrentTimeNanosec();
+	qreal cpuStart = getCpuTime();
+	ev_loop(loop, 0);
+	qreal duration = (getCurrentTimeNanosec() - tStart) * 1.0e-9;
+	qreal cpu = getCpuTime() - cpuStart;
+
+	quint64 bytesSent = benchSource ? benchSource->totalWritten : 0;
+	qreal gbits = bytesSent * 8.0e-9;
+	fprintf(stderr, "TCP loopback benchmark: %.1f s, %.1f s CPU\n", duration, cpu);
+	fprintf(stderr, "Sent: %s B, %.2f Gbps\n", withCommas(bytesSent), gbits / duration);
+	fprintf(stderr, "Reads: %s, %s B/read\n",
+			withCommas(reads), withCommas(reads > 0 ? bytesSent / reads : 0));
+	fprintf(stderr, "CPU per Gb: %.3f s (both endpoints)\n", gbits > 0 ? cpu / gbits : 0.0);
+
+	tcp_close_all();
+	return 0;
+}
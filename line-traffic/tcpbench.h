@@ -0,0 +1,27 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef TCPBENCH_H
+#define TCPBENCH_H
+
+// Loopback benchmark of the TCP data path: one TCPSource and one sink on the same event loop,
+// i.e. on one core. Prints the throughput and the CPU time used per Gb.
+// Usage: line-traffic --bench-tcp [seconds] [port]
+int runTcpBenchmark(int argc, char **argv);
+
+#endif // TCPBENCH_H
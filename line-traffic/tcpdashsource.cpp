@@ -78,9 +78,7 @@ void TCPDashSource::onWrite()
 
     qint64 size = params.shouldSend(totalWritten, (getCurrentTimeNanosec() - tConnect) * 1.0e-9);
     if (size > 0) {
-        QByteArray b;
-        b.fill('z', size);
-        write(b);
+        writePayload(size);
     }
 }
 
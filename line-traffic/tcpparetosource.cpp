@@ -49,16 +49,19 @@ void TCPParetoSource::onWrite()
 		return;
 	}
 
-	QByteArray b;
+	if (pendingPayload > 0) {
+		// Do not queue more than the transfer size
+		flushWrites();
+		return;
+	}
+
 	quint64 left = transferSize - getTotalBytesWritten();
 	const unsigned int bufferSize = 10000;
 	if (left > bufferSize) {
-		b.fill('z', bufferSize);
+		writePayload(bufferSize);
 	} else {
-		b.fill('z', left - 1);
-		b.append('\0');
+		writePayload(left, true);
 	}
-	write(b);
 }
 
 void TCPParetoSource::onStop()
@@ -33,9 +33,7 @@ void TCPSource::onWrite()
 {
 	TCPClient::onWrite();
 
-	QByteArray b;
-	b.fill('z', 100000);
-	write(b);
+	writePayload(100000);
 }
 
 void TCPSource::onStop()
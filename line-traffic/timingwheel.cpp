@@ -0,0 +1,155 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "timingwheel.h"
+
+#include <math.h>
+#include <string.h>
+
+static void timing_wheel_tick_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	Q_UNUSED(loop);
+	Q_UNUSED(revents);
+	static_cast<TimingWheel*>(w->data)->onTick();
+}
+
+TimingWheel::TimingWheel(struct ev_loop *loop) :
+	loop(loop)
+{
+	tStart = ev_now(loop);
+	currentTick = 0;
+	processing = false;
+	m_count = 0;
+	memset(slots, 0, sizeof(slots));
+	ev_timer_init(&w_tick, timing_wheel_tick_cb, TIMING_WHEEL_TICK, TIMING_WHEEL_TICK);
+	w_tick.data = this;
+}
+
+TimingWheel::~TimingWheel()
+{
+	ev_timer_stop(loop, &w_tick);
+	for (int i = 0; i < TIMING_WHEEL_SLOTS; i++) {
+		while (slots[i]) {
+			Entry *e = slots[i];
+			slots[i] = e->next;
+			entryPool.release(e);
+		}
+	}
+}
+
+TimingWheel *TimingWheel::threadWheel(struct ev_loop *loop)
+{
+	static thread_local TimingWheel *wheel = NULL;
+	if (!wheel) {
+		wheel = new TimingWheel(loop);
+	}
+	Q_ASSERT_FORCE(wheel->loop == loop);
+	return wheel;
+}
+
+int TimingWheel::count() const
+{
+	return m_count;
+}
+
+quint64 TimingWheel::deadlineToTick(ev_tstamp deadline)
+{
+	ev_tstamp ticks = ceil((deadline - tStart) / TIMING_WHEEL_TICK);
+	quint64 tick = ticks > 0 ? quint64(ticks) : 0;
+	if (tick <= currentTick) {
+		// Already due: in this tick if one is being processed, otherwise in the next one
+		tick = processing ? currentTick : currentTick + 1;
+	}
+	return tick;
+}
+
+void TimingWheel::scheduleAt(ev_tstamp deadline, TimingWheelCallback callback, void *arg)
+{
+	if (m_count == 0 && !processing) {
+		// The wheel was idle: skip the ticks elapsed in the meantime (all slots are empty)
+		ev_tstamp elapsed = floor((ev_now(loop) - tStart) / TIMING_WHEEL_TICK);
+		currentTick = qMax(currentTick, elapsed > 0 ? quint64(elapsed) : 0ULL);
+		ev_timer_again(loop, &w_tick);
+	}
+	Entry *e = entryPool.allocate();
+	e->tick = deadlineToTick(deadline);
+	e->deadline = deadline;
+	e->callback = callback;
+	e->arg = arg;
+	Entry *&slot = slots[e->tick & (TIMING_WHEEL_SLOTS - 1)];
+	e->next = slot;
+	slot = e;
+	m_count++;
+}
+
+void TimingWheel::schedule(ev_tstamp delay, TimingWheelCallback callback, void *arg)
+{
+	scheduleAt(ev_now(loop) + qMax(delay, 0.0), callback, arg);
+}
+
+void TimingWheel::processTick(quint64 tick)
+{
+	Entry *&slot = slots[tick & (TIMING_WHEEL_SLOTS - 1)];
+	// Callbacks may add due entries to this slot; repeat until none is left
+	bool fired = true;
+	while (fired) {
+		fired = false;
+		Entry *e = slot;
+		slot = NULL;
+		while (e) {
+			Entry *next = e->next;
+			if (e->tick <= tick) {
+				TimingWheelCallback callback = e->callback;
+				void *arg = e->arg;
+				ev_tstamp deadline = e->deadline;
+				entryPool.release(e);
+				m_count--;
+				callback(arg, deadline);
+				fired = true;
+			} else {
+				// Due in a later round
+				e->next = slot;
+				slot = e;
+			}
+			e = next;
+		}
+	}
+}
+
+void TimingWheel::onTick()
+{
+	ev_tstamp elapsed = floor((ev_now(loop) - tStart) / TIMING_WHEEL_TICK);
+	quint64 target = elapsed > 0 ? quint64(elapsed) : 0;
+	processing = true;
+	if (target > currentTick + TIMING_WHEEL_SLOTS) {
+		// The loop was blocked for more than a round: every slot has to be visited anyway
+		currentTick = target;
+		for (int i = TIMING_WHEEL_SLOTS - 1; i >= 0; i--) {
+			processTick(target - i);
+		}
+	} else {
+		while (currentTick < target) {
+			currentTick++;
+			processTick(currentTick);
+		}
+	}
+	processing = false;
+	if (m_count == 0) {
+		ev_timer_stop(loop, &w_tick);
+	}
+}
@@ -0,0 +1,85 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <ev.h>
+#include <QtCore>
+
+#include "slabpool.h"
+
+// Resolution of the timing wheel (s)
+#define TIMING_WHEEL_TICK 0.001
+// Number of slots (power of two); deadlines further than this many ticks wait for the next rounds
+#define TIMING_WHEEL_SLOTS 4096
+
+typedef void (*TimingWheelCallback)(void *arg, ev_tstamp deadline);
+
+// Hashed timing wheel for the flow arrivals of an event loop.
+// Scheduling and firing a timer is O(1) and allocation-free (the entries come from a slab pool),
+// and one ev_timer ticks for all of them, unlike ev_once() which allocates and inserts a watcher
+// in the heap of the loop for every call.
+// A timer fires at the first tick after its deadline. Timers scheduled from a callback with a
+// deadline that has already passed fire in the same tick, so a chain of arrivals that keeps its
+// own deadlines (next = deadline + interval) is not slowed down by the tick.
+class TimingWheel
+{
+public:
+	TimingWheel(struct ev_loop *loop);
+	~TimingWheel();
+
+	// Calls callback(arg, deadline) at the time deadline (in the time base of ev_now()).
+	void scheduleAt(ev_tstamp deadline, TimingWheelCallback callback, void *arg);
+	// Calls callback(arg, deadline) after delay seconds.
+	void schedule(ev_tstamp delay, TimingWheelCallback callback, void *arg);
+
+	// Number of pending timers
+	int count() const;
+
+	// Returns the wheel of the loop of the calling thread (created on first use).
+	static TimingWheel *threadWheel(struct ev_loop *loop);
+
+	void onTick();
+
+protected:
+	struct Entry {
+		quint64 tick;
+		ev_tstamp deadline;
+		TimingWheelCallback callback;
+		void *arg;
+		Entry *next;
+	};
+
+	quint64 deadlineToTick(ev_tstamp deadline);
+	// Fires the entries of the slot of tick that are due (tick <= this tick)
+	void processTick(quint64 tick);
+
+	struct ev_loop *loop;
+	ev_timer w_tick;
+	ev_tstamp tStart;
+	// Last tick processed
+	quint64 currentTick;
+	// Set while a tick is processed
+	bool processing;
+	Entry *slots[TIMING_WHEEL_SLOTS];
+	SlabPool<Entry> entryPool;
+	int m_count;
+};
+
+#endif // TIMINGWHEEL_H
@@ -0,0 +1,454 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "tracereplay.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "timingwheel.h"
+#include "util.h"
+
+#ifdef DEBUG
+#undef DEBUG
+#endif
+#define DEBUG 0
+
+static_assert(sizeof(TraceFileHeader) == 40, "TraceFileHeader must match the file format");
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord must match the file format");
+
+static void decodeHeader(const uchar *p, TraceFileHeader &header)
+{
+	memcpy(header.magic, p, 8);
+	header.version = qFromLittleEndian<quint32>(p + 8);
+	header.recordSize = qFromLittleEndian<quint32>(p + 12);
+	header.recordCount = qFromLittleEndian<quint64>(p + 16);
+	header.duration_ns = qFromLittleEndian<quint64>(p + 24);
+	header.totalBytes = qFromLittleEndian<quint64>(p + 32);
+}
+
+static void encodeHeader(const TraceFileHeader &header, uchar *p)
+{
+	memcpy(p, header.magic, 8);
+	qToLittleEndian<quint32>(header.version, p + 8);
+	qToLittleEndian<quint32>(header.recordSize, p + 12);
+	qToLittleEndian<quint64>(header.recordCount, p + 16);
+	qToLittleEndian<quint64>(header.duration_ns, p + 24);
+	qToLittleEndian<quint64>(header.totalBytes, p + 32);
+}
+
+static void decodeRecord(const uchar *p, TraceRecord &record)
+{
+	record.start_ns = qFromLittleEndian<quint64>(p);
+	record.size = qFromLittleEndian<quint64>(p + 8);
+	record.rate_kbps = qFromLittleEndian<quint32>(p + 16);
+	record.trafficClass = p[20];
+	record.flags = p[21];
+	record.reserved = 0;
+}
+
+static void encodeRecord(const TraceRecord &record, uchar *p)
+{
+	qToLittleEndian<quint64>(record.start_ns, p);
+	qToLittleEndian<quint64>(record.size, p + 8);
+	qToLittleEndian<quint32>(record.rate_kbps, p + 16);
+	p[20] = record.trafficClass;
+	p[21] = record.flags;
+	p[22] = 0;
+	p[23] = 0;
+}
+
+TraceFile::TraceFile()
+{
+	memset(&header, 0, sizeof(header));
+	data = NULL;
+	size = 0;
+	released = 0;
+}
+
+TraceFile::~TraceFile()
+{
+	close();
+}
+
+bool TraceFile::open(QString fileName)
+{
+	close();
+	QByteArray name = fileName.toLocal8Bit();
+
+	int fd = ::open(name.constData(), O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open trace %s: %s\n", name.constData(), strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		fprintf(stderr, "Could not stat trace %s: %s\n", name.constData(), strerror(errno));
+		::close(fd);
+		return false;
+	}
+	if (st.st_size < (off_t)sizeof(TraceFileHeader)) {
+		fprintf(stderr, "Trace %s is too short\n", name.constData());
+		::close(fd);
+		return false;
+	}
+	void *region = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (region == MAP_FAILED) {
+		fprintf(stderr, "Could not map trace %s: %s\n", name.constData(), strerror(errno));
+		return false;
+	}
+	data = (const uchar*)region;
+	size = st.st_size;
+	madvise(region, size, MADV_SEQUENTIAL);
+
+	decodeHeader(data, header);
+	if (memcmp(header.magic, TRACE_MAGIC, 8) != 0 ||
+		header.version != TRACE_VERSION ||
+		header.recordSize != sizeof(TraceRecord)) {
+		fprintf(stderr, "Trace %s: unsupported format\n", name.constData());
+		close();
+		return false;
+	}
+	if (header.recordCount > (size - sizeof(TraceFileHeader)) / sizeof(TraceRecord)) {
+		fprintf(stderr, "Trace %s is truncated\n", name.constData());
+		close();
+		return false;
+	}
+	if (header.recordCount > 0) {
+		// Looping must advance the time. The last record is decoded straight from the mapping:
+		// record() would release the pages before it.
+		TraceRecord last;
+		decodeRecord(data + sizeof(TraceFileHeader) + (header.recordCount - 1) * sizeof(TraceRecord), last);
+		header.duration_ns = qMax(header.duration_ns, last.start_ns + 1000000ULL);
+	}
+	rewind();
+	return true;
+}
+
+void TraceFile::close()
+{
+	if (data) {
+		munmap((void*)data, size);
+	}
+	data = NULL;
+	size = 0;
+	released = 0;
+	memset(&header, 0, sizeof(header));
+}
+
+quint64 TraceFile::count() const
+{
+	return header.recordCount;
+}
+
+TraceRecord TraceFile::record(quint64 i)
+{
+	Q_ASSERT_FORCE(data && i < header.recordCount);
+	size_t offset = sizeof(TraceFileHeader) + i * sizeof(TraceRecord);
+	if (offset >= released + TRACE_RELEASE_CHUNK) {
+		size_t end = offset & ~(size_t)(sysconf(_SC_PAGESIZE) - 1);
+		madvise((void*)(data + released), end - released, MADV_DONTNEED);
+		released = end;
+	}
+	TraceRecord result;
+	decodeRecord(data + offset, result);
+	return result;
+}
+
+void TraceFile::rewind()
+{
+	released = 0;
+}
+
+qreal traceMeanRate_Mbps(QString fileName)
+{
+	FILE *f = fopen(fileName.toLocal8Bit().constData(), "rb");
+	if (!f)
+		return -1;
+	uchar buffer[sizeof(TraceFileHeader)];
+	bool ok = fread(buffer, sizeof(buffer), 1, f) == 1;
+	fclose(f);
+	if (!ok)
+		return -1;
+	TraceFileHeader header;
+	decodeHeader(buffer, header);
+	if (memcmp(header.magic, TRACE_MAGIC, 8) != 0 || header.duration_ns == 0)
+		return -1;
+	return header.totalBytes * 8.0 / (header.duration_ns * 1.0e-9) * 1.0e-6;
+}
+
+TCPTraceSource::TCPTraceSource(int fd, TCPTraceSourceArg params)
+	: TCPClient(fd),
+	  transferSize(params.transferSize)
+{
+#ifdef SO_MAX_PACING_RATE
+	if (params.rate_Bps > 0) {
+		// The 32-bit value is accepted by all kernels
+		quint32 rate = quint32(qMin(params.rate_Bps, 4294967295.0));
+		if (setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) < 0) {
+			perror("Error setting the pacing rate");
+		}
+	}
+#endif
+	qDebugT() << "Trace transfer size (bytes): " << transferSize << "rate (B/s):" << params.rate_Bps;
+}
+
+TCPClient *TCPTraceSource::makeTCPTraceSource(int fd, void *arg)
+{
+	TCPTraceSourceArg *params = (TCPTraceSourceArg*)arg;
+	return new TCPTraceSource(fd, *params);
+}
+
+void TCPTraceSource::onWrite()
+{
+	TCPClient::onWrite();
+
+	if (getTotalBytesWritten() >= transferSize) {
+		qDebugT() << "TCPTraceSource finished";
+		tcp_deferred_close_client(m_fd);
+		return;
+	}
+
+	if (pendingPayload > 0) {
+		// Do not queue more than the transfer size
+		flushWrites();
+		return;
+	}
+
+	quint64 left = transferSize - getTotalBytesWritten();
+	const unsigned int bufferSize = 10000;
+	if (left > bufferSize) {
+		writePayload(bufferSize);
+	} else {
+		writePayload(left, true);
+	}
+}
+
+void TCPTraceSource::onStop()
+{
+	TCPClient::onStop();
+	printUploadStats();
+}
+
+TraceReplay::TraceReplay(struct ev_loop *loop,
+						 QString fileName,
+						 bool loopTrace,
+						 QByteArray localAddress,
+						 QByteArray remoteAddress,
+						 int port,
+						 int trafficClass,
+						 int tcpReceiveWindow,
+						 QString tcpCongestionControl) :
+	flowsStarted(0),
+	loop(loop),
+	loopTrace(loopTrace),
+	localAddress(localAddress),
+	remoteAddress(remoteAddress),
+	port(port),
+	trafficClass(trafficClass),
+	tcpReceiveWindow(tcpReceiveWindow),
+	tcpCongestionControl(tcpCongestionControl),
+	running(false),
+	timerPending(false),
+	cursor(0),
+	tStart(0),
+	nextDeadline(0)
+{
+	if (!trace.open(fileName)) {
+		exit(-1);
+	}
+}
+
+void TraceReplay::start()
+{
+	if (running)
+		return;
+	running = true;
+	cursor = 0;
+	trace.rewind();
+	tStart = ev_now(loop);
+	nextDeadline = tStart;
+	// If the timer of the previous run is still pending, it starts the replay when it fires
+	// (the wheel does not support cancelling).
+	if (!timerPending) {
+		startFlows(tStart);
+	}
+}
+
+void TraceReplay::stop()
+{
+	running = false;
+}
+
+void TraceReplay::timeoutHandler(void *arg, ev_tstamp deadline)
+{
+	TraceReplay *replay = static_cast<TraceReplay*>(arg);
+	replay->timerPending = false;
+	if (!replay->running)
+		return;
+	if (deadline < replay->nextDeadline) {
+		// Scheduled by a previous run
+		replay->scheduleNext();
+		return;
+	}
+	replay->startFlows(deadline);
+}
+
+void TraceReplay::startFlows(ev_tstamp deadline)
+{
+	while (running) {
+		if (cursor >= trace.count()) {
+			if (!loopTrace || trace.count() == 0) {
+				running = false;
+				return;
+			}
+			cursor = 0;
+			tStart += trace.header.duration_ns * 1.0e-9;
+			trace.rewind();
+		}
+		TraceRecord record = trace.record(cursor);
+		ev_tstamp t = tStart + record.start_ns * 1.0e-9;
+		if (t > deadline) {
+			nextDeadline = t;
+			scheduleNext();
+			return;
+		}
+		cursor++;
+
+		TCPTraceSourceArg params;
+		params.transferSize = record.size;
+		params.rate_Bps = record.rate_kbps * 1000.0 / 8.0;
+		int flowClass = (record.flags & TRACE_RECORD_HAS_CLASS) ? record.trafficClass : trafficClass;
+		tcp_client(loop, localAddress.constData(), remoteAddress.constData(), port, flowClass,
+				   TCPTraceSource::makeTCPTraceSource, &params, tcpReceiveWindow, tcpCongestionControl);
+		flowsStarted++;
+	}
+}
+
+void TraceReplay::scheduleNext()
+{
+	if (timerPending)
+		return;
+	timerPending = true;
+	TimingWheel::threadWheel(loop)->scheduleAt(nextDeadline, timeoutHandler, this);
+}
+
+int convertTrace(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: line-traffic --convert-trace input.txt output.trace\n");
+		return -1;
+	}
+	FILE *in = fopen(argv[0], "r");
+	if (!in) {
+		perror("Could not open the input");
+		return -1;
+	}
+	FILE *out = fopen(argv[1], "wb");
+	if (!out) {
+		perror("Could not open the output");
+		fclose(in);
+		return -1;
+	}
+
+	TraceFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, 8);
+	header.version = TRACE_VERSION;
+	header.recordSize = sizeof(TraceRecord);
+	uchar headerBuffer[sizeof(TraceFileHeader)];
+	// Rewritten at the end, when the counts are known
+	encodeHeader(header, headerBuffer);
+	fwrite(headerBuffer, sizeof(headerBuffer), 1, out);
+
+	char line[1024];
+	int lineNumber = 0;
+	quint64 firstStart_ns = 0;
+	quint64 lastStart_ns = 0;
+	bool ok = true;
+	while (fgets(line, sizeof(line), in)) {
+		lineNumber++;
+		char *p = line;
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p == '\0' || *p == '\n' || *p == '#')
+			continue;
+		double start_s;
+		unsigned long long size;
+		int trafficClass = 0;
+		double rate_Mbps = 0;
+		int fields = sscanf(p, "%lf %llu %d %lf", &start_s, &size, &trafficClass, &rate_Mbps);
+		if (fields < 2 || start_s < 0 || trafficClass < 0 || trafficClass > 255 || rate_Mbps < 0) {
+			fprintf(stderr, "%s:%d: could not parse the line\n", argv[0], lineNumber);
+			ok = false;
+			break;
+		}
+		TraceRecord record;
+		record.start_ns = quint64(start_s * 1.0e9 + 0.5);
+		record.size = size;
+		record.rate_kbps = quint32(qMin(rate_Mbps * 1000.0 + 0.5, 4294967295.0));
+		record.trafficClass = quint8(trafficClass);
+		record.flags = fields >= 3 ? TRACE_RECORD_HAS_CLASS : 0;
+		record.reserved = 0;
+		if (record.start_ns < lastStart_ns) {
+			fprintf(stderr, "%s:%d: the flows must be sorted by start time\n", argv[0], lineNumber);
+			ok = false;
+			break;
+		}
+		uchar recordBuffer[sizeof(TraceRecord)];
+		encodeRecord(record, recordBuffer);
+		fwrite(recordBuffer, sizeof(recordBuffer), 1, out);
+
+		if (header.recordCount == 0)
+			firstStart_ns = record.start_ns;
+		lastStart_ns = record.start_ns;
+		header.recordCount++;
+		header.totalBytes += record.size;
+	}
+	fclose(in);
+
+	// When looping, the next iteration starts one mean inter-arrival time after the last flow
+	header.duration_ns = lastStart_ns + (header.recordCount > 1 ?
+											 (lastStart_ns - firstStart_ns) / (header.recordCount - 1) :
+											 1000000000ULL);
+	encodeHeader(header, headerBuffer);
+	if (ok && (fseek(out, 0, SEEK_SET) != 0 || fwrite(headerBuffer, sizeof(headerBuffer), 1, out) != 1)) {
+		perror("Could not write the output");
+		ok = false;
+	}
+	if (fclose(out) != 0) {
+		perror("Could not write the output");
+		ok = false;
+	}
+	if (!ok) {
+		unlink(argv[1]);
+		return -1;
+	}
+
+	fprintf(stderr, "Converted %s flows, %s bytes, %.3f s, mean rate %.3f Mbps\n",
+			withCommas(header.recordCount), withCommas(header.totalBytes), header.duration_ns * 1.0e-9,
+			header.totalBytes * 8.0 / (header.duration_ns * 1.0e-9) * 1.0e-6);
+	return 0;
+}
@@ -0,0 +1,160 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef TRACEREPLAY_H
+#define TRACEREPLAY_H
+
+#include <ev.h>
+#include <QtCore>
+
+#include "evtcp.h"
+
+// Binary flow traces for TCP-Trace connections.
+// File layout (little endian): a TraceFileHeader followed by recordCount TraceRecords sorted by
+// start time. Use "line-traffic --convert-trace in.txt out.trace" to create one from a text file.
+#define TRACE_MAGIC "LINETRC1"
+#define TRACE_VERSION 1
+// If set, the trafficClass of the record overrides the class of the connection
+#define TRACE_RECORD_HAS_CLASS 0x01
+// The pages of the trace already replayed are dropped from memory in chunks of this size
+#define TRACE_RELEASE_CHUNK (1 << 20)
+
+struct TraceFileHeader {
+	char magic[8];
+	quint32 version;
+	quint32 recordSize;
+	quint64 recordCount;
+	// Length of one iteration of the trace, used when looping (>= the last start time)
+	quint64 duration_ns;
+	// Sum of the flow sizes
+	quint64 totalBytes;
+};
+
+struct TraceRecord {
+	// Start time relative to the start of the trace
+	quint64 start_ns;
+	// Flow size in bytes
+	quint64 size;
+	// Sending rate; 0 means as fast as TCP allows
+	quint32 rate_kbps;
+	quint8 trafficClass;
+	quint8 flags;
+	quint16 reserved;
+};
+
+// Read-only view of a trace file. The file is mapped, not loaded, so the memory used does not
+// depend on the length of the trace: the records must be read in increasing order, and the pages
+// behind the last one read are released.
+class TraceFile {
+public:
+	TraceFile();
+	~TraceFile();
+
+	// Prints the error and returns false if the file cannot be used.
+	bool open(QString fileName);
+	void close();
+
+	quint64 count() const;
+	// Decodes record i.
+	TraceRecord record(quint64 i);
+	// Call this before reading the records again from the start.
+	void rewind();
+
+	TraceFileHeader header;
+
+protected:
+	const uchar *data;
+	size_t size;
+	// Offset up to which the pages were released
+	size_t released;
+};
+
+// Mean rate of the flows of a trace file, from its header; negative if the file cannot be read.
+qreal traceMeanRate_Mbps(QString fileName);
+
+class TCPTraceSourceArg {
+public:
+	quint64 transferSize;
+	// 0 means unlimited
+	qreal rate_Bps;
+};
+
+// Sends transferSize bytes, optionally paced by the kernel (SO_MAX_PACING_RATE), then closes.
+class TCPTraceSource : public TCPClient {
+public:
+	TCPTraceSource(int fd, TCPTraceSourceArg params);
+	static TCPClient* makeTCPTraceSource(int fd, void *arg);
+	virtual void onWrite();
+	virtual void onStop();
+
+	quint64 transferSize;
+};
+
+// Starts the flows of a trace on schedule, from the timing wheel of the event loop. Only the next
+// flow is scheduled at any time, so the memory used is bounded by the number of flows in progress.
+// Must be used only from the thread of the event loop.
+class TraceReplay {
+public:
+	TraceReplay(struct ev_loop *loop,
+				QString fileName,
+				bool loopTrace,
+				QByteArray localAddress,
+				QByteArray remoteAddress,
+				int port,
+				int trafficClass,
+				int tcpReceiveWindow,
+				QString tcpCongestionControl);
+
+	// Replays the trace from the start.
+	void start();
+	// Stops starting new flows; the flows in progress continue.
+	void stop();
+
+	quint64 flowsStarted;
+
+protected:
+	static void timeoutHandler(void *arg, ev_tstamp deadline);
+	// Starts the flows due at deadline and schedules the next one
+	void startFlows(ev_tstamp deadline);
+	void scheduleNext();
+
+	struct ev_loop *loop;
+	TraceFile trace;
+	bool loopTrace;
+	QByteArray localAddress;
+	QByteArray remoteAddress;
+	int port;
+	int trafficClass;
+	int tcpReceiveWindow;
+	QString tcpCongestionControl;
+
+	bool running;
+	// Set while a timer is pending in the wheel (there is at most one)
+	bool timerPending;
+	quint64 cursor;
+	ev_tstamp tStart;
+	ev_tstamp nextDeadline;
+};
+
+// Converts a text trace to the binary format. Each line of the input is:
+//   start_s size_B [class [rate_Mbps]]
+// sorted by start time; empty lines and lines starting with # are ignored.
+// Usage: line-traffic --convert-trace input.txt output.trace
+int convertTrace(int argc, char **argv);
+
+#endif // TRACEREPLAY_H
@@ -0,0 +1,202 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "trafficthreads.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "evtcp.h"
+#include "evudp.h"
+#include "readerwriter.h"
+#include "tracereplay.h"
+#include "util.h"
+
+#ifdef DEBUG
+#undef DEBUG
+#endif
+#define DEBUG 0
+
+TrafficThreadStats::TrafficThreadStats()
+{
+	bytesWritten = 0;
+	bytesRead = 0;
+	endpoints = 0;
+	connections = 0;
+	load_Mbps = 0;
+}
+
+static void traffic_thread_publish_stats(TrafficThread *thread)
+{
+	quint64 bytesWritten;
+	quint64 bytesRead;
+	int endpoints;
+	getThreadTrafficTotals(bytesWritten, bytesRead, endpoints);
+	thread->stats->bytesWritten.store(bytesWritten, std::memory_order_relaxed);
+	thread->stats->bytesRead.store(bytesRead, std::memory_order_relaxed);
+	thread->stats->endpoints.store(endpoints, std::memory_order_relaxed);
+}
+
+static void traffic_thread_stats_cb(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	Q_UNUSED(loop);
+	Q_UNUSED(revents);
+	traffic_thread_publish_stats(static_cast<TrafficThread*>(w->data));
+}
+
+static void traffic_thread_stop_cb(struct ev_loop *loop, ev_async *w, int revents)
+{
+	Q_UNUSED(revents);
+	TrafficThread *thread = static_cast<TrafficThread*>(w->data);
+	qDebugT() << "Stopping event loop" << thread->threadIndex;
+	tcp_close_all();
+	udp_close_all();
+	traffic_thread_publish_stats(thread);
+	ev_unloop(loop, EVUNLOOP_ALL);
+}
+
+TrafficThread::TrafficThread(int threadIndex, int core, TrafficThreadSetupCallback setupCallback, TrafficThreadStats *stats)
+	: threadIndex(threadIndex),
+	  core(core),
+	  setupCallback(setupCallback),
+	  stats(stats)
+{
+	loop = ev_loop_new(EVFLAG_AUTO);
+	Q_ASSERT_FORCE(loop);
+
+	ev_async_init(&w_stop, traffic_thread_stop_cb);
+	w_stop.data = this;
+	ev_async_start(loop, &w_stop);
+
+	ev_timer_init(&w_stats, traffic_thread_stats_cb, 1.0, 1.0);
+	w_stats.data = this;
+	ev_timer_start(loop, &w_stats);
+}
+
+TrafficThread::~TrafficThread()
+{
+	ev_loop_destroy(loop);
+}
+
+void TrafficThread::requestStop()
+{
+	ev_async_send(loop, &w_stop);
+}
+
+void TrafficThread::run()
+{
+	if (core >= 0) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(core, &cpuset);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+			fprintf(stderr, "Could not pin event loop %d to core %d\n", threadIndex, core);
+		}
+	}
+
+	setupCallback(loop, threadIndex);
+
+	ev_loop(loop, 0);
+}
+
+qreal connectionWeight_Mbps(const NetGraphConnection &c, qreal greedyWeight_Mbps)
+{
+	qreal weight;
+	if (c.basicType == "UDP-CBR" || c.basicType == "UDP-VCBR") {
+		weight = c.rate_Mbps;
+	} else if (c.basicType == "TCP-DASH") {
+		weight = qMax(c.rate_Mbps, c.bufferingRate_Mbps);
+	} else if (c.basicType == "TCP-Poisson-Pareto") {
+		// Arrival rate times the mean transfer size. The mean is infinite for alpha <= 1;
+		// the transfers are limited by TCP anyway.
+		if (c.paretoAlpha > 1.0) {
+			qreal meanSize_b = c.paretoScale_b * c.paretoAlpha / (c.paretoAlpha - 1.0);
+			weight = qMin(c.poissonRate * meanSize_b * 1.0e-6, greedyWeight_Mbps);
+		} else {
+			weight = greedyWeight_Mbps;
+		}
+	} else if (c.basicType == "TCP-Trace") {
+		weight = traceMeanRate_Mbps(c.traceFile);
+		if (weight < 0) {
+			// The trace is on another machine
+			weight = greedyWeight_Mbps;
+		}
+	} else if (c.basicType == "TCPx") {
+		weight = c.multiplier * greedyWeight_Mbps;
+	} else {
+		// TCP, UDP-VBR
+		weight = greedyWeight_Mbps;
+	}
+	if (c.onOff) {
+		qreal on = (c.onDurationMin + c.onDurationMax) / 2.0;
+		qreal off = (c.offDurationMin + c.offDurationMax) / 2.0;
+		if (on + off > 0) {
+			weight *= on / (on + off);
+		}
+	}
+	return qMax(weight, 0.0);
+}
+
+QVector<int> assignConnectionsToThreads(NetGraph &netGraph, int numThreads, TrafficThreadStats *stats)
+{
+	Q_ASSERT_FORCE(numThreads > 0);
+	QVector<int> assignment(netGraph.connections.count(), -1);
+
+	// Greedy connections weigh as much as the fastest rate-limited one
+	qreal greedyWeight_Mbps = 0;
+	for (int c = 0; c < netGraph.connections.count(); c++) {
+		const NetGraphConnection &connection = netGraph.connections[c];
+		if (connection.basicType == "UDP-CBR" || connection.basicType == "UDP-VCBR" ||
+			connection.basicType == "TCP-DASH") {
+			greedyWeight_Mbps = qMax(greedyWeight_Mbps, connectionWeight_Mbps(connection, 0));
+		}
+	}
+	if (greedyWeight_Mbps <= 0) {
+		greedyWeight_Mbps = 100.0;
+	}
+
+	QList<QPair<qreal, int> > weights;
+	for (int c = 0; c < netGraph.connections.count(); c++) {
+		const NetGraphConnection &connection = netGraph.connections[c];
+		if (netGraph.nodes[connection.source].maskedOut && netGraph.nodes[connection.dest].maskedOut)
+			continue;
+		weights << qMakePair(connectionWeight_Mbps(connection, greedyWeight_Mbps), c);
+	}
+	// Heaviest first; ties by index, so that the assignment is deterministic
+	qSort(weights.begin(), weights.end(), qGreater<QPair<qreal, int> >());
+
+	for (int i = 0; i < weights.count(); i++) {
+		int best = 0;
+		for (int t = 1; t < numThreads; t++) {
+			if (stats[t].load_Mbps < stats[best].load_Mbps ||
+				(stats[t].load_Mbps == stats[best].load_Mbps && stats[t].connections < stats[best].connections)) {
+				best = t;
+			}
+		}
+		assignment[weights[i].second] = best;
+		stats[best].load_Mbps += weights[i].first;
+		stats[best].connections++;
+	}
+
+	for (int t = 0; t < numThreads; t++) {
+		fprintf(stderr, "Event loop %d: %d connections, %.1f Mbps expected\n",
+				t, int(stats[t].connections), stats[t].load_Mbps);
+	}
+
+	return assignment;
+}
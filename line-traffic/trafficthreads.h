@@ -0,0 +1,75 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef TRAFFICTHREADS_H
+#define TRAFFICTHREADS_H
+
+#include <ev.h>
+#include <atomic>
+#include <QtCore>
+
+#include "netgraph.h"
+
+// Traffic counters of one event loop thread. Written only by that thread (once per second),
+// read by the main thread. Aligned to a cache line so that the threads do not share lines.
+struct TrafficThreadStats {
+	TrafficThreadStats();
+	std::atomic<quint64> bytesWritten;
+	std::atomic<quint64> bytesRead;
+	std::atomic<qint32> endpoints;
+	std::atomic<qint32> connections;
+	// Sum of the weights of the connections assigned to the thread (Mbps)
+	qreal load_Mbps;
+} __attribute__((aligned(64)));
+
+// Called by each event loop thread, from the thread, before running the loop.
+// It must create the servers and the timers of the connections assigned to threadIndex.
+typedef void (*TrafficThreadSetupCallback)(struct ev_loop *loop, int threadIndex);
+
+// An event loop thread, pinned to a core.
+class TrafficThread : public QThread {
+public:
+	TrafficThread(int threadIndex, int core, TrafficThreadSetupCallback setupCallback, TrafficThreadStats *stats);
+	virtual ~TrafficThread();
+
+	// Closes all the connections of the thread and stops its loop. Callable from any thread.
+	void requestStop();
+
+	int threadIndex;
+	// -1 means not pinned
+	int core;
+	TrafficThreadSetupCallback setupCallback;
+	TrafficThreadStats *stats;
+	struct ev_loop *loop;
+	ev_async w_stop;
+	ev_timer w_stats;
+
+protected:
+	virtual void run();
+};
+
+// The expected average rate of a connection (Mbps), used to balance the load of the threads.
+// Greedy connections (TCP, TCPx, UDP-VBR) have no nominal rate; they get greedyWeight_Mbps each.
+qreal connectionWeight_Mbps(const NetGraphConnection &c, qreal greedyWeight_Mbps);
+
+// Assigns the connections to numThreads event loops (heaviest first, each to the least loaded
+// loop). Only the connections that have at least one endpoint on this host (nodes not masked
+// out) are assigned; the others get -1. Adds the weights to the load_Mbps of stats.
+QVector<int> assignConnectionsToThreads(NetGraph &netGraph, int numThreads, TrafficThreadStats *stats);
+
+#endif // TRAFFICTHREADS_H
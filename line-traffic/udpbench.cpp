@@ -0,0 +1,102 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "udpbench.h"
+
+#include <ev.h>
+#include <stdio.h>
+
+#include "evudp.h"
+#include "udpsource.h"
+#include "chronometer.h"
+#include "util.h"
+
+class UDPBenchSink : public UDPClient {
+public:
+	UDPBenchSink(int fd, quint64 *datagrams) : UDPClient(fd), datagrams(datagrams) {}
+	static UDPClient* makeUDPBenchSink(int fd, void *arg) {
+		return new UDPBenchSink(fd, (quint64*)arg);
+	}
+	virtual void onRead(QByteArray) {
+		(*datagrams)++;
+	}
+	quint64 *datagrams;
+};
+
+static UDPClient *benchSource = NULL;
+static int benchFrameSize = 64;
+
+static UDPClient* makeUDPBenchSource(int fd, void *arg)
+{
+	Q_UNUSED(arg);
+	benchSource = UDPSource::makeUDPSource(fd, &benchFrameSize);
+	return benchSource;
+}
+
+static void benchTimeoutCallback(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	Q_UNUSED(w);
+	Q_UNUSED(revents);
+	ev_unloop(loop, EVUNLOOP_ALL);
+}
+
+int runUdpBenchmark(int argc, char **argv)
+{
+	qreal seconds = 5.0;
+	int port = 20000;
+	bool ok = true;
+	if (argc > 0) {
+		seconds = QString(argv[0]).toDouble(&ok);
+		ok = ok && seconds > 0;
+	}
+	if (ok && argc > 1) {
+		benchFrameSize = QString(argv[1]).toInt(&ok);
+		ok = ok && benchFrameSize > 0 && benchFrameSize <= 65000;
+	}
+	if (ok && argc > 2) {
+		port = QString(argv[2]).toInt(&ok);
+	}
+	if (!ok) {
+		fprintf(stderr, "Usage: line-traffic --bench-udp [seconds] [frame_size] [port]\n");
+		return -1;
+	}
+
+	struct ev_loop *loop = ev_default_loop(0);
+	quint64 datagramsReceived = 0;
+	udp_server(loop, "127.0.0.1", port, UDPBenchSink::makeUDPBenchSink, &datagramsReceived);
+	udp_client(loop, "127.0.0.1", "127.0.0.1", port, 0, makeUDPBenchSource, NULL);
+
+	ev_timer timeout;
+	ev_timer_init(&timeout, benchTimeoutCallback, seconds, 0.0);
+	ev_timer_start(loop, &timeout);
+
+	quint64 tStart = getCurrentTimeNanosec();
+	ev_loop(loop, 0);
+	qreal duration = (getCurrentTimeNanosec() - tStart) * 1.0e-9;
+
+	quint64 datagramsSent = benchSource ? benchSource->totalWritten / benchFrameSize : 0;
+	fprintf(stderr, "UDP loopback benchmark: %d B datagrams, bursts of %d (send) / %d (receive), %.1f s\n",
+			benchFrameSize, UDP_SEND_BURST, UDP_RECV_BURST, duration);
+	fprintf(stderr, "Sent: %s datagrams, %s pps\n",
+			withCommas(datagramsSent), withCommas(quint64(datagramsSent / duration)));
+	fprintf(stderr, "Received: %s datagrams, %s pps\n",
+			withCommas(datagramsReceived), withCommas(quint64(datagramsReceived / duration)));
+
+	udp_close_all();
+	return 0;
+}
@@ -0,0 +1,27 @@
+/*
+*	Copyright (C) 2014 Ovidiu Mara
+*
+*	This program is free software; you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation; either version 2 of the License, or
+*	(at your option) any later version.
+*
+*	This program is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with this program; if not, write to the Free Software
+*	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef UDPBENCH_H
+#define UDPBENCH_H
+
+// Loopback benchmark of the UDP burst paths: one source (sendmmsg) and one server (recvmmsg)
+// on the same event loop, i.e. on one core. Prints the datagram rates.
+// Usage: line-traffic --bench-udp [seconds] [frame_size] [port]
+int runUdpBenchmark(int argc, char **argv);
+
+#endif // UDPBENCH_H
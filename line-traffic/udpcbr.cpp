@@ -19,35 +19,99 @@
 #include "udpcbr.h"
 #include "util.h"
 #include "chronometer.h"
+#include "payload.h"
 
 UDPCBRSourceArg::UDPCBRSourceArg(qreal rate_Bps, quint16 frameSize, bool poisson) :
 	rate_Bps(rate_Bps),
 	frameSize(frameSize),
 	poisson(poisson)
 {
-	timeNextSend = 0;
 }
 
-bool UDPCBRSourceArg::shouldSend(quint64 totalBytesSent, qreal time)
+int UDPCBRSourceArg::framesDue(quint64 totalBytesSent, qreal time, int maxFrames)
 {
+	int count = 0;
 	if (!poisson) {
 		qreal expectedSent = udpRawRate2PayloadRate(rate_Bps, frameSize) * time;
-		return (totalBytesSent + frameSize < expectedSent);
+		while (count < maxFrames && totalBytesSent + quint64(count + 1) * frameSize < expectedSent) {
+			count++;
+		}
+	} else {
+		// The first frame is sent right away
+		if (poissonSendTimes.isEmpty()) {
+			poissonSendTimes.append(time);
+		}
+		while (count < maxFrames) {
+			if (count == poissonSendTimes.count()) {
+				// The times drawn are kept until the frames are sent
+				extendPoissonSchedule();
+			}
+			if (poissonSendTimes[count] > time)
+				break;
+			count++;
+		}
+	}
+	return count;
+}
+
+void UDPCBRSourceArg::extendPoissonSchedule()
+{
+	qreal delta = -log(1.0 - frandex()) / (udpRawRate2PayloadRate(rate_Bps, frameSize) / (frameSize));
+	poissonSendTimes.append(poissonSendTimes.last() + delta);
+}
+
+void UDPCBRSourceArg::framesSent(int count)
+{
+	if (poisson && count > 0) {
+		// Keep the time of the next frame
+		while (poissonSendTimes.count() <= count) {
+			extendPoissonSchedule();
+		}
+		poissonSendTimes.erase(poissonSendTimes.begin(), poissonSendTimes.begin() + count);
+	}
+}
+
+qreal UDPCBRSourceArg::nextSendTime(quint64 totalBytesSent)
+{
+	if (!poisson) {
+		qreal rate = udpRawRate2PayloadRate(rate_Bps, frameSize);
+		return rate > 0 ? (totalBytesSent + frameSize) / rate : -1;
 	} else {
-		if (time >= timeNextSend) {
-			qreal delta = -log(1.0 - frandex()) / (udpRawRate2PayloadRate(rate_Bps, frameSize) / (frameSize));
-			timeNextSend = (timeNextSend == 0) ? time : (timeNextSend + delta);
-			return true;
-		} else {
-			return false;
+		return poissonSendTimes.isEmpty() ? 0 : poissonSendTimes.first();
+	}
+}
+
+// Sends the frames due until the end of the pacing slack, then sleeps until the next one.
+// Shared by the CBR and VCBR sources.
+template<typename SourceArg>
+static void paceFrames(UDPClient *source, SourceArg &params)
+{
+	qreal now = (getCurrentTimeNanosec() - source->tConnect) * 1.0e-9;
+	int burst = params.framesDue(source->totalWritten, now + UDP_PACING_SLACK, UDP_PACING_BURST);
+	if (burst > 0) {
+		// Only the frames actually written leave the schedule, so a partial write loses none
+		params.framesSent(source->writeBurst(payloadData(params.frameSize), params.frameSize, burst));
+		if (source->writeBlocked) {
+			source->waitWritable();
+			return;
 		}
 	}
+	if (burst == UDP_PACING_BURST) {
+		// Behind schedule: continue after the other watchers of the loop had their turn
+		source->schedulePacing(0);
+		return;
+	}
+	qreal next = params.nextSendTime(source->totalWritten);
+	if (next >= 0) {
+		source->schedulePacing(next - now);
+	}
 }
 
 UDPCBRSource::UDPCBRSource(int fd, UDPCBRSourceArg params) :
 	UDPClient(fd),
 	params(params)
 {
+	paced = true;
 }
 
 UDPClient* UDPCBRSource::makeUDPCBRSource(int fd, void *arg)
@@ -57,15 +121,10 @@ UDPClient* UDPCBRSource::makeUDPCBRSource(int fd, void *arg)
 	return new UDPCBRSource(fd, *params);
 }
 
-void UDPCBRSource::onWrite()
+void UDPCBRSource::onPace()
 {
 	UDPClient::onWrite();
-
-	if (params.shouldSend(totalWritten, (getCurrentTimeNanosec() - tConnect) * 1.0e-9)) {
-		QByteArray b;
-		b.fill('z', params.frameSize);
-		write(b);
-	}
+	paceFrames(this, params);
 }
 
 void UDPCBRSource::onStop()
@@ -85,16 +144,32 @@ void UDPVCBRSourceArg::changeRate()
 	actualRate = frand() * rate_Bps;
 }
 
-bool UDPVCBRSourceArg::shouldSend(quint64 totalBytesSent, qreal time)
+int UDPVCBRSourceArg::framesDue(quint64 totalBytesSent, qreal time, int maxFrames)
 {
 	qreal expectedSent = udpRawRate2PayloadRate(rate_Bps, frameSize) * time;
-	return (totalBytesSent + frameSize < expectedSent);
+	int count = 0;
+	while (count < maxFrames && totalBytesSent + quint64(count + 1) * frameSize < expectedSent) {
+		count++;
+	}
+	return count;
+}
+
+void UDPVCBRSourceArg::framesSent(int)
+{
+	// The schedule follows from the number of bytes sent
+}
+
+qreal UDPVCBRSourceArg::nextSendTime(quint64 totalBytesSent)
+{
+	qreal rate = udpRawRate2PayloadRate(rate_Bps, frameSize);
+	return rate > 0 ? (totalBytesSent + frameSize) / rate : -1;
 }
 
 UDPVCBRSource::UDPVCBRSource(int fd, UDPVCBRSourceArg params) :
 	UDPClient(fd),
 	params(params)
 {
+	paced = true;
 }
 
 UDPClient* UDPVCBRSource::makeUDPVCBRSource(int fd, void *arg)
@@ -104,15 +179,10 @@ UDPClient* UDPVCBRSource::makeUDPVCBRSource(int fd, void *arg)
 	return new UDPVCBRSource(fd, *params);
 }
 
-void UDPVCBRSource::onWrite()
+void UDPVCBRSource::onPace()
 {
 	UDPClient::onWrite();
-
-	if (params.shouldSend(totalWritten, (getCurrentTimeNanosec() - tConnect) * 1.0e-9)) {
-		QByteArray b;
-		b.fill('z', params.frameSize);
-		write(b);
-	}
+	paceFrames(this, params);
 }
 
 void UDPVCBRSource::onStop()
@@ -28,18 +28,29 @@ public:
 	quint16 frameSize; // UDP payload size
 	bool poisson;
 
-	qreal timeNextSend;
+	// Poisson mode: the send times (s, relative to the start of the flow) of the next frames,
+	// drawn in advance as needed; the first one is the time of the next frame.
+	QList<qreal> poissonSendTimes;
 
 	qreal payloadRateBps();
 
-	bool shouldSend(quint64 totalBytesSent, qreal time);
+	// Number of frames due at time (at most maxFrames). Does not advance the schedule.
+	int framesDue(quint64 totalBytesSent, qreal time, int maxFrames);
+	// Advances the schedule past count frames that were actually sent
+	void framesSent(int count);
+	// The time when the next frame is due (s, relative to the start of the flow)
+	qreal nextSendTime(quint64 totalBytesSent);
+
+protected:
+	// Appends the next send time to poissonSendTimes (which must not be empty)
+	void extendPoissonSchedule();
 };
 
 class UDPCBRSource : public UDPClient {
 public:
 	UDPCBRSource(int fd, UDPCBRSourceArg params);
 	static UDPClient* makeUDPCBRSource(int fd, void *arg);
-	virtual void onWrite();
+	virtual void onPace();
 	virtual void onStop();
 
 	UDPCBRSourceArg params;
@@ -53,14 +64,19 @@ public:
 	quint16 frameSize; // UDP payload size
 
 	void changeRate();
-	bool shouldSend(quint64 totalBytesSent, qreal time);
+	// Number of frames due at time (at most maxFrames). Does not advance the schedule.
+	int framesDue(quint64 totalBytesSent, qreal time, int maxFrames);
+	// Advances the schedule past count frames that were actually sent
+	void framesSent(int count);
+	// The time when the next frame is due (s, relative to the start of the flow)
+	qreal nextSendTime(quint64 totalBytesSent);
 };
 
 class UDPVCBRSource : public UDPClient {
 public:
 	UDPVCBRSource(int fd, UDPVCBRSourceArg params);
 	static UDPClient* makeUDPVCBRSource(int fd, void *arg);
-	virtual void onWrite();
+	virtual void onPace();
 	virtual void onStop();
 
 	UDPVCBRSourceArg params;
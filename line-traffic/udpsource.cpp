@@ -17,14 +17,18 @@
 */
 
 #include "udpsource.h"
+#include "payload.h"
 
-UDPSource::UDPSource(int fd) : UDPClient(fd)
+UDPSource::UDPSource(int fd, int frameSize) : UDPClient(fd),
+	frameSize(qMax(1, qMin(frameSize, 65536)))
 {
 }
 
 UDPClient* UDPSource::makeUDPSource(int fd, void *arg)
 {
-	Q_UNUSED(arg);
+	if (arg) {
+		return new UDPSource(fd, *(int*)arg);
+	}
 	return new UDPSource(fd);
 }
 
@@ -32,9 +36,7 @@ void UDPSource::onWrite()
 {
 	UDPClient::onWrite();
 
-	QByteArray b;
-	b.fill('z', 500);
-	write(b);
+	writeBurst(payloadData(frameSize), frameSize, UDP_SEND_BURST);
 }
 
 void UDPSource::onStop()
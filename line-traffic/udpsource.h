@@ -21,12 +21,16 @@
 
 #include "evudp.h"
 
+// Sends as fast as possible, in bursts of UDP_SEND_BURST datagrams
 class UDPSource : public UDPClient {
 public:
-	UDPSource(int fd);
+	UDPSource(int fd, int frameSize = 500);
+	// arg: optional pointer to the frame size (int)
 	static UDPClient* makeUDPSource(int fd, void *arg);
 	virtual void onWrite();
 	virtual void onStop();
+
+	int frameSize;
 };
 
 #endif // UDPSOURCE_H
@@ -20,10 +20,37 @@
 #include "util.h"
 #include "chronometer.h"
 
+#include <string.h>
+#include <time.h>
+
+// Send and receive timestamps of the datagrams: the hosts do not share a monotonic clock
+static quint64 wallClockNanosec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The doubles of the feedback have the same encoding as with QDataStream
+static void encodeDouble(qreal value, uchar *p)
+{
+	quint64 bits;
+	memcpy(&bits, &value, sizeof(bits));
+	qToBigEndian(bits, p);
+}
+
+static qreal decodeDouble(const uchar *p)
+{
+	quint64 bits = qFromBigEndian<quint64>(p);
+	qreal value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
 UDPVBRSourceArg::UDPVBRSourceArg(qreal baseRate_Bps, quint16 frameSize) :
 	frameSize(frameSize), baseRate(baseRate_Bps)
 {
-	frameSize = qMax(frameSize, (quint16)sizeof(quint64));
+	this->frameSize = qMax(frameSize, (quint16)UDPVBR_HEADER_SIZE);
 	rateRatio = 1;
 	lossThreshold1 = 0.01;
 	lossThreshold2 = 0.05;
@@ -84,6 +111,9 @@ bool UDPVBRSourceArg::shouldSend(quint64 totalBytesSent, qreal time)
 UDPVBRSource::UDPVBRSource(int fd, UDPVBRSourceArg params) : UDPClient(fd), params(params)
 {
 	seqNo = 0;
+	frameId = 0;
+	fragment = 0;
+	memset(header, 0, sizeof(header));
 }
 
 UDPClient* UDPVBRSource::makeUDPVBRSource(int fd, void *arg)
@@ -95,9 +125,11 @@ UDPClient* UDPVBRSource::makeUDPVBRSource(int fd, void *arg)
 
 void UDPVBRSource::onRead(QByteArray b)
 {
-	QDataStream in(b);
-	in >> params.loss;
-	in >> params.remoteRate;
+	if (b.count() < UDPVBR_FEEDBACK_SIZE)
+		return;
+	const uchar *p = (const uchar*)b.constData();
+	params.loss = decodeDouble(p);
+	params.remoteRate = decodeDouble(p + 8);
 	params.feedback = 5;
 	params.updateRate();
 }
@@ -106,15 +138,20 @@ void UDPVBRSource::onWrite()
 {
 	UDPClient::onWrite();
 
-	if (params.shouldSend(totalWritten, (getCurrentTimeNanosec() - tConnect) * 1.0e-9)) {
-		QByteArray b;
-		{
-			QDataStream out(&b, QIODevice::WriteOnly);
-			out << seqNo;
-			seqNo++;
+	quint64 elapsed = getCurrentTimeNanosec() - tConnect;
+	if (params.shouldSend(totalWritten, elapsed * 1.0e-9)) {
+		quint32 currentFrame = quint32(elapsed / UDPVBR_FRAME_INTERVAL_NS);
+		if (currentFrame != frameId) {
+			frameId = currentFrame;
+			fragment = 0;
 		}
-		b.append(QByteArray().fill('z', params.frameSize - b.count()));
-		write(b);
+		qToBigEndian(seqNo, header);
+		qToBigEndian(wallClockNanosec(), header + 8);
+		qToBigEndian(frameId, header + 16);
+		qToBigEndian(fragment, header + 20);
+		seqNo++;
+		fragment++;
+		writeFrame((const char*)header, UDPVBR_HEADER_SIZE, params.frameSize);
 	}
 }
 
@@ -135,6 +172,19 @@ UDPVBRSink::UDPVBRSink(int fd) : UDPClient(fd)
 	sendInterval = 0.001; // seconds
 	tUpdate = getCurrentTimeNanosec();
 	tSend = getCurrentTimeNanosec();
+	frameStarted = false;
+	frameId = 0;
+	frameFragments = 0;
+	frameMaxFragment = 0;
+	framesComplete = 0;
+	framesIncomplete = 0;
+	fragmentsLost = 0;
+	delaySamples = 0;
+	delayMin = 0;
+	delayMax = 0;
+	delaySum = 0;
+	jitter = 0;
+	lastTransit = 0;
 }
 
 UDPClient* UDPVBRSink::makeUDPVBRSink(int fd, void *arg)
@@ -145,9 +195,41 @@ UDPClient* UDPVBRSink::makeUDPVBRSink(int fd, void *arg)
 
 void UDPVBRSink::onRead(QByteArray b)
 {
-	quint64 seqNo;
-	QDataStream in(b);
-	in >> seqNo;
+	if (b.count() < UDPVBR_HEADER_SIZE)
+		return;
+	const uchar *p = (const uchar*)b.constData();
+	quint64 seqNo = qFromBigEndian<quint64>(p);
+	quint64 tSent = qFromBigEndian<quint64>(p + 8);
+	quint32 datagramFrameId = qFromBigEndian<quint32>(p + 16);
+	quint16 datagramFragment = qFromBigEndian<quint16>(p + 20);
+
+	qint64 transit = qint64(wallClockNanosec() - tSent);
+	if (delaySamples == 0) {
+		delayMin = delayMax = transit;
+	} else {
+		delayMin = qMin(delayMin, transit);
+		delayMax = qMax(delayMax, transit);
+		qreal d = qAbs(transit - lastTransit);
+		jitter += (d - jitter) / 16.0;
+	}
+	delaySum += transit;
+	delaySamples++;
+	lastTransit = transit;
+
+	if (!frameStarted || datagramFrameId > frameId) {
+		if (frameStarted) {
+			finishFrame();
+		}
+		frameStarted = true;
+		frameId = datagramFrameId;
+		frameFragments = 0;
+		frameMaxFragment = 0;
+	}
+	if (datagramFrameId == frameId) {
+		frameFragments++;
+		frameMaxFragment = qMax(frameMaxFragment, quint32(datagramFragment));
+	}
+
 	if (seqNo >= nextSeqNo) {
 		lossCounter += seqNo - nextSeqNo;
 		nextSeqNo = seqNo + 1;
@@ -170,18 +252,38 @@ void UDPVBRSink::onWrite()
 		qreal downloadRate = (getTotalBytesRead() - lastBytesRead)/((getCurrentTimeNanosec() - tSend));
 		lastBytesRead = getTotalBytesRead();
 		tSend = getCurrentTimeNanosec();
-		QByteArray b;
-		{
-			QDataStream out(&b, QIODevice::WriteOnly);
-			out << loss;
-			out << downloadRate;
-		}
+		QByteArray b(UDPVBR_FEEDBACK_SIZE, Qt::Uninitialized);
+		encodeDouble(loss, (uchar*)b.data());
+		encodeDouble(downloadRate, (uchar*)b.data() + 8);
 		write(b);
 	}
 }
 
+void UDPVBRSink::finishFrame()
+{
+	quint32 expected = frameMaxFragment + 1;
+	if (frameFragments >= expected) {
+		framesComplete++;
+	} else {
+		framesIncomplete++;
+		fragmentsLost += expected - frameFragments;
+	}
+}
+
 void UDPVBRSink::onStop()
 {
 	UDPClient::onStop();
 	printDownloadStats();
+	if (frameStarted) {
+		finishFrame();
+		frameStarted = false;
+	}
+	if (delaySamples > 0) {
+		qDebug() << QString("%1:%2 -> %3:%4 VBR frames: %5 complete, %6 incomplete (%7 fragments lost); "
+							"one-way delay (ms): min %8 avg %9 max %10; jitter %11 ms").
+					arg(remoteAddress).arg(remotePort).arg(localAddress).arg(localPort).
+					arg(framesComplete).arg(framesIncomplete).arg(fragmentsLost).
+					arg(delayMin * 1.0e-6).arg(delaySum / delaySamples * 1.0e-6).arg(delayMax * 1.0e-6).
+					arg(jitter * 1.0e-6);
+	}
 }
@@ -21,6 +21,19 @@
 
 #include "evudp.h"
 
+// Header of the UDP-VBR datagrams, encoded in place in network byte order (big endian):
+//   quint64 seqNo       datagram sequence number
+//   quint64 tSend       send time (ns since the epoch, CLOCK_REALTIME)
+//   quint32 frameId     video frame number
+//   quint16 fragment    index of the datagram in the frame
+//   quint16 reserved
+// The rest of the datagram is payload.
+#define UDPVBR_HEADER_SIZE 24
+// Duration of a video frame (ns): the datagrams sent within the same interval form a frame
+#define UDPVBR_FRAME_INTERVAL_NS 40000000ULL
+// Size of the feedback datagrams sent by the sink: loss and download rate (two big endian doubles)
+#define UDPVBR_FEEDBACK_SIZE 16
+
 class UDPVBRSourceArg {
 public:
 	UDPVBRSourceArg(qreal baseRate_Bps, quint16 frameSize = 1400);
@@ -56,6 +69,10 @@ public:
 
 	UDPVBRSourceArg params;
 	quint64 seqNo;
+	quint32 frameId;
+	quint16 fragment;
+	// Reused for every datagram
+	uchar header[UDPVBR_HEADER_SIZE];
 };
 
 class UDPVBRSink : public UDPClient {
@@ -66,6 +83,9 @@ public:
 	virtual void onWrite();
 	virtual void onStop();
 
+	// Accounts the previous frame when the first datagram of a newer one arrives
+	void finishFrame();
+
 	quint64 nextSeqNo;
 	quint64 lossCounter;
 	quint64 lossSeqNoStart;
@@ -75,6 +95,25 @@ public:
 	qreal sendInterval;
 	quint64 tUpdate;
 	quint64 tSend;
+
+	// Online per-frame statistics
+	// Frame currently received
+	bool frameStarted;
+	quint32 frameId;
+	quint32 frameFragments;
+	quint32 frameMaxFragment;
+	quint64 framesComplete;
+	// Frames with missing fragments (except the ones lost after the last fragment received)
+	quint64 framesIncomplete;
+	quint64 fragmentsLost;
+	// One-way delay (ns); meaningful only if the clocks of the hosts are synchronized
+	quint64 delaySamples;
+	qint64 delayMin;
+	qint64 delayMax;
+	qreal delaySum;
+	// Interarrival jitter (RFC 3550), which does not depend on the clock offset (ns)
+	qreal jitter;
+	qint64 lastTransit;
 };
 
 #endif // UDPVBR_H
@@ -23,6 +23,11 @@ BitArray::BitArray() {
     bitCount = 0;
 }
 
+BitArray::BitArray(quint64 count) {
+    bits.fill(0ULL, (count + 63) / 64);
+    bitCount = count;
+}
+
 BitArray& BitArray::append(int bit) {
     if (bitCount % 64 == 0) {
         // extend
@@ -37,6 +42,50 @@ quint64 BitArray::count() const {
     return bitCount;
 }
 
+// Bits are shifted in from the right, so the bit at index is at position 63 - index % 64 of its
+// word, except in the last word if it is not full.
+static inline int bitPosition(quint64 index, quint64 bitCount) {
+    quint64 wordBits = (index / 64 == (bitCount - 1) / 64 && bitCount % 64 != 0) ? bitCount % 64 : 64;
+    return wordBits - 1 - index % 64;
+}
+
+bool BitArray::testBit(quint64 index) const {
+    Q_ASSERT(index < bitCount);
+    return (bits[index / 64] >> bitPosition(index, bitCount)) & 1ULL;
+}
+
+void BitArray::setBit(quint64 index, int bit) {
+    Q_ASSERT(index < bitCount);
+    quint64 mask = 1ULL << bitPosition(index, bitCount);
+    if (bit) {
+        bits[index / 64] |= mask;
+    } else {
+        bits[index / 64] &= ~mask;
+    }
+}
+
+quint64 BitArray::countOnes() const {
+    // The unused bits of the last word are always 0
+    quint64 result = 0;
+    foreach (quint64 word, bits) {
+        result += __builtin_popcountll(word);
+    }
+    return result;
+}
+
+quint64 BitArray::countOnesAnd(const BitArray &other) const {
+    Q_ASSERT(bitCount == other.bitCount);
+    // Plain loop over raw pointers, so that the compiler can vectorize it
+    const quint64 *a = bits.constData();
+    const quint64 *b = other.bits.constData();
+    const int n = bits.count();
+    quint64 result = 0;
+    for (int i = 0; i < n; i++) {
+        result += __builtin_popcountll(a[i] & b[i]);
+    }
+    return result;
+}
+
 QString BitArray::toString() const {
     QString result;
     quint64 bitsLeft = bitCount;
@@ -134,7 +183,8 @@ void BitArray::test() {
         for (int c = i; c > 0; c--) {
             bits << 1;
             reference << 1;
-            if (reference != bits.toVector()) {
+            if (reference != bits.toVector() || bits.countOnes() != quint64(reference.count(1)) ||
+                bits.countOnesAnd(bits) != bits.countOnes()) {
                 qDebug() << "FAIL";
                 qDebug() << reference;
                 qDebug() << bits.toString();
@@ -144,6 +194,30 @@ void BitArray::test() {
             }
         }
     }
+    for (int count = 0; count < 200; count++) {
+        BitArray bits(count);
+        QVector<quint8> reference(count);
+        for (int i = 0; i < count; i += 3) {
+            bits.setBit(i, 1);
+            reference[i] = 1;
+        }
+        for (int i = 0; i < count; i += 6) {
+            bits.setBit(i, 0);
+            reference[i] = 0;
+        }
+        bool ok = reference == bits.toVector();
+        for (int i = 0; i < count; i++) {
+            ok = ok && bits.testBit(i) == (reference[i] != 0);
+        }
+        if (!ok) {
+            qDebug() << "FAIL";
+            qDebug() << reference;
+            qDebug() << bits.toString();
+            qDebug() << bits.count();
+            qDebug() << __FILE__ << __LINE__;
+            exit(EXIT_FAILURE);
+        }
+    }
     qDebug() << "OK";
 }
 
@@ -27,6 +27,8 @@ class BitArray {
 public:
     // Creates an empty array.
     BitArray();
+    // Creates an array of count bits set to 0.
+    explicit BitArray(quint64 count);
 
     // Appends a bit to the end of the array.
     // Returns a reference to self.
@@ -35,6 +37,18 @@ public:
     // Returns the number of bits in the array.
     quint64 count() const;
 
+    // Returns the bit at index (which must be smaller than count()).
+    bool testBit(quint64 index) const;
+    // Sets the bit at index (which must be smaller than count()).
+    void setBit(quint64 index, int bit);
+
+    // Returns the number of bits set to 1 (one popcount per word).
+    quint64 countOnes() const;
+
+    // Returns the number of positions where both this array and other have a 1.
+    // The arrays must have the same length.
+    quint64 countOnesAnd(const BitArray &other) const;
+
     // Returns a vector of bytes holding the bits, one bit per byte.
     // A byte can be either 0 or 1.
     QVector<quint8> toVector() const;
@@ -477,6 +477,37 @@ int getNumCoresLinux()
 	return total;
 }
 
+quint64 getAvailableMemoryLinux()
+{
+	QFile file("/proc/meminfo");
+	if (!file.open(QFile::ReadOnly)) {
+		return 0;
+	}
+	QTextStream stream(&file);
+
+	quint64 memFree = 0;
+	while (1) {
+		QString line = stream.readLine();
+		if (line.isNull())
+			break;
+		// e.g. "MemAvailable:    7632568 kB"
+		QStringList tokens = line.split(" ", QString::SkipEmptyParts);
+		if (tokens.count() < 2)
+			continue;
+		bool ok;
+		quint64 kb = tokens[1].toULongLong(&ok);
+		if (!ok)
+			continue;
+		if (tokens[0] == "MemAvailable:") {
+			return kb * 1024ULL;
+		} else if (tokens[0] == "MemFree:") {
+			// Older kernels do not report MemAvailable
+			memFree = kb * 1024ULL;
+		}
+	}
+	return memFree;
+}
+
 qreal median(QList<qreal> list)
 {
 	if (list.isEmpty())
@@ -777,6 +777,9 @@ public:
 
 int getNumCoresLinux();
 
+// Memory available for new processes (MemAvailable in /proc/meminfo), in bytes; 0 if unknown.
+quint64 getAvailableMemoryLinux();
+
 bool keyValHigherEqual(const KeyVal &s1, const KeyVal &s2);
 
 void serialSigInt(int sig);
@@ -801,6 +804,37 @@ void parallel(MapFunctor functor, JobList &jobs, int maxThreads, bool silent)
 	QThreadPool::globalInstance()->setMaxThreadCount(oldMaxThreads);
 }
 
+template <typename Functor>
+class ParallelForHelper
+{
+public:
+	typedef void result_type;
+	ParallelForHelper(Functor *functor) : functor(functor) {}
+	void operator()(int &index) { (*functor)(index); }
+	Functor *functor;
+};
+
+// Calls functor(i) for i = 0 .. count - 1 on up to maxThreads threads of the global thread pool.
+// The indices are handed out dynamically, so jobs of uneven length keep all the threads busy.
+// The calls must not write to shared state: store the result of each index separately and merge
+// the results in index order afterwards, so that the output does not depend on maxThreads.
+template <typename Functor>
+void parallelFor(int count, Functor &functor, int maxThreads)
+{
+	if (maxThreads <= 1 || count <= 1) {
+		for (int i = 0; i < count; i++)
+			functor(i);
+		return;
+	}
+	QVector<int> jobs(count);
+	for (int i = 0; i < count; i++)
+		jobs[i] = i;
+	int oldMaxThreads = QThreadPool::globalInstance()->maxThreadCount();
+	QThreadPool::globalInstance()->setMaxThreadCount(maxThreads);
+	QtConcurrent::blockingMap(jobs, ParallelForHelper<Functor>(&functor));
+	QThreadPool::globalInstance()->setMaxThreadCount(oldMaxThreads);
+}
+
 extern bool stopSerial;
 
 template <typename Iterator, typename MapFunctor>